@@ -0,0 +1,507 @@
+/*
+ * Host stand-in for BTstack
+ *
+ * Implements the utility and SDP data element helpers with BTstack
+ * semantics and records the calls the firmware makes into the stack, so
+ * the replay bench can play the remote device.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "btstack.h"
+#include "btstack_link_key_db_tlv.h"
+#include "btstack_stub.h"
+#include "btstack_tlv.h"
+#include "esp_timer.h"
+
+btstack_packet_handler_t btstack_stub_sdp_handler;
+btstack_packet_handler_t btstack_stub_l2cap_handler;
+uint16_t                 btstack_stub_last_psm;
+unsigned int             btstack_stub_sdp_queries;
+unsigned int             btstack_stub_tlv_stores;
+uint8_t                  btstack_stub_connectable;
+uint16_t                 btstack_stub_accepted_cid;
+uint16_t                 btstack_stub_disconnected_cid;
+unsigned int             btstack_stub_hci_credits = 1;
+unsigned int             btstack_stub_can_send_requests;
+unsigned int             btstack_stub_l2cap_sends;
+uint8_t                  btstack_stub_l2cap_sent[64];
+uint16_t                 btstack_stub_l2cap_sent_size;
+uint16_t                 btstack_stub_l2cap_sent_cid;
+unsigned int             btstack_stub_l2cap_unrequested_sends;
+
+const hci_cmd_t hci_write_link_policy_settings    = { OPCODE(OGF_LINK_POLICY, 0x0d), "H2" };
+const hci_cmd_t hci_exit_sniff_mode               = { OPCODE(OGF_LINK_POLICY, 0x04), "H" };
+const hci_cmd_t hci_switch_role_command           = { OPCODE(OGF_LINK_POLICY, 0x0b), "B1" };
+const hci_cmd_t hci_write_automatic_flush_timeout = { OPCODE(OGF_CONTROLLER_BASEBAND, 0x28), "H2" };
+const hci_cmd_t hci_read_rssi                     = { OPCODE(OGF_STATUS_PARAMETERS, 0x05), "H" };
+const hci_cmd_t hci_inquiry                       = { OPCODE(OGF_LINK_CONTROL, 0x01), "311" };
+const hci_cmd_t hci_inquiry_cancel                = { OPCODE(OGF_LINK_CONTROL, 0x02), "" };
+const hci_cmd_t hci_write_inquiry_mode            = { OPCODE(OGF_CONTROLLER_BASEBAND, 0x45), "1" };
+
+#define HCI_STUB_HANDLERS       4
+#define CAN_SEND_STUB_REQUESTS  8
+#define HCI_STUB_COMMANDS       16
+#define HCI_STUB_COMMAND_SIZE   64
+
+#define TLV_STUB_TAGS       16
+#define TLV_STUB_VALUE_SIZE 2048
+
+typedef struct {
+    uint32_t tag;
+    uint32_t size;      // 0 if the entry is free
+    uint8_t  value[TLV_STUB_VALUE_SIZE];
+} tlv_stub_entry_t;
+
+static uint16_t next_local_cid = 0x40;
+static uint16_t can_send_stub_cids[CAN_SEND_STUB_REQUESTS];
+static int      can_send_now_delivering;
+static btstack_packet_handler_t hci_stub_handlers[HCI_STUB_HANDLERS];
+static unsigned int             hci_stub_num_handlers;
+static uint8_t                  hci_stub_commands[HCI_STUB_COMMANDS][HCI_STUB_COMMAND_SIZE];
+static unsigned int             hci_stub_command_head;
+static unsigned int             hci_stub_command_tail;
+static tlv_stub_entry_t tlv_stub_entries[TLV_STUB_TAGS];
+
+uint16_t little_endian_read_16(const uint8_t *buffer, int position){
+    return (uint16_t)(buffer[position] | (buffer[position + 1] << 8));
+}
+
+uint32_t little_endian_read_32(const uint8_t *buffer, int position){
+    return ((uint32_t) buffer[position]) | (((uint32_t) buffer[position + 1]) << 8)
+        | (((uint32_t) buffer[position + 2]) << 16) | (((uint32_t) buffer[position + 3]) << 24);
+}
+
+uint32_t little_endian_read_24(const uint8_t *buffer, int position){
+    return ((uint32_t) buffer[position]) | (((uint32_t) buffer[position + 1]) << 8) | (((uint32_t) buffer[position + 2]) << 16);
+}
+
+uint16_t big_endian_read_16(const uint8_t *buffer, int pos){
+    return (uint16_t)((buffer[pos] << 8) | buffer[pos + 1]);
+}
+
+uint32_t big_endian_read_24(const uint8_t *buffer, int pos){
+    return (((uint32_t) buffer[pos]) << 16) | (((uint32_t) buffer[pos + 1]) << 8) | ((uint32_t) buffer[pos + 2]);
+}
+
+uint32_t big_endian_read_32(const uint8_t *buffer, int pos){
+    return (((uint32_t) buffer[pos]) << 24) | (((uint32_t) buffer[pos + 1]) << 16)
+        | (((uint32_t) buffer[pos + 2]) << 8) | ((uint32_t) buffer[pos + 3]);
+}
+
+void little_endian_store_16(uint8_t *buffer, uint16_t position, uint16_t value){
+    buffer[position++] = (uint8_t) value;
+    buffer[position]   = (uint8_t)(value >> 8);
+}
+
+void little_endian_store_32(uint8_t *buffer, uint16_t position, uint32_t value){
+    little_endian_store_16(buffer, position, (uint16_t) value);
+    little_endian_store_16(buffer, position + 2, (uint16_t)(value >> 16));
+}
+
+void reverse_bd_addr(const bd_addr_t src, bd_addr_t dest){
+    int i;
+    for (i = 0; i < 6; i++){
+        dest[i] = src[5 - i];
+    }
+}
+
+void big_endian_store_16(uint8_t *buffer, uint16_t pos, uint16_t value){
+    buffer[pos++] = (uint8_t)(value >> 8);
+    buffer[pos]   = (uint8_t) value;
+}
+
+int sscanf_bd_addr(const char *addr_string, bd_addr_t addr){
+    unsigned int bytes[6];
+    int i;
+    if (sscanf(addr_string, "%2x%*c%2x%*c%2x%*c%2x%*c%2x%*c%2x", &bytes[0], &bytes[1],
+               &bytes[2], &bytes[3], &bytes[4], &bytes[5]) != 6) return 0;
+    for (i = 0; i < 6; i++){
+        addr[i] = (uint8_t) bytes[i];
+    }
+    return 1;
+}
+
+char * bd_addr_to_str(const bd_addr_t addr){
+    static char addr_string[18];
+    snprintf(addr_string, sizeof(addr_string), "%02X:%02X:%02X:%02X:%02X:%02X",
+             addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+    return addr_string;
+}
+
+void printf_hexdump(const void *data, int size){
+    const uint8_t *bytes = (const uint8_t *) data;
+    int i;
+    for (i = 0; i < size; i++){
+        printf("%02X ", bytes[i]);
+    }
+    printf("\n");
+}
+
+static int de_get_header_size(const uint8_t *header){
+    switch ((de_size_t)(header[0] & 0x07)){
+        case DE_SIZE_VAR_8:
+            return 2;
+        case DE_SIZE_VAR_16:
+            return 3;
+        case DE_SIZE_VAR_32:
+            return 5;
+        default:
+            return 1;
+    }
+}
+
+de_type_t de_get_element_type(const uint8_t *header){
+    return (de_type_t)(header[0] >> 3);
+}
+
+uint32_t de_get_data_size(const uint8_t *header){
+    de_size_t size_type = (de_size_t)(header[0] & 0x07);
+    if (de_get_element_type(header) == DE_NIL) return 0;
+    switch (size_type){
+        case DE_SIZE_VAR_8:
+            return header[1];
+        case DE_SIZE_VAR_16:
+            return big_endian_read_16(header, 1);
+        case DE_SIZE_VAR_32:
+            return big_endian_read_32(header, 1);
+        default:
+            return 1u << size_type;
+    }
+}
+
+uint32_t de_get_len(const uint8_t *header){
+    return (uint32_t) de_get_header_size(header) + de_get_data_size(header);
+}
+
+uint32_t de_get_uuid32(const uint8_t *element){
+    if (de_get_element_type(element) != DE_UUID) return 0;
+    switch ((de_size_t)(element[0] & 0x07)){
+        case DE_SIZE_16:
+            return big_endian_read_16(element, 1);
+        case DE_SIZE_32:
+        case DE_SIZE_128:
+            return big_endian_read_32(element, 1);
+        default:
+            return 0;
+    }
+}
+
+uint8_t *de_get_string(const uint8_t *element){
+    if (de_get_element_type(element) != DE_STRING) return NULL;
+    return (uint8_t *) &element[de_get_header_size(element)];
+}
+
+int de_element_get_uint16(const uint8_t *element, uint16_t *value){
+    if (de_get_element_type(element) != DE_UINT) return 0;
+    if ((element[0] & 0x07) != DE_SIZE_16) return 0;
+    *value = big_endian_read_16(element, 1);
+    return 1;
+}
+
+int des_iterator_init(des_iterator_t *it, uint8_t *element){
+    de_type_t type = de_get_element_type(element);
+    if (type != DE_DES && type != DE_DEA) return 0;
+    it->element = element;
+    it->pos     = (uint16_t) de_get_header_size(element);
+    it->length  = (uint16_t) de_get_len(element);
+    return 1;
+}
+
+int des_iterator_has_more(des_iterator_t *it){
+    return it->pos < it->length;
+}
+
+de_type_t des_iterator_get_type(des_iterator_t *it){
+    if (!des_iterator_has_more(it)) return DE_NIL;
+    return de_get_element_type(&it->element[it->pos]);
+}
+
+uint8_t *des_iterator_get_element(des_iterator_t *it){
+    if (!des_iterator_has_more(it)) return NULL;
+    return &it->element[it->pos];
+}
+
+void des_iterator_next(des_iterator_t *it){
+    it->pos += (uint16_t) de_get_len(&it->element[it->pos]);
+}
+
+void l2cap_init(void){
+}
+
+void hci_add_event_handler(btstack_packet_callback_registration_t *callback_handler){
+    if (hci_stub_num_handlers == HCI_STUB_HANDLERS){
+        fprintf(stderr, "btstack stub: more than %d HCI event handlers\n", HCI_STUB_HANDLERS);
+        return;
+    }
+    hci_stub_handlers[hci_stub_num_handlers++] = callback_handler->callback;
+}
+
+void btstack_stub_hci_event(uint8_t *event, uint16_t size){
+    unsigned int i;
+    if (event[0] == HCI_EVENT_COMMAND_COMPLETE && size > 2){
+        btstack_stub_hci_credits = event[2];
+    }
+    if (event[0] == HCI_EVENT_COMMAND_STATUS && size > 3){
+        btstack_stub_hci_credits = event[3];
+    }
+    for (i = 0; i < hci_stub_num_handlers; i++){
+        (*hci_stub_handlers[i])(HCI_EVENT_PACKET, 0, event, size);
+    }
+}
+
+int hci_can_send_command_packet_now(void){
+    return btstack_stub_hci_credits > 0;
+}
+
+/* encodes the parameters by the command's format, the subset of hci_cmd.c the firmware uses */
+int hci_send_cmd(const hci_cmd_t *cmd, ...){
+    uint8_t    *packet;
+    uint16_t    pos = 3;
+    const char *format;
+    uint32_t    value;
+    va_list     argptr;
+
+    if (!btstack_stub_hci_credits){
+        fprintf(stderr, "btstack stub: HCI command 0x%04x sent without credits\n", cmd->opcode);
+        return -1;
+    }
+    if (hci_stub_command_head - hci_stub_command_tail == HCI_STUB_COMMANDS){
+        fprintf(stderr, "btstack stub: more than %d HCI commands not taken\n", HCI_STUB_COMMANDS);
+        return -1;
+    }
+    btstack_stub_hci_credits--;
+    packet = hci_stub_commands[hci_stub_command_head++ % HCI_STUB_COMMANDS];
+    little_endian_store_16(packet, 0, cmd->opcode);
+    va_start(argptr, cmd);
+    for (format = cmd->format; *format; format++){
+        switch (*format){
+            case '1':
+                packet[pos++] = (uint8_t) va_arg(argptr, int);
+                break;
+            case '2':
+            case 'H':
+                little_endian_store_16(packet, pos, (uint16_t) va_arg(argptr, int));
+                pos += 2;
+                break;
+            case '3':
+                value = va_arg(argptr, uint32_t);
+                little_endian_store_16(packet, pos, (uint16_t) value);
+                packet[pos + 2] = (uint8_t)(value >> 16);
+                pos += 3;
+                break;
+            case '4':
+                little_endian_store_32(packet, pos, va_arg(argptr, uint32_t));
+                pos += 4;
+                break;
+            case 'B':
+                reverse_bd_addr(va_arg(argptr, uint8_t *), &packet[pos]);
+                pos += 6;
+                break;
+            default:
+                fprintf(stderr, "btstack stub: format '%c' not supported\n", *format);
+                break;
+        }
+    }
+    va_end(argptr);
+    packet[2] = (uint8_t)(pos - 3);
+    return 0;
+}
+
+uint16_t btstack_stub_hci_command_take(uint8_t *buffer, uint16_t buffer_size){
+    const uint8_t *packet;
+    uint16_t size;
+    if (hci_stub_command_tail == hci_stub_command_head) return 0;
+    packet = hci_stub_commands[hci_stub_command_tail++ % HCI_STUB_COMMANDS];
+    size = (uint16_t)(3 + packet[2]);
+    if (size > buffer_size) size = buffer_size;
+    memcpy(buffer, packet, size);
+    return size;
+}
+
+int hci_power_control(int power_mode){
+    UNUSED(power_mode);
+    return 0;
+}
+
+int gap_pin_code_response(const bd_addr_t addr, const char *pin){
+    UNUSED(addr);
+    UNUSED(pin);
+    return 0;
+}
+
+uint8_t l2cap_create_channel(btstack_packet_handler_t packet_handler, bd_addr_t address, uint16_t psm, uint16_t mtu, uint16_t *out_local_cid){
+    UNUSED(address);
+    UNUSED(mtu);
+    btstack_stub_l2cap_handler = packet_handler;
+    btstack_stub_last_psm = psm;
+    *out_local_cid = next_local_cid++;
+    return 0;
+}
+
+uint8_t sdp_client_query_uuid16(btstack_packet_handler_t callback, bd_addr_t remote, uint16_t uuid16){
+    UNUSED(remote);
+    UNUSED(uuid16);
+    btstack_stub_sdp_handler = callback;
+    btstack_stub_sdp_queries++;
+    return 0;
+}
+
+int gap_ssp_confirmation_response(const bd_addr_t addr){
+    UNUSED(addr);
+    return 0;
+}
+
+void gap_connectable_control(uint8_t enable){
+    btstack_stub_connectable = enable;
+}
+
+void gap_discoverable_control(uint8_t enable){
+    UNUSED(enable);
+}
+
+static const btstack_link_key_db_t link_key_db_stub;
+
+void hci_set_link_key_db(const btstack_link_key_db_t *link_key_db){
+    UNUSED(link_key_db);
+}
+
+const btstack_link_key_db_t * btstack_link_key_db_tlv_get_instance(const btstack_tlv_t *tlv_impl, void *tlv_context){
+    UNUSED(tlv_impl);
+    UNUSED(tlv_context);
+    return &link_key_db_stub;
+}
+
+uint8_t l2cap_register_service(btstack_packet_handler_t packet_handler, uint16_t psm, uint16_t mtu, gap_security_level_t security_level){
+    UNUSED(psm);
+    UNUSED(mtu);
+    UNUSED(security_level);
+    btstack_stub_l2cap_handler = packet_handler;
+    return 0;
+}
+
+void l2cap_accept_connection(uint16_t local_cid){
+    btstack_stub_accepted_cid = local_cid;
+}
+
+void l2cap_decline_connection(uint16_t local_cid){
+    UNUSED(local_cid);
+}
+
+void l2cap_disconnect(uint16_t local_cid, uint8_t reason){
+    UNUSED(reason);
+    btstack_stub_disconnected_cid = local_cid;
+}
+
+uint8_t l2cap_request_can_send_now_event(uint16_t local_cid){
+    if (btstack_stub_can_send_requests == CAN_SEND_STUB_REQUESTS) return BTSTACK_MEMORY_ALLOC_FAILED;
+    can_send_stub_cids[btstack_stub_can_send_requests++] = local_cid;
+    return 0;
+}
+
+uint8_t l2cap_send(uint16_t local_cid, uint8_t *data, uint16_t len){
+    if (!can_send_now_delivering){
+        btstack_stub_l2cap_unrequested_sends++;
+    }
+    btstack_stub_l2cap_sends++;
+    btstack_stub_l2cap_sent_cid  = local_cid;
+    btstack_stub_l2cap_sent_size = len < sizeof(btstack_stub_l2cap_sent) ? len : sizeof(btstack_stub_l2cap_sent);
+    memcpy(btstack_stub_l2cap_sent, data, btstack_stub_l2cap_sent_size);
+    return 0;
+}
+
+int btstack_stub_can_send_now(void){
+    uint8_t event[4];
+
+    if (!btstack_stub_can_send_requests) return 0;
+    event[0] = L2CAP_EVENT_CAN_SEND_NOW;
+    event[1] = 2;
+    little_endian_store_16(event, 2, can_send_stub_cids[0]);
+    btstack_stub_can_send_requests--;
+    memmove(&can_send_stub_cids[0], &can_send_stub_cids[1], btstack_stub_can_send_requests * sizeof(can_send_stub_cids[0]));
+    can_send_now_delivering = 1;
+    (*btstack_stub_l2cap_handler)(HCI_EVENT_PACKET, 0, event, sizeof(event));
+    can_send_now_delivering = 0;
+    return 1;
+}
+
+void btstack_run_loop_set_timer(btstack_timer_source_t *ts, uint32_t timeout_in_ms){
+    ts->timeout = btstack_run_loop_get_time_ms() + timeout_in_ms;
+}
+
+void btstack_run_loop_set_timer_handler(btstack_timer_source_t *ts, void (*process)(btstack_timer_source_t *ts)){
+    ts->process = process;
+}
+
+void btstack_run_loop_add_timer(btstack_timer_source_t *ts){
+    UNUSED(ts);
+}
+
+int btstack_run_loop_remove_timer(btstack_timer_source_t *ts){
+    UNUSED(ts);
+    return 0;
+}
+
+uint32_t btstack_run_loop_get_time_ms(void){
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static tlv_stub_entry_t *tlv_stub_find(uint32_t tag){
+    int i;
+    for (i = 0; i < TLV_STUB_TAGS; i++){
+        if (tlv_stub_entries[i].size && tlv_stub_entries[i].tag == tag) return &tlv_stub_entries[i];
+    }
+    return NULL;
+}
+
+static int tlv_stub_get_tag(void *context, uint32_t tag, uint8_t *buffer, uint32_t buffer_size){
+    tlv_stub_entry_t *entry = tlv_stub_find(tag);
+    UNUSED(context);
+    if (!entry) return 0;
+    memcpy(buffer, entry->value, entry->size < buffer_size ? entry->size : buffer_size);
+    return (int) entry->size;
+}
+
+static int tlv_stub_store_tag(void *context, uint32_t tag, const uint8_t *data, uint32_t data_size){
+    tlv_stub_entry_t *entry = tlv_stub_find(tag);
+    int i;
+    UNUSED(context);
+    if (!data_size || data_size > TLV_STUB_VALUE_SIZE) return 1;
+    for (i = 0; !entry && i < TLV_STUB_TAGS; i++){
+        if (!tlv_stub_entries[i].size) entry = &tlv_stub_entries[i];
+    }
+    if (!entry) return 1;
+    entry->tag  = tag;
+    entry->size = data_size;
+    memcpy(entry->value, data, data_size);
+    btstack_stub_tlv_stores++;
+    return 0;
+}
+
+static void tlv_stub_delete_tag(void *context, uint32_t tag){
+    tlv_stub_entry_t *entry = tlv_stub_find(tag);
+    UNUSED(context);
+    if (entry) entry->size = 0;
+}
+
+static const btstack_tlv_t tlv_stub_impl = {
+    &tlv_stub_get_tag,
+    &tlv_stub_store_tag,
+    &tlv_stub_delete_tag,
+};
+
+// the ESP32 port installs its NVS backed TLV before btstack_main
+static const btstack_tlv_t *tlv_instance = &tlv_stub_impl;
+static void                *tlv_context;
+
+void btstack_tlv_set_instance(const btstack_tlv_t *tlv_impl, void *context){
+    tlv_instance = tlv_impl;
+    tlv_context  = context;
+}
+
+void btstack_tlv_get_instance(const btstack_tlv_t **tlv_impl, void **context){
+    *tlv_impl = tlv_instance;
+    *context  = tlv_context;
+}
@@ -0,0 +1,52 @@
+/*
+ * Hooks into the host BTstack stand-in used by the replay bench
+ */
+#ifndef BTSTACK_STUB_H
+#define BTSTACK_STUB_H
+
+#include "btstack.h"
+
+// handlers registered by the firmware
+extern btstack_packet_handler_t btstack_stub_sdp_handler;
+extern btstack_packet_handler_t btstack_stub_l2cap_handler;
+
+// PSM of the last l2cap_create_channel call
+extern uint16_t btstack_stub_last_psm;
+
+// number of sdp_client_query_uuid16 calls
+extern unsigned int btstack_stub_sdp_queries;
+
+// number of TLV tags written
+extern unsigned int btstack_stub_tlv_stores;
+
+// page scan state, last accepted incoming and last locally disconnected channel
+extern uint8_t  btstack_stub_connectable;
+extern uint16_t btstack_stub_accepted_cid;
+extern uint16_t btstack_stub_disconnected_cid;
+
+// outstanding l2cap_request_can_send_now_event calls
+extern unsigned int btstack_stub_can_send_requests;
+
+// l2cap_send calls, the last packet sent and its channel, and calls outside of L2CAP_EVENT_CAN_SEND_NOW
+extern unsigned int btstack_stub_l2cap_sends;
+extern uint8_t      btstack_stub_l2cap_sent[64];
+extern uint16_t     btstack_stub_l2cap_sent_size;
+extern uint16_t     btstack_stub_l2cap_sent_cid;
+extern unsigned int btstack_stub_l2cap_unrequested_sends;
+
+// HCI command packets the controller accepts before the next Command Complete or Status, 1 after reset
+extern unsigned int btstack_stub_hci_credits;
+
+/* delivers an HCI event to every registered handler, taking the credits of Command Complete and Status */
+void btstack_stub_hci_event(uint8_t *event, uint16_t size);
+
+/* delivers L2CAP_EVENT_CAN_SEND_NOW for the oldest request, @return 0 if none is outstanding */
+int btstack_stub_can_send_now(void);
+
+/*
+ * takes the oldest HCI command the firmware sent: opcode, length, parameters
+ * @return its size, 0 if none is left
+ */
+uint16_t btstack_stub_hci_command_take(uint8_t *buffer, uint16_t buffer_size);
+
+#endif
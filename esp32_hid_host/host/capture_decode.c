@@ -0,0 +1,82 @@
+/*
+ * Capture decoder
+ *
+ * Decodes an image of the firmware's capture partition back into the
+ * reports the controllers sent, oldest first.
+ *
+ * Usage: capture_decode [-r] [-s controller] capture.bin
+ *
+ *  -r  write the reports in the format of hid_replay_bench -f, one report
+ *      per line as hex bytes, session starts as comments
+ *  -s  only the reports of one controller, 1..4
+ *
+ * Without -r every line holds the session, the time since power on in
+ * seconds, the controller and the report. A summary goes to stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "capture_format.h"
+#include "capture_image.h"
+
+typedef struct {
+    int          replay_format;
+    unsigned int controller;    // 0 for all
+    int          session_seen;
+    uint16_t     session;
+} decode_options_t;
+
+static void decode_report(void *context, uint16_t session, uint32_t time_ms,
+                          unsigned int slot, const uint8_t *report, uint16_t len){
+    decode_options_t *options = context;
+    uint16_t i;
+
+    if (options->controller && slot + 1 != options->controller) return;
+    if (options->replay_format && (!options->session_seen || session != options->session)){
+        printf("# session %u\n", session);
+    }
+    options->session_seen = 1;
+    options->session      = session;
+    if (!options->replay_format){
+        printf("%u %u.%03u %u ", session, time_ms / 1000, time_ms % 1000, slot + 1);
+    }
+    for (i = 0; i < len; i++){
+        printf(i ? " %02X" : "%02X", report[i]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[]){
+    decode_options_t options = { 0, 0, 0, 0 };
+    capture_image_stats_t stats;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "rs:")) != -1){
+        switch (opt){
+            case 'r':
+                options.replay_format = 1;
+                break;
+            case 's':
+                options.controller = (unsigned int) strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-r] [-s controller] capture.bin\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind + 1 != argc || options.controller > CAPTURE_SLOTS){
+        fprintf(stderr, "usage: %s [-r] [-s controller] capture.bin\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (!capture_image_decode(argv[optind], decode_report, &options, &stats)) return EXIT_FAILURE;
+
+    fprintf(stderr, "%u sectors, %u sessions, %lu reports in %lu bytes (%.2f bytes/report)\n",
+            stats.sectors, stats.sessions, stats.reports, stats.bytes,
+            stats.reports ? (double) stats.bytes / stats.reports : 0.0);
+    if (stats.gaps || stats.malformed){
+        fprintf(stderr, "%u sectors missing, %u sectors malformed\n", stats.gaps, stats.malformed);
+    }
+    return stats.malformed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+/*
+ * Reader for images of the firmware's capture partition
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture_format.h"
+#include "capture_image.h"
+
+typedef struct {
+    uint32_t sequence;
+    uint32_t offset;
+} capture_image_sector_t;
+
+static int compare_sectors(const void *a, const void *b){
+    uint32_t x = ((const capture_image_sector_t *) a)->sequence;
+    uint32_t y = ((const capture_image_sector_t *) b)->sequence;
+    return (x > y) - (x < y);
+}
+
+int capture_image_decode(const char *path, capture_image_handler_t handler, void *context,
+                         capture_image_stats_t *stats){
+    capture_image_sector_t *sectors;
+    capture_sector_header_t header;
+    capture_decoder_t decoder;
+    uint8_t  report[CAPTURE_REPORT_MAX];
+    uint8_t *image;
+    long     size;
+    unsigned int count = 0;
+    uint16_t last_session = 0;
+    unsigned int i;
+    FILE *file = fopen(path, "rb");
+
+    memset(stats, 0, sizeof(*stats));
+    if (!file){
+        perror(path);
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+    image   = malloc(size > 0 ? (size_t) size : 1);
+    sectors = malloc((size / CAPTURE_SECTOR_SIZE + 1) * sizeof(*sectors));
+    if (!image || !sectors || fread(image, 1, (size_t) size, file) != (size_t) size){
+        fprintf(stderr, "%s: cannot read\n", path);
+        fclose(file);
+        free(image);
+        free(sectors);
+        return 0;
+    }
+    fclose(file);
+
+    for (i = 0; i + CAPTURE_SECTOR_SIZE <= (unsigned long) size; i += CAPTURE_SECTOR_SIZE){
+        if (!capture_decoder_start(&decoder, &image[i], &header)) continue;
+        sectors[count].sequence = header.sequence;
+        sectors[count].offset   = i;
+        count++;
+    }
+    qsort(sectors, count, sizeof(*sectors), compare_sectors);
+
+    for (i = 0; i < count; i++){
+        unsigned int slot;
+        uint32_t time_ms;
+        int len;
+
+        capture_decoder_start(&decoder, &image[sectors[i].offset], &header);
+        if (!stats->sessions || header.session != last_session){
+            stats->sessions++;
+            last_session = header.session;
+        }
+        if (i && header.sequence != sectors[i - 1].sequence + 1){
+            stats->gaps += header.sequence - sectors[i - 1].sequence - 1;
+        }
+        stats->sectors++;
+        while ((len = capture_decoder_next(&decoder, &slot, report, &time_ms)) > 0){
+            stats->reports++;
+            (*handler)(context, header.session, time_ms, slot, report, (uint16_t) len);
+        }
+        if (len < 0){
+            stats->malformed++;
+        }
+        stats->bytes += decoder.pos - sizeof(header);
+    }
+    free(image);
+    free(sectors);
+    return 1;
+}
@@ -0,0 +1,32 @@
+/*
+ * Reader for images of the firmware's capture partition
+ *
+ * An image is the partition as read from flash, e.g. with
+ * "esptool.py read_flash 0x110000 0xF0000 capture.bin". Its sectors are
+ * decoded oldest first, by their sequence number.
+ */
+#ifndef CAPTURE_IMAGE_H
+#define CAPTURE_IMAGE_H
+
+#include <stdint.h>
+
+typedef void (*capture_image_handler_t)(void *context, uint16_t session, uint32_t time_ms,
+                                        unsigned int slot, const uint8_t *report, uint16_t len);
+
+typedef struct {
+    unsigned int  sectors;      // holding a capture
+    unsigned int  sessions;
+    unsigned int  gaps;         // missing sequence numbers between sectors
+    unsigned int  malformed;    // sectors whose records stopped making sense
+    unsigned long reports;
+    unsigned long bytes;        // of records, without the sector headers
+} capture_image_stats_t;
+
+/*
+ * hands every report of an image to the handler, oldest first
+ * @return 0 if the file could not be read
+ */
+int capture_image_decode(const char *path, capture_image_handler_t handler, void *context,
+                         capture_image_stats_t *stats);
+
+#endif
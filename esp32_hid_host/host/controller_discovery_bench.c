@@ -0,0 +1,329 @@
+/*
+ * Controller discovery bench
+ *
+ * Plays the Bluetooth controller and the controller slots for the
+ * firmware's discovery: a script says which HCI commands the firmware must
+ * send, which inquiry responses come back, and which candidates the
+ * firmware must hand to which slot, in which order. One HCI command
+ * credit at a time, as with the link policy bench; the clock only moves
+ * when the script says so.
+ *
+ * Usage: controller_discovery_bench [-v] script.txt...
+ *
+ *  -v  print the firmware's log records and console output
+ *
+ * Script lines, '#' starts a comment:
+ *
+ *  start <slot>                            discovery for a slot without a controller
+ *  expect <opcode> [parameter bytes]       next command the firmware sent, hex
+ *  none                                    the firmware sent no other command
+ *  event <code> [parameter bytes]          HCI event to deliver, hex, the length is added
+ *  found <slot> <address>|none             candidate the firmware handed over since the last check
+ *  busy <0|1>                              the slots refuse candidates, or take them again
+ *  failed <slot>                           the candidate of a slot did not connect
+ *  attach <slot> <address>                 HID channels of a slot opened
+ *  detach <slot>                           HID channels closed
+ *  wait <ms>                               the clock moves on
+ *  tick                                    one period of the discovery timer
+ *  console <arguments>                     "discover <arguments>" must succeed
+ *  reject <arguments>                      "discover <arguments>" must fail
+ *  candidate <index> <address> <rssi>      ranked candidate
+ *  remembered <slot> <address>|none        address kept in NVS for a slot
+ *  check <field> <min> [max]               discovery statistic within [min, max]
+ */
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "btstack_stub.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+
+// firmware under test, included to reach its timer and reset its state
+#include "controller_discovery.c"
+
+#define SCRIPT_LINE_SIZE    256
+#define SCRIPT_PACKET_SIZE  64
+#define SCRIPT_MAX_ARGS     8
+#define BENCH_SLOTS         2
+
+static int       verbose;
+static int       slots_busy;
+static int       found_slot = -1;   // last candidate handed over, -1 after the check
+static bd_addr_t found_addr;
+
+static void log_drain(void){
+    log_record_t record;
+    while (log_ring_read(&record)){
+        if (verbose){
+            log_ring_print(&record);
+        }
+    }
+}
+
+/* the firmware's slots: they take a candidate unless the script made them busy */
+static int bench_found(unsigned int slot, const bd_addr_t addr){
+    if (slots_busy) return 0;
+    found_slot = (int) slot;
+    memcpy(found_addr, addr, sizeof(bd_addr_t));
+    return 1;
+}
+
+/* parses hex bytes, @return their number or -1 */
+static int parse_hex_bytes(char *pos, uint8_t *buffer, int buffer_size){
+    int count = 0;
+    char *end;
+    for (;;){
+        unsigned long byte = strtoul(pos, &end, 16);
+        if (end == pos) return count;
+        if (byte > 0xff || count == buffer_size) return -1;
+        buffer[count++] = (uint8_t) byte;
+        pos = end;
+    }
+}
+
+static int console(char *line){
+    char *argv[SCRIPT_MAX_ARGS];
+    int   argc = 0;
+    char *arg;
+    FILE *saved = stdout;
+    int   ret;
+
+    argv[argc++] = "discover";
+    for (arg = strtok(line, " \t\r\n"); arg && argc < SCRIPT_MAX_ARGS; arg = strtok(NULL, " \t\r\n")){
+        argv[argc++] = arg;
+    }
+    if (!verbose){
+        stdout = fopen("/dev/null", "w");
+    }
+    ret = controller_discovery_command(argc, argv);
+    if (!verbose){
+        fclose(stdout);
+        stdout = saved;
+    }
+    return ret;
+}
+
+static int stat_field(const controller_discovery_stats_t *stats, const char *field, long *value){
+    static const struct {
+        const char *name;
+        size_t      offset;
+        size_t      size;
+    } fields[] = {
+#define STAT_FIELD(name) { #name, offsetof(controller_discovery_stats_t, name), sizeof(((controller_discovery_stats_t *) 0)->name) }
+        STAT_FIELD(state), STAT_FIELD(slot), STAT_FIELD(inquiries), STAT_FIELD(candidates),
+        STAT_FIELD(responses), STAT_FIELD(filtered), STAT_FIELD(attempts),
+        STAT_FIELD(first_response_ms), STAT_FIELD(connect_ms),
+#undef STAT_FIELD
+    };
+    const uint8_t *base = (const uint8_t *) stats;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++){
+        if (strcmp(fields[i].name, field)) continue;
+        if (fields[i].size == 1){
+            *value = *(const uint8_t *)(base + fields[i].offset);
+        } else {
+            *value = *(const uint32_t *)(base + fields[i].offset);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* runs one script line, @return an error message or NULL */
+static const char *script_step(char *line){
+    uint8_t  packet[SCRIPT_PACKET_SIZE];
+    uint8_t  sent[SCRIPT_PACKET_SIZE];
+    uint16_t sent_size;
+    char     command[16];
+    char     field[32];
+    char     address[32];
+    unsigned int slot, opcode, ms, index;
+    long     min, max, value;
+    int      consumed, len, i, rssi;
+    controller_discovery_stats_t     stats;
+    controller_discovery_candidate_t candidate;
+    bd_addr_t addr, expected;
+
+    if (sscanf(line, "%15s%n", command, &consumed) != 1) return NULL;
+    line += consumed;
+
+    if (strcmp(command, "start") == 0){
+        if (sscanf(line, "%u", &slot) != 1) return "start <slot>";
+        controller_discovery_start(slot);
+    } else if (strcmp(command, "expect") == 0){
+        if (sscanf(line, "%x%n", &opcode, &consumed) != 1) return "expect <opcode> [parameters]";
+        little_endian_store_16(packet, 0, (uint16_t) opcode);
+        len = parse_hex_bytes(line + consumed, &packet[3], sizeof(packet) - 3);
+        if (len < 0) return "bad parameter bytes";
+        packet[2] = (uint8_t) len;
+        sent_size = btstack_stub_hci_command_take(sent, sizeof(sent));
+        if (!sent_size) return "no command sent";
+        if (sent_size != len + 3 || memcmp(sent, packet, sent_size)){
+            fprintf(stderr, "sent:    ");
+            for (i = 0; i < sent_size; i++) fprintf(stderr, " %02x", sent[i]);
+            fprintf(stderr, "\nexpected:");
+            for (i = 0; i < len + 3; i++) fprintf(stderr, " %02x", packet[i]);
+            fprintf(stderr, "\n");
+            return "unexpected command";
+        }
+    } else if (strcmp(command, "none") == 0){
+        if (btstack_stub_hci_command_take(sent, sizeof(sent))) return "unexpected command sent";
+    } else if (strcmp(command, "event") == 0){
+        len = parse_hex_bytes(line, sent, sizeof(sent) - 1);
+        if (len < 1) return "event <code> [parameters]";
+        packet[0] = sent[0];
+        packet[1] = (uint8_t)(len - 1);
+        memcpy(&packet[2], &sent[1], (size_t)(len - 1));
+        btstack_stub_hci_event(packet, (uint16_t)(len + 1));
+    } else if (strcmp(command, "found") == 0){
+        if (sscanf(line, "%31s", address) != 1) return "found <slot> <address>|none";
+        if (strcmp(address, "none") == 0){
+            if (found_slot >= 0) return "a candidate was handed over";
+            return NULL;
+        }
+        if (sscanf(line, "%u %31s", &slot, address) != 2 || !sscanf_bd_addr(address, addr)) return "found <slot> <address>|none";
+        if (found_slot < 0) return "no candidate handed over";
+        if ((unsigned int) found_slot != slot || memcmp(found_addr, addr, sizeof(bd_addr_t))){
+            fprintf(stderr, "handed %s to slot %d\n", bd_addr_to_str(found_addr), found_slot);
+            return "unexpected candidate";
+        }
+        found_slot = -1;
+    } else if (strcmp(command, "busy") == 0){
+        if (sscanf(line, "%d", &slots_busy) != 1) return "busy <0|1>";
+    } else if (strcmp(command, "failed") == 0){
+        if (sscanf(line, "%u", &slot) != 1) return "failed <slot>";
+        controller_discovery_failed(slot);
+    } else if (strcmp(command, "attach") == 0){
+        if (sscanf(line, "%u %31s", &slot, address) != 2 || !sscanf_bd_addr(address, addr)) return "attach <slot> <address>";
+        controller_discovery_attach(slot, addr);
+    } else if (strcmp(command, "detach") == 0){
+        if (sscanf(line, "%u", &slot) != 1) return "detach <slot>";
+        controller_discovery_detach(slot);
+    } else if (strcmp(command, "wait") == 0){
+        if (sscanf(line, "%u", &ms) != 1) return "wait <ms>";
+        esp_timer_mock_offset_us += (int64_t) ms * 1000;
+    } else if (strcmp(command, "tick") == 0){
+        (*discovery_timer.process)(&discovery_timer);
+    } else if (strcmp(command, "console") == 0){
+        if (console(line)) return "console command failed";
+    } else if (strcmp(command, "reject") == 0){
+        if (!console(line)) return "console command succeeded";
+    } else if (strcmp(command, "candidate") == 0){
+        if (sscanf(line, "%u %31s %d", &index, address, &rssi) != 3 || !sscanf_bd_addr(address, addr)) return "candidate <index> <address> <rssi>";
+        if (!controller_discovery_get_candidate(index, &candidate)) return "no such candidate";
+        if (memcmp(candidate.addr, addr, sizeof(bd_addr_t)) || candidate.rssi != rssi){
+            fprintf(stderr, "candidate %u is %s, RSSI %d\n", index, bd_addr_to_str(candidate.addr), candidate.rssi);
+            return "unexpected candidate";
+        }
+    } else if (strcmp(command, "remembered") == 0){
+        if (sscanf(line, "%u %31s", &slot, address) != 2) return "remembered <slot> <address>|none";
+        if (strcmp(address, "none") == 0){
+            if (controller_discovery_remembered(slot, addr)) return "an address is remembered";
+            return NULL;
+        }
+        if (!sscanf_bd_addr(address, expected)) return "remembered <slot> <address>|none";
+        if (!controller_discovery_remembered(slot, addr)) return "no address remembered";
+        if (memcmp(addr, expected, sizeof(bd_addr_t))){
+            fprintf(stderr, "remembered %s\n", bd_addr_to_str(addr));
+            return "unexpected address";
+        }
+    } else if (strcmp(command, "check") == 0){
+        i = sscanf(line, "%31s %ld %ld", field, &min, &max);
+        if (i < 2) return "check <field> <min> [max]";
+        if (i == 2) max = min;
+        controller_discovery_get_stats(&stats);
+        if (!stat_field(&stats, field, &value)) return "unknown field";
+        if (value < min || value > max){
+            fprintf(stderr, "%s is %ld\n", field, value);
+            return "check failed";
+        }
+    } else {
+        return "unknown command";
+    }
+    return NULL;
+}
+
+/* runs a script from a fresh boot without remembered addresses, @return 1 if every line passed */
+static int script_run(const char *path){
+    char line[SCRIPT_LINE_SIZE];
+    uint8_t sent[SCRIPT_PACKET_SIZE];
+    unsigned int line_number = 0;
+    unsigned int slot;
+    const char *error;
+    FILE *file = fopen(path, "r");
+
+    if (!file){
+        perror(path);
+        return 0;
+    }
+    memset(&discovery_stats, 0, sizeof(discovery_stats));
+    memset(discovery_remembered_addrs, 0, sizeof(discovery_remembered_addrs));
+    discovery_save();
+    for (slot = 0; slot < BENCH_SLOTS; slot++){
+        controller_discovery_detach(slot);
+    }
+    discovery_waiting      = 0;
+    discovery_pending      = 0;
+    discovery_inquiring    = 0;
+    discovery_mode_written = 0;
+    discovery_attempting   = 0;
+    discovery_request      = REQUEST_NONE;
+    while (btstack_stub_hci_command_take(sent, sizeof(sent)));
+    btstack_stub_hci_credits = 1;
+    slots_busy = 0;
+    found_slot = -1;
+
+    while (fgets(line, sizeof(line), file)){
+        char *comment = strchr(line, '#');
+        line_number++;
+        if (comment) *comment = 0;
+        error = script_step(line);
+        log_drain();
+        if (error){
+            fprintf(stderr, "%s:%u: %s\n", path, line_number, error);
+            fclose(file);
+            return 0;
+        }
+    }
+    fclose(file);
+    if (found_slot >= 0){
+        fprintf(stderr, "%s: candidate %s handed to slot %d, not checked\n", path, bd_addr_to_str(found_addr), found_slot);
+        return 0;
+    }
+    fprintf(stderr, "%-40s ok\n", path);
+    return 1;
+}
+
+int main(int argc, char *argv[]){
+    int failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "v")) != -1){
+        switch (opt){
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-v] script.txt...\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind == argc){
+        fprintf(stderr, "usage: %s [-v] script.txt...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    log_ring_init();
+    nvs_flash_init();
+    controller_discovery_init(BENCH_SLOTS, bench_found);
+    for (; optind < argc; optind++){
+        failed += !script_run(argv[optind]);
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,345 @@
+/*
+ * Drive mixer bench
+ *
+ * Checks the firmware's fixed-point arcade and tank mixes against golden
+ * values and against a double precision reference over the full 16 bit
+ * range of both axes, then times them.
+ *
+ * Usage: drive_mixer_bench [-n mixes] [-s stride]
+ *
+ *  -n  mixes to time per kernel (default 10000000)
+ *  -s  step of the sweep over both axes (default 31), every value of the
+ *      axes' edges and center lines is swept in any case
+ *
+ * The reference rescales the deflection outside the deadzone radius to
+ * full travel at the edge of the unit circle and, for arcade, scales both
+ * motors by full / (|throttle| + |steer|) beyond full travel. Every mix
+ * has to be the reference rounded to a step, stay within full travel,
+ * rest inside the deadzone, mirror left and right with the stick and,
+ * for tank, never reverse its direction along Y.
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "drive_mixer.h"
+#include "hid_decoder.h"
+
+#define DEFAULT_MIXES       10000000
+#define DEFAULT_STRIDE      31
+#define MAX_ERROR           0.501   // off the reference: rounded to the nearest step
+#define FULL                DRIVE_MIXER_FULL
+#define CENTER              HID_DECODER_JOYSTICK_CENTER
+
+typedef struct {
+    uint16_t deadzone;
+    uint16_t x;
+    uint16_t y;
+    int32_t  left;                  // arcade
+    int32_t  right;
+    int32_t  tank;
+} golden_mix_t;
+
+static const golden_mix_t golden_mixes[] = {
+    // without a deadzone
+    { 0,    CENTER, CENTER,     0,      0,      0 },
+    { 0,    CENTER, 0,          FULL,   FULL,   FULL },     // full ahead
+    { 0,    CENTER, 65535,      -FULL,  -FULL,  -FULL },    // full astern
+    { 0,    65535,  CENTER,     FULL,   -FULL,  0 },        // spin right on the spot
+    { 0,    0,      CENTER,     -FULL,  FULL,   0 },
+    { 0,    65535,  0,          FULL,   0,      23170 },    // corner: on the circle, then saturated
+    { 0,    0,      65535,      -FULL,  0,      -23170 },
+    { 0,    CENTER, 16384,      16384,  16384,  16384 },
+    { 0,    49152,  16384,      FULL,   0,      16384 },    // 16384 + 16384 saturates
+    { 0,    40960,  24576,      16384,  0,      8192 },
+    { 0,    36864,  16384,      20480,  12288,  16384 },
+    // the default deadzone of 10 %
+    { 3277, CENTER, CENTER - 3277, 0,   0,      0 },        // on the edge of the deadzone
+    { 3277, CENTER + 3277, CENTER, 0,   0,      0 },
+    { 3277, CENTER, CENTER - 3278, 1,   1,      1 },        // just past it
+    { 3277, CENTER + 2317, CENTER - 2317, 0, 0, 0 },        // radial: 3276.7 off the center
+    { 3277, CENTER, 0,          FULL,   FULL,   FULL },
+    { 3277, CENTER, 16384,      14563,  14563,  14563 },
+    { 3277, 65535,  CENTER,     FULL,   -FULL,  0 },
+    { 3277, 65535,  0,          FULL,   0,      23170 },
+    { 3277, 36864,  16384,      18340,  11004,  14672 },
+    // half the travel
+    { 16384, CENTER, 16384,     0,      0,      0 },
+    { 16384, CENTER, 12288,     8192,   8192,   8192 },
+};
+
+typedef struct {
+    int32_t  mix;
+    uint32_t min;
+    uint32_t max;
+    int      reversible;
+    uint32_t value;
+} golden_output_t;
+
+static const golden_output_t golden_outputs[] = {
+    { 0,        1000,   2000,   1,  1500 },     // reversible ESC at rest
+    { FULL,     1000,   2000,   1,  2000 },
+    { -FULL,    1000,   2000,   1,  1000 },
+    { FULL / 2, 1000,   2000,   1,  1750 },
+    { 0,        500,    2500,   1,  1500 },     // servo
+    { -FULL,    500,    2500,   1,  500 },
+    { 0,        0,      1000,   0,  0 },        // duty, forward only
+    { -FULL,    0,      1000,   0,  0 },
+    { FULL,     0,      1000,   0,  1000 },
+    { FULL / 2, 0,      1000,   0,  500 },
+    { FULL,     0,      2000,   0,  2000 },     // DShot throttle
+    { 2 * FULL, 1000,   2000,   1,  2000 },     // clamped
+};
+
+static int failures;
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static double reference_axis(uint16_t value){
+    double axis = (double) value - CENTER;
+    return axis < -FULL ? -FULL : axis;
+}
+
+static void reference_deadzone(double deadzone, double *x, double *y){
+    double magnitude = hypot(*x, *y);
+    double scaled;
+
+    if (magnitude <= deadzone){
+        *x = *y = 0;
+        return;
+    }
+    scaled = (magnitude - deadzone) * FULL / (FULL - deadzone);
+    if (scaled > FULL) scaled = FULL;
+    *x *= scaled / magnitude;
+    *y *= scaled / magnitude;
+}
+
+static void reference_arcade(double deadzone, uint16_t x, uint16_t y, double *left, double *right){
+    double steer = reference_axis(x);
+    double throttle = -reference_axis(y);
+    double peak;
+
+    reference_deadzone(deadzone, &steer, &throttle);
+    *left = throttle + steer;
+    *right = throttle - steer;
+    peak = fabs(throttle) + fabs(steer);
+    if (peak > FULL){
+        *left *= FULL / peak;
+        *right *= FULL / peak;
+    }
+}
+
+static double reference_tank(double deadzone, uint16_t x, uint16_t y){
+    double deflection_x = reference_axis(x);
+    double deflection_y = -reference_axis(y);
+
+    reference_deadzone(deadzone, &deflection_x, &deflection_y);
+    return deflection_y;
+}
+
+static void check_golden(void){
+    drive_mixer_stick_t stick;
+    int32_t left, right, tank;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(golden_mixes) / sizeof(golden_mixes[0]); i++){
+        const golden_mix_t *golden = &golden_mixes[i];
+
+        drive_mixer_stick_init(&stick, golden->deadzone);
+        drive_mixer_arcade(&stick, golden->x, golden->y, &left, &right);
+        tank = drive_mixer_tank(&stick, golden->x, golden->y);
+        if (left != golden->left || right != golden->right || tank != golden->tank){
+            fprintf(stderr, "deadzone %u at %u,%u: arcade %d/%d tank %d, expected %d/%d %d\n",
+                    golden->deadzone, golden->x, golden->y, left, right, tank, golden->left, golden->right, golden->tank);
+            failures++;
+        }
+    }
+    printf("golden mixes:       %u checked\n", i);
+
+    for (i = 0; i < sizeof(golden_outputs) / sizeof(golden_outputs[0]); i++){
+        const golden_output_t *golden = &golden_outputs[i];
+        uint32_t value = drive_mixer_output(golden->mix, golden->min, golden->max, golden->reversible);
+        if (value != golden->value){
+            fprintf(stderr, "output of %d over %u..%u%s: %u, expected %u\n", golden->mix, golden->min, golden->max,
+                    golden->reversible ? " reversible" : "", value, golden->value);
+            failures++;
+        }
+    }
+    printf("golden outputs:     %u checked\n", i);
+}
+
+typedef struct {
+    unsigned long mixes;
+    double        max_error;
+    unsigned long off;              // mixes off the reference by more than MAX_ERROR
+    unsigned long out_of_range;
+    unsigned long not_at_rest;      // inside the deadzone
+    unsigned long asymmetric;
+    unsigned long reversed;         // tank going back along Y
+} sweep_stats_t;
+
+static void sweep_one(const drive_mixer_stick_t *stick, uint16_t x, uint16_t y, sweep_stats_t *stats){
+    double  reference_left, reference_right, reference_track, error, dx, dy;
+    int32_t left, right, track, mirrored_left, mirrored_right;
+
+    drive_mixer_arcade(stick, x, y, &left, &right);
+    track = drive_mixer_tank(stick, x, y);
+    reference_arcade(stick->deadzone, x, y, &reference_left, &reference_right);
+    reference_track = reference_tank(stick->deadzone, x, y);
+    stats->mixes++;
+
+    error = fabs(left - reference_left);
+    if (fabs(right - reference_right) > error) error = fabs(right - reference_right);
+    if (fabs(track - reference_track) > error) error = fabs(track - reference_track);
+    if (error > stats->max_error) stats->max_error = error;
+    if (error > MAX_ERROR){
+        if (!stats->off){
+            fprintf(stderr, "deadzone %u at %u,%u: arcade %d/%d tank %d, reference %.2f/%.2f %.2f\n", stick->deadzone,
+                    x, y, left, right, track, reference_left, reference_right, reference_track);
+        }
+        stats->off++;
+    }
+    if (abs(left) > FULL || abs(right) > FULL || abs(track) > FULL) stats->out_of_range++;
+    dx = reference_axis(x);
+    dy = reference_axis(y);
+    if (dx * dx + dy * dy <= (double) stick->deadzone * stick->deadzone && (left || right || track)){
+        stats->not_at_rest++;
+    }
+    // the stick mirrored left to right swaps the motors; 0 and 65535 are both full travel
+    drive_mixer_arcade(stick, x ? (uint16_t)(2 * CENTER - x) : 65535, y, &mirrored_left, &mirrored_right);
+    if (mirrored_left != right || mirrored_right != left) stats->asymmetric++;
+}
+
+/* sweeps a line of one axis over every value, the other fixed */
+static void sweep_line(const drive_mixer_stick_t *stick, int along_y, uint16_t fixed, sweep_stats_t *stats){
+    int32_t track, last_track = FULL;
+    uint32_t value;
+
+    for (value = 0; value <= 65535; value++){
+        sweep_one(stick, along_y ? fixed : (uint16_t) value, along_y ? (uint16_t) value : fixed, stats);
+        if (!along_y) continue;
+        track = drive_mixer_tank(stick, fixed, (uint16_t) value);
+        if (track > last_track) stats->reversed++;
+        last_track = track;
+    }
+}
+
+static void sweep(uint16_t deadzone, unsigned int stride){
+    static const uint16_t lines[] = { 0, 1, 16384, CENTER - 1, CENTER, CENTER + 1, 49152, 65534, 65535 };
+    drive_mixer_stick_t stick;
+    sweep_stats_t stats;
+    uint64_t start = now_ns();
+    uint32_t x, y;
+    unsigned int i;
+
+    memset(&stats, 0, sizeof(stats));
+    drive_mixer_stick_init(&stick, deadzone);
+    for (i = 0; i < sizeof(lines) / sizeof(lines[0]); i++){
+        sweep_line(&stick, 0, lines[i], &stats);
+        sweep_line(&stick, 1, lines[i], &stats);
+    }
+    for (x = 0; x <= 65535; x += stride){
+        for (y = 0; y <= 65535; y += stride){
+            sweep_one(&stick, (uint16_t) x, (uint16_t) y, &stats);
+        }
+    }
+    printf("deadzone %5u:     %lu mixes, max error %.3f, %lu off, %lu out of range, %lu not at rest, "
+           "%lu asymmetric, %lu reversed (%.1f s)\n", deadzone, stats.mixes, stats.max_error, stats.off,
+           stats.out_of_range, stats.not_at_rest, stats.asymmetric, stats.reversed, (now_ns() - start) / 1e9);
+    if (stats.off || stats.out_of_range || stats.not_at_rest || stats.asymmetric || stats.reversed){
+        failures++;
+    }
+}
+
+/* @return pseudo-random stick positions, a fixed sequence */
+static uint32_t next_input(uint32_t *state){
+    *state = *state * 1664525u + 1013904223u;
+    return *state;
+}
+
+static void time_kernels(unsigned long mixes){
+    drive_mixer_stick_t stick;
+    uint64_t start, arcade_ns, tank_ns, reference_ns;
+    volatile int32_t sink = 0;     // keeps the loops
+    volatile double reference_sink = 0;
+    double reference_left, reference_right;
+    int32_t left, right;
+    uint32_t state, input;
+    unsigned long n;
+
+    drive_mixer_stick_init(&stick, DRIVE_MIXER_DEADZONE_DEFAULT);
+
+    state = 1;
+    start = now_ns();
+    for (n = 0; n < mixes; n++){
+        input = next_input(&state);
+        drive_mixer_arcade(&stick, (uint16_t) input, (uint16_t)(input >> 16), &left, &right);
+        sink += left + right;
+    }
+    arcade_ns = now_ns() - start;
+
+    state = 1;
+    start = now_ns();
+    for (n = 0; n < mixes; n++){
+        input = next_input(&state);
+        sink += drive_mixer_tank(&stick, (uint16_t) input, (uint16_t)(input >> 16));
+    }
+    tank_ns = now_ns() - start;
+
+    state = 1;
+    start = now_ns();
+    for (n = 0; n < mixes; n++){
+        input = next_input(&state);
+        reference_arcade(stick.deadzone, (uint16_t) input, (uint16_t)(input >> 16), &reference_left, &reference_right);
+        reference_sink += reference_left + reference_right;
+    }
+    reference_ns = now_ns() - start;
+
+    printf("arcade:             %.1f ns/mix (double reference %.1f ns)\n",
+           (double) arcade_ns / mixes, (double) reference_ns / mixes);
+    printf("tank:               %.1f ns/mix\n", (double) tank_ns / mixes);
+}
+
+int main(int argc, char *argv[]){
+    unsigned long mixes = DEFAULT_MIXES;
+    unsigned int stride = DEFAULT_STRIDE;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1){
+        switch (opt){
+            case 'n':
+                mixes = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                stride = (unsigned int) strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n mixes] [-s stride]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (!mixes) mixes = 1;
+    if (!stride) stride = 1;
+
+    check_golden();
+    sweep(0, stride);
+    sweep(DRIVE_MIXER_DEADZONE_DEFAULT, stride);
+    sweep(DRIVE_MIXER_DEADZONE_MAX, stride);
+    time_kernels(mixes);
+
+    if (failures){
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,263 @@
+/*
+ * DShot encoder bench
+ *
+ * Checks the firmware's DShot frame encoder against reference values and
+ * bit timings, then compares the cost of a commit of four motors on the
+ * DShot backend with the LEDC path, and the time until the new values
+ * reach the ESCs.
+ *
+ * Usage: dshot_encoder_bench [-n commits]
+ *
+ *  -n  commits to time per backend (default 1000000)
+ *
+ * Frames: 11 bit value, telemetry request bit, CRC over the three
+ * nibbles of both; the references are the frames of the DShot
+ * documentation and Betaflight. Timings: the bit period of 150, 300 and
+ * 600 kbit/s with three quarters (one) and three eighths (zero) high, each
+ * within one RMT tick. The encoded items are decoded back and every frame
+ * of a batch has to start after all of them are written.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "driver/ledc.h"
+#include "driver/rmt.h"
+#include "dshot.h"
+#include "motor_pwm.h"
+
+#define DEFAULT_COMMITS 1000000
+#define BENCH_MOTORS    4
+#define RMT_TICK_PS     (1000000000000ull / DSHOT_RMT_CLOCK_HZ)
+
+typedef struct {
+    uint16_t value;
+    int      telemetry;
+    uint16_t frame;
+} reference_frame_t;
+
+static const reference_frame_t reference_frames[] = {
+    { 0,    0, 0x0000 },    // disarmed
+    { 0,    1, 0x0011 },
+    { 48,   0, 0x0606 },    // lowest throttle
+    { 1000, 0, 0x7d0a },
+    { 1046, 0, 0x82c6 },    // the example frame of the DShot documentation
+    { 1046, 1, 0x82d7 },
+    { 2047, 1, 0xffff },
+};
+
+typedef struct {
+    const char *name;
+    uint32_t    bit_ps;
+    uint32_t    one_high_ps;
+    uint32_t    zero_high_ps;
+} reference_timing_t;
+
+static const reference_timing_t reference_timings[DSHOT_PROTOCOL_COUNT] = {
+    [DSHOT_150] = { "DShot150", 6666667, 5000000, 2500000 },
+    [DSHOT_300] = { "DShot300", 3333333, 2500000, 1250000 },
+    [DSHOT_600] = { "DShot600", 1666667, 1250000, 625000 },
+};
+
+static int failures;
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static int within_tick(uint32_t ticks, uint32_t reference_ps){
+    uint64_t ps = ticks * RMT_TICK_PS;
+    return ps + RMT_TICK_PS >= reference_ps && ps <= reference_ps + RMT_TICK_PS;
+}
+
+/* @return the frame the items send, -1 if an item is not a DShot bit of the protocol */
+static int decode_items(dshot_protocol_t protocol, const rmt_item32_t *items){
+    const dshot_timing_t *timing = dshot_get_timing(protocol);
+    int frame = 0;
+    int i;
+
+    for (i = 0; i < DSHOT_BITS; i++){
+        if (!items[i].level0 || items[i].level1
+                || items[i].duration0 + items[i].duration1 != timing->bit_ticks){
+            return -1;
+        }
+        frame = (frame << 1) | (items[i].duration0 > timing->bit_ticks / 2);
+    }
+    return items[DSHOT_BITS].duration0 ? -1 : frame;
+}
+
+static void check_frames(void){
+    unsigned int i;
+
+    for (i = 0; i < sizeof(reference_frames) / sizeof(reference_frames[0]); i++){
+        const reference_frame_t *reference = &reference_frames[i];
+        uint16_t frame = dshot_frame(reference->value, reference->telemetry);
+        if (frame != reference->frame){
+            fprintf(stderr, "value %u telemetry %d: frame %04x, expected %04x\n",
+                    reference->value, reference->telemetry, frame, reference->frame);
+            failures++;
+        }
+    }
+    printf("frames:             %u reference frames checked\n", i);
+}
+
+static void check_timings(void){
+    rmt_item32_t items[DSHOT_ITEMS];
+    unsigned int frame;
+    int protocol;
+
+    for (protocol = 0; protocol < DSHOT_PROTOCOL_COUNT; protocol++){
+        const reference_timing_t *reference = &reference_timings[protocol];
+        const dshot_timing_t *timing = dshot_get_timing((dshot_protocol_t) protocol);
+
+        if (!within_tick(timing->bit_ticks, reference->bit_ps)
+                || !within_tick(timing->one_high_ticks, reference->one_high_ps)
+                || !within_tick(timing->zero_high_ticks, reference->zero_high_ps)){
+            fprintf(stderr, "%s: %u/%u/%u ticks off the reference timing\n", reference->name,
+                    timing->bit_ticks, timing->one_high_ticks, timing->zero_high_ticks);
+            failures++;
+        }
+        // every value, both telemetry bits, decoded back from the items
+        for (frame = 0; frame <= 2 * DSHOT_VALUE_MAX + 1; frame++){
+            uint16_t expected = dshot_frame((uint16_t)(frame >> 1), frame & 1);
+            dshot_encode((dshot_protocol_t) protocol, expected, items);
+            if (decode_items((dshot_protocol_t) protocol, items) != expected){
+                fprintf(stderr, "%s: frame %04x does not decode from its items\n", reference->name, expected);
+                failures++;
+                break;
+            }
+        }
+        printf("%-19s %.3f us/bit, %.3f us one, %.3f us zero, %.1f us/frame\n", reference->name,
+               timing->bit_ticks * RMT_TICK_PS / 1e6, timing->one_high_ticks * RMT_TICK_PS / 1e6,
+               timing->zero_high_ticks * RMT_TICK_PS / 1e6, DSHOT_BITS * timing->bit_ticks * RMT_TICK_PS / 1e6);
+    }
+}
+
+/* writes and starts one batch, checks what every channel sends and that the starts follow all writes */
+static void check_batch(void){
+    uint16_t frames[BENCH_MOTORS];
+    unsigned long starts = rmt_mock_start_count;
+    uint32_t mask = 0;
+    int i;
+
+    for (i = 0; i < BENCH_MOTORS; i++){
+        frames[i] = dshot_frame((uint16_t)(DSHOT_THROTTLE_MIN + 500 * i), i == 2);
+        if (dshot_write((rmt_channel_t) i, frames[i]) != ESP_OK || rmt_mock_start_count != starts){
+            fprintf(stderr, "batch: channel %d started before all frames were written\n", i);
+            failures++;
+        }
+        mask |= 1u << i;
+    }
+    dshot_start(mask);
+    if (rmt_mock_start_count - starts != BENCH_MOTORS){
+        fprintf(stderr, "batch: %lu channels started, %d expected\n", rmt_mock_start_count - starts, BENCH_MOTORS);
+        failures++;
+    }
+    for (i = 0; i < BENCH_MOTORS; i++){
+        if (decode_items(DSHOT_600, rmt_mock_mem[i]) != frames[i]){
+            fprintf(stderr, "batch: channel %d sends %04x, expected %04x\n", i,
+                    decode_items(DSHOT_600, rmt_mock_mem[i]), frames[i]);
+            failures++;
+        }
+    }
+    printf("batch:              %d channels written, then started back to back\n", BENCH_MOTORS);
+}
+
+/*
+ * times a commit of four changed motors on both backends, each against
+ * the host stand-in of its driver, and the time a new value takes to
+ * reach the ESC: a whole frame for DShot, up to one period plus the
+ * pulse for PWM
+ */
+static void compare_backends(unsigned long commits){
+    rmt_item32_t items[DSHOT_ITEMS];
+    motor_pwm_info_t info;
+    uint64_t start, encode_ns, dshot_ns, ledc_ns;
+    unsigned long n;
+    volatile uint32_t sink = 0;    // keeps the encoder loop
+    int i;
+
+    start = now_ns();
+    for (n = 0; n < commits; n++){
+        dshot_encode(DSHOT_600, dshot_frame((uint16_t)(DSHOT_THROTTLE_MIN + (n & 1023)), 0), items);
+        sink += items[n % DSHOT_BITS].duration0;
+    }
+    encode_ns = now_ns() - start;
+
+    start = now_ns();
+    for (n = 0; n < commits; n++){
+        for (i = 0; i < BENCH_MOTORS; i++){
+            dshot_write((rmt_channel_t) i, dshot_frame((uint16_t)(DSHOT_THROTTLE_MIN + ((n + i) & 1023)), 0));
+        }
+        dshot_start((1u << BENCH_MOTORS) - 1);
+    }
+    dshot_ns = now_ns() - start;
+
+    start = now_ns();
+    for (n = 0; n < commits; n++){
+        for (i = 0; i < BENCH_MOTORS; i++){
+            motor_pwm_stage((motor_pwm_output_t) i, (i == MOTOR_PWM_LED ? 0 : 1000) + (n + i) % 1000);
+        }
+        motor_pwm_commit();
+    }
+    ledc_ns = now_ns() - start;
+
+    printf("encode:             %.1f ns/frame\n", (double) encode_ns / commits);
+    printf("commit, 4 motors:   DShot %.1f ns, LEDC %.1f ns (host, driver stand-ins)\n",
+           (double) dshot_ns / commits, (double) ledc_ns / commits);
+    for (i = 0; i < DSHOT_PROTOCOL_COUNT; i++){
+        const dshot_timing_t *timing = dshot_get_timing((dshot_protocol_t) i);
+        printf("%-19s new value at the ESC after %.1f us\n", reference_timings[i].name,
+               DSHOT_BITS * timing->bit_ticks * RMT_TICK_PS / 1e6);
+    }
+    for (i = 0; i < MOTOR_PWM_COUNT; i++){
+        motor_pwm_get_info((motor_pwm_output_t) i, &info);
+        if (!motor_pwm_mode_is_pulse(info.mode)) continue;
+        printf("pwm%d %-14s new value at the ESC after up to %.1f us\n", i + 1, info.name,
+               1e6 / info.freq_hz + info.max);
+    }
+}
+
+int main(int argc, char *argv[]){
+    unsigned long commits = DEFAULT_COMMITS;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1){
+        switch (opt){
+            case 'n':
+                commits = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n commits]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (!commits) commits = 1;
+
+    motor_pwm_init();
+    for (i = 0; i < BENCH_MOTORS; i++){
+        if (dshot_init_channel((rmt_channel_t) i, GPIO_NUM_19, DSHOT_600) != ESP_OK){
+            fprintf(stderr, "RMT channel %d not configured\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    check_frames();
+    check_timings();
+    check_batch();
+    compare_backends(commits);
+
+    if (failures){
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,417 @@
+/*
+ * Host stand-in for the ESP-IDF drivers used by the firmware
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "driver/ledc.h"
+#include "soc/ledc_struct.h"
+#include "driver/rmt.h"
+#include "driver/uart.h"
+#include "esp_console.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs_flash.h"
+
+#define NVS_MOCK_NAMESPACES 8
+#define NVS_MOCK_ENTRIES    16
+#define NVS_MOCK_NAME_SIZE  16  // NVS keys and namespaces are at most 15 characters
+#define NVS_MOCK_BLOB_SIZE  1024
+#define CONSOLE_MOCK_COMMANDS 16
+#define CONSOLE_MOCK_ARGS   8
+#define CONSOLE_MOCK_LINE   128
+
+unsigned long     ledc_mock_calls;
+unsigned long     ledc_mock_writes;
+ledc_mock_write_t ledc_mock_log[LEDC_MOCK_LOG_SIZE];
+uint32_t          ledc_mock_duty[LEDC_CHANNEL_MAX];
+uint32_t          ledc_mock_channel_timer[LEDC_CHANNEL_MAX];
+uint32_t          ledc_mock_timer_freq[LEDC_TIMER_MAX];
+uint32_t          ledc_mock_timer_bits[LEDC_TIMER_MAX];
+uint32_t          ledc_mock_hpoint[LEDC_CHANNEL_MAX];
+uint64_t          ledc_mock_time_ns;
+unsigned long     ledc_mock_latches[LEDC_CHANNEL_MAX];
+uint64_t          ledc_mock_latch_period[LEDC_CHANNEL_MAX];
+static ledc_dev_t ledc_mock_registers;
+
+uint8_t       uart_mock_tx[UART_MOCK_TX_SIZE];
+unsigned long uart_mock_tx_bytes;
+unsigned long uart_mock_writes;
+
+unsigned long rmt_mock_calls;
+uint8_t       rmt_mock_clk_div[RMT_CHANNEL_MAX];
+rmt_item32_t  rmt_mock_mem[RMT_CHANNEL_MAX][RMT_MEM_ITEM_NUM];
+unsigned long rmt_mock_start_count;
+uint8_t       rmt_mock_starts[RMT_MOCK_STARTS];
+
+/* @return counts of a timer since 0 ns on the simulated clock */
+static uint64_t ledc_mock_timer_ticks(unsigned int timer){
+    return (uint64_t)(((unsigned __int128) ledc_mock_time_ns * ledc_mock_timer_freq[timer]
+                       << ledc_mock_timer_bits[timer]) / 1000000000u);
+}
+
+ledc_dev_t *ledc_mock_dev(void){
+    unsigned int timer;
+    ledc_mock_time_ns += LEDC_MOCK_READ_NS;
+    for (timer = 0; timer < LEDC_TIMER_MAX; timer++){
+        uint64_t ticks = ledc_mock_timer_ticks(timer);
+        ledc_mock_registers.timer_group[LEDC_HIGH_SPEED_MODE].timer[timer].value.timer_cnt =
+            (uint32_t)(ticks & ((1u << ledc_mock_timer_bits[timer]) - 1));
+    }
+    return &ledc_mock_registers;
+}
+
+static void ledc_mock_write(ledc_mock_register_t reg, int channel, uint32_t value){
+    ledc_mock_write_t *write = &ledc_mock_log[ledc_mock_writes++ % LEDC_MOCK_LOG_SIZE];
+    write->reg     = (uint8_t) reg;
+    write->channel = (uint8_t) channel;
+    write->value   = value;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *ledc_conf){
+    ledc_mock_calls++;
+    if (ledc_conf->channel >= LEDC_CHANNEL_MAX) return ESP_ERR_INVALID_ARG;
+    ledc_mock_write(LEDC_MOCK_HPOINT, ledc_conf->channel, (uint32_t) ledc_conf->hpoint);
+    ledc_mock_hpoint[ledc_conf->channel] = (uint32_t) ledc_conf->hpoint;
+    ledc_mock_write(LEDC_MOCK_DUTY, ledc_conf->channel, ledc_conf->duty);
+    ledc_mock_write(LEDC_MOCK_CONF1, ledc_conf->channel, 1);
+    ledc_mock_write(LEDC_MOCK_CONF0, ledc_conf->channel, ledc_conf->timer_sel);
+    ledc_mock_write(LEDC_MOCK_GPIO_MATRIX, ledc_conf->channel, (uint32_t) ledc_conf->gpio_num);
+    ledc_mock_duty[ledc_conf->channel] = ledc_conf->duty;
+    ledc_mock_channel_timer[ledc_conf->channel] = ledc_conf->timer_sel;
+    return ESP_OK;
+}
+
+/* rejects what the IDF driver rejects: a clock divider below 1, i.e. freq << bits above the APB clock */
+esp_err_t ledc_timer_config(const ledc_timer_config_t *timer_conf){
+    ledc_mock_calls++;
+    if (timer_conf->timer_num >= LEDC_TIMER_MAX || !timer_conf->freq_hz
+            || timer_conf->bit_num < LEDC_TIMER_1_BIT || timer_conf->bit_num >= LEDC_TIMER_BIT_MAX
+            || ((uint64_t) timer_conf->freq_hz << timer_conf->bit_num) > LEDC_APB_CLK_HZ){
+        return ESP_FAIL;
+    }
+    ledc_mock_write(LEDC_MOCK_TIMER_CONF, timer_conf->timer_num, timer_conf->freq_hz);
+    ledc_mock_timer_freq[timer_conf->timer_num] = timer_conf->freq_hz;
+    ledc_mock_timer_bits[timer_conf->timer_num] = timer_conf->bit_num;
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t duty){
+    (void) speed_mode;
+    ledc_mock_calls++;
+    if (channel >= LEDC_CHANNEL_MAX) return ESP_ERR_INVALID_ARG;
+    ledc_mock_time_ns += LEDC_MOCK_CALL_NS;
+    ledc_mock_write(LEDC_MOCK_HPOINT, channel, 0);
+    ledc_mock_write(LEDC_MOCK_DUTY, channel, duty);
+    ledc_mock_write(LEDC_MOCK_CONF1, channel, 0);
+    ledc_mock_duty[channel] = duty;
+    ledc_mock_hpoint[channel] = 0;
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_duty_with_hpoint(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t duty, uint32_t hpoint){
+    (void) speed_mode;
+    ledc_mock_calls++;
+    if (channel >= LEDC_CHANNEL_MAX) return ESP_ERR_INVALID_ARG;
+    ledc_mock_time_ns += LEDC_MOCK_CALL_NS;
+    ledc_mock_write(LEDC_MOCK_HPOINT, channel, hpoint);
+    ledc_mock_write(LEDC_MOCK_DUTY, channel, duty);
+    ledc_mock_write(LEDC_MOCK_CONF1, channel, 0);
+    ledc_mock_duty[channel] = duty;
+    ledc_mock_hpoint[channel] = hpoint;
+    return ESP_OK;
+}
+
+int ledc_get_hpoint(ledc_mode_t speed_mode, ledc_channel_t channel){
+    (void) speed_mode;
+    return channel < LEDC_CHANNEL_MAX ? (int) ledc_mock_hpoint[channel] : -1;
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t speed_mode, ledc_channel_t channel){
+    (void) speed_mode;
+    ledc_mock_calls++;
+    if (channel >= LEDC_CHANNEL_MAX) return ESP_ERR_INVALID_ARG;
+    ledc_mock_time_ns += LEDC_MOCK_CALL_NS;
+    ledc_mock_write(LEDC_MOCK_CONF0, channel, 1);
+    ledc_mock_write(LEDC_MOCK_CONF1, channel, 1);
+    ledc_mock_latches[channel]++;
+    ledc_mock_latch_period[channel] = (ledc_mock_timer_ticks(ledc_mock_channel_timer[channel])
+                                       >> ledc_mock_timer_bits[ledc_mock_channel_timer[channel]]) + 1;
+    return ESP_OK;
+}
+
+uint32_t ledc_get_duty(ledc_mode_t speed_mode, ledc_channel_t channel){
+    (void) speed_mode;
+    return channel < LEDC_CHANNEL_MAX ? ledc_mock_duty[channel] : 0;
+}
+
+esp_err_t rmt_config(const rmt_config_t *rmt_param){
+    rmt_mock_calls++;
+    if (rmt_param->channel >= RMT_CHANNEL_MAX || rmt_param->rmt_mode != RMT_MODE_TX || !rmt_param->clk_div
+            || !rmt_param->mem_block_num || rmt_param->channel + rmt_param->mem_block_num > RMT_CHANNEL_MAX){
+        return ESP_ERR_INVALID_ARG;
+    }
+    rmt_mock_clk_div[rmt_param->channel] = rmt_param->clk_div;
+    return ESP_OK;
+}
+
+/* one memory block per channel, the way the firmware configures them */
+esp_err_t rmt_fill_tx_items(rmt_channel_t channel, const rmt_item32_t *item, uint16_t item_num, uint16_t mem_offset){
+    rmt_mock_calls++;
+    if (channel >= RMT_CHANNEL_MAX || !item_num || mem_offset + item_num > RMT_MEM_ITEM_NUM) return ESP_ERR_INVALID_ARG;
+    memcpy(&rmt_mock_mem[channel][mem_offset], item, item_num * sizeof(*item));
+    return ESP_OK;
+}
+
+esp_err_t rmt_tx_start(rmt_channel_t channel, bool tx_idx_rst){
+    (void) tx_idx_rst;
+    rmt_mock_calls++;
+    if (channel >= RMT_CHANNEL_MAX || !rmt_mock_clk_div[channel]) return ESP_ERR_INVALID_ARG;
+    rmt_mock_starts[rmt_mock_start_count++ % RMT_MOCK_STARTS] = (uint8_t) channel;
+    return ESP_OK;
+}
+
+typedef struct {
+    nvs_handle handle;
+    char       key[NVS_MOCK_NAME_SIZE];
+    size_t     length;
+    uint8_t    value[NVS_MOCK_BLOB_SIZE];
+} nvs_mock_entry_t;
+
+static int              nvs_mock_initialized;
+static char             nvs_mock_namespaces[NVS_MOCK_NAMESPACES][NVS_MOCK_NAME_SIZE];
+static nvs_mock_entry_t nvs_mock_entries[NVS_MOCK_ENTRIES];
+
+esp_err_t nvs_flash_init(void){
+    nvs_mock_initialized = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle){
+    int i;
+    if (!nvs_mock_initialized) return ESP_ERR_NVS_NOT_INITIALIZED;
+    if (strlen(name) >= NVS_MOCK_NAME_SIZE) return ESP_ERR_INVALID_ARG;
+    for (i = 0; i < NVS_MOCK_NAMESPACES; i++) {
+        if (strcmp(nvs_mock_namespaces[i], name) == 0) break;
+    }
+    if (i == NVS_MOCK_NAMESPACES) {
+        // a read-only open never creates the namespace
+        if (open_mode == NVS_READONLY) return ESP_ERR_NVS_NOT_FOUND;
+        for (i = 0; i < NVS_MOCK_NAMESPACES && nvs_mock_namespaces[i][0]; i++);
+        if (i == NVS_MOCK_NAMESPACES) return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        strcpy(nvs_mock_namespaces[i], name);
+    }
+    *out_handle = (nvs_handle) i + 1;
+    return ESP_OK;
+}
+
+static nvs_mock_entry_t *nvs_mock_find(nvs_handle handle, const char *key){
+    int i;
+    for (i = 0; i < NVS_MOCK_ENTRIES; i++) {
+        if (nvs_mock_entries[i].handle == handle && strcmp(nvs_mock_entries[i].key, key) == 0) {
+            return &nvs_mock_entries[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length){
+    nvs_mock_entry_t *entry = nvs_mock_find(handle, key);
+    if (!entry) return ESP_ERR_NVS_NOT_FOUND;
+    if (out_value == NULL) {
+        *length = entry->length;
+        return ESP_OK;
+    }
+    if (*length < entry->length) return ESP_ERR_NVS_INVALID_LENGTH;
+    memcpy(out_value, entry->value, entry->length);
+    *length = entry->length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length){
+    nvs_mock_entry_t *entry = nvs_mock_find(handle, key);
+    if (handle == 0 || handle > NVS_MOCK_NAMESPACES) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (strlen(key) >= NVS_MOCK_NAME_SIZE) return ESP_ERR_INVALID_ARG;
+    if (length > NVS_MOCK_BLOB_SIZE) return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    if (!entry) entry = nvs_mock_find(0, "");
+    if (!entry) return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    entry->handle = handle;
+    strcpy(entry->key, key);
+    memcpy(entry->value, value, length);
+    entry->length = length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle handle){
+    return handle && handle <= NVS_MOCK_NAMESPACES ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+void nvs_close(nvs_handle handle){
+    (void) handle;
+}
+
+int uart_write_bytes(int uart_num, const char *src, size_t size){
+    size_t i;
+    (void) uart_num;
+    uart_mock_writes++;
+    for (i = 0; i < size; i++, uart_mock_tx_bytes++){
+        if (uart_mock_tx_bytes < UART_MOCK_TX_SIZE) uart_mock_tx[uart_mock_tx_bytes] = (uint8_t) src[i];
+    }
+    return (int) size;
+}
+
+int64_t esp_timer_mock_offset_us;
+
+int64_t esp_timer_get_time(void){
+    static int64_t start;
+    struct timespec ts;
+    int64_t now;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if (!start) start = now;
+    return now - start + esp_timer_mock_offset_us;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_depth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *created_task){
+    (void) task;
+    (void) name;
+    (void) stack_depth;
+    (void) parameters;
+    (void) priority;
+    if (created_task) *created_task = NULL;
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth,
+                                   void *parameters, UBaseType_t priority, TaskHandle_t *created_task,
+                                   BaseType_t core_id){
+    (void) core_id;
+    return xTaskCreate(task, name, stack_depth, parameters, priority, created_task);
+}
+
+void vTaskDelay(TickType_t ticks){
+    (void) ticks;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task){
+    (void) task;
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait){
+    (void) clear_count_on_exit;
+    (void) ticks_to_wait;
+    return 0;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle){
+    (void) create_args;
+    *out_handle = NULL;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period){
+    (void) timer;
+    (void) period;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer){
+    (void) timer;
+    return ESP_OK;
+}
+
+static esp_console_cmd_t console_mock_commands[CONSOLE_MOCK_COMMANDS];
+static unsigned int      console_mock_count;
+
+esp_err_t esp_console_init(const esp_console_config_t *config){
+    (void) config;
+    console_mock_count = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t *cmd){
+    if (!cmd->command || strchr(cmd->command, ' ')) return ESP_ERR_INVALID_ARG;
+    if (console_mock_count == CONSOLE_MOCK_COMMANDS) return ESP_ERR_NO_MEM;
+    console_mock_commands[console_mock_count++] = *cmd;
+    return ESP_OK;
+}
+
+esp_err_t esp_console_register_help_command(void){
+    return ESP_OK;
+}
+
+esp_err_t esp_console_run(const char *cmdline, int *cmd_ret){
+    char         line[CONSOLE_MOCK_LINE];
+    char        *argv[CONSOLE_MOCK_ARGS];
+    int          argc = 0;
+    char        *token;
+    unsigned int i;
+
+    if (strlen(cmdline) >= sizeof(line)) return ESP_ERR_INVALID_ARG;
+    strcpy(line, cmdline);
+    for (token = strtok(line, " "); token && argc < CONSOLE_MOCK_ARGS; token = strtok(NULL, " ")){
+        argv[argc++] = token;
+    }
+    if (!argc) return ESP_ERR_INVALID_ARG;
+    for (i = 0; i < console_mock_count; i++){
+        if (strcmp(console_mock_commands[i].command, argv[0]) == 0){
+            *cmd_ret = console_mock_commands[i].func(argc, argv);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+uint8_t       partition_mock_image[PARTITION_MOCK_SIZE];
+unsigned long partition_mock_writes;
+unsigned long partition_mock_erases;
+unsigned long partition_mock_bad_writes;
+
+static const esp_partition_t partition_mock = {
+    ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t) 0x40, 0x110000, PARTITION_MOCK_SIZE, "capture", 0
+};
+static int partition_mock_initialized;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label){
+    if (type != partition_mock.type || (subtype != ESP_PARTITION_SUBTYPE_ANY && subtype != partition_mock.subtype)) return NULL;
+    if (label && strcmp(label, partition_mock.label)) return NULL;
+    if (!partition_mock_initialized){
+        // flash comes erased
+        memset(partition_mock_image, 0xff, sizeof(partition_mock_image));
+        partition_mock_initialized = 1;
+    }
+    return &partition_mock;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size){
+    if (partition != &partition_mock || src_offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+    memcpy(dst, &partition_mock_image[src_offset], size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size){
+    const uint8_t *bytes = src;
+    size_t i;
+    if (partition != &partition_mock || dst_offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+    partition_mock_writes++;
+    for (i = 0; i < size; i++){
+        if (bytes[i] & ~partition_mock_image[dst_offset + i]){
+            partition_mock_bad_writes++;
+        }
+        partition_mock_image[dst_offset + i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t start_addr, size_t size){
+    if (partition != &partition_mock || start_addr + size > partition->size) return ESP_ERR_INVALID_SIZE;
+    if (start_addr % PARTITION_MOCK_SECTOR_SIZE || size % PARTITION_MOCK_SECTOR_SIZE) return ESP_ERR_INVALID_SIZE;
+    partition_mock_erases += size / PARTITION_MOCK_SECTOR_SIZE;
+    memset(&partition_mock_image[start_addr], 0xff, size);
+    return ESP_OK;
+}
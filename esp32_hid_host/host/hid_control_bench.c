@@ -0,0 +1,287 @@
+/*
+ * HID control channel bench
+ *
+ * Plays the controllers for the firmware's HID control channel client: a
+ * script says which HIDP messages the firmware must send on a control
+ * channel, in which order, and what the controller answers. Messages go
+ * out only on L2CAP_EVENT_CAN_SEND_NOW, which the bench delivers when it
+ * expects one; the clock only moves when the script says so.
+ *
+ * Usage: hid_control_bench [-v] script.txt...
+ *
+ *  -v  pass the firmware's console output through to stderr
+ *
+ * Script lines, '#' starts a comment:
+ *
+ *  attach <slot> <cid>                     HID channels of a controller opened
+ *  detach <slot>                           HID channels closed
+ *  poll                                    one period of the HID control timer
+ *  wait <ms>                               the clock moves on
+ *  expect <cid> <bytes>                    next message the firmware sent, hex
+ *  none                                    the firmware has nothing to send
+ *  answer <cid> <bytes>                    message of the controller, hex
+ *  console <arguments>                     "hidctl <arguments>" must succeed
+ *  reject <arguments>                      "hidctl <arguments>" must fail
+ *  printed <text>                          the firmware printed the text since the last check
+ *  check <slot> <field> <min> [max]        control channel statistic within [min, max]
+ */
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "btstack_stub.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+
+// firmware under test, included to reset its state between scripts
+#include "hid_control.c"
+
+#define SCRIPT_LINE_SIZE    256
+#define SCRIPT_PACKET_SIZE  64
+#define SCRIPT_MAX_ARGS     8
+#define PRINTED_SIZE        4096
+
+static int    verbose;
+static char   printed[PRINTED_SIZE];
+static size_t printed_len;
+
+static ssize_t console_write(void *cookie, const char *buf, size_t size){
+    size_t copy = size < PRINTED_SIZE - 1 - printed_len ? size : PRINTED_SIZE - 1 - printed_len;
+    (void) cookie;
+    memcpy(&printed[printed_len], buf, copy);
+    printed_len += copy;
+    printed[printed_len] = 0;
+    if (verbose){
+        fwrite(buf, 1, size, stderr);
+    }
+    return (ssize_t) size;
+}
+
+static void console_init(void){
+    cookie_io_functions_t functions = { NULL, console_write, NULL, NULL };
+    FILE *console = fopencookie(NULL, "w", functions);
+    if (!console){
+        perror("fopencookie");
+        exit(EXIT_FAILURE);
+    }
+    setvbuf(console, NULL, _IONBF, 0);
+    stdout = console;
+}
+
+/* the firmware's packet handler, as far as the control channel goes */
+static void bench_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    (void) channel;
+    (void) size;
+    if (packet_type == HCI_EVENT_PACKET && packet[0] == L2CAP_EVENT_CAN_SEND_NOW){
+        hid_control_can_send_now(l2cap_event_can_send_now_get_local_cid(packet));
+    }
+}
+
+/* parses hex bytes, @return their number or -1 */
+static int parse_hex_bytes(char *pos, uint8_t *buffer, int buffer_size){
+    int count = 0;
+    char *end;
+    for (;;){
+        unsigned long byte = strtoul(pos, &end, 16);
+        if (end == pos) return count;
+        if (byte > 0xff || count == buffer_size) return -1;
+        buffer[count++] = (uint8_t) byte;
+        pos = end;
+    }
+}
+
+/* delivers CAN_SEND_NOW until the firmware sends, @return 1 if it did */
+static int deliver_until_sent(void){
+    unsigned int sends = btstack_stub_l2cap_sends;
+    while (btstack_stub_l2cap_sends == sends){
+        if (!btstack_stub_can_send_now()) return 0;
+    }
+    return 1;
+}
+
+static int console(char *line){
+    char *argv[SCRIPT_MAX_ARGS];
+    int   argc = 0;
+    char *arg;
+
+    argv[argc++] = "hidctl";
+    for (arg = strtok(line, " \t\r\n"); arg && argc < SCRIPT_MAX_ARGS; arg = strtok(NULL, " \t\r\n")){
+        argv[argc++] = arg;
+    }
+    return hid_control_command(argc, argv);
+}
+
+static int stat_field(const hid_control_stats_t *stats, int attached, const char *field, long *value){
+    static const struct {
+        const char *name;
+        size_t      offset;
+        size_t      size;
+    } fields[] = {
+#define STAT_FIELD(name) { #name, offsetof(hid_control_stats_t, name), sizeof(((hid_control_stats_t *) 0)->name) }
+        STAT_FIELD(protocol), STAT_FIELD(idle), STAT_FIELD(idle_ms), STAT_FIELD(transactions),
+        STAT_FIELD(retries), STAT_FIELD(errors), STAT_FIELD(timeouts), STAT_FIELD(unexpected),
+#undef STAT_FIELD
+    };
+    const uint8_t *base = (const uint8_t *) stats;
+    unsigned int i;
+
+    if (strcmp(field, "attached") == 0){
+        *value = attached;
+        return 1;
+    }
+    for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++){
+        if (strcmp(fields[i].name, field)) continue;
+        if (fields[i].size == 1){
+            *value = *(const uint8_t *)(base + fields[i].offset);
+        } else if (fields[i].size == 2){
+            *value = *(const uint16_t *)(base + fields[i].offset);
+        } else {
+            *value = *(const uint32_t *)(base + fields[i].offset);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* runs one script line, @return an error message or NULL */
+static const char *script_step(char *line){
+    uint8_t  packet[SCRIPT_PACKET_SIZE];
+    char     command[16];
+    char     field[32];
+    unsigned int slot, cid, ms;
+    long     min, max, value;
+    int      consumed, len, i;
+    hid_control_stats_t stats;
+
+    if (sscanf(line, "%15s%n", command, &consumed) != 1) return NULL;
+    line += consumed;
+
+    if (strcmp(command, "attach") == 0){
+        if (sscanf(line, "%u %x", &slot, &cid) != 2) return "attach <slot> <cid>";
+        hid_control_attach(slot, (uint16_t) cid);
+    } else if (strcmp(command, "detach") == 0){
+        if (sscanf(line, "%u", &slot) != 1) return "detach <slot>";
+        hid_control_detach(slot);
+    } else if (strcmp(command, "poll") == 0){
+        hid_control_poll();
+    } else if (strcmp(command, "wait") == 0){
+        if (sscanf(line, "%u", &ms) != 1) return "wait <ms>";
+        esp_timer_mock_offset_us += (int64_t) ms * 1000;
+    } else if (strcmp(command, "expect") == 0){
+        if (sscanf(line, "%x%n", &cid, &consumed) != 1) return "expect <cid> <bytes>";
+        len = parse_hex_bytes(line + consumed, packet, sizeof(packet));
+        if (len < 1) return "bad message bytes";
+        if (!deliver_until_sent()) return "no message sent";
+        if (btstack_stub_l2cap_sent_cid != cid || btstack_stub_l2cap_sent_size != len
+                || memcmp(btstack_stub_l2cap_sent, packet, (size_t) len)){
+            fprintf(stderr, "sent on 0x%04x:    ", btstack_stub_l2cap_sent_cid);
+            for (i = 0; i < btstack_stub_l2cap_sent_size; i++) fprintf(stderr, " %02x", btstack_stub_l2cap_sent[i]);
+            fprintf(stderr, "\nexpected on 0x%04x:", cid);
+            for (i = 0; i < len; i++) fprintf(stderr, " %02x", packet[i]);
+            fprintf(stderr, "\n");
+            return "unexpected message";
+        }
+    } else if (strcmp(command, "none") == 0){
+        if (deliver_until_sent()) return "unexpected message sent";
+    } else if (strcmp(command, "answer") == 0){
+        if (sscanf(line, "%x%n", &cid, &consumed) != 1) return "answer <cid> <bytes>";
+        len = parse_hex_bytes(line + consumed, packet, sizeof(packet));
+        if (len < 1) return "bad message bytes";
+        hid_control_packet((uint16_t) cid, packet, (uint16_t) len);
+    } else if (strcmp(command, "console") == 0){
+        if (console(line)) return "console command failed";
+    } else if (strcmp(command, "reject") == 0){
+        if (!console(line)) return "console command succeeded";
+    } else if (strcmp(command, "printed") == 0){
+        while (*line == ' ' || *line == '\t') line++;
+        line[strcspn(line, "\r\n")] = 0;
+        if (!strstr(printed, line)){
+            fprintf(stderr, "printed: %s", printed);
+            return "text not printed";
+        }
+        printed_len = 0;
+        printed[0]  = 0;
+    } else if (strcmp(command, "check") == 0){
+        i = sscanf(line, "%u %31s %ld %ld", &slot, field, &min, &max);
+        if (i < 3) return "check <slot> <field> <min> [max]";
+        if (i == 3) max = min;
+        if (!stat_field(&stats, hid_control_get_stats(slot, &stats), field, &value)) return "unknown field";
+        if (value < min || value > max){
+            fprintf(stderr, "%s is %ld\n", field, value);
+            return "check failed";
+        }
+    } else {
+        return "unknown command";
+    }
+    return NULL;
+}
+
+/* runs a script from detached channels and the default idle rate, @return 1 if every line passed */
+static int script_run(const char *path){
+    char line[SCRIPT_LINE_SIZE];
+    unsigned int line_number = 0;
+    unsigned int slot;
+    const char *error;
+    FILE *file = fopen(path, "r");
+
+    if (!file){
+        perror(path);
+        return 0;
+    }
+    for (slot = 0; slot < HID_CONTROL_SLOTS; slot++){
+        hid_control_detach(slot);
+        hid_control_request_state[slot] = REQUEST_FREE;
+    }
+    while (btstack_stub_can_send_now());
+    hid_control_idle_ms = HID_CONTROL_IDLE_DEFAULT_MS;
+    printed_len = 0;
+    printed[0]  = 0;
+
+    while (fgets(line, sizeof(line), file)){
+        char *comment = strchr(line, '#');
+        line_number++;
+        if (comment) *comment = 0;
+        error = script_step(line);
+        if (error){
+            fprintf(stderr, "%s:%u: %s\n", path, line_number, error);
+            fclose(file);
+            return 0;
+        }
+    }
+    fclose(file);
+    fprintf(stderr, "%-40s ok\n", path);
+    return 1;
+}
+
+int main(int argc, char *argv[]){
+    int failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "v")) != -1){
+        switch (opt){
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-v] script.txt...\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind == argc){
+        fprintf(stderr, "usage: %s [-v] script.txt...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    console_init();
+    nvs_flash_init();
+    btstack_stub_l2cap_handler = bench_packet_handler;
+    hid_control_init();
+    for (; optind < argc; optind++){
+        failed += !script_run(argv[optind]);
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
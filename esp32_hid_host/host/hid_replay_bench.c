@@ -0,0 +1,1373 @@
+/*
+ * HID report replay bench
+ *
+ * Builds the firmware's decode/dispatch path for the host and replays
+ * interrupt-channel reports through packet_handler ->
+ * handle_controller_interrupts -> state mailbox, measuring the per-report
+ * cost of the Bluetooth side, and runs the control loop periods
+ * (handle_controller_state -> routing table -> motion stage ->
+ * motor_pwm_commit) in between.
+ *
+ * The bench plays the remote Xbox One Controller: it answers the SDP query
+ * with the controller's HID record, opens the control and interrupt
+ * channels and then delivers the reports as L2CAP_DATA_PACKETs, just like
+ * BTstack does on the ESP32.
+ *
+ * Usage: hid_replay_bench [-f reports.txt] [-p capture.bin] [-w reports.txt] [-C capture.bin] [-n passes] [-r reports] [-t periods] [-c controllers] [-k] [-D] [-d reports] [-R route] [-P pwm] [-T Hz] [-U uart.bin] [-I ms] [-l] [-v]
+ *
+ *  -f  replay reports from a file, one report per line as hex bytes
+ *      starting with the HIDP header (A1 01 ...), '#' starts a comment
+ *  -p  replay the reports of a capture partition image, each to the
+ *      controller that sent it
+ *  -w  write the replayed reports to a file in the same format
+ *  -C  switch the firmware's report capture on and write its partition
+ *      image to a file afterwards
+ *  -n  number of timed passes over the reports (default 20)
+ *  -r  reports per control loop period (default 1), more coalesce
+ *  -t  control loop periods per report period (default 1), 4 runs the
+ *      500 Hz loop between the 8 ms reports of a controller
+ *  -c  controllers the reports are spread over round robin (default 1),
+ *      two are connected
+ *  -k  start with both controllers in the SDP cache: the firmware connects
+ *      first and checks the descriptor with SDP afterwards
+ *  -D  start with the default configuration, no controller addresses,
+ *      instead of configuring both controllers: the bench answers the
+ *      firmware's inquiries with both of them in pairing mode, the firmware
+ *      must find, connect and remember them
+ *  -d  drop the link of the reporting controller every n reports: the
+ *      outputs must fall back to rest in the next control period and the
+ *      firmware must page the controller again
+ *  -R  run "route <route>" on the firmware console before the replay, as
+ *      often as given: "-R clear -R 'add 1 lx scale pwm2'" replaces the routing
+ *      table, the failsafe check of -d covers every routed output
+ *  -P  run "pwm <pwm>" on the firmware console before the replay, as often
+ *      as given: "-P '2 group 0'" latches pwm2 on its own, "-P '3 phase 0'"
+ *      moves the start of its pulse
+ *  -T  switch the firmware's binary telemetry on at a rate, its frames must
+ *      decode in sequence and the last one must hold the state of its period
+ *  -U  write what the firmware sent on the UART to a file, for telemetry_decode
+ *  -I  run "hidctl idle <ms>" on the firmware console and play a controller
+ *      that takes SET_IDLE: it holds back a report that equals the one it
+ *      sent last until the idle rate has passed, for ever at 0
+ *  -l  print the firmware's latency histograms after the timed passes,
+ *      through its "latency" console command
+ *  -v  pass the firmware console output through to stderr
+ *
+ * The motion stage must keep every output it moves within its slew
+ * limit and put the setpoints of unlimited outputs in place in the
+ * period they were set; the bench fails otherwise.
+ *
+ * The LEDC timers run on the mock's simulated clock, which the bench
+ * advances by a control period plus up to CONTROL_JITTER_NS of timer
+ * dispatch jitter before each one. Outputs of one timer that a period
+ * latches take effect in the same timer period unless an overflow falls
+ * between their latches; the bench counts those splits and fails on one
+ * within an output group, on a duty of a group written after the group
+ * started latching, or on an hpoint that is not the output's phase.
+ *
+ * The rumble output reports go out the way BTstack lets them: every 50 ms
+ * of reports the firmware's haptics timer runs, and each CAN_SEND_NOW it
+ * asked for is delivered. The bench fails if a report is sent outside of
+ * CAN_SEND_NOW or more than one request per channel is outstanding.
+ *
+ * The control channel is answered like the controller does: HANDSHAKE
+ * successful for SET_PROTOCOL, and for SET_IDLE only with -I, otherwise
+ * unsupported request, so the controller streams every report as before.
+ * The controller sends a report every 8 ms; the reports per second of
+ * the stretches where nothing changed are the saving of the idle rate.
+ *
+ * Without -f a synthetic session is generated: idle stretches, stick
+ * sweeps, trigger ramps, button presses, guide-button and battery reports.
+ *
+ * Deferred log records are drained and formatted between reports, outside
+ * the timed region, the way the firmware's low priority log task does.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btstack_stub.h"
+#include "capture_image.h"
+#include "driver/ledc.h"
+#include "driver/rmt.h"
+#include "driver/uart.h"
+#include "dshot.h"
+#include "esp_console.h"
+#include "esp_partition.h"
+
+// firmware under test with its default configuration, included to reach its static handlers
+#include "esp32_hid_host.c"
+
+// two controllers, so the per-connection table is exercised
+static const char * const bench_addr_strings[MAX_CONTROLLERS] = { "5C-BA-37-FE-E0-03", "5C-BA-37-FE-E0-04" };
+
+#define MAX_REPORT_SIZE     64
+#define MAX_REPORTS         100000
+#define SYNTHETIC_REPORTS   8000
+#define DEFAULT_PASSES      20
+#define MAX_ROUTE_COMMANDS  16
+#define MAX_PWM_COMMANDS    16
+#define CONTROL_JITTER_NS   20000
+#define UART_BAUDRATE       115200
+#define UART_BITS_PER_BYTE  10
+#define HAPTICS_REPORTS     6       // reports per haptics timer period, 50 ms at 8 ms each
+#define REPORT_PERIOD_MS    8       // of each controller
+#define HIDP_HANDSHAKE_SUCCESSFUL  0x00
+#define HIDP_HANDSHAKE_UNSUPPORTED 0x03
+#define HIDP_SET_PROTOCOL   0x70
+#define HIDP_SET_IDLE       0x90
+#define HCI_COMMAND_SIZE    64
+
+typedef struct {
+    uint8_t  data[MAX_REPORT_SIZE];
+    uint16_t len;
+    uint8_t  slot;      // controller of a captured report
+} replay_report_t;
+
+static replay_report_t reports[MAX_REPORTS];
+static unsigned int    report_count;
+static int             reports_captured;   // replayed to the controller that sent them
+
+// allocation counters, fed by the --wrap'ed allocator
+static unsigned long allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size){
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size){
+    allocations++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size){
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr){
+    __real_free(ptr);
+}
+
+// console stand-in: counts the bytes the firmware prints
+static unsigned long console_bytes;
+static int           console_verbose;
+
+static ssize_t console_write(void *cookie, const char *buf, size_t size){
+    (void) cookie;
+    console_bytes += size;
+    if (console_verbose){
+        fwrite(buf, 1, size, stderr);
+    }
+    return (ssize_t) size;
+}
+
+/* runs a firmware console command, its output goes to stderr if shown */
+static void console_command(const char *line, int show){
+    int verbose = console_verbose;
+    int ret;
+    console_verbose = show;
+    if (esp_console_run(line, &ret) != ESP_OK || ret){
+        fprintf(stderr, "console command '%s' failed\n", line);
+        exit(EXIT_FAILURE);
+    }
+    fflush(stdout);
+    console_verbose = verbose;
+}
+
+static void console_init(void){
+    cookie_io_functions_t functions = { NULL, console_write, NULL, NULL };
+    FILE *console = fopencookie(NULL, "w", functions);
+    if (!console){
+        perror("fopencookie");
+        exit(EXIT_FAILURE);
+    }
+    stdout = console;
+}
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/* Xbox One Controller (model 1708) HID report descriptor, as announced in its SDP record */
+static const uint8_t xbox_one_hid_descriptor[] = {
+    0x05, 0x01, 0x09, 0x05, 0xa1, 0x01,
+    // report 1: sticks, triggers, hat switch and buttons
+    0x85, 0x01,
+    0x09, 0x01, 0xa1, 0x00, 0x09, 0x30, 0x09, 0x31, 0x15, 0x00, 0x27, 0xff, 0xff, 0x00, 0x00,
+    0x95, 0x02, 0x75, 0x10, 0x81, 0x02, 0xc0,
+    0x09, 0x01, 0xa1, 0x00, 0x09, 0x32, 0x09, 0x35, 0x15, 0x00, 0x27, 0xff, 0xff, 0x00, 0x00,
+    0x95, 0x02, 0x75, 0x10, 0x81, 0x02, 0xc0,
+    0x05, 0x02, 0x09, 0xc5, 0x15, 0x00, 0x26, 0xff, 0x03, 0x95, 0x01, 0x75, 0x0a, 0x81, 0x02,
+    0x15, 0x00, 0x25, 0x00, 0x75, 0x06, 0x95, 0x01, 0x81, 0x03,
+    0x05, 0x02, 0x09, 0xc4, 0x15, 0x00, 0x26, 0xff, 0x03, 0x95, 0x01, 0x75, 0x0a, 0x81, 0x02,
+    0x15, 0x00, 0x25, 0x00, 0x75, 0x06, 0x95, 0x01, 0x81, 0x03,
+    0x05, 0x01, 0x09, 0x39, 0x15, 0x01, 0x25, 0x08, 0x75, 0x04, 0x95, 0x01, 0x81, 0x42,
+    0x15, 0x00, 0x25, 0x00, 0x75, 0x04, 0x95, 0x01, 0x81, 0x03,
+    0x05, 0x09, 0x19, 0x01, 0x29, 0x0a, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x0a, 0x81, 0x02,
+    0x15, 0x00, 0x25, 0x00, 0x75, 0x06, 0x95, 0x01, 0x81, 0x03,
+    // report 2: guide button
+    0x85, 0x02,
+    0x05, 0x0c, 0x0a, 0x23, 0x02, 0x15, 0x00, 0x25, 0x01, 0x95, 0x01, 0x75, 0x01, 0x81, 0x02,
+    0x15, 0x00, 0x25, 0x00, 0x75, 0x07, 0x95, 0x01, 0x81, 0x03,
+    // report 3: force feedback output
+    0x85, 0x03,
+    0x05, 0x0f, 0x09, 0x21, 0xa1, 0x02,
+    0x09, 0x97, 0x15, 0x00, 0x25, 0x01, 0x75, 0x04, 0x95, 0x01, 0x91, 0x02,
+    0x15, 0x00, 0x25, 0x00, 0x75, 0x04, 0x95, 0x01, 0x91, 0x03,
+    0x09, 0x70, 0x15, 0x00, 0x25, 0x64, 0x75, 0x08, 0x95, 0x04, 0x91, 0x02,
+    0x09, 0x50, 0x66, 0x01, 0x10, 0x55, 0x0e, 0x15, 0x00, 0x26, 0xff, 0x00, 0x75, 0x08, 0x95, 0x01, 0x91, 0x02,
+    0x09, 0xa7, 0x15, 0x00, 0x26, 0xff, 0x00, 0x75, 0x08, 0x95, 0x01, 0x91, 0x02,
+    0x65, 0x00, 0x55, 0x00, 0x09, 0x7c, 0x15, 0x00, 0x26, 0xff, 0x00, 0x75, 0x08, 0x95, 0x01, 0x91, 0x02,
+    0xc0,
+    // report 4: battery strength
+    0x85, 0x04,
+    0x05, 0x06, 0x09, 0x20, 0x15, 0x00, 0x26, 0xff, 0x00, 0x75, 0x08, 0x95, 0x01, 0x81, 0x02,
+    0xc0,
+};
+
+/* delivers one attribute of the SDP record byte by byte, as sdp_client does */
+static void sdp_deliver_attribute(uint16_t attribute_id, const uint8_t *value, uint16_t len){
+    uint8_t  event[11];
+    uint16_t offset;
+    for (offset = 0; offset < len; offset++){
+        event[0] = SDP_EVENT_QUERY_ATTRIBUTE_VALUE;
+        event[1] = sizeof(event) - 2;
+        little_endian_store_16(event, 2, 0);
+        little_endian_store_16(event, 4, attribute_id);
+        little_endian_store_16(event, 6, len);
+        little_endian_store_16(event, 8, offset);
+        event[10] = value[offset];
+        (*btstack_stub_sdp_handler)(HCI_EVENT_PACKET, 0, event, sizeof(event));
+    }
+}
+
+static void sdp_deliver_hid_record(void){
+    static const uint8_t protocol_descriptor_list[] = {
+        0x35, 0x0d, 0x35, 0x06, 0x19, 0x01, 0x00, 0x09, 0x00, 0x11, 0x35, 0x03, 0x19, 0x00, 0x11,
+    };
+    static const uint8_t additional_protocol_descriptor_lists[] = {
+        0x35, 0x0f, 0x35, 0x0d, 0x35, 0x06, 0x19, 0x01, 0x00, 0x09, 0x00, 0x13, 0x35, 0x03, 0x19, 0x00, 0x11,
+    };
+    uint8_t  hid_descriptor_list[11 + sizeof(xbox_one_hid_descriptor)];
+    uint16_t pos = 0;
+    uint8_t  event[3];
+
+    // DES { DES { uint8 report descriptor type, string report descriptor } }
+    hid_descriptor_list[pos++] = 0x36;
+    big_endian_store_16(hid_descriptor_list, pos, (uint16_t)(8 + sizeof(xbox_one_hid_descriptor)));
+    pos += 2;
+    hid_descriptor_list[pos++] = 0x36;
+    big_endian_store_16(hid_descriptor_list, pos, (uint16_t)(5 + sizeof(xbox_one_hid_descriptor)));
+    pos += 2;
+    hid_descriptor_list[pos++] = 0x08;
+    hid_descriptor_list[pos++] = 0x22;
+    hid_descriptor_list[pos++] = 0x26;
+    big_endian_store_16(hid_descriptor_list, pos, (uint16_t) sizeof(xbox_one_hid_descriptor));
+    pos += 2;
+    memcpy(&hid_descriptor_list[pos], xbox_one_hid_descriptor, sizeof(xbox_one_hid_descriptor));
+    pos += sizeof(xbox_one_hid_descriptor);
+
+    sdp_deliver_attribute(BLUETOOTH_ATTRIBUTE_PROTOCOL_DESCRIPTOR_LIST, protocol_descriptor_list, sizeof(protocol_descriptor_list));
+    sdp_deliver_attribute(BLUETOOTH_ATTRIBUTE_ADDITIONAL_PROTOCOL_DESCRIPTOR_LISTS, additional_protocol_descriptor_lists, sizeof(additional_protocol_descriptor_lists));
+    sdp_deliver_attribute(BLUETOOTH_ATTRIBUTE_HID_DESCRIPTOR_LIST, hid_descriptor_list, pos);
+
+    event[0] = SDP_EVENT_QUERY_COMPLETE;
+    event[1] = 1;
+    event[2] = 0;
+    (*btstack_stub_sdp_handler)(HCI_EVENT_PACKET, 0, event, sizeof(event));
+}
+
+static void l2cap_deliver_channel_opened(uint16_t local_cid){
+    uint8_t event[24];
+    memset(event, 0, sizeof(event));
+    event[0] = L2CAP_EVENT_CHANNEL_OPENED;
+    event[1] = sizeof(event) - 2;
+    event[2] = 0;
+    little_endian_store_16(event, 13, local_cid);
+    (*btstack_stub_l2cap_handler)(HCI_EVENT_PACKET, local_cid, event, sizeof(event));
+}
+
+static void l2cap_deliver_channel_closed(uint16_t local_cid){
+    uint8_t event[4];
+    event[0] = L2CAP_EVENT_CHANNEL_CLOSED;
+    event[1] = sizeof(event) - 2;
+    little_endian_store_16(event, 2, local_cid);
+    (*btstack_stub_l2cap_handler)(HCI_EVENT_PACKET, local_cid, event, sizeof(event));
+}
+
+/* stores the controllers' SDP results the way a previous boot would have */
+static void cache_controllers(void){
+    static hid_cache_record_t record;
+    static hid_decoder_t      decoder;
+    unsigned int i;
+
+    record.hid_control_psm    = 0x11;
+    record.hid_interrupt_psm  = 0x13;
+    record.hid_descriptor_len = sizeof(xbox_one_hid_descriptor);
+    record.hid_descriptor_hash = hid_cache_hash(xbox_one_hid_descriptor, sizeof(xbox_one_hid_descriptor));
+    hid_decoder_compile(&decoder, xbox_one_hid_descriptor, sizeof(xbox_one_hid_descriptor));
+    for (i = 0; i < MAX_CONTROLLERS; i++){
+        sscanf_bd_addr(bench_addr_strings[i], record.remote_addr);
+        hid_cache_store(&record, &decoder);
+    }
+}
+
+static int          discover_controllers;
+static unsigned int discovery_inquiries_answered;
+
+/*
+ * answers the firmware's HCI commands like a controller after reset, with
+ * both controllers responding to every inquiry, the second one weaker
+ */
+static int hci_answer(void){
+    uint8_t  command[HCI_COMMAND_SIZE];
+    uint8_t  answer[6];
+    uint8_t  event[17];
+    uint16_t opcode;
+    bd_addr_t addr;
+    unsigned int i;
+    int answered = 0;
+
+    while (btstack_stub_hci_command_take(command, sizeof(command))){
+        opcode = little_endian_read_16(command, 0);
+        answered = 1;
+        answer[1] = sizeof(answer) - 2;
+        if (opcode != hci_inquiry.opcode){
+            answer[0] = HCI_EVENT_COMMAND_COMPLETE;
+            answer[2] = 1;
+            little_endian_store_16(answer, 3, opcode);
+            answer[5] = 0;
+            btstack_stub_hci_event(answer, sizeof(answer));
+            continue;
+        }
+        answer[0] = HCI_EVENT_COMMAND_STATUS;
+        answer[2] = 0;
+        answer[3] = 1;
+        little_endian_store_16(answer, 4, opcode);
+        btstack_stub_hci_event(answer, sizeof(answer));
+        discovery_inquiries_answered++;
+        for (i = 0; i < MAX_CONTROLLERS; i++){
+            sscanf_bd_addr(bench_addr_strings[i], addr);
+            memset(event, 0, sizeof(event));
+            event[0] = HCI_EVENT_INQUIRY_RESULT_WITH_RSSI;
+            event[1] = sizeof(event) - 2;
+            event[2] = 1;
+            reverse_bd_addr(addr, &event[3]);
+            event[9]  = 1;                                  // page scan repetition mode R1
+            little_endian_store_16(event, 11, 0x2508);      // limited discoverable, peripheral, gamepad
+            event[16] = (uint8_t)(int8_t)(-40 - 10 * (int) i);
+            btstack_stub_hci_event(event, sizeof(event));
+        }
+    }
+    return answered;
+}
+
+static const char  *idle_setting;
+// the controllers' side of SET_IDLE, -1 streams every report
+static int32_t      controller_idle_ms[MAX_CONTROLLERS];
+static replay_report_t controller_sent[MAX_CONTROLLERS];   // report each controller sent last
+static uint32_t     controller_clock_ms[MAX_CONTROLLERS];
+static uint32_t     controller_sent_ms[MAX_CONTROLLERS];
+static unsigned long idle_reports;          // reports equal to the one sent last
+static unsigned long idle_reports_sent;     // of them, sent anyway
+
+/* answers what the firmware sent on a control channel, the way the controller does */
+static void control_answer(void){
+    uint8_t  answer = HIDP_HANDSHAKE_UNSUPPORTED;
+    unsigned int slot;
+
+    for (slot = 0; slot < num_controllers; slot++){
+        if (hid_controllers[slot].l2cap_hid_control_cid == btstack_stub_l2cap_sent_cid) break;
+    }
+    if (slot == num_controllers || !btstack_stub_l2cap_sent_size) return;
+    switch (btstack_stub_l2cap_sent[0] & 0xf0){
+        case HIDP_SET_PROTOCOL:
+            answer = HIDP_HANDSHAKE_SUCCESSFUL;
+            break;
+        case HIDP_SET_IDLE:
+            if (!idle_setting) break;
+            controller_idle_ms[slot] = btstack_stub_l2cap_sent[1] * 4;
+            answer = HIDP_HANDSHAKE_SUCCESSFUL;
+            break;
+        default:
+            break;
+    }
+    packet_handler(L2CAP_DATA_PACKET, btstack_stub_l2cap_sent_cid, &answer, 1);
+}
+
+/* delivers the CAN_SEND_NOW events the firmware asked for, @return 1 if there were any */
+static int deliver_can_send_now(void){
+    unsigned int sends = btstack_stub_l2cap_sends;
+    int delivered = 0;
+
+    while (btstack_stub_can_send_now()){
+        delivered = 1;
+        if (btstack_stub_l2cap_sends != sends){
+            sends = btstack_stub_l2cap_sends;
+            control_answer();
+        }
+    }
+    return delivered;
+}
+
+/* checks that the discovery connected the controllers in the order of their RSSI and remembered them */
+static void discovery_check(void){
+    controller_discovery_stats_t stats;
+    bd_addr_t expected, remembered;
+    unsigned int i;
+
+    for (i = 0; i < num_controllers; i++){
+        sscanf_bd_addr(bench_addr_strings[i], expected);
+        if (!controller_discovery_remembered(i, remembered) || memcmp(remembered, expected, sizeof(bd_addr_t))
+                || memcmp(hid_controllers[i].remote_addr, expected, sizeof(bd_addr_t))){
+            fprintf(stderr, "controller %u is not %s after the discovery\n", i + 1, bench_addr_strings[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    controller_discovery_get_stats(&stats);
+    if (stats.state != CONTROLLER_DISCOVERY_CONNECTED){
+        fprintf(stderr, "discovery of controller %u ended %u\n", stats.slot + 1, stats.state);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "discovered:         %u controllers, %u inquiries, the last one with %u responses and %u attempts\n",
+            num_controllers, discovery_inquiries_answered, stats.responses, stats.attempts);
+}
+
+/*
+ * runs the firmware from power on up to the open interrupt channels,
+ * answering SDP queries and opening channels in the order it asks for them
+ */
+static void connect_controllers(void){
+    uint8_t state_event[3] = { BTSTACK_EVENT_STATE, 1, HCI_STATE_WORKING };
+    uint8_t control_open[MAX_CONTROLLERS] = {0};
+    uint8_t interrupt_open[MAX_CONTROLLERS] = {0};
+    unsigned int answered_queries = 0;
+    unsigned int i;
+    int progress;
+
+    for (i = 0; i < MAX_CONTROLLERS; i++){
+        controller_idle_ms[i] = -1;
+    }
+    btstack_main(0, NULL);
+    if (num_controllers != MAX_CONTROLLERS){
+        fprintf(stderr, "firmware runs %u of %d controllers\n", num_controllers, MAX_CONTROLLERS);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < num_controllers; i++){
+        if (discover_controllers){
+            // the default CONTROLLER_ADDRESSES leaves every controller to a discovery
+            if (controller_assigned(&hid_controllers[i])){
+                fprintf(stderr, "controller %u has an address before the discovery\n", i + 1);
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+        // what a CONTROLLER_ADDRESSES with both addresses configures
+        sscanf_bd_addr(bench_addr_strings[i], hid_controllers[i].remote_addr);
+    }
+    btstack_stub_hci_event(state_event, sizeof(state_event));
+    do {
+        progress = 0;
+        if (discover_controllers){
+            progress |= hci_answer();
+        }
+        if (answered_queries < btstack_stub_sdp_queries){
+            answered_queries++;
+            sdp_deliver_hid_record();
+            progress = 1;
+        }
+        for (i = 0; i < num_controllers; i++){
+            if (hid_controllers[i].l2cap_hid_control_cid && !control_open[i]){
+                control_open[i] = 1;
+                l2cap_deliver_channel_opened(hid_controllers[i].l2cap_hid_control_cid);
+                progress = 1;
+            }
+            if (hid_controllers[i].l2cap_hid_interrupt_cid && !interrupt_open[i]){
+                interrupt_open[i] = 1;
+                l2cap_deliver_channel_opened(hid_controllers[i].l2cap_hid_interrupt_cid);
+                progress = 1;
+            }
+        }
+        progress |= deliver_can_send_now();
+    } while (progress);
+
+    for (i = 0; i < num_controllers; i++){
+        if (!interrupt_open[i]){
+            fprintf(stderr, "firmware did not open the HID channels of controller %u\n", i + 1);
+            exit(EXIT_FAILURE);
+        }
+    }
+    fprintf(stderr, "connected:          %u controllers, %u SDP queries, %u TLV stores\n",
+            num_controllers, btstack_stub_sdp_queries, btstack_stub_tlv_stores);
+    if (discover_controllers){
+        discovery_check();
+    }
+}
+
+static replay_report_t *report_add(void){
+    if (report_count >= MAX_REPORTS){
+        fprintf(stderr, "more than %d reports\n", MAX_REPORTS);
+        exit(EXIT_FAILURE);
+    }
+    return &reports[report_count++];
+}
+
+static void reports_load(const char *path){
+    char line[4 * MAX_REPORT_SIZE];
+    FILE *file = fopen(path, "r");
+    if (!file){
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    while (fgets(line, sizeof(line), file)){
+        replay_report_t report;
+        char *pos = line;
+        char *end;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = 0;
+        report.len  = 0;
+        report.slot = 0;
+        for (;;){
+            unsigned long byte = strtoul(pos, &end, 16);
+            if (end == pos) break;
+            if (report.len == MAX_REPORT_SIZE){
+                fprintf(stderr, "%s: report longer than %d bytes\n", path, MAX_REPORT_SIZE);
+                exit(EXIT_FAILURE);
+            }
+            report.data[report.len++] = (uint8_t) byte;
+            pos = end;
+        }
+        if (!report.len) continue;
+        *report_add() = report;
+    }
+    fclose(file);
+}
+
+static void capture_add_report(void *context, uint16_t session, uint32_t time_ms,
+                               unsigned int slot, const uint8_t *data, uint16_t len){
+    replay_report_t *report = report_add();
+    (void) context;
+    (void) session;
+    (void) time_ms;
+    memcpy(report->data, data, len);
+    report->len  = len;
+    report->slot = (uint8_t) slot;
+}
+
+static void reports_load_capture(const char *path){
+    capture_image_stats_t stats;
+
+    if (!capture_image_decode(path, capture_add_report, NULL, &stats)) exit(EXIT_FAILURE);
+    if (stats.malformed){
+        fprintf(stderr, "%s: %u malformed sectors\n", path, stats.malformed);
+        exit(EXIT_FAILURE);
+    }
+    reports_captured = 1;
+    fprintf(stderr, "capture image:      %u sectors, %u sessions, %lu reports\n",
+            stats.sectors, stats.sessions, stats.reports);
+}
+
+/* writes the capture partition after the firmware wrote out what it still held */
+static void capture_save(const char *path){
+    report_capture_stats_t stats;
+    FILE *file;
+
+    console_command("capture off", 0);
+    report_capture_drain();
+    report_capture_get_stats(&stats);
+    file = fopen(path, "wb");
+    if (!file || fwrite(partition_mock_image, 1, sizeof(partition_mock_image), file) != sizeof(partition_mock_image)){
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(file);
+    fprintf(stderr, "capture:            %u reports in %u bytes (%.2f bytes/report), %u dropped\n",
+            stats.reports, stats.bytes, stats.reports ? (double) stats.bytes / stats.reports : 0.0, stats.dropped);
+    fprintf(stderr, "capture flash:      %u sectors, %lu erases, %lu writes, %lu bad writes, %u errors\n",
+            stats.sequence, partition_mock_erases, partition_mock_writes, partition_mock_bad_writes, stats.flash_errors);
+    if (stats.dropped || stats.flash_errors || partition_mock_bad_writes){
+        fprintf(stderr, "capture lost reports\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void reports_save(const char *path){
+    unsigned int i;
+    FILE *file = fopen(path, "w");
+    if (!file){
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < report_count; i++){
+        uint16_t j;
+        for (j = 0; j < reports[i].len; j++){
+            fprintf(file, j ? " %02X" : "%02X", reports[i].data[j]);
+        }
+        fprintf(file, "\n");
+    }
+    fclose(file);
+}
+
+static uint32_t synthetic_random(void){
+    static uint32_t seed = 0x12345678;
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+static void synthetic_input_report(uint16_t lx, uint16_t ly, uint16_t rx, uint16_t ry,
+                                   uint16_t lt, uint16_t rt, uint8_t hat, uint16_t buttons){
+    replay_report_t *report = report_add();
+    uint8_t *data = report->data;
+    data[0] = 0xa1;
+    data[1] = 0x01;
+    little_endian_store_16(data, 2, lx);
+    little_endian_store_16(data, 4, ly);
+    little_endian_store_16(data, 6, rx);
+    little_endian_store_16(data, 8, ry);
+    little_endian_store_16(data, 10, lt);
+    little_endian_store_16(data, 12, rt);
+    data[14] = hat;
+    little_endian_store_16(data, 15, buttons);
+    report->len = 17;
+}
+
+static void synthetic_short_report(uint8_t report_id, uint8_t value){
+    replay_report_t *report = report_add();
+    report->data[0] = 0xa1;
+    report->data[1] = report_id;
+    report->data[2] = value;
+    report->len = 3;
+}
+
+/* stick noise around the center, as reported by an idle controller */
+static uint16_t synthetic_center(void){
+    return (uint16_t)(0x8000 + (int)(synthetic_random() % 64) - 32);
+}
+
+static void reports_generate(void){
+    unsigned int i;
+    while (report_count < SYNTHETIC_REPORTS){
+        switch (synthetic_random() % 6){
+            case 0:
+                // idle: the controller repeats the same report
+                for (i = 0; i < 200; i++){
+                    synthetic_input_report(0x8000, 0x8000, 0x8000, 0x8000, 0, 0, 0, 0);
+                }
+                break;
+            case 1:
+                // left stick sweep with the right stick resting
+                for (i = 0; i < 256; i++){
+                    synthetic_input_report((uint16_t)(i << 8), (uint16_t)(0xffff - (i << 8)),
+                                           synthetic_center(), synthetic_center(), 0, 0, 0, 0);
+                }
+                break;
+            case 2:
+                // trigger ramps
+                for (i = 0; i < 1024; i += 4){
+                    synthetic_input_report(0x8000, 0x8000, 0x8000, 0x8000, (uint16_t) i, (uint16_t)(1023 - i), 0, 0);
+                }
+                break;
+            case 3:
+                // button presses, each held for a few reports
+                for (i = 0; i < 10 * 8; i++){
+                    synthetic_input_report(0x8000, 0x8000, 0x8000, 0x8000, 0, 0, 0, (uint16_t)(1u << (i / 8)));
+                }
+                break;
+            case 4:
+                // dpad round
+                for (i = 0; i < 8 * 8; i++){
+                    synthetic_input_report(0x8000, 0x8000, 0x8000, 0x8000, 0, 0, (uint8_t)(1 + i / 8), 0);
+                }
+                break;
+            default:
+                // guide button press and release, battery report
+                synthetic_short_report(0x02, 1);
+                synthetic_short_report(0x02, 0);
+                synthetic_short_report(0x04, (uint8_t)(synthetic_random() & 0xff));
+                break;
+        }
+    }
+}
+
+static int compare_u64(const void *a, const void *b){
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static unsigned long log_records;
+
+static void log_drain(void){
+    log_record_t record;
+    while (log_ring_read(&record)){
+        log_ring_print(&record);
+        log_records++;
+    }
+}
+
+static unsigned int reports_per_period = 1;
+static unsigned int periods_per_report = 1;
+static unsigned int active_controllers = 1;
+static unsigned int drop_interval;
+static int          start_cached;
+static uint64_t     control_ns;
+static unsigned int link_drops;
+static unsigned int failsafe_misses;
+static unsigned int haptics_periods;
+static const char  *route_commands[MAX_ROUTE_COMMANDS];
+static unsigned int route_command_count;
+static const char  *pwm_commands[MAX_PWM_COMMANDS];
+static unsigned int pwm_command_count;
+static unsigned int pwm_shared_latches;     // periods that latched several outputs of a timer, per timer
+static unsigned int pwm_split_latches;      // of them, those that took effect in different timer periods
+static unsigned int pwm_group_splits;       // of them, splits between outputs of one group
+static unsigned int pwm_order_errors;
+static unsigned long control_periods_run;
+static const char  *telemetry_rate;
+
+/*
+ * checks the LEDC writes of a period: every latched output of a group had
+ * its duty written before the group's first latch, and the outputs of a
+ * timer latched in the period take effect in the same timer period
+ */
+static void pwm_latch_check(const unsigned long *latches_before, unsigned long writes_before){
+    motor_pwm_info_t info[MOTOR_PWM_COUNT];
+    uint32_t latched = 0;
+    unsigned long w;
+    int i, j;
+
+    for (i = 0; i < MOTOR_PWM_COUNT; i++){
+        motor_pwm_get_info((motor_pwm_output_t) i, &info[i]);
+        if (!motor_pwm_mode_is_dshot(info[i].mode) && ledc_mock_latches[info[i].channel] != latches_before[i]){
+            latched |= 1u << i;
+        }
+    }
+    if (ledc_mock_writes - writes_before <= LEDC_MOCK_LOG_SIZE){
+        for (i = 0; i < MOTOR_PWM_COUNT; i++){
+            unsigned long first_latch = ledc_mock_writes;
+            unsigned long last_duty = writes_before;
+            if (!(latched & (1u << i)) || info[i].group == MOTOR_PWM_NO_GROUP) continue;
+            for (w = writes_before; w < ledc_mock_writes; w++){
+                const ledc_mock_write_t *write = &ledc_mock_log[w % LEDC_MOCK_LOG_SIZE];
+                for (j = 0; j < MOTOR_PWM_COUNT; j++){
+                    if (!(latched & (1u << j)) || info[j].group != info[i].group || write->channel != info[j].channel) continue;
+                    if (write->reg == LEDC_MOCK_DUTY) last_duty = w;
+                    if (write->reg == LEDC_MOCK_CONF1 && write->value && first_latch == ledc_mock_writes) first_latch = w;
+                }
+            }
+            if (last_duty > first_latch) pwm_order_errors++;
+        }
+    }
+    for (i = 0; i < MOTOR_PWM_COUNT; i++){
+        int shared = 0, split = 0, group_split = 0;
+        if (!(latched & (1u << i))) continue;
+        for (j = i + 1; j < MOTOR_PWM_COUNT; j++){
+            if (!(latched & (1u << j)) || info[j].timer != info[i].timer) continue;
+            latched &= ~(1u << j);
+            shared = 1;
+            if (ledc_mock_latch_period[info[j].channel] != ledc_mock_latch_period[info[i].channel]){
+                split = 1;
+                if (info[i].group != MOTOR_PWM_NO_GROUP && info[j].group == info[i].group) group_split = 1;
+            }
+        }
+        pwm_shared_latches += shared;
+        pwm_split_latches += split;
+        pwm_group_splits += group_split;
+    }
+}
+
+/*
+ * runs a control period on the simulated LEDC clock and checks its latches
+ * @return ns the period took
+ */
+static uint64_t control_period(void){
+    unsigned long latches_before[MOTOR_PWM_COUNT];
+    unsigned long writes_before = ledc_mock_writes;
+    motor_pwm_info_t info;
+    uint64_t start;
+    int i;
+
+    ledc_mock_time_ns += CONTROL_LOOP_PERIOD_US * 1000ull + synthetic_random() % CONTROL_JITTER_NS;
+    for (i = 0; i < MOTOR_PWM_COUNT; i++){
+        motor_pwm_get_info((motor_pwm_output_t) i, &info);
+        latches_before[i] = motor_pwm_mode_is_dshot(info.mode) ? 0 : ledc_mock_latches[info.channel];
+    }
+    start = now_ns();
+    control_loop_run_period();
+    start = now_ns() - start;
+    control_periods_run++;
+    pwm_latch_check(latches_before, writes_before);
+    return start;
+}
+
+/* runs the haptics and HID control timers and delivers the CAN_SEND_NOW events they asked for */
+static void haptics_period(void){
+    haptics_poll();
+    hid_control_poll();
+    // one request per channel, the interrupt channel's for rumble and the control channel's
+    if (btstack_stub_can_send_requests > 2 * num_controllers){
+        fprintf(stderr, "firmware asked for %u CAN_SEND_NOW events for %u controllers\n",
+                btstack_stub_can_send_requests, num_controllers);
+        exit(EXIT_FAILURE);
+    }
+    deliver_can_send_now();
+    if (btstack_stub_l2cap_unrequested_sends){
+        fprintf(stderr, "firmware sent an output report outside of CAN_SEND_NOW\n");
+        exit(EXIT_FAILURE);
+    }
+    haptics_periods++;
+}
+
+/*
+ * prints the motion stage of the outputs and checks its guarantees: no
+ * step beyond the slew limit, rounded up to whole units, and no
+ * tick of delay for the outputs without a limit
+ */
+static void motion_check(void){
+    motion_stage_limits_t limits;
+    motion_stage_stats_t  stats;
+    uint32_t step_limit;
+    int failed = 0;
+    int i;
+
+    for (i = 0; i < MOTOR_PWM_COUNT; i++){
+        motion_stage_get_limits((motor_pwm_output_t) i, &limits);
+        motion_stage_get_stats((motor_pwm_output_t) i, &stats);
+        fprintf(stderr, "motion pwm%d:        %u setpoints, %u immediate, %u jumps, settled after %.1f ticks (%u max), steps up to %u\n",
+                i + 1, stats.setpoints, stats.immediate, stats.jumps,
+                stats.settled ? (double) stats.settle_ticks / stats.settled : 0.0, stats.settle_ticks_max, stats.step_max);
+        if (!limits.slew){
+            if (stats.settle_ticks_max){
+                fprintf(stderr, "unlimited pwm%d reached a setpoint %u ticks late\n", i + 1, stats.settle_ticks_max);
+                failed = 1;
+            }
+            continue;
+        }
+        step_limit = (uint32_t)(((uint64_t) limits.slew * CONTROL_LOOP_PERIOD_US + 999999) / 1000000) + 1;
+        if (stats.step_max > step_limit){
+            fprintf(stderr, "pwm%d stepped %u counts in a tick, its slew allows %u\n", i + 1, stats.step_max, step_limit);
+            failed = 1;
+        }
+    }
+    if (failed) exit(EXIT_FAILURE);
+}
+
+/*
+ * prints the timing of the outputs and checks that the duty register of
+ * each one holds its value: the pulse width or duty the LEDC timer it
+ * runs on produces from the register must be within one unit, a DShot
+ * output must send the frame of its throttle
+ */
+static void pwm_check(void){
+    motor_pwm_info_t info;
+    uint32_t timer, freq, bits, full_scale, value;
+    uint64_t produced;
+    int failed = 0;
+    int i;
+
+    for (i = 0; i < MOTOR_PWM_COUNT; i++){
+        motor_pwm_get_info((motor_pwm_output_t) i, &info);
+        value = motor_pwm_get_value((motor_pwm_output_t) i);
+        if (motor_pwm_mode_is_dshot(info.mode)){
+            uint16_t frame = 0;
+            int bit;
+            fprintf(stderr, "pwm%d:               %s on RMT channel %u\n", i + 1, info.name, info.channel);
+            for (bit = 0; bit < DSHOT_BITS; bit++){
+                const rmt_item32_t *item = &rmt_mock_mem[info.channel][bit];
+                frame = (uint16_t)((frame << 1) | (item->duration0 > item->duration1));
+            }
+            if ((frame >> 5) != (value ? value + DSHOT_THROTTLE_MIN - 1 : 0)){
+                fprintf(stderr, "pwm%d sends frame %04x for throttle %u\n", i + 1, frame, value);
+                failed = 1;
+            }
+            continue;
+        }
+        timer      = ledc_mock_channel_timer[info.channel];
+        freq       = ledc_mock_timer_freq[timer];
+        bits       = ledc_mock_timer_bits[timer];
+        full_scale = info.mode == MOTOR_PWM_MODE_DUTY ? MOTOR_PWM_DUTY_FULL : 1000000 / info.freq_hz;
+        fprintf(stderr, "pwm%d:               %s on timer %u, %u Hz, %u bit, %llu counts over %u..%u %s, group %u, phase %u %s\n",
+                i + 1, info.name, timer, freq, bits,
+                (unsigned long long)(((uint64_t)(info.max - info.min) << bits) / full_scale), info.min, info.max, info.unit,
+                info.group, info.phase, info.unit);
+        if (!freq || freq != info.freq_hz || bits != info.bits){
+            fprintf(stderr, "pwm%d runs on an LEDC timer that was not configured for its mode\n", i + 1);
+            failed = 1;
+            continue;
+        }
+        if (ledc_mock_hpoint[info.channel] + (((uint64_t) info.max << bits) + full_scale - 1) / full_scale > (1ull << bits)
+                || (((uint64_t) ledc_mock_hpoint[info.channel] * full_scale) + (1u << (bits - 1))) >> bits != info.phase){
+            fprintf(stderr, "pwm%d starts its pulse at hpoint %u for phase %u %s\n", i + 1, ledc_mock_hpoint[info.channel],
+                    info.phase, info.unit);
+            failed = 1;
+        }
+        produced = (((uint64_t) ledc_mock_duty[info.channel] * full_scale) + (1u << (bits - 1))) >> bits;
+        if (produced + 1 < value || produced > value + 1){
+            fprintf(stderr, "pwm%d produces %llu %s for %u %s\n", i + 1, (unsigned long long) produced, info.unit,
+                    value, info.unit);
+            failed = 1;
+        }
+    }
+    if (pwm_group_splits || pwm_order_errors){
+        fprintf(stderr, "%u group latches split over two timer periods, %u duties written after their group latched\n",
+                pwm_group_splits, pwm_order_errors);
+        failed = 1;
+    }
+    if (failed) exit(EXIT_FAILURE);
+}
+
+/*
+ * drops the link of a controller the way a controller switched off does:
+ * the interrupt channel closes first, the firmware disconnects control
+ * then checks the outputs went to rest and lets the reconnect timer page it again
+ */
+static void link_drop(hid_controller_t *controller){
+    unsigned int slot = controller - hid_controllers;
+    uint16_t interrupt_cid = controller->l2cap_hid_interrupt_cid;
+    hid_gamepad_state_t rest;
+    uint32_t value;
+    int output;
+
+    link_drops++;
+    // a controller that reconnects starts over at its own rate
+    controller_idle_ms[slot] = -1;
+    controller_sent[slot].len = 0;
+    btstack_stub_disconnected_cid = 0;
+    l2cap_deliver_channel_closed(interrupt_cid);
+    if (btstack_stub_disconnected_cid){
+        l2cap_deliver_channel_closed(btstack_stub_disconnected_cid);
+    }
+    control_period();
+    // every output the controller's routes drive sits at the value of the failsafe state
+    memset(&rest, 0, sizeof(rest));
+    rest.value[HID_FIELD_LEFT_X] = rest.value[HID_FIELD_LEFT_Y] = HID_DECODER_JOYSTICK_CENTER;
+    rest.value[HID_FIELD_RIGHT_X] = rest.value[HID_FIELD_RIGHT_Y] = HID_DECODER_JOYSTICK_CENTER;
+    for (output = 0; output < MOTOR_PWM_COUNT; output++){
+        if (input_route_value(slot, (motor_pwm_output_t) output, &rest, &value)
+                && motor_pwm_get_value((motor_pwm_output_t) output) != value){
+            failsafe_misses++;
+            break;
+        }
+    }
+    if (controller->l2cap_hid_control_cid || !controller->reconnect_timer.process){
+        fprintf(stderr, "firmware did not close the session of a dropped controller\n");
+        exit(EXIT_FAILURE);
+    }
+    (*controller->reconnect_timer.process)(&controller->reconnect_timer);
+    l2cap_deliver_channel_opened(controller->l2cap_hid_control_cid);
+    l2cap_deliver_channel_opened(controller->l2cap_hid_interrupt_cid);
+    if (!controller->l2cap_hid_interrupt_cid){
+        fprintf(stderr, "firmware did not reconnect a dropped controller\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * decodes the frames the firmware wrote to the UART: every one has to
+ * decode, the sequence numbers follow each other, and the snapshot of one
+ * more period holds its dispatched inputs and committed outputs
+ */
+static void telemetry_check(unsigned long periods){
+    telemetry_stats_t stats;
+    telemetry_snapshot_t snapshot;
+    unsigned long start = 0, pos, frames = 0, bad = 0, gaps = 0;
+    uint16_t sequence = 0;
+    uint32_t submitted;
+    unsigned int slot;
+    int i, failed = 0;
+
+    // one more period with a snapshot, it is compared with the state right after
+    telemetry_get_stats(&stats);
+    submitted = stats.snapshots;
+    while (stats.snapshots == submitted){
+        control_period();
+        telemetry_get_stats(&stats);
+    }
+    telemetry_drain();
+    telemetry_get_stats(&stats);
+    if (uart_mock_tx_bytes > UART_MOCK_TX_SIZE){
+        fprintf(stderr, "telemetry:          %lu UART bytes, only the first %d decoded\n", uart_mock_tx_bytes, UART_MOCK_TX_SIZE);
+    }
+    for (pos = 0; pos < uart_mock_tx_bytes && pos < UART_MOCK_TX_SIZE; pos++){
+        if (uart_mock_tx[pos]) continue;
+        if (!telemetry_decode(&uart_mock_tx[start], pos - start, &snapshot)){
+            bad++;
+        } else {
+            if (frames && snapshot.sequence != (uint16_t)(sequence + 1)) gaps++;
+            sequence = snapshot.sequence;
+            frames++;
+        }
+        start = pos + 1;
+    }
+    fprintf(stderr, "telemetry:          %lu frames at %s Hz, %.1f bytes/frame, %.0f bytes/s (%.1f%% of %d baud), %u dropped\n",
+            frames, telemetry_rate, frames ? (double) stats.bytes / frames : 0.0,
+            (double) stats.bytes * 1000000.0 / ((double) periods * CONTROL_LOOP_PERIOD_US),
+            (double) stats.bytes * UART_BITS_PER_BYTE * 100.0 * 1000000.0 / ((double) periods * CONTROL_LOOP_PERIOD_US) / UART_BAUDRATE,
+            UART_BAUDRATE, stats.dropped);
+    if (!frames || bad || gaps || stats.dropped || frames != stats.frames){
+        fprintf(stderr, "telemetry: %lu frames of %u decoded, %lu malformed, %lu sequence gaps\n", frames, stats.frames, bad, gaps);
+        exit(EXIT_FAILURE);
+    }
+    for (slot = 0; slot < snapshot.num_controllers; slot++){
+        const hid_gamepad_state_t *state = &dispatched_states[slot];
+        for (i = 0; i < TELEMETRY_AXES; i++){
+            if (snapshot.controllers[slot].axes[i] != state->value[HID_FIELD_LEFT_X + i]) failed = 1;
+        }
+        if (snapshot.controllers[slot].buttons != state->value[HID_FIELD_BUTTONS]) failed = 1;
+        if (!(snapshot.controllers[slot].flags & TELEMETRY_LINKED)) failed = 1;
+    }
+    for (i = 0; i < snapshot.num_outputs; i++){
+        if (snapshot.outputs[i] != motor_pwm_get_value((motor_pwm_output_t) i)) failed = 1;
+    }
+    if (snapshot.num_controllers != num_controllers || snapshot.num_outputs != MOTOR_PWM_COUNT || failed){
+        fprintf(stderr, "telemetry: the last snapshot does not hold the state of its period\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void uart_save(const char *path){
+    FILE *file = fopen(path, "wb");
+    unsigned long size = uart_mock_tx_bytes < UART_MOCK_TX_SIZE ? uart_mock_tx_bytes : UART_MOCK_TX_SIZE;
+    if (!file || fwrite(uart_mock_tx, 1, size, file) != size){
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(file);
+}
+
+/*
+ * plays the controller's side of the idle rate
+ * @return 1 if the controller sends the report, 0 if it holds it back
+ */
+static int controller_sends(unsigned int slot, const replay_report_t *report){
+    uint32_t now = controller_clock_ms[slot];
+    int unchanged = report->len == controller_sent[slot].len
+                    && !memcmp(report->data, controller_sent[slot].data, report->len);
+
+    controller_clock_ms[slot] += REPORT_PERIOD_MS;
+    if (unchanged){
+        idle_reports++;
+        if (controller_idle_ms[slot] == 0) return 0;
+        if (controller_idle_ms[slot] > 0 && now - controller_sent_ms[slot] < (uint32_t) controller_idle_ms[slot]) return 0;
+        idle_reports_sent++;
+    }
+    controller_sent[slot]    = *report;
+    controller_sent_ms[slot] = now;
+    return 1;
+}
+
+/* @return number of reports the controllers sent, their latencies are stored */
+static unsigned long replay_pass(uint64_t *latencies){
+    uint8_t buffer[MAX_REPORT_SIZE];
+    unsigned long sent = 0;
+    unsigned int i;
+    for (i = 0; i < report_count; i++){
+        hid_controller_t *controller;
+        uint64_t start;
+        memcpy(buffer, reports[i].data, reports[i].len);
+        controller = reports_captured ? &hid_controllers[reports[i].slot % num_controllers]
+                                      : &hid_controllers[i % active_controllers];
+        if (controller_sends(controller - hid_controllers, &reports[i])){
+            start = now_ns();
+            packet_handler(L2CAP_DATA_PACKET, controller->l2cap_hid_interrupt_cid, buffer, reports[i].len);
+            if (latencies){
+                latencies[sent] = now_ns() - start;
+            }
+            sent++;
+        }
+        if ((i + 1) % reports_per_period == 0){
+            unsigned int period;
+            for (period = 0; period < periods_per_report; period++){
+                control_ns += control_period();
+            }
+        }
+        if (drop_interval && (i + 1) % drop_interval == 0){
+            link_drop(controller);
+        }
+        if ((i + 1) % HAPTICS_REPORTS == 0){
+            haptics_period();
+        }
+        log_drain();
+        report_capture_drain();
+        telemetry_drain();
+    }
+    return sent;
+}
+
+int main(int argc, char *argv[]){
+    const char *input_path  = NULL;
+    const char *output_path = NULL;
+    const char *capture_input_path  = NULL;
+    const char *capture_output_path = NULL;
+    const char *uart_path = NULL;
+    unsigned long periods_start;
+    unsigned int passes = DEFAULT_PASSES;
+    unsigned long total_reports, source_reports;
+    unsigned long allocations_start, ledc_calls_start, ledc_writes_start, console_bytes_start, log_records_start;
+    uint32_t log_dropped_start;
+    control_loop_stats_t control_stats;
+    input_route_stats_t route_start, route_stats;
+    uint32_t controller_reports_start[MAX_CONTROLLERS];
+    haptics_stats_t haptics_stats, haptics_total;
+    hid_control_stats_t control_stats_1;
+    uint64_t *latencies;
+    uint64_t total_ns = 0;
+    uint64_t timer_overhead;
+    unsigned int pass;
+    unsigned long i;
+    int print_latency = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:p:w:C:n:r:t:c:kDd:R:P:T:U:I:lv")) != -1){
+        switch (opt){
+            case 'f':
+                input_path = optarg;
+                break;
+            case 'p':
+                capture_input_path = optarg;
+                break;
+            case 'w':
+                output_path = optarg;
+                break;
+            case 'C':
+                capture_output_path = optarg;
+                break;
+            case 'n':
+                passes = (unsigned int) strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                reports_per_period = (unsigned int) strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                periods_per_report = (unsigned int) strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                active_controllers = (unsigned int) strtoul(optarg, NULL, 0);
+                break;
+            case 'k':
+                start_cached = 1;
+                break;
+            case 'D':
+                discover_controllers = 1;
+                break;
+            case 'd':
+                drop_interval = (unsigned int) strtoul(optarg, NULL, 0);
+                break;
+            case 'R':
+                if (route_command_count < MAX_ROUTE_COMMANDS){
+                    route_commands[route_command_count++] = optarg;
+                }
+                break;
+            case 'P':
+                if (pwm_command_count < MAX_PWM_COMMANDS){
+                    pwm_commands[pwm_command_count++] = optarg;
+                }
+                break;
+            case 'T':
+                telemetry_rate = optarg;
+                break;
+            case 'U':
+                uart_path = optarg;
+                break;
+            case 'I':
+                idle_setting = optarg;
+                break;
+            case 'l':
+                print_latency = 1;
+                break;
+            case 'v':
+                console_verbose = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-f reports.txt] [-p capture.bin] [-w reports.txt] [-C capture.bin] [-n passes] [-r reports] [-t periods] [-c controllers] [-k] [-D] [-d reports] [-R route] [-P pwm] [-T Hz] [-U uart.bin] [-I ms] [-l] [-v]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (!passes) passes = 1;
+    if (!reports_per_period) reports_per_period = 1;
+    if (!periods_per_report) periods_per_report = 1;
+
+    if (input_path){
+        reports_load(input_path);
+    } else if (capture_input_path){
+        reports_load_capture(capture_input_path);
+    } else {
+        reports_generate();
+    }
+    if (!report_count){
+        fprintf(stderr, "no reports to replay\n");
+        return EXIT_FAILURE;
+    }
+    if (output_path){
+        reports_save(output_path);
+    }
+
+    console_init();
+    if (start_cached){
+        cache_controllers();
+    }
+    connect_controllers();
+    if (!active_controllers || active_controllers > num_controllers) active_controllers = num_controllers;
+    if (capture_output_path){
+        console_command("capture on", 0);
+    }
+    for (i = 0; i < route_command_count; i++){
+        char line[128];
+        // the control task takes each table before the next one compiles, the first at boot
+        control_period();
+        snprintf(line, sizeof(line), "route %s", route_commands[i]);
+        console_command(line, console_verbose);
+    }
+    for (i = 0; i < pwm_command_count; i++){
+        char line[128];
+        snprintf(line, sizeof(line), "pwm %s", pwm_commands[i]);
+        console_command(line, console_verbose);
+    }
+    if (telemetry_rate){
+        char line[128];
+        snprintf(line, sizeof(line), "telemetry %s", telemetry_rate);
+        console_command(line, console_verbose);
+    }
+    if (idle_setting){
+        char line[128];
+        snprintf(line, sizeof(line), "hidctl idle %s", idle_setting);
+        console_command(line, console_verbose);
+        haptics_period();
+    }
+    periods_start = control_periods_run;
+
+    // warm up caches and the firmware's shadow state
+    replay_pass(NULL);
+
+    source_reports = (unsigned long) report_count * passes;
+    latencies = malloc(source_reports * sizeof(uint64_t));
+    if (!latencies){
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    console_command("latency reset", 0);
+    motion_stage_reset_stats();
+    allocations_start   = allocations;
+    ledc_calls_start    = ledc_mock_calls;
+    ledc_writes_start   = ledc_mock_writes;
+    console_bytes_start = console_bytes;
+    log_records_start   = log_records;
+    log_dropped_start   = log_ring_dropped();
+    control_ns          = 0;
+    for (i = 0; i < num_controllers; i++){
+        controller_reports_start[i] = hid_controllers[i].reports;
+    }
+    control_loop_reset_stats();
+    input_route_get_stats(&route_start);
+    pwm_shared_latches = pwm_split_latches = pwm_group_splits = pwm_order_errors = 0;
+    idle_reports = idle_reports_sent = 0;
+    total_reports = 0;
+    for (pass = 0; pass < passes; pass++){
+        total_reports += replay_pass(&latencies[total_reports]);
+    }
+    allocations     -= allocations_start;
+    ledc_mock_calls -= ledc_calls_start;
+    ledc_mock_writes -= ledc_writes_start;
+    console_bytes -= console_bytes_start;
+    log_records   -= log_records_start;
+    control_loop_get_stats(&control_stats);
+    input_route_get_stats(&route_stats);
+
+    timer_overhead = now_ns();
+    timer_overhead = now_ns() - timer_overhead;
+
+    for (i = 0; i < total_reports; i++){
+        total_ns += latencies[i];
+    }
+    qsort(latencies, total_reports, sizeof(uint64_t), compare_u64);
+
+    fprintf(stderr, "reports:            %u x %u passes, %lu sent\n", report_count, passes, total_reports);
+    fprintf(stderr, "ns/report:          %.1f\n", (double) total_ns / total_reports);
+    fprintf(stderr, "latency p50:        %llu ns\n", (unsigned long long) latencies[total_reports / 2]);
+    fprintf(stderr, "latency p99:        %llu ns\n", (unsigned long long) latencies[(total_reports * 99) / 100]);
+    fprintf(stderr, "latency max:        %llu ns\n", (unsigned long long) latencies[total_reports - 1]);
+    fprintf(stderr, "timer overhead:     %llu ns\n", (unsigned long long) timer_overhead);
+    fprintf(stderr, "control periods:    %u (%u per %u reports), %.1f ns/period\n",
+            control_stats.periods, periods_per_report, reports_per_period, (double) control_ns / control_stats.periods);
+    fprintf(stderr, "control updates:    %u (%u states coalesced)\n",
+            control_stats.updates, control_stats.coalesced);
+    fprintf(stderr, "routes/report:      %.3f run (%.3f mixes), %.3f skipped in %.3f changed fields\n",
+            (double)(route_stats.routes - route_start.routes) / total_reports,
+            (double)(route_stats.mixes - route_start.mixes) / total_reports,
+            (double)(route_stats.skipped - route_start.skipped) / total_reports,
+            (double)(route_stats.dispatches - route_start.dispatches) / total_reports);
+    for (i = 0; i < num_controllers; i++){
+        uint32_t controller_reports = hid_controllers[i].reports - controller_reports_start[i];
+        fprintf(stderr, "controller %lu:       %u reports (%.1f%%)\n", i + 1, controller_reports,
+                100.0 * controller_reports / total_reports);
+    }
+    hid_control_get_stats(0, &control_stats_1);
+    fprintf(stderr, "controller rate:    %.1f reports/s, %.1f/s while idle (%lu of %lu unchanged reports sent), idle %s",
+            (double) total_reports * 1000.0 / ((double) source_reports * REPORT_PERIOD_MS),
+            idle_reports ? (double) idle_reports_sent * 1000.0 / ((double) idle_reports * REPORT_PERIOD_MS) : 0.0,
+            idle_reports_sent, idle_reports,
+            control_stats_1.idle == HID_CONTROL_SUCCESSFUL ? "rate" : "unsupported, streaming");
+    if (control_stats_1.idle == HID_CONTROL_SUCCESSFUL){
+        fprintf(stderr, " %u ms", control_stats_1.idle_ms);
+    }
+    fprintf(stderr, "\n");
+    if (drop_interval){
+        fprintf(stderr, "link drops:         %u (%u failsafe misses)\n", link_drops, failsafe_misses);
+    }
+    fprintf(stderr, "allocations/report: %.3f\n", (double) allocations / total_reports);
+    fprintf(stderr, "ledc calls/report:  %.3f (%.3f register writes)\n",
+            (double) ledc_mock_calls / total_reports, (double) ledc_mock_writes / total_reports);
+    fprintf(stderr, "pwm latches:        %u periods latched several outputs of a timer, %u split over two timer periods (%u in a group)\n",
+            pwm_shared_latches, pwm_split_latches, pwm_group_splits);
+    fprintf(stderr, "console bytes/report: %.1f (%.1f us at %d baud)\n",
+            (double) console_bytes / total_reports,
+            (double) console_bytes * UART_BITS_PER_BYTE * 1000000.0 / UART_BAUDRATE / total_reports,
+            UART_BAUDRATE);
+    fprintf(stderr, "log records/report: %.3f (%u dropped)\n",
+            (double) log_records / total_reports, log_ring_dropped() - log_dropped_start);
+
+    memset(&haptics_total, 0, sizeof(haptics_total));
+    for (i = 0; i < num_controllers; i++){
+        haptics_get_stats(i, &haptics_stats);
+        haptics_total.requests  += haptics_stats.requests;
+        haptics_total.reports   += haptics_stats.reports;
+        haptics_total.refreshes += haptics_stats.refreshes;
+    }
+    fprintf(stderr, "haptic reports:     %u sent (%u refreshes) for %u effect changes in %u periods\n",
+            haptics_total.reports, haptics_total.refreshes, haptics_total.requests, haptics_periods);
+
+    motion_check();
+    pwm_check();
+    if (telemetry_rate){
+        telemetry_check(control_periods_run - periods_start);
+    }
+    if (uart_path){
+        uart_save(uart_path);
+    }
+
+    if (capture_output_path){
+        capture_save(capture_output_path);
+    }
+
+    if (print_latency){
+        console_command("latency", 1);
+    }
+
+    free(latencies);
+    return EXIT_SUCCESS;
+}
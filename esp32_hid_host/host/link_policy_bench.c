@@ -0,0 +1,234 @@
+/*
+ * Link policy bench
+ *
+ * Plays the Bluetooth controller for the firmware's link policy: a script
+ * says which HCI commands the firmware must send, in which order and with
+ * which parameters, and which events the controller answers with. The
+ * host stub hands out one HCI command credit at a time, as a controller
+ * after reset does, so a command sent before the previous one completed
+ * fails the script.
+ *
+ * Usage: link_policy_bench [-v] script.txt...
+ *
+ *  -v  print the firmware's log records
+ *
+ * Script lines, '#' starts a comment:
+ *
+ *  attach <slot> <handle> <address>        HID channels of a controller opened
+ *  detach <slot>                           HID channels closed
+ *  expect <opcode> [parameter bytes]       next command the firmware sent, hex
+ *  none                                    the firmware sent no other command
+ *  event <code> [parameter bytes]          HCI event to deliver, hex, the length is added
+ *  reports <slot> <count> <interval> [jitter]
+ *                                          report arrivals, interval +/- jitter us alternating
+ *  tick                                    one second of the link quality timer
+ *  check <slot> <field> <min> [max]        link statistic within [min, max]
+ */
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "btstack_stub.h"
+
+// firmware under test, included to reach its timer
+#include "link_policy.c"
+
+#define SCRIPT_LINE_SIZE    256
+#define SCRIPT_PACKET_SIZE  64
+
+static int verbose;
+
+static void log_drain(void){
+    log_record_t record;
+    while (log_ring_read(&record)){
+        if (verbose){
+            log_ring_print(&record);
+        }
+    }
+}
+
+/* parses hex bytes, @return their number or -1 */
+static int parse_hex_bytes(char *pos, uint8_t *buffer, int buffer_size){
+    int count = 0;
+    char *end;
+    for (;;){
+        unsigned long byte = strtoul(pos, &end, 16);
+        if (end == pos) return count;
+        if (byte > 0xff || count == buffer_size) return -1;
+        buffer[count++] = (uint8_t) byte;
+        pos = end;
+    }
+}
+
+static int stat_field(const link_policy_stats_t *stats, int attached, const char *field, long *value){
+    static const struct {
+        const char *name;
+        size_t      offset;
+        size_t      size;
+    } fields[] = {
+#define STAT_FIELD(name) { #name, offsetof(link_policy_stats_t, name), sizeof(((link_policy_stats_t *) 0)->name) }
+        STAT_FIELD(central), STAT_FIELD(mode), STAT_FIELD(applied), STAT_FIELD(rssi),
+        STAT_FIELD(poll_latency_us), STAT_FIELD(failed_contacts), STAT_FIELD(flushes),
+        STAT_FIELD(sniff_exits), STAT_FIELD(command_failures), STAT_FIELD(reports),
+        STAT_FIELD(interval_us), STAT_FIELD(jitter_us), STAT_FIELD(late_reports),
+#undef STAT_FIELD
+    };
+    const uint8_t *base = (const uint8_t *) stats;
+    unsigned int i;
+
+    if (strcmp(field, "attached") == 0){
+        *value = attached;
+        return 1;
+    }
+    for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++){
+        if (strcmp(fields[i].name, field)) continue;
+        if (strcmp(field, "rssi") == 0){
+            *value = *(const int8_t *)(base + fields[i].offset);
+        } else if (fields[i].size == 1){
+            *value = *(const uint8_t *)(base + fields[i].offset);
+        } else {
+            *value = *(const uint32_t *)(base + fields[i].offset);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* runs one script line, @return an error message or NULL */
+static const char *script_step(char *line){
+    uint8_t  packet[SCRIPT_PACKET_SIZE];
+    uint8_t  sent[SCRIPT_PACKET_SIZE];
+    uint16_t sent_size;
+    char     command[16];
+    char     field[32];
+    char     address[32];
+    unsigned int slot, handle, count, opcode;
+    long     interval, jitter, min, max, value;
+    int      consumed, len, i;
+    link_policy_stats_t stats;
+    bd_addr_t addr;
+
+    if (sscanf(line, "%15s%n", command, &consumed) != 1) return NULL;
+    line += consumed;
+
+    if (strcmp(command, "attach") == 0){
+        if (sscanf(line, "%u %x %31s", &slot, &handle, address) != 3 || !sscanf_bd_addr(address, addr)) return "attach <slot> <handle> <address>";
+        link_policy_attach(slot, (hci_con_handle_t) handle, addr);
+    } else if (strcmp(command, "detach") == 0){
+        if (sscanf(line, "%u", &slot) != 1) return "detach <slot>";
+        link_policy_detach(slot);
+    } else if (strcmp(command, "expect") == 0){
+        if (sscanf(line, "%x%n", &opcode, &consumed) != 1) return "expect <opcode> [parameters]";
+        little_endian_store_16(packet, 0, (uint16_t) opcode);
+        len = parse_hex_bytes(line + consumed, &packet[3], sizeof(packet) - 3);
+        if (len < 0) return "bad parameter bytes";
+        packet[2] = (uint8_t) len;
+        sent_size = btstack_stub_hci_command_take(sent, sizeof(sent));
+        if (!sent_size) return "no command sent";
+        if (sent_size != len + 3 || memcmp(sent, packet, sent_size)){
+            fprintf(stderr, "sent:    ");
+            for (i = 0; i < sent_size; i++) fprintf(stderr, " %02x", sent[i]);
+            fprintf(stderr, "\nexpected:");
+            for (i = 0; i < len + 3; i++) fprintf(stderr, " %02x", packet[i]);
+            fprintf(stderr, "\n");
+            return "unexpected command";
+        }
+    } else if (strcmp(command, "none") == 0){
+        if (btstack_stub_hci_command_take(sent, sizeof(sent))) return "unexpected command sent";
+    } else if (strcmp(command, "event") == 0){
+        len = parse_hex_bytes(line, sent, sizeof(sent) - 1);
+        if (len < 1) return "event <code> [parameters]";
+        packet[0] = sent[0];
+        packet[1] = (uint8_t)(len - 1);
+        memcpy(&packet[2], &sent[1], (size_t)(len - 1));
+        btstack_stub_hci_event(packet, (uint16_t)(len + 1));
+    } else if (strcmp(command, "reports") == 0){
+        jitter = 0;
+        if (sscanf(line, "%u %u %ld %ld", &slot, &count, &interval, &jitter) < 3) return "reports <slot> <count> <interval> [jitter]";
+        for (i = 0; i < (int) count; i++){
+            link_policy_report(slot, (uint32_t)(interval + ((i & 1) ? jitter : -jitter)));
+        }
+    } else if (strcmp(command, "tick") == 0){
+        (*link_timer.process)(&link_timer);
+    } else if (strcmp(command, "check") == 0){
+        i = sscanf(line, "%u %31s %ld %ld", &slot, field, &min, &max);
+        if (i < 3) return "check <slot> <field> <min> [max]";
+        if (i == 3) max = min;
+        if (!stat_field(&stats, link_policy_get_stats(slot, &stats), field, &value)) return "unknown field";
+        if (value < min || value > max){
+            fprintf(stderr, "%s is %ld\n", field, value);
+            return "check failed";
+        }
+    } else {
+        return "unknown command";
+    }
+    return NULL;
+}
+
+/* runs a script from a clean link table, @return 1 if every line passed */
+static int script_run(const char *path){
+    char line[SCRIPT_LINE_SIZE];
+    uint8_t sent[SCRIPT_PACKET_SIZE];
+    unsigned int line_number = 0;
+    unsigned int slot;
+    const char *error;
+    FILE *file = fopen(path, "r");
+
+    if (!file){
+        perror(path);
+        return 0;
+    }
+    for (slot = 0; slot < LINK_POLICY_SLOTS; slot++){
+        link_policy_detach(slot);
+    }
+    while (btstack_stub_hci_command_take(sent, sizeof(sent)));
+    btstack_stub_hci_credits = 1;
+    link_ticks = 0;
+
+    while (fgets(line, sizeof(line), file)){
+        char *comment = strchr(line, '#');
+        line_number++;
+        if (comment) *comment = 0;
+        error = script_step(line);
+        log_drain();
+        if (error){
+            fprintf(stderr, "%s:%u: %s\n", path, line_number, error);
+            fclose(file);
+            return 0;
+        }
+    }
+    fclose(file);
+    fprintf(stderr, "%-40s ok\n", path);
+    return 1;
+}
+
+int main(int argc, char *argv[]){
+    int failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "v")) != -1){
+        switch (opt){
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-v] script.txt...\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind == argc){
+        fprintf(stderr, "usage: %s [-v] script.txt...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    log_ring_init();
+    link_policy_init();
+    for (; optind < argc; optind++){
+        failed += !script_run(argv[optind]);
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,509 @@
+/*
+ * SDP HID record parser bench and fuzzer
+ *
+ * Feeds recorded HID service records byte by byte, the way BTstack's SDP
+ * client delivers them, through the firmware's streaming parser and
+ * through the reassembly parser it replaced (300 byte attribute buffer,
+ * des_iterator walks once the attribute is complete, descriptor compiled
+ * afterwards), checks both find the same PSMs and descriptor and compares
+ * their CPU time and the memory they hold during discovery.
+ *
+ * Usage: sdp_parser_bench [-n passes] [-z iterations] [-v] record.txt...
+ *
+ *  -n  timed passes over every record (default 2000)
+ *  -z  fuzz: mutate the records this many times and feed the results to
+ *      the streaming parser, build with sanitizers (make fuzz)
+ *  -v  print the parser results per record
+ *
+ * Record files hold one attribute per line: the attribute ID, a colon and
+ * the attribute value as hex bytes, '#' starts a comment.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btstack.h"
+#include "hid_cache.h"
+#include "hid_decoder.h"
+#include "sdp_hid_parser.h"
+
+#define MAX_RECORDS         32
+#define MAX_ATTRIBUTES      64
+#define MAX_ATTRIBUTE_SIZE  2048
+#define DEFAULT_PASSES      2000
+#define MAX_CONTROLLERS     2       // as configured in the firmware
+#define LEGACY_VALUE_SIZE   300     // the former MAX_ATTRIBUTE_VALUE_SIZE
+
+typedef struct {
+    uint16_t id;
+    uint16_t len;
+    uint8_t  value[MAX_ATTRIBUTE_SIZE];
+} sdp_attribute_t;
+
+typedef struct {
+    const char     *name;
+    unsigned int    num_attributes;
+    sdp_attribute_t attributes[MAX_ATTRIBUTES];
+} sdp_record_t;
+
+// what a parser found in a record
+typedef struct {
+    uint16_t hid_control_psm;
+    uint16_t hid_interrupt_psm;
+    int      descriptor_found;
+    uint32_t descriptor_len;
+    uint32_t descriptor_hash;
+    int      num_fields;
+} sdp_result_t;
+
+static sdp_record_t records[MAX_RECORDS];
+static unsigned int record_count;
+
+// allocation counter, fed by the --wrap'ed allocator
+static unsigned long allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size){
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size){
+    allocations++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size){
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr){
+    __real_free(ptr);
+}
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static void record_load(const char *path){
+    char line[4 * MAX_ATTRIBUTE_SIZE];
+    sdp_record_t *record;
+    FILE *file;
+
+    if (record_count == MAX_RECORDS){
+        fprintf(stderr, "more than %d records\n", MAX_RECORDS);
+        exit(EXIT_FAILURE);
+    }
+    file = fopen(path, "r");
+    if (!file){
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    record = &records[record_count++];
+    record->name = path;
+    while (fgets(line, sizeof(line), file)){
+        sdp_attribute_t *attribute;
+        char *pos;
+        char *end;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = 0;
+        pos = strchr(line, ':');
+        if (!pos) continue;
+        if (record->num_attributes == MAX_ATTRIBUTES){
+            fprintf(stderr, "%s: more than %d attributes\n", path, MAX_ATTRIBUTES);
+            exit(EXIT_FAILURE);
+        }
+        attribute = &record->attributes[record->num_attributes++];
+        attribute->id  = (uint16_t) strtoul(line, NULL, 16);
+        attribute->len = 0;
+        pos++;
+        for (;;){
+            unsigned long byte = strtoul(pos, &end, 16);
+            if (end == pos) break;
+            if (attribute->len == MAX_ATTRIBUTE_SIZE){
+                fprintf(stderr, "%s: attribute longer than %d bytes\n", path, MAX_ATTRIBUTE_SIZE);
+                exit(EXIT_FAILURE);
+            }
+            attribute->value[attribute->len++] = (uint8_t) byte;
+            pos = end;
+        }
+    }
+    fclose(file);
+}
+
+typedef void (*sdp_byte_handler_t)(const uint8_t *event);
+
+// longest single event of the last delivery, measured when event_timing is set
+static int      event_timing;
+static uint64_t event_max_ns;
+
+/* delivers a record as SDP_EVENT_QUERY_ATTRIBUTE_BYTE events, one per byte like sdp_client */
+static void record_deliver(const sdp_record_t *record, sdp_byte_handler_t handler){
+    uint8_t event[11];
+    unsigned int i;
+    uint16_t offset;
+
+    event[0] = SDP_EVENT_QUERY_ATTRIBUTE_VALUE;
+    event[1] = sizeof(event) - 2;
+    little_endian_store_16(event, 2, 0);
+    for (i = 0; i < record->num_attributes; i++){
+        const sdp_attribute_t *attribute = &record->attributes[i];
+        little_endian_store_16(event, 4, attribute->id);
+        little_endian_store_16(event, 6, attribute->len);
+        for (offset = 0; offset < attribute->len; offset++){
+            little_endian_store_16(event, 8, offset);
+            event[10] = attribute->value[offset];
+            if (event_timing){
+                uint64_t start = now_ns();
+                (*handler)(event);
+                start = now_ns() - start;
+                if (start > event_max_ns) event_max_ns = start;
+                continue;
+            }
+            (*handler)(event);
+        }
+    }
+}
+
+static sdp_hid_parser_t *streaming_parser;
+
+/* the streaming parser's share of handle_sdp_client_query_result */
+static void __attribute__((noinline)) streaming_byte(const uint8_t *event){
+    sdp_hid_parser_byte(streaming_parser, sdp_event_query_attribute_byte_get_attribute_id(event),
+                        sdp_event_query_attribute_byte_get_data_offset(event),
+                        sdp_event_query_attribute_byte_get_data(event));
+}
+
+/* accounts SDP_EVENT_QUERY_COMPLETE, where the work left for the end of the query runs */
+static void event_complete(uint64_t start){
+    if (!event_timing) return;
+    start = now_ns() - start;
+    if (start > event_max_ns) event_max_ns = start;
+}
+
+static void parse_streaming(const sdp_record_t *record, sdp_hid_parser_t *parser, hid_decoder_t *decoder, sdp_result_t *result){
+    sdp_hid_parser_init(parser, decoder);
+    uint64_t start;
+
+    streaming_parser = parser;
+    record_deliver(record, &streaming_byte);
+    start = now_ns();
+    result->num_fields        = sdp_hid_parser_finish(parser);
+    event_complete(start);
+    result->hid_control_psm   = parser->hid_control_psm;
+    result->hid_interrupt_psm = parser->hid_interrupt_psm;
+    result->descriptor_found  = parser->hid_descriptor_found;
+    result->descriptor_len    = parser->hid_descriptor_found ? parser->hid_descriptor_len : 0;
+    result->descriptor_hash   = parser->hid_descriptor_found ? parser->hid_descriptor_hash : 0;
+}
+
+// state of the former parser: reassembly buffer and the descriptor copy of one controller
+static uint8_t  legacy_attribute_value[LEGACY_VALUE_SIZE];
+static uint8_t  legacy_descriptor[LEGACY_VALUE_SIZE];
+static uint16_t legacy_descriptor_len;
+
+/* the former per-attribute walk over the reassembled value */
+static void legacy_attribute(uint16_t attribute_id, sdp_result_t *result){
+    des_iterator_t attribute_list_it;
+    des_iterator_t additional_des_it;
+    des_iterator_t prot_it;
+    uint8_t       *des_element;
+    uint8_t       *element;
+
+    switch (attribute_id){
+        case BLUETOOTH_ATTRIBUTE_PROTOCOL_DESCRIPTOR_LIST:
+            for (des_iterator_init(&attribute_list_it, legacy_attribute_value); des_iterator_has_more(&attribute_list_it); des_iterator_next(&attribute_list_it)){
+                if (des_iterator_get_type(&attribute_list_it) != DE_DES) continue;
+                des_element = des_iterator_get_element(&attribute_list_it);
+                des_iterator_init(&prot_it, des_element);
+                element = des_iterator_get_element(&prot_it);
+                if (!element || de_get_element_type(element) != DE_UUID) continue;
+                if (de_get_uuid32(element) != BLUETOOTH_PROTOCOL_L2CAP) continue;
+                des_iterator_next(&prot_it);
+                if (!des_iterator_has_more(&prot_it)) continue;
+                de_element_get_uint16(des_iterator_get_element(&prot_it), &result->hid_control_psm);
+            }
+            break;
+        case BLUETOOTH_ATTRIBUTE_ADDITIONAL_PROTOCOL_DESCRIPTOR_LISTS:
+            for (des_iterator_init(&attribute_list_it, legacy_attribute_value); des_iterator_has_more(&attribute_list_it); des_iterator_next(&attribute_list_it)){
+                if (des_iterator_get_type(&attribute_list_it) != DE_DES) continue;
+                des_element = des_iterator_get_element(&attribute_list_it);
+                for (des_iterator_init(&additional_des_it, des_element); des_iterator_has_more(&additional_des_it); des_iterator_next(&additional_des_it)){
+                    if (des_iterator_get_type(&additional_des_it) != DE_DES) continue;
+                    des_element = des_iterator_get_element(&additional_des_it);
+                    des_iterator_init(&prot_it, des_element);
+                    element = des_iterator_get_element(&prot_it);
+                    if (!element || de_get_element_type(element) != DE_UUID) continue;
+                    if (de_get_uuid32(element) != BLUETOOTH_PROTOCOL_L2CAP) continue;
+                    des_iterator_next(&prot_it);
+                    if (!des_iterator_has_more(&prot_it)) continue;
+                    de_element_get_uint16(des_iterator_get_element(&prot_it), &result->hid_interrupt_psm);
+                }
+            }
+            break;
+        case BLUETOOTH_ATTRIBUTE_HID_DESCRIPTOR_LIST:
+            for (des_iterator_init(&attribute_list_it, legacy_attribute_value); des_iterator_has_more(&attribute_list_it); des_iterator_next(&attribute_list_it)){
+                if (des_iterator_get_type(&attribute_list_it) != DE_DES) continue;
+                des_element = des_iterator_get_element(&attribute_list_it);
+                for (des_iterator_init(&additional_des_it, des_element); des_iterator_has_more(&additional_des_it); des_iterator_next(&additional_des_it)){
+                    if (des_iterator_get_type(&additional_des_it) != DE_STRING) continue;
+                    element = des_iterator_get_element(&additional_des_it);
+                    legacy_descriptor_len = (uint16_t) de_get_data_size(element);
+                    memcpy(legacy_descriptor, de_get_string(element), legacy_descriptor_len);
+                    result->descriptor_found = 1;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static sdp_result_t *legacy_result;
+static int           legacy_dropped_descriptor;
+
+/* the former parser's share of handle_sdp_client_query_result */
+static void __attribute__((noinline)) legacy_byte(const uint8_t *event){
+    uint16_t length = sdp_event_query_attribute_byte_get_attribute_length(event);
+    uint16_t offset = sdp_event_query_attribute_byte_get_data_offset(event);
+
+    // the attribute is dropped, byte by byte, when it does not fit
+    if (length > LEGACY_VALUE_SIZE){
+        if (sdp_event_query_attribute_byte_get_attribute_id(event) == BLUETOOTH_ATTRIBUTE_HID_DESCRIPTOR_LIST){
+            legacy_dropped_descriptor = 1;
+        }
+        return;
+    }
+    legacy_attribute_value[offset] = sdp_event_query_attribute_byte_get_data(event);
+    if ((uint16_t)(offset + 1) == length){
+        legacy_attribute(sdp_event_query_attribute_byte_get_attribute_id(event), legacy_result);
+    }
+}
+
+/* the former parser, only safe on well-formed records */
+static void parse_legacy(const sdp_record_t *record, hid_decoder_t *decoder, sdp_result_t *result){
+    uint64_t start;
+
+    memset(result, 0, sizeof(*result));
+    legacy_result = result;
+    legacy_dropped_descriptor = 0;
+    record_deliver(record, &legacy_byte);
+    if (!result->descriptor_found) return;
+    start = now_ns();
+    result->descriptor_len  = legacy_descriptor_len;
+    result->descriptor_hash = hid_cache_hash(legacy_descriptor, legacy_descriptor_len);
+    result->num_fields      = hid_decoder_compile(decoder, legacy_descriptor, legacy_descriptor_len);
+    event_complete(start);
+}
+
+static void result_print(const char *parser, const sdp_result_t *result){
+    fprintf(stderr, "  %-10s control PSM 0x%04x, interrupt PSM 0x%04x, ", parser,
+            result->hid_control_psm, result->hid_interrupt_psm);
+    if (result->descriptor_found){
+        fprintf(stderr, "descriptor %u bytes hash 0x%08x, %d fields\n", result->descriptor_len,
+                result->descriptor_hash, result->num_fields);
+    } else {
+        fprintf(stderr, "no descriptor\n");
+    }
+}
+
+static uint32_t fuzz_random(void){
+    static uint32_t seed = 0x2545f491;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+/* applies a few random edits to a copy of a record */
+static void fuzz_mutate(sdp_record_t *record){
+    unsigned int mutations = 1 + fuzz_random() % 8;
+    unsigned int i;
+
+    for (i = 0; i < mutations; i++){
+        sdp_attribute_t *attribute = &record->attributes[fuzz_random() % record->num_attributes];
+        uint16_t pos = attribute->len ? (uint16_t)(fuzz_random() % attribute->len) : 0;
+        switch (fuzz_random() % 5){
+            case 0:
+                // bit flip, often in a header or length byte
+                if (attribute->len) attribute->value[pos] ^= (uint8_t)(1u << (fuzz_random() % 8));
+                break;
+            case 1:
+                // random byte
+                if (attribute->len) attribute->value[pos] = (uint8_t) fuzz_random();
+                break;
+            case 2:
+                // truncation
+                attribute->len = pos;
+                break;
+            case 3:
+                // inserted byte
+                if (attribute->len < MAX_ATTRIBUTE_SIZE){
+                    memmove(&attribute->value[pos + 1], &attribute->value[pos], attribute->len - pos);
+                    attribute->value[pos] = (uint8_t) fuzz_random();
+                    attribute->len++;
+                }
+                break;
+            default:
+                // removed byte
+                if (attribute->len){
+                    memmove(&attribute->value[pos], &attribute->value[pos + 1], attribute->len - pos - 1);
+                    attribute->len--;
+                }
+                break;
+        }
+    }
+}
+
+static void fuzz(unsigned long iterations){
+    static sdp_record_t mutated;
+    static hid_decoder_t decoder;
+    sdp_hid_parser_t parser;
+    sdp_result_t first, second;
+    unsigned long found = 0;
+    unsigned long malformed = 0;
+    unsigned long i;
+
+    for (i = 0; i < iterations; i++){
+        mutated = records[fuzz_random() % record_count];
+        fuzz_mutate(&mutated);
+        parse_streaming(&mutated, &parser, &decoder, &first);
+        malformed += parser.malformed_attributes;
+        // the parser holds no state across queries
+        parse_streaming(&mutated, &parser, &decoder, &second);
+        if (memcmp(&first, &second, sizeof(first)) != 0){
+            fprintf(stderr, "fuzz: iteration %lu parsed differently the second time\n", i);
+            exit(EXIT_FAILURE);
+        }
+        if (first.descriptor_found && first.descriptor_len > MAX_ATTRIBUTE_SIZE){
+            fprintf(stderr, "fuzz: iteration %lu found a descriptor longer than its attribute\n", i);
+            exit(EXIT_FAILURE);
+        }
+        found += first.descriptor_found;
+    }
+    fprintf(stderr, "fuzz:               %lu mutated records, %lu with a descriptor, %lu malformed attributes skipped\n",
+            iterations, found, malformed);
+}
+
+int main(int argc, char *argv[]){
+    static hid_decoder_t decoder;
+    unsigned int passes = DEFAULT_PASSES;
+    unsigned long fuzz_iterations = 0;
+    unsigned long allocations_start;
+    int verbose = 0;
+    int mismatches = 0;
+    unsigned int i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:z:v")) != -1){
+        switch (opt){
+            case 'n':
+                passes = (unsigned int) strtoul(optarg, NULL, 0);
+                break;
+            case 'z':
+                fuzz_iterations = strtoul(optarg, NULL, 0);
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n passes] [-z iterations] [-v] record.txt...\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind == argc){
+        fprintf(stderr, "no records\n");
+        return EXIT_FAILURE;
+    }
+    if (!passes) passes = 1;
+    for (i = (unsigned int) optind; i < (unsigned int) argc; i++){
+        record_load(argv[i]);
+    }
+
+    allocations_start = allocations;
+    for (i = 0; i < record_count; i++){
+        const sdp_record_t *record = &records[i];
+        sdp_hid_parser_t parser;
+        sdp_result_t streaming, legacy;
+        uint64_t streaming_ns = 0, legacy_ns = 0;
+        uint64_t streaming_event_ns = 0, legacy_event_ns = 0;
+        uint64_t start;
+        unsigned int pass;
+        unsigned long bytes = 0;
+        unsigned int j;
+
+        for (j = 0; j < record->num_attributes; j++){
+            bytes += record->attributes[j].len;
+        }
+        parse_streaming(record, &parser, &decoder, &streaming);
+        fprintf(stderr, "%s: %u attributes, %lu bytes\n", record->name, record->num_attributes, bytes);
+        if (parser.malformed_attributes){
+            // the former parser walks past the end of malformed values, it is not run on them
+            fprintf(stderr, "  %u malformed attributes skipped\n", parser.malformed_attributes);
+            if (verbose) result_print("streaming", &streaming);
+            continue;
+        }
+
+        for (pass = 0; pass < passes; pass++){
+            start = now_ns();
+            parse_streaming(record, &parser, &decoder, &streaming);
+            streaming_ns += now_ns() - start;
+            start = now_ns();
+            parse_legacy(record, &decoder, &legacy);
+            legacy_ns += now_ns() - start;
+        }
+        // separate passes, the per event clock reads would distort the totals
+        event_timing = 1;
+        for (pass = 0; pass < passes; pass++){
+            event_max_ns = 0;
+            parse_streaming(record, &parser, &decoder, &streaming);
+            streaming_event_ns += event_max_ns;
+            event_max_ns = 0;
+            parse_legacy(record, &decoder, &legacy);
+            legacy_event_ns += event_max_ns;
+        }
+        event_timing = 0;
+        fprintf(stderr, "  streaming: %8.1f ns/record, %.2f ns/byte, longest event %.1f ns\n",
+                (double) streaming_ns / passes, (double) streaming_ns / passes / bytes,
+                (double) streaming_event_ns / passes);
+        fprintf(stderr, "  legacy:    %8.1f ns/record, %.2f ns/byte, longest event %.1f ns\n",
+                (double) legacy_ns / passes, (double) legacy_ns / passes / bytes,
+                (double) legacy_event_ns / passes);
+        if (verbose){
+            result_print("streaming", &streaming);
+            result_print("legacy", &legacy);
+        }
+        if (legacy_dropped_descriptor){
+            fprintf(stderr, "  legacy dropped the descriptor list, longer than %d bytes\n", LEGACY_VALUE_SIZE);
+            legacy.descriptor_found = streaming.descriptor_found;
+            legacy.descriptor_len   = streaming.descriptor_len;
+            legacy.descriptor_hash  = streaming.descriptor_hash;
+            legacy.num_fields       = streaming.num_fields;
+        }
+        if (memcmp(&streaming, &legacy, sizeof(streaming)) != 0){
+            fprintf(stderr, "  MISMATCH between the parsers\n");
+            mismatches++;
+        }
+    }
+
+    // held from the first attribute byte to the end of the query
+    fprintf(stderr, "discovery state:    streaming %u bytes (parser), legacy %u bytes (%u reassembly + %u x %u descriptor copies)\n",
+            (unsigned int) sizeof(sdp_hid_parser_t), LEGACY_VALUE_SIZE * (1 + MAX_CONTROLLERS),
+            LEGACY_VALUE_SIZE, MAX_CONTROLLERS, LEGACY_VALUE_SIZE);
+    fprintf(stderr, "allocations:        %lu\n", allocations - allocations_start);
+
+    if (fuzz_iterations){
+        fuzz(fuzz_iterations);
+    }
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
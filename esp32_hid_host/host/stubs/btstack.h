@@ -0,0 +1,252 @@
+/*
+ * Host stand-in for the subset of BTstack used by esp32_hid_host.c
+ *
+ * Constants and event layouts follow BTstack so the firmware compiles
+ * unchanged; btstack_stub.c provides the implementations.
+ */
+#ifndef BTSTACK_H
+#define BTSTACK_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define UNUSED(x) (void)(x)
+
+typedef uint8_t bd_addr_t[6];
+typedef uint16_t hci_con_handle_t;
+
+#define HCI_CON_HANDLE_INVALID 0xffff
+
+// HCI commands, encoded from the format string like hci_cmd.c does
+typedef struct {
+    uint16_t    opcode;
+    const char *format;
+} hci_cmd_t;
+
+#define OPCODE(ogf, ocf) ((ocf) | ((ogf) << 10))
+#define OGF_LINK_CONTROL            0x01
+#define OGF_LINK_POLICY             0x02
+#define OGF_CONTROLLER_BASEBAND     0x03
+#define OGF_STATUS_PARAMETERS       0x05
+
+#define LM_LINK_POLICY_ENABLE_ROLE_SWITCH   0x01
+#define LM_LINK_POLICY_ENABLE_SNIFF_MODE    0x04
+
+extern const hci_cmd_t hci_write_link_policy_settings;
+extern const hci_cmd_t hci_exit_sniff_mode;
+extern const hci_cmd_t hci_switch_role_command;
+extern const hci_cmd_t hci_write_automatic_flush_timeout;
+extern const hci_cmd_t hci_read_rssi;
+extern const hci_cmd_t hci_inquiry;
+extern const hci_cmd_t hci_inquiry_cancel;
+extern const hci_cmd_t hci_write_inquiry_mode;
+
+#define HCI_INQUIRY_LAP 0x9E8B33L   // General/Unlimited Inquiry Access Code (GIAC)
+
+typedef void (*btstack_packet_handler_t) (uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+
+typedef struct btstack_linked_item {
+    struct btstack_linked_item *next;
+} btstack_linked_item_t;
+
+typedef struct {
+    btstack_linked_item_t    item;
+    btstack_packet_handler_t callback;
+} btstack_packet_callback_registration_t;
+
+typedef struct btstack_timer_source {
+    btstack_linked_item_t item;
+    uint32_t              timeout;  // run loop time in ms
+    void                  (*process)(struct btstack_timer_source *ts);
+    void                 *context;
+} btstack_timer_source_t;
+
+// packet types
+#define HCI_EVENT_PACKET        0x04
+#define L2CAP_DATA_PACKET       0x06
+
+// events
+#define HCI_EVENT_INQUIRY_COMPLETE              0x01
+#define HCI_EVENT_INQUIRY_RESULT                0x02
+#define HCI_EVENT_DISCONNECTION_COMPLETE        0x05
+#define HCI_EVENT_QOS_SETUP_COMPLETE            0x0D
+#define HCI_EVENT_COMMAND_COMPLETE              0x0E
+#define HCI_EVENT_COMMAND_STATUS                0x0F
+#define HCI_EVENT_FLUSH_OCCURRED                0x11
+#define HCI_EVENT_ROLE_CHANGE                   0x12
+#define HCI_EVENT_MODE_CHANGE                   0x14
+#define HCI_EVENT_PIN_CODE_REQUEST              0x16
+#define HCI_EVENT_INQUIRY_RESULT_WITH_RSSI      0x22
+#define HCI_EVENT_EXTENDED_INQUIRY_RESPONSE     0x2F
+#define HCI_EVENT_USER_CONFIRMATION_REQUEST     0x33
+#define BTSTACK_EVENT_STATE                     0x60
+#define L2CAP_EVENT_CHANNEL_OPENED              0x70
+#define L2CAP_EVENT_CHANNEL_CLOSED              0x71
+#define L2CAP_EVENT_INCOMING_CONNECTION         0x72
+#define L2CAP_EVENT_CAN_SEND_NOW                0x78
+#define SDP_EVENT_QUERY_COMPLETE                0x91
+#define SDP_EVENT_QUERY_ATTRIBUTE_BYTE          0x93
+#define SDP_EVENT_QUERY_ATTRIBUTE_VALUE         SDP_EVENT_QUERY_ATTRIBUTE_BYTE
+
+#define HCI_STATE_WORKING   2
+#define HCI_POWER_ON        1
+
+// L2CAP
+#define PSM_HID_CONTROL                             0x11
+#define PSM_HID_INTERRUPT                           0x13
+#define L2CAP_CONNECTION_RESPONSE_RESULT_REFUSED_PSM 0x02
+#define BTSTACK_MEMORY_ALLOC_FAILED                  0x56
+
+typedef enum {
+    LEVEL_0 = 0,
+    LEVEL_1,
+    LEVEL_2,
+    LEVEL_3,
+    LEVEL_4
+} gap_security_level_t;
+
+typedef struct {
+    void (*open)(void);
+} btstack_link_key_db_t;
+
+// SDP
+#define BLUETOOTH_ATTRIBUTE_PROTOCOL_DESCRIPTOR_LIST                0x0004
+#define BLUETOOTH_ATTRIBUTE_ADDITIONAL_PROTOCOL_DESCRIPTOR_LISTS    0x000D
+#define BLUETOOTH_ATTRIBUTE_HID_DESCRIPTOR_LIST                     0x0206
+#define BLUETOOTH_PROTOCOL_L2CAP                                    0x0100
+#define BLUETOOTH_PROTOCOL_HIDP                                     0x0011
+#define BLUETOOTH_SERVICE_CLASS_HUMAN_INTERFACE_DEVICE_SERVICE      0x1124
+
+typedef enum {
+    DE_NIL = 0,
+    DE_UINT,
+    DE_INT,
+    DE_UUID,
+    DE_STRING,
+    DE_BOOL,
+    DE_DES,
+    DE_DEA,
+    DE_URL
+} de_type_t;
+
+typedef enum {
+    DE_SIZE_8 = 0,
+    DE_SIZE_16,
+    DE_SIZE_32,
+    DE_SIZE_64,
+    DE_SIZE_128,
+    DE_SIZE_VAR_8,
+    DE_SIZE_VAR_16,
+    DE_SIZE_VAR_32
+} de_size_t;
+
+typedef struct {
+    uint8_t  *element;
+    uint16_t pos;
+    uint16_t length;
+} des_iterator_t;
+
+// util
+uint16_t little_endian_read_16(const uint8_t *buffer, int position);
+uint32_t little_endian_read_24(const uint8_t *buffer, int position);
+uint32_t little_endian_read_32(const uint8_t *buffer, int position);
+uint16_t big_endian_read_16(const uint8_t *buffer, int pos);
+uint32_t big_endian_read_24(const uint8_t *buffer, int pos);
+uint32_t big_endian_read_32(const uint8_t *buffer, int pos);
+void little_endian_store_16(uint8_t *buffer, uint16_t position, uint16_t value);
+void little_endian_store_32(uint8_t *buffer, uint16_t position, uint32_t value);
+void reverse_bd_addr(const bd_addr_t src, bd_addr_t dest);
+void big_endian_store_16(uint8_t *buffer, uint16_t pos, uint16_t value);
+int sscanf_bd_addr(const char *addr_string, bd_addr_t addr);
+void printf_hexdump(const void *data, int size);
+char * bd_addr_to_str(const bd_addr_t addr);
+
+// SDP data elements
+de_type_t de_get_element_type(const uint8_t *header);
+uint32_t de_get_len(const uint8_t *header);
+uint32_t de_get_data_size(const uint8_t *header);
+uint32_t de_get_uuid32(const uint8_t *element);
+uint8_t *de_get_string(const uint8_t *element);
+int de_element_get_uint16(const uint8_t *element, uint16_t *value);
+
+int des_iterator_init(des_iterator_t *it, uint8_t *element);
+int des_iterator_has_more(des_iterator_t *it);
+de_type_t des_iterator_get_type(des_iterator_t *it);
+uint8_t *des_iterator_get_element(des_iterator_t *it);
+void des_iterator_next(des_iterator_t *it);
+
+// events
+static inline uint8_t hci_event_packet_get_type(const uint8_t *event){
+    return event[0];
+}
+static inline uint8_t btstack_event_state_get_state(const uint8_t *event){
+    return event[2];
+}
+static inline void hci_event_pin_code_request_get_bd_addr(const uint8_t *event, bd_addr_t addr){
+    memcpy(addr, &event[2], 6);
+}
+static inline void hci_event_user_confirmation_request_get_bd_addr(const uint8_t *event, bd_addr_t addr){
+    memcpy(addr, &event[2], 6);
+}
+static inline uint8_t sdp_event_query_complete_get_status(const uint8_t *event){
+    return event[2];
+}
+static inline void l2cap_event_incoming_connection_get_address(const uint8_t *event, bd_addr_t addr){
+    memcpy(addr, &event[2], 6);
+}
+static inline uint16_t l2cap_event_incoming_connection_get_psm(const uint8_t *event){
+    return little_endian_read_16(event, 10);
+}
+static inline uint16_t l2cap_event_incoming_connection_get_local_cid(const uint8_t *event){
+    return little_endian_read_16(event, 12);
+}
+static inline hci_con_handle_t l2cap_event_channel_opened_get_handle(const uint8_t *event){
+    return little_endian_read_16(event, 9);
+}
+static inline uint16_t l2cap_event_channel_closed_get_local_cid(const uint8_t *event){
+    return little_endian_read_16(event, 2);
+}
+static inline uint16_t l2cap_event_can_send_now_get_local_cid(const uint8_t *event){
+    return little_endian_read_16(event, 2);
+}
+static inline uint16_t sdp_event_query_attribute_byte_get_attribute_id(const uint8_t *event){
+    return little_endian_read_16(event, 4);
+}
+static inline uint16_t sdp_event_query_attribute_byte_get_attribute_length(const uint8_t *event){
+    return little_endian_read_16(event, 6);
+}
+static inline uint16_t sdp_event_query_attribute_byte_get_data_offset(const uint8_t *event){
+    return little_endian_read_16(event, 8);
+}
+static inline uint8_t sdp_event_query_attribute_byte_get_data(const uint8_t *event){
+    return event[10];
+}
+
+// stack
+void l2cap_init(void);
+void hci_add_event_handler(btstack_packet_callback_registration_t *callback_handler);
+int hci_send_cmd(const hci_cmd_t *cmd, ...);
+int hci_can_send_command_packet_now(void);
+int hci_power_control(int power_mode);
+int gap_pin_code_response(const bd_addr_t addr, const char *pin);
+uint8_t l2cap_create_channel(btstack_packet_handler_t packet_handler, bd_addr_t address, uint16_t psm, uint16_t mtu, uint16_t *out_local_cid);
+uint8_t sdp_client_query_uuid16(btstack_packet_handler_t callback, bd_addr_t remote, uint16_t uuid16);
+int gap_ssp_confirmation_response(const bd_addr_t addr);
+void gap_connectable_control(uint8_t enable);
+void gap_discoverable_control(uint8_t enable);
+void hci_set_link_key_db(const btstack_link_key_db_t *link_key_db);
+uint8_t l2cap_register_service(btstack_packet_handler_t packet_handler, uint16_t psm, uint16_t mtu, gap_security_level_t security_level);
+void l2cap_accept_connection(uint16_t local_cid);
+void l2cap_decline_connection(uint16_t local_cid);
+void l2cap_disconnect(uint16_t local_cid, uint8_t reason);
+uint8_t l2cap_request_can_send_now_event(uint16_t local_cid);
+uint8_t l2cap_send(uint16_t local_cid, uint8_t *data, uint16_t len);
+
+// run loop, timers never fire on the host
+void btstack_run_loop_set_timer(btstack_timer_source_t *ts, uint32_t timeout_in_ms);
+void btstack_run_loop_set_timer_handler(btstack_timer_source_t *ts, void (*process)(btstack_timer_source_t *ts));
+void btstack_run_loop_add_timer(btstack_timer_source_t *ts);
+int btstack_run_loop_remove_timer(btstack_timer_source_t *ts);
+uint32_t btstack_run_loop_get_time_ms(void);
+
+#endif
@@ -0,0 +1,9 @@
+/*
+ * Host stand-in for the ESP32 port's btstack_config.h
+ */
+#ifndef BTSTACK_CONFIG_H
+#define BTSTACK_CONFIG_H
+
+#define ENABLE_CLASSIC
+
+#endif
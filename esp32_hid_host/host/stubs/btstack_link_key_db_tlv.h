@@ -0,0 +1,12 @@
+/*
+ * Host stand-in for BTstack's btstack_link_key_db_tlv.h
+ */
+#ifndef BTSTACK_LINK_KEY_DB_TLV_H
+#define BTSTACK_LINK_KEY_DB_TLV_H
+
+#include "btstack.h"
+#include "btstack_tlv.h"
+
+const btstack_link_key_db_t * btstack_link_key_db_tlv_get_instance(const btstack_tlv_t *tlv_impl, void *tlv_context);
+
+#endif
@@ -0,0 +1,18 @@
+/*
+ * Host stand-in for BTstack's btstack_tlv.h, backed by memory
+ */
+#ifndef BTSTACK_TLV_H
+#define BTSTACK_TLV_H
+
+#include <stdint.h>
+
+typedef struct {
+    int  (*get_tag)(void *context, uint32_t tag, uint8_t *buffer, uint32_t buffer_size);
+    int  (*store_tag)(void *context, uint32_t tag, const uint8_t *data, uint32_t data_size);
+    void (*delete_tag)(void *context, uint32_t tag);
+} btstack_tlv_t;
+
+void btstack_tlv_set_instance(const btstack_tlv_t *tlv_impl, void *tlv_context);
+void btstack_tlv_get_instance(const btstack_tlv_t **tlv_impl, void **tlv_context);
+
+#endif
@@ -0,0 +1,14 @@
+/*
+ * Host stand-in for the ESP-IDF v3.2 GPIO numbers
+ */
+#ifndef DRIVER_GPIO_H
+#define DRIVER_GPIO_H
+
+typedef enum {
+    GPIO_NUM_17 = 17,
+    GPIO_NUM_18 = 18,
+    GPIO_NUM_19 = 19,
+    GPIO_NUM_21 = 21,
+} gpio_num_t;
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * Host stand-in for the ESP-IDF v3.2 LEDC driver
+ *
+ * Every driver call is counted in ledc_mock_calls and the register writes
+ * the IDF driver performs for it are appended to ledc_mock_log, so the
+ * replay bench can report peripheral accesses per report and check their
+ * order.
+ *
+ * The timers run on a simulated clock, ledc_mock_time_ns, that every
+ * driver call and register read advances by what it takes on the ESP32
+ * and the bench advances between the control periods. ledc_update_duty()
+ * records the timer period the latched duty takes effect in, the one
+ * after the overflow following the call.
+ */
+#ifndef DRIVER_LEDC_H
+#define DRIVER_LEDC_H
+
+#include <stdint.h>
+#include "driver/gpio.h"
+#include "esp_err.h"
+
+#define LEDC_APB_CLK_HZ (80 * 1000000)
+
+typedef enum {
+    LEDC_HIGH_SPEED_MODE = 0,
+    LEDC_LOW_SPEED_MODE,
+    LEDC_SPEED_MODE_MAX,
+} ledc_mode_t;
+
+typedef enum {
+    LEDC_INTR_DISABLE = 0,
+    LEDC_INTR_FADE_END,
+} ledc_intr_type_t;
+
+typedef enum {
+    LEDC_TIMER_0 = 0,
+    LEDC_TIMER_1,
+    LEDC_TIMER_2,
+    LEDC_TIMER_3,
+    LEDC_TIMER_MAX,
+} ledc_timer_t;
+
+typedef enum {
+    LEDC_CHANNEL_0 = 0,
+    LEDC_CHANNEL_1,
+    LEDC_CHANNEL_2,
+    LEDC_CHANNEL_3,
+    LEDC_CHANNEL_4,
+    LEDC_CHANNEL_5,
+    LEDC_CHANNEL_6,
+    LEDC_CHANNEL_7,
+    LEDC_CHANNEL_MAX,
+} ledc_channel_t;
+
+typedef enum {
+    LEDC_TIMER_1_BIT = 1,
+    LEDC_TIMER_2_BIT,
+    LEDC_TIMER_3_BIT,
+    LEDC_TIMER_4_BIT,
+    LEDC_TIMER_5_BIT,
+    LEDC_TIMER_6_BIT,
+    LEDC_TIMER_7_BIT,
+    LEDC_TIMER_8_BIT,
+    LEDC_TIMER_9_BIT,
+    LEDC_TIMER_10_BIT,
+    LEDC_TIMER_11_BIT,
+    LEDC_TIMER_12_BIT,
+    LEDC_TIMER_13_BIT,
+    LEDC_TIMER_14_BIT,
+    LEDC_TIMER_15_BIT,
+    LEDC_TIMER_16_BIT,
+    LEDC_TIMER_17_BIT,
+    LEDC_TIMER_18_BIT,
+    LEDC_TIMER_19_BIT,
+    LEDC_TIMER_20_BIT,
+    LEDC_TIMER_BIT_MAX,
+} ledc_timer_bit_t;
+
+typedef struct {
+    int gpio_num;
+    ledc_mode_t speed_mode;
+    ledc_channel_t channel;
+    ledc_intr_type_t intr_type;
+    ledc_timer_t timer_sel;
+    uint32_t duty;
+    int hpoint;
+} ledc_channel_config_t;
+
+typedef struct {
+    ledc_mode_t speed_mode;
+    union {
+        ledc_timer_bit_t duty_resolution;
+        ledc_timer_bit_t bit_num;
+    };
+    ledc_timer_t timer_num;
+    uint32_t freq_hz;
+} ledc_timer_config_t;
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *ledc_conf);
+esp_err_t ledc_timer_config(const ledc_timer_config_t *timer_conf);
+esp_err_t ledc_set_duty(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t duty);
+esp_err_t ledc_set_duty_with_hpoint(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t duty, uint32_t hpoint);
+int ledc_get_hpoint(ledc_mode_t speed_mode, ledc_channel_t channel);
+esp_err_t ledc_update_duty(ledc_mode_t speed_mode, ledc_channel_t channel);
+uint32_t ledc_get_duty(ledc_mode_t speed_mode, ledc_channel_t channel);
+
+// registers written by the driver
+typedef enum {
+    LEDC_MOCK_GPIO_MATRIX = 0,  // output signal routing
+    LEDC_MOCK_TIMER_CONF,
+    LEDC_MOCK_CONF0,            // timer select, output enable
+    LEDC_MOCK_HPOINT,
+    LEDC_MOCK_DUTY,
+    LEDC_MOCK_CONF1,            // duty_start and fade parameters
+} ledc_mock_register_t;
+
+typedef struct {
+    uint8_t  reg;
+    uint8_t  channel;
+    uint32_t value;
+} ledc_mock_write_t;
+
+#define LEDC_MOCK_LOG_SIZE 256
+#define LEDC_MOCK_CALL_NS  1000  // a driver call, argument checks and spinlock included
+#define LEDC_MOCK_READ_NS  50    // a peripheral register read
+
+extern unsigned long     ledc_mock_calls;
+extern unsigned long     ledc_mock_writes;  // total, ledc_mock_log wraps
+extern ledc_mock_write_t ledc_mock_log[LEDC_MOCK_LOG_SIZE];
+extern uint32_t          ledc_mock_duty[LEDC_CHANNEL_MAX];
+extern uint32_t          ledc_mock_channel_timer[LEDC_CHANNEL_MAX];
+extern uint32_t          ledc_mock_timer_freq[LEDC_TIMER_MAX];   // 0 until configured
+extern uint32_t          ledc_mock_timer_bits[LEDC_TIMER_MAX];
+extern uint32_t          ledc_mock_hpoint[LEDC_CHANNEL_MAX];
+extern uint64_t          ledc_mock_time_ns;
+extern unsigned long     ledc_mock_latches[LEDC_CHANNEL_MAX];
+extern uint64_t          ledc_mock_latch_period[LEDC_CHANNEL_MAX];  // of the channel's timer, counted from 0 ns
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ * Host stand-in for the ESP-IDF v3.2 RMT driver, transmit side only
+ *
+ * rmt_fill_tx_items() copies the items into the channel's mock RAM block
+ * and rmt_tx_start() appends the channel to rmt_mock_starts, so a bench
+ * can decode what a channel sends and check that a batch starts together.
+ */
+#ifndef DRIVER_RMT_H
+#define DRIVER_RMT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "driver/gpio.h"
+#include "esp_err.h"
+
+#define RMT_MEM_ITEM_NUM 64 // items per memory block
+
+typedef enum {
+    RMT_CHANNEL_0 = 0,
+    RMT_CHANNEL_1,
+    RMT_CHANNEL_2,
+    RMT_CHANNEL_3,
+    RMT_CHANNEL_4,
+    RMT_CHANNEL_5,
+    RMT_CHANNEL_6,
+    RMT_CHANNEL_7,
+    RMT_CHANNEL_MAX,
+} rmt_channel_t;
+
+typedef enum {
+    RMT_MODE_TX = 0,
+    RMT_MODE_RX,
+    RMT_MODE_MAX,
+} rmt_mode_t;
+
+typedef enum {
+    RMT_IDLE_LEVEL_LOW = 0,
+    RMT_IDLE_LEVEL_HIGH,
+    RMT_IDLE_LEVEL_MAX,
+} rmt_idle_level_t;
+
+typedef enum {
+    RMT_CARRIER_LEVEL_LOW = 0,
+    RMT_CARRIER_LEVEL_HIGH,
+    RMT_CARRIER_LEVEL_MAX,
+} rmt_carrier_level_t;
+
+typedef struct {
+    union {
+        struct {
+            uint32_t duration0 :15;
+            uint32_t level0    :1;
+            uint32_t duration1 :15;
+            uint32_t level1    :1;
+        };
+        uint32_t val;
+    };
+} rmt_item32_t;
+
+typedef struct {
+    bool                loop_en;
+    uint32_t            carrier_freq_hz;
+    uint8_t             carrier_duty_percent;
+    rmt_carrier_level_t carrier_level;
+    bool                carrier_en;
+    rmt_idle_level_t    idle_level;
+    bool                idle_output_en;
+} rmt_tx_config_t;
+
+typedef struct {
+    bool     filter_en;
+    uint8_t  filter_ticks_thresh;
+    uint16_t idle_threshold;
+} rmt_rx_config_t;
+
+typedef struct {
+    rmt_mode_t    rmt_mode;
+    rmt_channel_t channel;
+    uint8_t       clk_div;
+    gpio_num_t    gpio_num;
+    uint8_t       mem_block_num;
+    union {
+        rmt_tx_config_t tx_config;
+        rmt_rx_config_t rx_config;
+    };
+} rmt_config_t;
+
+esp_err_t rmt_config(const rmt_config_t *rmt_param);
+esp_err_t rmt_fill_tx_items(rmt_channel_t channel, const rmt_item32_t *item, uint16_t item_num, uint16_t mem_offset);
+esp_err_t rmt_tx_start(rmt_channel_t channel, bool tx_idx_rst);
+
+#define RMT_MOCK_STARTS 64
+
+extern unsigned long rmt_mock_calls;
+extern uint8_t       rmt_mock_clk_div[RMT_CHANNEL_MAX];     // 0 until configured
+extern rmt_item32_t  rmt_mock_mem[RMT_CHANNEL_MAX][RMT_MEM_ITEM_NUM];
+extern unsigned long rmt_mock_start_count;                  // total, rmt_mock_starts wraps
+extern uint8_t       rmt_mock_starts[RMT_MOCK_STARTS];
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * Host stand-in for ESP-IDF driver/uart.h
+ *
+ * uart_write_bytes() appends to uart_mock_tx, so the bench can decode what
+ * the firmware sent; bytes beyond its size are only counted.
+ */
+#ifndef UART_H
+#define UART_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define UART_MOCK_TX_SIZE (4 * 1024 * 1024)
+
+extern uint8_t       uart_mock_tx[UART_MOCK_TX_SIZE];
+extern unsigned long uart_mock_tx_bytes;   // total, uart_mock_tx holds the first UART_MOCK_TX_SIZE
+extern unsigned long uart_mock_writes;
+
+int uart_write_bytes(int uart_num, const char *src, size_t size);
+
+static inline esp_err_t uart_driver_install(int uart_num, int rx_buffer_size, int tx_buffer_size,
+                                            int queue_size, void *uart_queue, int intr_alloc_flags){
+    (void) uart_num;
+    (void) rx_buffer_size;
+    (void) tx_buffer_size;
+    (void) queue_size;
+    (void) uart_queue;
+    (void) intr_alloc_flags;
+    return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Host stand-in for ESP-IDF esp_partition.h
+ *
+ * The "capture" data partition of partitions.csv is backed by memory with
+ * NOR flash semantics: erase sets 4 KB sectors to 0xff, a write can only
+ * clear bits. Writes that would have to set a bit are counted.
+ */
+#ifndef ESP_PARTITION_H
+#define ESP_PARTITION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef enum {
+    ESP_PARTITION_TYPE_APP  = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef enum {
+    ESP_PARTITION_SUBTYPE_DATA_NVS = 0x02,
+    ESP_PARTITION_SUBTYPE_ANY      = 0xff,
+} esp_partition_subtype_t;
+
+typedef struct {
+    esp_partition_type_t    type;
+    esp_partition_subtype_t subtype;
+    uint32_t                address;
+    uint32_t                size;
+    char                    label[17];
+    int                     encrypted;
+} esp_partition_t;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label);
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t start_addr, size_t size);
+
+#define PARTITION_MOCK_SIZE         0xF0000
+#define PARTITION_MOCK_SECTOR_SIZE  4096
+
+extern uint8_t       partition_mock_image[PARTITION_MOCK_SIZE];
+extern unsigned long partition_mock_writes;
+extern unsigned long partition_mock_erases;         // sectors
+extern unsigned long partition_mock_bad_writes;     // would have set a bit
+
+#endif
@@ -0,0 +1,36 @@
+/*
+ * Host stand-in for ESP-IDF esp_timer.h
+ */
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef struct esp_timer *esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void *arg);
+
+typedef enum {
+    ESP_TIMER_TASK
+} esp_timer_dispatch_t;
+
+typedef struct {
+    esp_timer_cb_t       callback;
+    void                *arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char          *name;
+} esp_timer_create_args_t;
+
+/* timers never fire on the host; the bench runs the periodic work itself */
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+
+/* microseconds since the bench started, plus the offset */
+int64_t esp_timer_get_time(void);
+
+/* moves the clock ahead, for timeouts a bench does not want to wait for */
+extern int64_t esp_timer_mock_offset_us;
+
+#endif
@@ -0,0 +1,17 @@
+/*
+ * Host stand-in for ESP-IDF esp_vfs_dev.h
+ */
+#ifndef ESP_VFS_DEV_H
+#define ESP_VFS_DEV_H
+
+typedef enum {
+    ESP_LINE_ENDINGS_CRLF,
+    ESP_LINE_ENDINGS_CR,
+    ESP_LINE_ENDINGS_LF,
+} esp_line_endings_t;
+
+static inline void esp_vfs_dev_uart_set_rx_line_endings(esp_line_endings_t mode){ (void) mode; }
+static inline void esp_vfs_dev_uart_set_tx_line_endings(esp_line_endings_t mode){ (void) mode; }
+static inline void esp_vfs_dev_uart_use_driver(int uart_num){ (void) uart_num; }
+
+#endif
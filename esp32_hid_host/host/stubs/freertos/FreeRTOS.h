@@ -0,0 +1,38 @@
+/*
+ * Host stand-in for the FreeRTOS kernel headers
+ *
+ * Tasks are never started on the host; the bench calls the work functions
+ * directly.
+ */
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE          1
+#define pdFALSE         0
+#define pdPASS          1
+#define pdFAIL          0
+#define portMAX_DELAY   0xffffffffu
+#define portNUM_PROCESSORS 2
+#define tskNO_AFFINITY  0x7FFFFFFF
+#define configTICK_RATE_HZ 1000
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / 1000))
+
+// the bench runs single threaded, critical sections only nest
+typedef struct {
+    uint32_t owner;
+    uint32_t count;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0, 0 }
+#define portENTER_CRITICAL(mux) ((mux)->count++)
+#define portEXIT_CRITICAL(mux)  ((mux)->count--)
+
+#endif
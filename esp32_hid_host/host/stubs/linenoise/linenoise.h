@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for linenoise, the console task never runs on the host
+ */
+#ifndef LINENOISE_H
+#define LINENOISE_H
+
+#include <stddef.h>
+
+static inline char *linenoise(const char *prompt){ (void) prompt; return NULL; }
+static inline void linenoiseFree(void *ptr){ (void) ptr; }
+static inline int linenoiseHistoryAdd(const char *line){ (void) line; return 0; }
+static inline int linenoiseHistorySetMaxLen(int len){ (void) len; return 0; }
+static inline void linenoiseSetDumbMode(int set){ (void) set; }
+
+#endif
@@ -0,0 +1,11 @@
+/*
+ * Host stand-in for ESP-IDF nvs_flash.h
+ */
+#ifndef NVS_FLASH_H
+#define NVS_FLASH_H
+
+#include "nvs.h"
+
+esp_err_t nvs_flash_init(void);
+
+#endif
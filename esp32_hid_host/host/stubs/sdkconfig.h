@@ -0,0 +1,14 @@
+/*
+ * Host stand-in for the generated sdkconfig.h
+ *
+ * Dual-core build (no CONFIG_FREERTOS_UNICORE) without FreeRTOS run-time
+ * statistics.
+ */
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+#define CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ 240
+#define CONFIG_CONSOLE_UART_NUM 0
+#define CONFIG_CONSOLE_UART_BAUDRATE 115200
+
+#endif
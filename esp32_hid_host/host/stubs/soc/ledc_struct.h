@@ -0,0 +1,31 @@
+/*
+ * Host stand-in for the ESP32 LEDC register block
+ *
+ * Only the timer counters are modeled. Every access to LEDC reads them
+ * from the LEDC mock's simulated clock, which the read advances, so a
+ * loop waiting for a count ends.
+ */
+#ifndef SOC_LEDC_STRUCT_H
+#define SOC_LEDC_STRUCT_H
+
+#include <stdint.h>
+
+typedef volatile struct {
+    struct {
+        struct {
+            union {
+                struct {
+                    uint32_t timer_cnt:  20;
+                    uint32_t reserved20: 12;
+                };
+                uint32_t val;
+            } value;
+        } timer[4];
+    } timer_group[2];
+} ledc_dev_t;
+
+ledc_dev_t *ledc_mock_dev(void);
+
+#define LEDC (*ledc_mock_dev())
+
+#endif
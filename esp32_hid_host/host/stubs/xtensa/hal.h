@@ -0,0 +1,20 @@
+/*
+ * Host stand-in for the Xtensa HAL
+ */
+#ifndef XTENSA_HAL_H
+#define XTENSA_HAL_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "sdkconfig.h"
+
+/* the cycle counter runs at the configured CPU clock, derived from the monotonic clock */
+static inline unsigned xthal_get_ccount(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned)(((uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec)
+                      * CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ / 1000);
+}
+
+#endif
@@ -0,0 +1,327 @@
+/*
+ * Telemetry decoder
+ *
+ * Reads the console UART of the firmware, or a recording of it, and
+ * decodes the binary snapshots "telemetry <Hz>" switches on. The stream is
+ * split at the 0 bytes; the console text printed between two frames ends
+ * up in front of the second one and is told apart by the frame sizes the
+ * format allows.
+ *
+ * Usage: telemetry_decode [-c] [-d] [-t] [file|device|-]
+ *
+ *  -c  one CSV line per snapshot with a header, e.g. for
+ *        telemetry_decode -c /dev/ttyUSB0 > run.csv
+ *        gnuplot -e "set datafile separator ','; set key autotitle columnhead;
+ *                    plot 'run.csv' using 2:6 with lines, '' using 2:35 with lines"
+ *  -d  a dashboard that redraws on every snapshot, sticks and triggers as bars
+ *  -t  pass the console text through to stderr
+ *
+ * A tty is switched to raw 115200 baud. Without -c or -d every snapshot
+ * is one line of text. A summary goes to stderr at the end of the input or
+ * on Ctrl-C.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "hid_decoder.h"
+#include "telemetry_format.h"
+
+#define DECODE_BAUDRATE     B115200
+#define DECODE_CHUNK_MAX    4096    // longer console text is passed on in pieces
+#define DECODE_BAR_WIDTH    20
+
+typedef enum {
+    DECODE_TEXT = 0,
+    DECODE_CSV,
+    DECODE_DASHBOARD
+} decode_output_t;
+
+typedef struct {
+    decode_output_t output;
+    int             text;
+    unsigned long   frames;
+    unsigned long   corrupt;
+    unsigned long   gaps;
+    unsigned long   frame_bytes;
+    unsigned long   text_bytes;
+    uint16_t        sequence;
+    uint32_t        first_us;
+    uint32_t        last_us;
+    int             header_written;
+} decode_state_t;
+
+static volatile sig_atomic_t decode_stop;
+
+static void decode_interrupt(int signal){
+    (void) signal;
+    decode_stop = 1;
+}
+
+static int open_input(const char *path){
+    struct termios tty;
+    int fd;
+
+    if (!path || strcmp(path, "-") == 0) return STDIN_FILENO;
+    fd = open(path, O_RDONLY | O_NOCTTY);
+    if (fd < 0){
+        perror(path);
+        return -1;
+    }
+    if (isatty(fd)){
+        if (tcgetattr(fd, &tty) < 0){
+            perror(path);
+            close(fd);
+            return -1;
+        }
+        cfmakeraw(&tty);
+        cfsetispeed(&tty, DECODE_BAUDRATE);
+        cfsetospeed(&tty, DECODE_BAUDRATE);
+        tty.c_cc[VMIN]  = 1;
+        tty.c_cc[VTIME] = 0;
+        if (tcsetattr(fd, TCSANOW, &tty) < 0){
+            perror(path);
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static int is_text(const uint8_t *data, size_t len){
+    size_t i;
+    for (i = 0; i < len; i++){
+        if ((data[i] < 0x20 || data[i] > 0x7e) && data[i] != '\n' && data[i] != '\r' && data[i] != '\t') return 0;
+    }
+    return 1;
+}
+
+static void print_bar(const char *name, unsigned int value, unsigned int full){
+    unsigned int fill = full ? (value * DECODE_BAR_WIDTH + full / 2) / full : 0;
+    unsigned int i;
+
+    if (fill > DECODE_BAR_WIDTH) fill = DECODE_BAR_WIDTH;
+    printf("  %-4s [", name);
+    for (i = 0; i < DECODE_BAR_WIDTH; i++){
+        putchar(i < fill ? '#' : ' ');
+    }
+    printf("] %5u", value);
+}
+
+static void print_csv(decode_state_t *state, const telemetry_snapshot_t *snapshot){
+    unsigned int i, axis;
+
+    if (!state->header_written){
+        printf("sequence,time_s");
+        for (i = 0; i < snapshot->num_controllers; i++){
+            printf(",c%u_flags,c%u_rssi,c%u_lx,c%u_ly,c%u_rx,c%u_ry,c%u_lt,c%u_rt,c%u_buttons,c%u_dpad,c%u_battery,"
+                   "c%u_interval_us,c%u_jitter_us,c%u_late",
+                   i + 1, i + 1, i + 1, i + 1, i + 1, i + 1, i + 1, i + 1, i + 1, i + 1, i + 1, i + 1, i + 1, i + 1);
+        }
+        for (i = 0; i < snapshot->num_outputs; i++){
+            printf(",pwm%u", i + 1);
+        }
+        printf("\n");
+        state->header_written = 1;
+    }
+    printf("%u,%u.%06u", snapshot->sequence, snapshot->time_us / 1000000, snapshot->time_us % 1000000);
+    for (i = 0; i < snapshot->num_controllers; i++){
+        const telemetry_controller_t *controller = &snapshot->controllers[i];
+        printf(",%u,%d", controller->flags, controller->rssi);
+        for (axis = 0; axis < TELEMETRY_AXES; axis++){
+            printf(",%u", controller->axes[axis]);
+        }
+        printf(",%u,%u,%u,%u,%u,%u", controller->buttons, controller->dpad, controller->battery,
+               controller->interval_us, controller->jitter_us, controller->late_reports);
+    }
+    for (i = 0; i < snapshot->num_outputs; i++){
+        printf(",%u", snapshot->outputs[i]);
+    }
+    printf("\n");
+}
+
+static void print_text(const telemetry_snapshot_t *snapshot){
+    unsigned int i, axis;
+
+    printf("%5u %u.%06u", snapshot->sequence, snapshot->time_us / 1000000, snapshot->time_us % 1000000);
+    for (i = 0; i < snapshot->num_controllers; i++){
+        const telemetry_controller_t *controller = &snapshot->controllers[i];
+        if (!(controller->flags & TELEMETRY_LINKED)){
+            printf(" | %u -", i + 1);
+            continue;
+        }
+        printf(" | %u%s", i + 1, controller->flags & TELEMETRY_SNIFF ? "s" : "");
+        for (axis = 0; axis < TELEMETRY_AXES; axis++){
+            printf(" %u", controller->axes[axis]);
+        }
+        printf(" b%04x d%u%s", controller->buttons, controller->dpad & 0x0f,
+               controller->dpad & TELEMETRY_GUIDE ? " g" : "");
+    }
+    printf(" | out");
+    for (i = 0; i < snapshot->num_outputs; i++){
+        printf(" %u", snapshot->outputs[i]);
+    }
+    printf("\n");
+}
+
+static void print_dashboard(const decode_state_t *state, const telemetry_snapshot_t *snapshot){
+    static const char *const axis_names[TELEMETRY_AXES] = { "lx", "ly", "rx", "ry", "lt", "rt" };
+    unsigned int i, axis;
+
+    printf("\033[H\033[2J");
+    printf("snapshot %u at %u.%03u s, %lu frames, %lu corrupt, %lu gaps\n\n", snapshot->sequence,
+           snapshot->time_us / 1000000, snapshot->time_us / 1000 % 1000, state->frames, state->corrupt, state->gaps);
+    for (i = 0; i < snapshot->num_controllers; i++){
+        const telemetry_controller_t *controller = &snapshot->controllers[i];
+        if (!(controller->flags & TELEMETRY_LINKED)){
+            printf("controller %u: no link\n\n", i + 1);
+            continue;
+        }
+        printf("controller %u: %s, RSSI %d, %u us +- %u, %u late, battery %u\n", i + 1,
+               controller->flags & TELEMETRY_SNIFF ? "sniff" : "active", controller->rssi,
+               controller->interval_us, controller->jitter_us, controller->late_reports, controller->battery);
+        for (axis = 0; axis < TELEMETRY_AXES; axis++){
+            print_bar(axis_names[axis], controller->axes[axis],
+                      axis < 4 ? HID_DECODER_JOYSTICK_FULL : HID_DECODER_TRIGGER_FULL);
+            printf(axis & 1 ? "\n" : "");
+        }
+        printf("  buttons %04x, dpad %u%s\n\n", controller->buttons, controller->dpad & 0x0f,
+               controller->dpad & TELEMETRY_GUIDE ? ", guide" : "");
+    }
+    // the outputs are in the unit of their mode, us, permille or DShot throttle
+    printf("outputs:");
+    for (i = 0; i < snapshot->num_outputs; i++){
+        printf("  pwm%u %u", i + 1, snapshot->outputs[i]);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+/* a frame sits at the end of the chunk, the console text printed before it at the start */
+static int decode_frame(const uint8_t *chunk, size_t len, telemetry_snapshot_t *snapshot, size_t *frame_len){
+    unsigned int controllers, outputs;
+
+    for (controllers = 0; controllers <= TELEMETRY_CONTROLLERS; controllers++){
+        for (outputs = 0; outputs <= TELEMETRY_OUTPUTS; outputs++){
+            size_t size = telemetry_frame_size(controllers, outputs) - 1;
+            if (size <= len && telemetry_decode(chunk + len - size, size, snapshot)){
+                *frame_len = size;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void decode_chunk(decode_state_t *state, const uint8_t *chunk, size_t len){
+    telemetry_snapshot_t snapshot;
+    size_t frame_len = 0;
+
+    if (!len) return;
+    if (!decode_frame(chunk, len, &snapshot, &frame_len)){
+        if (!is_text(chunk, len)){
+            state->corrupt++;
+            return;
+        }
+        frame_len = 0;
+    }
+    if (len > frame_len){
+        state->text_bytes += len - frame_len;
+        if (state->text) fwrite(chunk, 1, len - frame_len, stderr);
+    }
+    if (!frame_len) return;
+
+    if (state->frames && snapshot.sequence != (uint16_t)(state->sequence + 1)) state->gaps++;
+    if (!state->frames) state->first_us = snapshot.time_us;
+    state->last_us  = snapshot.time_us;
+    state->sequence = snapshot.sequence;
+    state->frames++;
+    state->frame_bytes += frame_len + 1;
+    switch (state->output){
+        case DECODE_CSV:
+            print_csv(state, &snapshot);
+            break;
+        case DECODE_DASHBOARD:
+            print_dashboard(state, &snapshot);
+            break;
+        default:
+            print_text(&snapshot);
+            break;
+    }
+}
+
+int main(int argc, char *argv[]){
+    decode_state_t state;
+    static uint8_t chunk[DECODE_CHUNK_MAX];
+    uint8_t buffer[256];
+    size_t len = 0;
+    double seconds;
+    ssize_t got;
+    int fd, opt;
+
+    memset(&state, 0, sizeof(state));
+    while ((opt = getopt(argc, argv, "cdt")) != -1){
+        switch (opt){
+            case 'c':
+                state.output = DECODE_CSV;
+                break;
+            case 'd':
+                state.output = DECODE_DASHBOARD;
+                break;
+            case 't':
+                state.text = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-c] [-d] [-t] [file|device|-]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind + 1 < argc){
+        fprintf(stderr, "usage: %s [-c] [-d] [-t] [file|device|-]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    fd = open_input(optind < argc ? argv[optind] : NULL);
+    if (fd < 0) return EXIT_FAILURE;
+    signal(SIGINT, decode_interrupt);
+
+    while (!decode_stop){
+        ssize_t i;
+        got = read(fd, buffer, sizeof(buffer));
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0){
+            perror("read");
+            break;
+        }
+        if (!got) break;
+        for (i = 0; i < got; i++){
+            if (!buffer[i]){
+                decode_chunk(&state, chunk, len);
+                len = 0;
+                continue;
+            }
+            // no frame is this long, pass on the text that filled the buffer
+            if (len == sizeof(chunk)){
+                decode_chunk(&state, chunk, len);
+                len = 0;
+            }
+            chunk[len++] = buffer[i];
+        }
+        fflush(stdout);
+    }
+    if (len && state.text) fwrite(chunk, 1, len, stderr);
+
+    seconds = (double)(uint32_t)(state.last_us - state.first_us) / 1000000.0;
+    fprintf(stderr, "%lu frames in %lu bytes, %lu corrupt, %lu sequence gaps, %lu bytes of text\n",
+            state.frames, state.frame_bytes, state.corrupt, state.gaps, state.text_bytes);
+    if (state.frames > 1 && seconds > 0){
+        fprintf(stderr, "%.1f Hz over %.3f s, %.0f bytes/s\n", (state.frames - 1) / seconds, seconds,
+                state.frame_bytes / seconds);
+    }
+    return state.frames && !state.corrupt ? EXIT_SUCCESS : EXIT_FAILURE;
+}
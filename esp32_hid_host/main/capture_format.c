@@ -0,0 +1,205 @@
+/*
+ * capture_format.c
+ *
+ * Controllers repeat most of a report from one to the next: a stick move
+ * changes two or three bytes, a held button none. A changed report is
+ * stored as runs against the previous report of its controller, unless
+ * the runs are no shorter than the report itself. With millisecond times
+ * an unchanged report at the usual 8 ms cadence takes a single byte.
+ */
+
+#include <string.h>
+
+#include "capture_format.h"
+
+#define CAPTURE_OP_REPEAT   0
+#define CAPTURE_OP_DELTA    1
+#define CAPTURE_OP_FULL     2
+#define CAPTURE_TIME_VARINT 15      // time nibble: the time follows as a varint
+#define CAPTURE_RUN_MAX     15      // bytes a run nibble can count
+#define CAPTURE_END         0xff    // erased flash
+
+static uint16_t capture_write_varint(uint8_t *out, uint32_t value) {
+    uint16_t size = 0;
+    while (value >= 0x80) {
+        out[size++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[size++] = (uint8_t) value;
+    return size;
+}
+
+/* @return 1 if a varint of at most five bytes was read within the sector */
+static int capture_read_varint(const uint8_t *sector, uint16_t *pos, uint32_t *value) {
+    unsigned int shift;
+    *value = 0;
+    for (shift = 0; shift < 35; shift += 7) {
+        uint8_t byte;
+        if (*pos >= CAPTURE_SECTOR_SIZE) return 0;
+        byte = sector[(*pos)++];
+        *value |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return 1;
+    }
+    return 0;
+}
+
+/*
+ * encodes the runs from last to report
+ * @return their size, 0 if they would take limit bytes or more
+ */
+static uint16_t capture_encode_runs(const uint8_t *last, const uint8_t *report, uint16_t len,
+                                    uint8_t *out, uint16_t limit) {
+    uint16_t pos = 0, size = 0;
+
+    while (pos < len) {
+        uint16_t skip = 0, count = 0;
+        while (pos + skip < len && last[pos + skip] == report[pos + skip]) skip++;
+        if (pos + skip == len) break;
+        // runs of unchanged bytes longer than a nibble skip without new bytes
+        while (skip > CAPTURE_RUN_MAX) {
+            if (size == limit) return 0;
+            out[size++] = CAPTURE_RUN_MAX << 4;
+            skip -= CAPTURE_RUN_MAX;
+            pos += CAPTURE_RUN_MAX;
+        }
+        pos += skip;
+        while (pos + count < len && count < CAPTURE_RUN_MAX && last[pos + count] != report[pos + count]) count++;
+        if (size + 1 + count >= limit) return 0;
+        out[size++] = (uint8_t)((skip << 4) | count);
+        memcpy(&out[size], &report[pos], count);
+        size += count;
+        pos += count;
+    }
+    if (size + 1 >= limit) return 0;
+    out[size++] = 0;
+    return size;
+}
+
+void capture_encoder_start(capture_encoder_t *encoder, uint8_t *sector, uint32_t sequence,
+                           uint16_t session, uint32_t start_ms) {
+    capture_sector_header_t header;
+
+    memset(sector, CAPTURE_END, CAPTURE_SECTOR_SIZE);
+    header.magic    = CAPTURE_MAGIC;
+    header.sequence = sequence;
+    header.session  = session;
+    header.version  = CAPTURE_VERSION;
+    header.reserved = 0;
+    header.start_ms = start_ms;
+    memcpy(sector, &header, sizeof(header));
+
+    encoder->sector  = sector;
+    encoder->used    = sizeof(header);
+    encoder->time_ms = start_ms;
+    memset(encoder->last_len, 0, sizeof(encoder->last_len));
+}
+
+int capture_encoder_add(capture_encoder_t *encoder, unsigned int slot, const uint8_t *report,
+                        uint16_t len, uint32_t time_ms) {
+    uint8_t  record[CAPTURE_RECORD_MAX];
+    uint8_t *last;
+    uint32_t delta = time_ms - encoder->time_ms;
+    uint16_t size = 1;
+    uint16_t runs = 0;
+    uint8_t  op;
+
+    if (slot >= CAPTURE_SLOTS || !len || len > CAPTURE_REPORT_MAX) return 1;
+    last = encoder->last[slot];
+    if (delta >= CAPTURE_TIME_VARINT) {
+        size += capture_write_varint(&record[size], delta);
+    }
+
+    if (encoder->last_len[slot] == len && memcmp(last, report, len) == 0) {
+        op = CAPTURE_OP_REPEAT;
+    } else {
+        if (encoder->last_len[slot] == len) {
+            runs = capture_encode_runs(last, report, len, &record[size], 1 + len);
+        }
+        if (runs) {
+            op = CAPTURE_OP_DELTA;
+            size += runs;
+        } else {
+            op = CAPTURE_OP_FULL;
+            record[size++] = (uint8_t) len;
+            memcpy(&record[size], report, len);
+            size += len;
+        }
+    }
+    record[0] = (uint8_t)((op << 6) | (slot << 4) | (delta < CAPTURE_TIME_VARINT ? delta : CAPTURE_TIME_VARINT));
+
+    if (encoder->used + size > CAPTURE_SECTOR_SIZE) return 0;
+    memcpy(&encoder->sector[encoder->used], record, size);
+    encoder->used += size;
+    encoder->time_ms = time_ms;
+    memcpy(last, report, len);
+    encoder->last_len[slot] = (uint8_t) len;
+    return 1;
+}
+
+int capture_decoder_start(capture_decoder_t *decoder, const uint8_t *sector, capture_sector_header_t *header) {
+    memcpy(header, sector, sizeof(*header));
+    if (header->magic != CAPTURE_MAGIC || header->version != CAPTURE_VERSION) return 0;
+    decoder->sector  = sector;
+    decoder->pos     = sizeof(*header);
+    decoder->time_ms = header->start_ms;
+    memset(decoder->last_len, 0, sizeof(decoder->last_len));
+    return 1;
+}
+
+int capture_decoder_next(capture_decoder_t *decoder, unsigned int *slot, uint8_t *report, uint32_t *time_ms) {
+    const uint8_t *sector = decoder->sector;
+    uint16_t pos = decoder->pos;
+    uint32_t delta;
+    uint8_t  tag, *last;
+    unsigned int s;
+
+    if (pos >= CAPTURE_SECTOR_SIZE || sector[pos] == CAPTURE_END) return 0;
+    tag   = sector[pos++];
+    s     = (tag >> 4) & (CAPTURE_SLOTS - 1);
+    delta = tag & 0x0f;
+    if (delta == CAPTURE_TIME_VARINT && !capture_read_varint(sector, &pos, &delta)) return -1;
+    last = decoder->last[s];
+
+    switch (tag >> 6) {
+        case CAPTURE_OP_REPEAT:
+            if (!decoder->last_len[s]) return -1;
+            break;
+        case CAPTURE_OP_DELTA: {
+            uint16_t offset = 0;
+            if (!decoder->last_len[s]) return -1;
+            for (;;) {
+                uint8_t run, skip, count;
+                if (pos >= CAPTURE_SECTOR_SIZE) return -1;
+                run = sector[pos++];
+                if (!run) break;
+                skip  = run >> 4;
+                count = run & 0x0f;
+                if (offset + skip + count > decoder->last_len[s] || pos + count > CAPTURE_SECTOR_SIZE) return -1;
+                offset += skip;
+                memcpy(&last[offset], &sector[pos], count);
+                offset += count;
+                pos += count;
+            }
+            break;
+        }
+        case CAPTURE_OP_FULL: {
+            uint8_t len;
+            if (pos >= CAPTURE_SECTOR_SIZE) return -1;
+            len = sector[pos++];
+            if (!len || len > CAPTURE_REPORT_MAX || pos + len > CAPTURE_SECTOR_SIZE) return -1;
+            memcpy(last, &sector[pos], len);
+            decoder->last_len[s] = len;
+            pos += len;
+            break;
+        }
+        default:
+            return -1;
+    }
+
+    decoder->pos      = pos;
+    decoder->time_ms += delta;
+    *slot    = s;
+    *time_ms = decoder->time_ms;
+    memcpy(report, last, decoder->last_len[s]);
+    return decoder->last_len[s];
+}
@@ -0,0 +1,83 @@
+/*
+ * capture_format.h
+ *
+ * Compact format of the captured interrupt-channel reports. The capture
+ * partition is a ring of 4 KB flash sectors; each sector starts with a
+ * header and holds records until it is full, and decodes on its own, so
+ * the ring can overwrite its oldest sector without breaking the rest.
+ *
+ * A record is a tag byte, optionally followed by a time and a payload:
+ *
+ *   tag      op (2 bits), controller slot (2 bits), ms since the previous
+ *            record of the sector (4 bits, 15: a varint with the ms follows)
+ *   REPEAT   the same bytes as the previous report of the slot
+ *   DELTA    runs against the previous report of the slot: a byte with the
+ *            unchanged bytes to skip (high nibble) and the number of new
+ *            bytes that follow it (low nibble), up to a 0 byte
+ *   FULL     length byte and the report
+ *
+ * Erased flash reads 0xff, which is no valid tag, so the records of a
+ * sector end at the first 0xff tag. Everything is shared with the host
+ * decoder, the header is stored little endian like the ESP32 does.
+ */
+
+#ifndef CAPTURE_FORMAT_H
+#define CAPTURE_FORMAT_H
+
+#include <stdint.h>
+
+#define CAPTURE_SECTOR_SIZE     4096
+#define CAPTURE_MAGIC           0x50414348  // "HCAP"
+#define CAPTURE_VERSION         1
+#define CAPTURE_SLOTS           4           // controller slots a tag can name
+#define CAPTURE_REPORT_MAX      64          // longer reports are not captured
+#define CAPTURE_TICK_US         1000        // time resolution of the records
+// tag, time varint, length, report
+#define CAPTURE_RECORD_MAX      (1 + 5 + 1 + CAPTURE_REPORT_MAX)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;      // sectors written before this one, orders the ring
+    uint16_t session;       // boots with capture on, the clock restarts with each
+    uint8_t  version;
+    uint8_t  reserved;
+    uint32_t start_ms;      // session time the record times count from
+} capture_sector_header_t;
+
+typedef struct {
+    uint8_t  *sector;       // CAPTURE_SECTOR_SIZE bytes, filled with 0xff beyond used
+    uint16_t  used;
+    uint32_t  time_ms;      // of the last record
+    uint8_t   last_len[CAPTURE_SLOTS];     // 0 if the slot has no report in this sector
+    uint8_t   last[CAPTURE_SLOTS][CAPTURE_REPORT_MAX];
+} capture_encoder_t;
+
+typedef struct {
+    const uint8_t *sector;
+    uint16_t       pos;
+    uint32_t       time_ms;
+    uint8_t        last_len[CAPTURE_SLOTS];
+    uint8_t        last[CAPTURE_SLOTS][CAPTURE_REPORT_MAX];
+} capture_decoder_t;
+
+/* starts an empty sector with its header */
+void capture_encoder_start(capture_encoder_t *encoder, uint8_t *sector, uint32_t sequence,
+                           uint16_t session, uint32_t start_ms);
+
+/*
+ * appends a report, time_ms must not go backwards within the sector
+ * @return 1 if the record fit into the sector, 0 if a new sector is needed
+ */
+int capture_encoder_add(capture_encoder_t *encoder, unsigned int slot, const uint8_t *report,
+                        uint16_t len, uint32_t time_ms);
+
+/* @return 1 if the sector holds a capture, its header is copied */
+int capture_decoder_start(capture_decoder_t *decoder, const uint8_t *sector, capture_sector_header_t *header);
+
+/*
+ * decodes the next report of the sector
+ * @return its length, 0 at the end of the sector, -1 if the record is malformed
+ */
+int capture_decoder_next(capture_decoder_t *decoder, unsigned int *slot, uint8_t *report, uint32_t *time_ms);
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * control_loop.c
+ *
+ * The esp_timer callback only notifies the task. Notifications count up,
+ * so a task that wakes up to more than one has missed periods: those are
+ * the overruns. The wake-up jitter is measured against the ideal period
+ * boundary, not against the previous wake-up, so it does not accumulate.
+ *
+ * On a dual-core build the Bluetooth controller, BTstack and the log task
+ * stay on core 0 and the control task gets core 1 to itself; the timer
+ * notification and the state mailbox are the only things crossing over.
+ */
+
+#include <stdio.h>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+
+#include "control_loop.h"
+#include "latency_stats.h"
+#include "log_ring.h"
+#include "state_mailbox.h"
+
+#define CONTROL_TASK_STACK_SIZE 4096
+#define CONTROL_TASK_PRIORITY   5   // above the BTstack run loop and the log task
+#define CONTROL_STATS_PERIOD_US 10000000
+#if CONFIG_FREERTOS_UNICORE
+#define CONTROL_TASK_CORE       0
+#else
+#define CONTROL_TASK_CORE       1   // APP CPU, core 0 runs the Bluetooth controller and BTstack
+#endif
+
+static control_loop_step_t  control_step;
+static control_loop_tick_t  control_tick;
+static unsigned int         control_num_slots;
+static uint32_t             control_period_us;
+static TaskHandle_t         control_task_handle;
+static esp_timer_handle_t   control_timer;
+static int64_t              control_boundary;   // ideal time of the last period
+
+static hid_gamepad_state_t  control_states[STATE_MAILBOX_SLOTS];
+static uint32_t             control_sequences[STATE_MAILBOX_SLOTS];
+static control_loop_stats_t control_stats;
+
+static void control_loop_timer_callback(void *arg) {
+    (void) arg;
+    xTaskNotifyGive(control_task_handle);
+}
+
+void control_loop_run_period(void) {
+    uint32_t     start = (uint32_t) esp_timer_get_time();
+    uint32_t     timestamps[STATE_MAILBOX_SLOTS];
+    uint32_t     updates[STATE_MAILBOX_SLOTS];
+    uint32_t     latency;
+    unsigned int slot;
+
+    control_stats.periods++;
+    for (slot = 0; slot < control_num_slots; slot++) {
+        updates[slot] = state_mailbox_take(slot, &control_states[slot], &timestamps[slot], &control_sequences[slot]);
+        control_step(slot, &control_states[slot], updates[slot]);
+    }
+    control_tick();
+
+    for (slot = 0; slot < control_num_slots; slot++) {
+        if (!updates[slot]) continue;
+
+        control_stats.updates++;
+        control_stats.coalesced += updates[slot] - 1;
+        // a state published after the period started has not waited at all
+        latency = (uint32_t) esp_timer_get_time() - timestamps[slot];
+        latency_stats_record(LATENCY_QUEUE, (int32_t)(start - timestamps[slot]) > 0 ? start - timestamps[slot] : 0);
+        latency_stats_record(LATENCY_ACTUATE, latency);
+        control_stats.latency_total_us += latency;
+        if (latency > control_stats.latency_max_us) control_stats.latency_max_us = latency;
+    }
+}
+
+/* prints the statistics of the last window through the log ring */
+static void control_loop_log_stats(void) {
+    log_ring_write(LOG_CONTROL_TIMING, control_stats.jitter_max_us, control_stats.step_max_us);
+    log_ring_write(LOG_CONTROL_OVERRUNS, control_stats.overruns, control_stats.coalesced);
+    if (control_stats.flash_stalls) {
+        log_ring_write(LOG_CONTROL_FLASH_STALLS, control_stats.flash_stalls, control_stats.flash_stall_max_us);
+    }
+    if (control_stats.updates) {
+        log_ring_write(LOG_CONTROL_LATENCY, control_stats.latency_total_us / control_stats.updates,
+                       control_stats.latency_max_us);
+    }
+    control_loop_reset_stats();
+}
+
+static void control_loop_task(void *arg) {
+    int64_t  stats_due = esp_timer_get_time() + CONTROL_STATS_PERIOD_US;
+    int64_t  now, done;
+    uint32_t elapsed;
+    (void) arg;
+
+    for (;;) {
+        elapsed = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (!elapsed) continue;
+        now = esp_timer_get_time();
+        control_boundary += (int64_t) elapsed * control_period_us;
+        if (elapsed > 1) {
+            control_stats.overruns += elapsed - 1;
+        }
+        if (now > control_boundary) {
+            uint32_t jitter = (uint32_t)(now - control_boundary);
+            control_stats.jitter_total_us += jitter;
+            if (jitter > control_stats.jitter_max_us) control_stats.jitter_max_us = jitter;
+        }
+
+        control_loop_run_period();
+
+        done = esp_timer_get_time();
+        if ((uint32_t)(done - now) > control_stats.step_max_us) {
+            control_stats.step_max_us = (uint32_t)(done - now);
+        }
+        if (done >= stats_due) {
+            control_loop_log_stats();
+            stats_due += CONTROL_STATS_PERIOD_US;
+        }
+    }
+}
+
+void control_loop_start(uint32_t period_us, unsigned int num_slots, control_loop_step_t step,
+                        control_loop_tick_t tick) {
+    esp_timer_create_args_t timer_args = {0};
+
+    control_step = step;
+    control_tick = tick;
+    control_num_slots = num_slots < STATE_MAILBOX_SLOTS ? num_slots : STATE_MAILBOX_SLOTS;
+    control_period_us = period_us;
+    if (xTaskCreatePinnedToCore(control_loop_task, "control", CONTROL_TASK_STACK_SIZE, NULL,
+                                CONTROL_TASK_PRIORITY, &control_task_handle, CONTROL_TASK_CORE) != pdPASS) {
+        printf("Control task not started\n");
+        return;
+    }
+    timer_args.callback = control_loop_timer_callback;
+    timer_args.name = "control";
+    ESP_ERROR_CHECK( esp_timer_create(&timer_args, &control_timer) );
+    control_boundary = esp_timer_get_time();
+    ESP_ERROR_CHECK( esp_timer_start_periodic(control_timer, period_us) );
+    printf("Control loop: %u us period on core %d\n", period_us, CONTROL_TASK_CORE);
+}
+
+void control_loop_flash_stall(uint32_t stall_us) {
+    __atomic_add_fetch(&control_stats.flash_stalls, 1, __ATOMIC_RELAXED);
+    if (stall_us > __atomic_load_n(&control_stats.flash_stall_max_us, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&control_stats.flash_stall_max_us, stall_us, __ATOMIC_RELAXED);
+    }
+}
+
+void control_loop_get_stats(control_loop_stats_t *stats) {
+    *stats = control_stats;
+}
+
+void control_loop_reset_stats(void) {
+    control_stats = (control_loop_stats_t) {0};
+}
@@ -0,0 +1,63 @@
+/*
+ * control_loop.h
+ *
+ * Fixed-rate control loop. An esp_timer wakes a task every period; the
+ * task takes the newest gamepad states from the mailbox and runs the step
+ * that drives the outputs, so actuation no longer follows the irregular
+ * report arrival and never runs in the Bluetooth packet callback.
+ */
+
+#ifndef CONTROL_LOOP_H
+#define CONTROL_LOOP_H
+
+#include <stdint.h>
+
+#include "hid_decoder.h"
+
+/*
+ * called once per period and mailbox slot with the slot's newest state
+ * @param updates states published since the last period, 0 if unchanged
+ */
+typedef void (*control_loop_step_t)(unsigned int slot, const hid_gamepad_state_t *state, uint32_t updates);
+
+/* called once per period after the steps of all slots, drives the outputs */
+typedef void (*control_loop_tick_t)(void);
+
+typedef struct {
+    uint32_t periods;           // periods run
+    uint32_t overruns;          // periods skipped because a step or the wake-up was late
+    uint32_t updates;           // slot periods that had a new state
+    uint32_t coalesced;         // published states replaced before a period could take them
+    uint32_t jitter_max_us;     // latest wake-up after the period boundary
+    uint32_t jitter_total_us;   // sum of the wake-up delays, for the average
+    uint32_t step_max_us;       // longest step
+    uint32_t latency_max_us;    // report arrival to the committed PWM duties of its period
+    uint32_t latency_total_us;  // sum over the updates, for the average
+    uint32_t flash_stalls;      // flash erases of other tasks, they stop this core too
+    uint32_t flash_stall_max_us;
+} control_loop_stats_t;
+
+/*
+ * starts the timer and the control task, period in microseconds
+ * the task runs on core 1 unless FreeRTOS is built for a single core
+ * @param num_slots mailbox slots to take from, one per controller
+ */
+void control_loop_start(uint32_t period_us, unsigned int num_slots, control_loop_step_t step,
+                        control_loop_tick_t tick);
+
+/* takes the newest states, runs the step once per slot and then the tick, without any timing */
+void control_loop_run_period(void);
+
+/*
+ * records a flash erase of another task: it stops the caches of both
+ * cores, the control task cannot run for its duration and the periods it
+ * covered show up as overruns
+ */
+void control_loop_flash_stall(uint32_t stall_us);
+
+/* copies the statistics since boot or the last reset */
+void control_loop_get_stats(control_loop_stats_t *stats);
+
+void control_loop_reset_stats(void);
+
+#endif
@@ -0,0 +1,494 @@
+/*
+ * controller_discovery.c
+ *
+ * The inquiry runs in the extended inquiry mode, so every response
+ * carries its RSSI; a controller that refuses the mode answers with plain
+ * results, whose candidates rank last. Inquiry results list the responses
+ * one after the other, 14 bytes each, like the Linux host reads them;
+ * controllers send one per event anyway. The commands are pending bits,
+ * sent one at a time whenever BTstack can send a command, like the link
+ * policy does.
+ *
+ * An inquiry of 3.84 s instead of the 10.24 s of a general one: a
+ * gamepad in pairing mode scans every 1.28 s and answers the first train
+ * that hits its scan, and its candidate is handed over with that answer.
+ * Paging a candidate while the inquiry goes on takes longer than paging
+ * alone, it still beats waiting for the inquiry to complete. The inquiry
+ * is cancelled once a candidate connects.
+ *
+ * Console requests reach the Bluetooth side through one request word,
+ * which the timer takes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btstack.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include "controller_discovery.h"
+#include "log_ring.h"
+
+#define DISCOVERY_TIMER_PERIOD_MS   100     // console requests and busy slots are picked up this often
+#define DISCOVERY_INQUIRY_LENGTH    3       // 1.28 s units
+#define DISCOVERY_INQUIRIES         3       // before the discovery gives up
+#define DISCOVERY_INQUIRY_MODE_EIR  2       // results with RSSI or extended results
+#define DISCOVERY_RESPONSE_SIZE     14      // of every response in an inquiry result
+#define DISCOVERY_RSSI_UNKNOWN      -127
+#define COD_MAJOR_PERIPHERAL        0x05
+#define COD_MINOR_JOYSTICK          0x01
+#define COD_MINOR_GAMEPAD           0x02
+#define NVS_NAMESPACE               "discovery"
+#define NVS_KEY_ADDRESSES           "addresses"
+
+// commands, sent in this order
+#define DISCOVERY_WRITE_INQUIRY_MODE    (1 << 0)
+#define DISCOVERY_INQUIRY_CANCEL        (1 << 1)
+#define DISCOVERY_INQUIRY               (1 << 2)
+
+// console requests, the kind above the slot
+#define REQUEST_NONE                0
+#define REQUEST_DISCOVER            1
+#define REQUEST_STOP                2
+#define REQUEST_FORGET              3
+
+static controller_discovery_stats_t     discovery_stats;
+static controller_discovery_candidate_t discovery_candidates[CONTROLLER_DISCOVERY_CANDIDATES];
+static controller_discovery_handler_t   discovery_handler;
+static unsigned int                     discovery_num_slots;
+static bd_addr_t                        discovery_remembered_addrs[CONTROLLER_DISCOVERY_SLOTS];
+static bd_addr_t                        discovery_attached_addrs[CONTROLLER_DISCOVERY_SLOTS];
+static uint8_t                          discovery_attached[CONTROLLER_DISCOVERY_SLOTS]; // the console reads them
+static uint8_t                          discovery_waiting;      // slots to discover after the running one, bits
+static uint8_t                          discovery_pending;      // DISCOVERY_* commands still to send
+static uint8_t                          discovery_inquiring;    // inquiry sent, neither completed nor cancelled
+static uint8_t                          discovery_mode_written;
+static uint8_t                          discovery_attempting;   // a candidate is connecting
+static bd_addr_t                        discovery_attempt_addr;
+static int64_t                          discovery_start_us;
+static uint16_t                         discovery_request;
+static btstack_packet_callback_registration_t discovery_event_registration;
+static btstack_timer_source_t           discovery_timer;
+
+static const char * const discovery_state_names[] = { "idle", "running", "connected", "failed" };
+
+static void discovery_save(void) {
+    nvs_handle handle;
+    esp_err_t  err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, NVS_KEY_ADDRESSES, discovery_remembered_addrs, sizeof(discovery_remembered_addrs));
+        if (err == ESP_OK) err = nvs_commit(handle);
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        printf("Controller addresses not saved: error 0x%x\n", err);
+    }
+}
+
+/* @return 1 for the Class of Device of a gamepad or joystick */
+static int discovery_is_gamepad(uint32_t class_of_device) {
+    // the upper two bits of the peripheral minor class say keyboard or pointing device, a combination still counts
+    uint32_t minor = (class_of_device >> 2) & 0x0F;
+
+    return ((class_of_device >> 8) & 0x1F) == COD_MAJOR_PERIPHERAL
+        && (minor == COD_MINOR_JOYSTICK || minor == COD_MINOR_GAMEPAD);
+}
+
+/* @return 1 if the address belongs to a connected controller or is remembered for another slot */
+static int discovery_addr_taken(const bd_addr_t addr) {
+    unsigned int slot;
+
+    for (slot = 0; slot < discovery_num_slots; slot++) {
+        if (discovery_attached[slot] && memcmp(discovery_attached_addrs[slot], addr, sizeof(bd_addr_t)) == 0) return 1;
+        if (slot != discovery_stats.slot && memcmp(discovery_remembered_addrs[slot], addr, sizeof(bd_addr_t)) == 0) return 1;
+    }
+    return 0;
+}
+
+/* sends the next pending command */
+static void discovery_run(void) {
+    uint8_t command = discovery_pending & -discovery_pending;
+
+    if (!command || !hci_can_send_command_packet_now()) return;
+    discovery_pending &= ~command;
+    switch (command) {
+        case DISCOVERY_WRITE_INQUIRY_MODE:
+            discovery_mode_written = 1;
+            hci_send_cmd(&hci_write_inquiry_mode, DISCOVERY_INQUIRY_MODE_EIR);
+            break;
+        case DISCOVERY_INQUIRY_CANCEL:
+            hci_send_cmd(&hci_inquiry_cancel);
+            break;
+        case DISCOVERY_INQUIRY:
+            discovery_inquiring = 1;
+            discovery_stats.inquiries++;
+            hci_send_cmd(&hci_inquiry, (uint32_t) HCI_INQUIRY_LAP, DISCOVERY_INQUIRY_LENGTH, 0);
+            break;
+        default:
+            break;
+    }
+}
+
+static void discovery_begin(unsigned int slot) {
+    discovery_waiting &= ~(1u << slot);
+    memset(&discovery_stats, 0, sizeof(discovery_stats));
+    discovery_stats.state = CONTROLLER_DISCOVERY_RUNNING;
+    discovery_stats.slot = (uint8_t) slot;
+    discovery_start_us = esp_timer_get_time();
+    discovery_pending |= DISCOVERY_INQUIRY;
+    if (!discovery_mode_written) {
+        discovery_pending |= DISCOVERY_WRITE_INQUIRY_MODE;
+    }
+}
+
+/* ends the running discovery and starts the next waiting one */
+static void discovery_finish(uint8_t state) {
+    unsigned int slot;
+
+    discovery_stats.state = state;
+    discovery_attempting = 0;
+    discovery_pending &= ~DISCOVERY_INQUIRY;
+    if (discovery_inquiring) {
+        discovery_pending |= DISCOVERY_INQUIRY_CANCEL;
+    }
+    for (slot = 0; slot < discovery_num_slots; slot++) {
+        if (!(discovery_waiting & (1u << slot))) continue;
+        discovery_begin(slot);
+        return;
+    }
+}
+
+/* hands the strongest untried candidate to the slot, inquires again when none is left */
+static void discovery_next(void) {
+    unsigned int i;
+
+    if (discovery_stats.state != CONTROLLER_DISCOVERY_RUNNING || discovery_attempting) return;
+    for (i = 0; i < discovery_stats.candidates; i++) {
+        controller_discovery_candidate_t *candidate = &discovery_candidates[i];
+
+        if (candidate->tried || discovery_addr_taken(candidate->addr)) continue;
+        // a busy slot is asked again by the timer
+        if (!(*discovery_handler)(discovery_stats.slot, candidate->addr)) return;
+        candidate->tried = 1;
+        discovery_attempting = 1;
+        memcpy(discovery_attempt_addr, candidate->addr, sizeof(bd_addr_t));
+        discovery_stats.attempts++;
+        return;
+    }
+    if (discovery_inquiring || (discovery_pending & DISCOVERY_INQUIRY)) return;
+    if (discovery_stats.inquiries < DISCOVERY_INQUIRIES) {
+        discovery_pending |= DISCOVERY_INQUIRY;
+        return;
+    }
+    log_ring_write(LOG_DISCOVERY_FAILED, discovery_stats.slot + 1, discovery_stats.inquiries);
+    discovery_finish(CONTROLLER_DISCOVERY_FAILED);
+}
+
+/* ranks a gamepad that responded, a device that responds again keeps its latest RSSI */
+static void discovery_add_candidate(const bd_addr_t addr, uint32_t class_of_device, int8_t rssi) {
+    unsigned int count = discovery_stats.candidates;
+    unsigned int i, pos;
+    uint8_t tried = 0;
+
+    for (i = 0; i < count; i++) {
+        if (memcmp(discovery_candidates[i].addr, addr, sizeof(bd_addr_t))) continue;
+        tried = discovery_candidates[i].tried;
+        count--;
+        memmove(&discovery_candidates[i], &discovery_candidates[i + 1], (count - i) * sizeof(discovery_candidates[0]));
+        break;
+    }
+    for (pos = count; pos > 0 && discovery_candidates[pos - 1].rssi < rssi; pos--);
+    if (pos == CONTROLLER_DISCOVERY_CANDIDATES) {
+        // weaker than every candidate of a full table
+        discovery_stats.candidates = (uint8_t) count;
+        return;
+    }
+    if (count == CONTROLLER_DISCOVERY_CANDIDATES) {
+        count--;
+    }
+    memmove(&discovery_candidates[pos + 1], &discovery_candidates[pos], (count - pos) * sizeof(discovery_candidates[0]));
+    memcpy(discovery_candidates[pos].addr, addr, sizeof(bd_addr_t));
+    discovery_candidates[pos].class_of_device = class_of_device;
+    discovery_candidates[pos].rssi = rssi;
+    discovery_candidates[pos].tried = tried;
+    discovery_stats.candidates = (uint8_t)(count + 1);
+}
+
+/*
+ * takes the responses of an inquiry result event
+ * @param class_offset, rssi_offset where the fields sit in a response, rssi_offset 0 if it has none
+ */
+static void discovery_results(const uint8_t *packet, uint16_t size, int class_offset, int rssi_offset) {
+    const uint8_t *response = &packet[3];
+    unsigned int num_responses = size > 2 ? packet[2] : 0;
+    unsigned int i;
+    bd_addr_t addr;
+    uint32_t  class_of_device;
+    int8_t    rssi;
+    int32_t   elapsed_ms;
+
+    if (discovery_stats.state != CONTROLLER_DISCOVERY_RUNNING) return;
+    for (i = 0; i < num_responses; i++, response += DISCOVERY_RESPONSE_SIZE) {
+        if (response + DISCOVERY_RESPONSE_SIZE > packet + size) break;
+        reverse_bd_addr(response, addr);
+        class_of_device = little_endian_read_24(response, class_offset);
+        rssi = rssi_offset ? (int8_t) response[rssi_offset] : DISCOVERY_RSSI_UNKNOWN;
+        discovery_stats.responses++;
+        if (!discovery_is_gamepad(class_of_device)) {
+            discovery_stats.filtered++;
+            continue;
+        }
+        if (!discovery_stats.candidates) {
+            elapsed_ms = (int32_t)((esp_timer_get_time() - discovery_start_us) / 1000);
+            discovery_stats.first_response_ms = (uint32_t) elapsed_ms;
+            log_ring_write(LOG_DISCOVERY_RESPONSE, elapsed_ms, rssi);
+        }
+        discovery_add_candidate(addr, class_of_device, rssi);
+    }
+    // the first gamepad goes to the slot right away, the inquiry goes on
+    discovery_next();
+}
+
+static void discovery_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    uint16_t opcode;
+    UNUSED(channel);
+
+    if (packet_type != HCI_EVENT_PACKET) return;
+    switch (hci_event_packet_get_type(packet)) {
+        case HCI_EVENT_INQUIRY_RESULT:
+            discovery_results(packet, size, 9, 0);
+            break;
+        case HCI_EVENT_INQUIRY_RESULT_WITH_RSSI:
+        case HCI_EVENT_EXTENDED_INQUIRY_RESPONSE:
+            discovery_results(packet, size, 8, 13);
+            break;
+        case HCI_EVENT_INQUIRY_COMPLETE:
+            if (!discovery_inquiring) break;
+            discovery_inquiring = 0;
+            discovery_next();
+            break;
+        case HCI_EVENT_COMMAND_COMPLETE:
+            if (size < 6) break;
+            opcode = little_endian_read_16(packet, 3);
+            if (opcode == hci_inquiry_cancel.opcode) {
+                // no Inquiry Complete follows a cancel
+                discovery_inquiring = 0;
+            } else if (opcode == hci_write_inquiry_mode.opcode && packet[5]) {
+                log_ring_write(LOG_DISCOVERY_COMMAND_FAILED, opcode, packet[5]);
+            }
+            break;
+        case HCI_EVENT_COMMAND_STATUS:
+            if (size < 6 || !packet[2] || little_endian_read_16(packet, 4) != hci_inquiry.opcode) break;
+            // the inquiry did not start, no Inquiry Complete follows
+            log_ring_write(LOG_DISCOVERY_COMMAND_FAILED, hci_inquiry.opcode, packet[2]);
+            discovery_inquiring = 0;
+            discovery_next();
+            break;
+        default:
+            break;
+    }
+    discovery_run();
+}
+
+static void discovery_take_request(void) {
+    uint16_t     request = __atomic_load_n(&discovery_request, __ATOMIC_ACQUIRE);
+    unsigned int slot = request & 0xFF;
+
+    switch (request >> 8) {
+        case REQUEST_NONE:
+            return;
+        case REQUEST_DISCOVER:
+            controller_discovery_start(slot);
+            break;
+        case REQUEST_STOP:
+            // a candidate that is connecting already may still connect, it is not remembered
+            discovery_waiting = 0;
+            if (discovery_stats.state == CONTROLLER_DISCOVERY_RUNNING) {
+                discovery_finish(CONTROLLER_DISCOVERY_IDLE);
+            }
+            break;
+        case REQUEST_FORGET:
+            memset(discovery_remembered_addrs[slot], 0, sizeof(bd_addr_t));
+            discovery_save();
+            break;
+        default:
+            break;
+    }
+    __atomic_store_n(&discovery_request, REQUEST_NONE, __ATOMIC_RELEASE);
+}
+
+/* takes console requests and asks a busy slot again */
+static void discovery_timer_handler(btstack_timer_source_t *ts) {
+    discovery_take_request();
+    discovery_next();
+    discovery_run();
+    btstack_run_loop_set_timer(ts, DISCOVERY_TIMER_PERIOD_MS);
+    btstack_run_loop_add_timer(ts);
+}
+
+void controller_discovery_init(unsigned int num_slots, controller_discovery_handler_t handler) {
+    nvs_handle handle;
+    size_t     size = sizeof(discovery_remembered_addrs);
+
+    discovery_num_slots = num_slots < CONTROLLER_DISCOVERY_SLOTS ? num_slots : CONTROLLER_DISCOVERY_SLOTS;
+    discovery_handler = handler;
+    memset(discovery_remembered_addrs, 0, sizeof(discovery_remembered_addrs));
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        if (nvs_get_blob(handle, NVS_KEY_ADDRESSES, discovery_remembered_addrs, &size) != ESP_OK
+                || size != sizeof(discovery_remembered_addrs)) {
+            memset(discovery_remembered_addrs, 0, sizeof(discovery_remembered_addrs));
+        }
+        nvs_close(handle);
+    }
+    discovery_event_registration.callback = &discovery_event_handler;
+    hci_add_event_handler(&discovery_event_registration);
+    btstack_run_loop_set_timer_handler(&discovery_timer, &discovery_timer_handler);
+    btstack_run_loop_set_timer(&discovery_timer, DISCOVERY_TIMER_PERIOD_MS);
+    btstack_run_loop_add_timer(&discovery_timer);
+}
+
+int controller_discovery_remembered(unsigned int slot, bd_addr_t addr) {
+    static const bd_addr_t none;
+
+    if (slot >= discovery_num_slots || memcmp(discovery_remembered_addrs[slot], none, sizeof(bd_addr_t)) == 0) return 0;
+    memcpy(addr, discovery_remembered_addrs[slot], sizeof(bd_addr_t));
+    return 1;
+}
+
+void controller_discovery_start(unsigned int slot) {
+    if (slot >= discovery_num_slots || discovery_attached[slot]) return;
+    if (discovery_stats.state == CONTROLLER_DISCOVERY_RUNNING) {
+        if (slot != discovery_stats.slot) discovery_waiting |= 1u << slot;
+        return;
+    }
+    discovery_begin(slot);
+    discovery_run();
+}
+
+void controller_discovery_failed(unsigned int slot) {
+    if (discovery_stats.state != CONTROLLER_DISCOVERY_RUNNING || slot != discovery_stats.slot) return;
+    discovery_attempting = 0;
+    discovery_next();
+    discovery_run();
+}
+
+void controller_discovery_attach(unsigned int slot, const bd_addr_t addr) {
+    int32_t elapsed_ms;
+
+    if (slot >= discovery_num_slots) return;
+    memcpy(discovery_attached_addrs[slot], addr, sizeof(bd_addr_t));
+    __atomic_store_n(&discovery_attached[slot], 1, __ATOMIC_RELAXED);
+    discovery_waiting &= ~(1u << slot);
+    if (discovery_stats.state != CONTROLLER_DISCOVERY_RUNNING || slot != discovery_stats.slot) return;
+    if (!discovery_attempting || memcmp(addr, discovery_attempt_addr, sizeof(bd_addr_t))) {
+        // the previous controller of the slot came back first
+        discovery_finish(CONTROLLER_DISCOVERY_IDLE);
+        discovery_run();
+        return;
+    }
+    elapsed_ms = (int32_t)((esp_timer_get_time() - discovery_start_us) / 1000);
+    discovery_stats.connect_ms = (uint32_t) elapsed_ms;
+    log_ring_write(LOG_DISCOVERY_CONNECTED, slot + 1, elapsed_ms);
+    if (memcmp(discovery_remembered_addrs[slot], addr, sizeof(bd_addr_t))) {
+        memcpy(discovery_remembered_addrs[slot], addr, sizeof(bd_addr_t));
+        discovery_save();
+    }
+    discovery_finish(CONTROLLER_DISCOVERY_CONNECTED);
+    discovery_run();
+}
+
+void controller_discovery_detach(unsigned int slot) {
+    if (slot >= discovery_num_slots) return;
+    __atomic_store_n(&discovery_attached[slot], 0, __ATOMIC_RELAXED);
+}
+
+void controller_discovery_get_stats(controller_discovery_stats_t *stats) {
+    *stats = discovery_stats;
+}
+
+int controller_discovery_get_candidate(unsigned int index, controller_discovery_candidate_t *candidate) {
+    if (index >= discovery_stats.candidates) return 0;
+    *candidate = discovery_candidates[index];
+    return 1;
+}
+
+/* queues a request for the Bluetooth side, @return 1 if the previous one is still pending */
+static int discovery_queue_request(unsigned int kind, unsigned int slot) {
+    if (__atomic_load_n(&discovery_request, __ATOMIC_ACQUIRE) != REQUEST_NONE) {
+        printf("previous discover request pending\n");
+        return 1;
+    }
+    __atomic_store_n(&discovery_request, (uint16_t)(kind << 8 | slot), __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* @return the slot of a controller argument, -1 after printing why not */
+static int discovery_parse_slot(const char *arg) {
+    char *end;
+    long  controller = strtol(arg, &end, 10);
+
+    if (*end || controller < 1 || controller > (long) discovery_num_slots) {
+        printf("controller must be 1 to %u\n", discovery_num_slots);
+        return -1;
+    }
+    return (int)(controller - 1);
+}
+
+static void discovery_print(void) {
+    controller_discovery_stats_t     stats;
+    controller_discovery_candidate_t candidate;
+    bd_addr_t    addr;
+    unsigned int i;
+
+    controller_discovery_get_stats(&stats);
+    printf("discovery %s, controller %u: %u inquiries, %u responses, %u filtered, %u attempts\n",
+           discovery_state_names[stats.state], stats.slot + 1, stats.inquiries, stats.responses,
+           stats.filtered, stats.attempts);
+    if (stats.candidates) {
+        printf("  first gamepad after %u ms", stats.first_response_ms);
+        if (stats.connect_ms) printf(", connected after %u ms", stats.connect_ms);
+        printf("\n");
+    }
+    for (i = 0; controller_discovery_get_candidate(i, &candidate); i++) {
+        printf("  %s class 0x%06x RSSI %d dBm%s\n", bd_addr_to_str(candidate.addr),
+               (unsigned int) candidate.class_of_device, candidate.rssi, candidate.tried ? ", tried" : "");
+    }
+    for (i = 0; i < discovery_num_slots; i++) {
+        if (controller_discovery_remembered(i, addr)) {
+            printf("controller %u: %s remembered\n", i + 1, bd_addr_to_str(addr));
+        } else {
+            printf("controller %u: no address remembered\n", i + 1);
+        }
+    }
+}
+
+int controller_discovery_command(int argc, char **argv) {
+    int slot;
+
+    if (argc == 1) {
+        discovery_print();
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+        return discovery_queue_request(REQUEST_STOP, 0);
+    }
+    if (argc == 3 && strcmp(argv[1], "forget") == 0) {
+        slot = discovery_parse_slot(argv[2]);
+        if (slot < 0) return 1;
+        return discovery_queue_request(REQUEST_FORGET, (unsigned int) slot);
+    }
+    if (argc == 2) {
+        slot = discovery_parse_slot(argv[1]);
+        if (slot < 0) return 1;
+        if (__atomic_load_n(&discovery_attached[slot], __ATOMIC_RELAXED)) {
+            printf("controller %d connected, switch it off first\n", slot + 1);
+            return 1;
+        }
+        return discovery_queue_request(REQUEST_DISCOVER, (unsigned int) slot);
+    }
+    printf("usage: %s [<controller>|stop|forget <controller>]\n", argv[0]);
+    return 1;
+}
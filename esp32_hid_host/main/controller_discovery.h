@@ -0,0 +1,87 @@
+/*
+ * controller_discovery.h
+ *
+ * Finds a new controller without its address compiled in. A discovery
+ * runs short inquiries and keeps the devices whose Class of Device is a
+ * gamepad or joystick, ranked by the RSSI of their inquiry response. The
+ * first one that responds is handed to its controller slot at once, for
+ * SDP and the HID channels, while the inquiry goes on; if it does not
+ * connect, the strongest of the others is next. The address that
+ * connected is remembered in NVS and used from the next boot on.
+ */
+
+#ifndef CONTROLLER_DISCOVERY_H
+#define CONTROLLER_DISCOVERY_H
+
+#include <stdint.h>
+
+#include "btstack.h"
+
+#define CONTROLLER_DISCOVERY_SLOTS      4   // one per controller
+#define CONTROLLER_DISCOVERY_CANDIDATES 8
+
+// discovery states
+#define CONTROLLER_DISCOVERY_IDLE       0
+#define CONTROLLER_DISCOVERY_RUNNING    1   // inquiring or connecting a candidate
+#define CONTROLLER_DISCOVERY_CONNECTED  2
+#define CONTROLLER_DISCOVERY_FAILED     3   // no candidate connected within the inquiries
+
+typedef struct {
+    bd_addr_t addr;
+    uint32_t  class_of_device;
+    int8_t    rssi;                     // dBm, -127 if the response had none
+    uint8_t   tried;                    // handed to the slot already
+} controller_discovery_candidate_t;
+
+typedef struct {
+    uint8_t  state;
+    uint8_t  slot;                      // controller the last discovery was for
+    uint8_t  inquiries;
+    uint8_t  candidates;
+    uint32_t responses;                 // inquiry responses of any device
+    uint32_t filtered;                  // of them, no gamepad or joystick
+    uint32_t attempts;                  // candidates handed to the slot
+    uint32_t first_response_ms;         // start to the first gamepad response, 0 until then
+    uint32_t connect_ms;                // start to the open HID channels, 0 until then
+} controller_discovery_stats_t;
+
+/*
+ * hands a candidate to its controller slot
+ * @return 0 if the slot cannot take it yet, the discovery asks again later
+ */
+typedef int (*controller_discovery_handler_t)(unsigned int slot, const bd_addr_t addr);
+
+/* loads the remembered addresses, registers for HCI events and starts the request timer */
+void controller_discovery_init(unsigned int num_slots, controller_discovery_handler_t handler);
+
+/*
+ * looks up the address remembered for a controller slot
+ * @return 1 if there is one
+ */
+int controller_discovery_remembered(unsigned int slot, bd_addr_t addr);
+
+/* starts a discovery for a slot, after the one running */
+void controller_discovery_start(unsigned int slot);
+
+/* the candidate handed to a slot did not connect, the next one is tried */
+void controller_discovery_failed(unsigned int slot);
+
+/* the HID channels of a slot opened, completes its discovery if it was for this address */
+void controller_discovery_attach(unsigned int slot, const bd_addr_t addr);
+
+/* the HID channels of a slot closed */
+void controller_discovery_detach(unsigned int slot);
+
+/* copies the statistics of the last discovery */
+void controller_discovery_get_stats(controller_discovery_stats_t *stats);
+
+/*
+ * copies a candidate of the last discovery, strongest first
+ * @return 0 past the last one
+ */
+int controller_discovery_get_candidate(unsigned int index, controller_discovery_candidate_t *candidate);
+
+/* console command: "discover" prints the discovery, "discover <controller>|stop|forget <controller>" */
+int controller_discovery_command(int argc, char **argv);
+
+#endif
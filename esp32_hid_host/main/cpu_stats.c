@@ -0,0 +1,69 @@
+/*
+ * cpu_stats.c
+ *
+ * The idle task of a core runs whenever nothing else does, so the growth
+ * of its run-time counter over the growth of the total run time is the
+ * headroom left on that core.
+ */
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "cpu_stats.h"
+#include "log_ring.h"
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+
+#define CPU_STATS_STACK_SIZE 2048
+#define CPU_STATS_PRIORITY   1
+#define CPU_STATS_PERIOD_MS  10000
+#define CPU_STATS_MAX_TASKS  24
+
+static TaskStatus_t cpu_stats_tasks[CPU_STATS_MAX_TASKS];
+
+static void cpu_stats_task(void *arg) {
+    uint32_t last_idle[portNUM_PROCESSORS] = {0};
+    uint32_t last_total = 0;
+    (void) arg;
+
+    for (;;) {
+        uint32_t    idle[portNUM_PROCESSORS] = {0};
+        uint32_t    total;
+        UBaseType_t num_tasks;
+        UBaseType_t i;
+        int cpu;
+
+        num_tasks = uxTaskGetSystemState(cpu_stats_tasks, CPU_STATS_MAX_TASKS, &total);
+        for (i = 0; i < num_tasks; i++) {
+            for (cpu = 0; cpu < portNUM_PROCESSORS; cpu++) {
+                if (cpu_stats_tasks[i].xHandle == xTaskGetIdleTaskHandleForCPU(cpu)) {
+                    idle[cpu] = cpu_stats_tasks[i].ulRunTimeCounter;
+                }
+            }
+        }
+        // uxTaskGetSystemState() returns 0 if there were more tasks than slots
+        if (num_tasks && last_total && total != last_total) {
+            for (cpu = 0; cpu < portNUM_PROCESSORS; cpu++) {
+                log_ring_write(LOG_CPU_IDLE, cpu,
+                               (int32_t)(((uint64_t)(idle[cpu] - last_idle[cpu]) * 100) / (total - last_total)));
+            }
+        }
+        for (cpu = 0; cpu < portNUM_PROCESSORS; cpu++) {
+            last_idle[cpu] = idle[cpu];
+        }
+        last_total = total;
+        vTaskDelay(pdMS_TO_TICKS(CPU_STATS_PERIOD_MS));
+    }
+}
+
+void cpu_stats_start(void) {
+    xTaskCreatePinnedToCore(cpu_stats_task, "cpu_stats", CPU_STATS_STACK_SIZE, NULL, CPU_STATS_PRIORITY, NULL, 0);
+}
+
+#else
+
+void cpu_stats_start(void) {
+}
+
+#endif
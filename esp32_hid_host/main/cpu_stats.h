@@ -0,0 +1,14 @@
+/*
+ * cpu_stats.h
+ *
+ * CPU headroom: a low priority task samples the FreeRTOS run-time
+ * counters and logs the idle share of every core.
+ */
+
+#ifndef CPU_STATS_H
+#define CPU_STATS_H
+
+/* starts the sampling task, does nothing without CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS */
+void cpu_stats_start(void);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * drive_mixer.c
+ *
+ * Axes are signed deflections from the center, both ends clamped to
+ * DRIVE_MIXER_FULL so the travel is symmetric. The deadzone turns a
+ * deflection into a gain, 2.30, that every motor output takes with a
+ * single rounding: 1 / |deflection| comes from an inverse square root of
+ * the squared deflection, refined by Newton-Raphson from a linear estimate
+ * on [0.25, 1). The saturation of arcade mixes divides by the reciprocal
+ * of the same kind of estimate, 48/17 - 32/17 d for d in [0.5, 1). The
+ * ESP32 has no double precision FPU and no integer divide faster than
+ * that.
+ */
+
+#include <stdlib.h>
+
+#include "drive_mixer.h"
+#include "hid_decoder.h"
+
+#define GAIN_ONE            (1ll << 30)
+#define RSQRT_SEED_A        2362232013ll    // 2.2, 2.30
+#define RSQRT_SEED_B        1288490189ll    // 1.2, 2.30
+#define RSQRT_STEPS         4
+#define RECIPROCAL_SEED_A   3031741621ll    // 48/17, 2.30
+#define RECIPROCAL_SEED_B   2021161081ll    // 32/17, 2.30
+#define RECIPROCAL_STEPS    3
+
+/* @return an axis as a signed deflection from the center */
+static int32_t drive_mixer_axis(uint16_t value) {
+    int32_t axis = (int32_t) value - HID_DECODER_JOYSTICK_CENTER;
+    return axis < -DRIVE_MIXER_FULL ? -DRIVE_MIXER_FULL : axis;
+}
+
+/* @return 1 / sqrt(value) as 18.46, value above 0 */
+static uint64_t drive_mixer_rsqrt(uint32_t value) {
+    int      shift = __builtin_clz(value) & ~1;
+    uint64_t u = (uint64_t)(value << shift);   // 0.32, 0.25 <= u < 1
+    uint64_t y = (uint64_t)(RSQRT_SEED_A - (int64_t)((RSQRT_SEED_B * u) >> 32));
+    int i;
+
+    for (i = 0; i < RSQRT_STEPS; i++) {
+        // y = y (3 - u y^2) / 2
+        uint64_t uy2 = (u * ((y * y) >> 30)) >> 32;
+        y = (y * ((3ull << 30) - uy2)) >> 31;
+    }
+    // 1 / sqrt(value) = y 2^(shift / 2 - 46)
+    return y << (shift >> 1);
+}
+
+/*
+ * @return value * num / den rounded, without a divide
+ * |value| * num stays below 2^31, den above 0
+ */
+static int32_t drive_mixer_scale(int32_t value, uint32_t num, uint32_t den) {
+    int      shift = __builtin_clz(den);
+    uint64_t d = (uint64_t)(den << shift);     // 0.32, 0.5 <= d < 1
+    int64_t  r = RECIPROCAL_SEED_A - (int64_t)((RECIPROCAL_SEED_B * d) >> 32);
+    uint64_t product;
+    int i;
+
+    for (i = 0; i < RECIPROCAL_STEPS; i++) {
+        // r += r (1 - d r)
+        int64_t error = GAIN_ONE - (int64_t)((d * (uint64_t) r) >> 32);
+        r += (r * error) >> 30;
+    }
+    // 1 / den = r 2^(shift - 62)
+    product = (uint64_t) abs(value) * num;
+    product = (product * (uint64_t) r + (1ull << (61 - shift))) >> (62 - shift);
+    return value < 0 ? -(int32_t) product : (int32_t) product;
+}
+
+/* @return value * gain rounded, gain 2.30 */
+static int32_t drive_mixer_apply(int32_t value, uint32_t gain) {
+    int64_t product = (int64_t) value * gain;
+    return (int32_t)(product < 0 ? -((-product + (GAIN_ONE >> 1)) >> 30) : (product + (GAIN_ONE >> 1)) >> 30);
+}
+
+/*
+ * @return gain of a deflection past the radial deadzone, 2.30: 0 inside,
+ * full travel on and beyond the circle of DRIVE_MIXER_FULL
+ */
+static uint32_t drive_mixer_gain(const drive_mixer_stick_t *stick, int32_t x, int32_t y) {
+    uint32_t magnitude_squared = (uint32_t)(x * x) + (uint32_t)(y * y);
+    uint64_t inverse;
+
+    if (magnitude_squared <= (uint32_t) stick->deadzone * stick->deadzone) return 0;
+    inverse = drive_mixer_rsqrt(magnitude_squared);
+    if (magnitude_squared >= (uint32_t) DRIVE_MIXER_FULL * DRIVE_MIXER_FULL) {
+        return (uint32_t)((DRIVE_MIXER_FULL * inverse) >> 16);
+    }
+    // (1 - deadzone / magnitude) full / (full - deadzone)
+    return (uint32_t)(((((1ull << 46) - stick->deadzone * inverse) >> 16) * stick->gain) >> 24);
+}
+
+void drive_mixer_stick_init(drive_mixer_stick_t *stick, uint16_t deadzone) {
+    if (deadzone > DRIVE_MIXER_DEADZONE_MAX) deadzone = DRIVE_MIXER_DEADZONE_MAX;
+    stick->deadzone = deadzone;
+    stick->gain = (uint32_t)((((uint64_t) DRIVE_MIXER_FULL << 24) + (DRIVE_MIXER_FULL - deadzone) / 2)
+                             / (DRIVE_MIXER_FULL - deadzone));
+}
+
+void drive_mixer_arcade(const drive_mixer_stick_t *stick, uint16_t x, uint16_t y, int32_t *left, int32_t *right) {
+    int32_t  steer = drive_mixer_axis(x);
+    int32_t  throttle = -drive_mixer_axis(y);
+    uint32_t gain = drive_mixer_gain(stick, steer, throttle);
+    uint32_t peak = (uint32_t)(abs(throttle) + abs(steer));
+
+    // the faster motor runs at |throttle| + |steer|, up to sqrt(2) full along the diagonals
+    if ((uint64_t) peak * gain > ((uint64_t) DRIVE_MIXER_FULL << 30)) {
+        // scaled back to full travel the gain cancels out
+        *left = drive_mixer_scale(throttle + steer, DRIVE_MIXER_FULL, peak);
+        *right = drive_mixer_scale(throttle - steer, DRIVE_MIXER_FULL, peak);
+        return;
+    }
+    *left = drive_mixer_apply(throttle + steer, gain);
+    *right = drive_mixer_apply(throttle - steer, gain);
+}
+
+int32_t drive_mixer_tank(const drive_mixer_stick_t *stick, uint16_t x, uint16_t y) {
+    int32_t deflection_y = -drive_mixer_axis(y);
+
+    return drive_mixer_apply(deflection_y, drive_mixer_gain(stick, drive_mixer_axis(x), deflection_y));
+}
+
+uint32_t drive_mixer_output(int32_t mix, uint32_t min, uint32_t max, int reversible) {
+    uint32_t span = max - min;
+    uint32_t position;
+
+    if (mix > DRIVE_MIXER_FULL) mix = DRIVE_MIXER_FULL;
+    if (mix < -DRIVE_MIXER_FULL) mix = -DRIVE_MIXER_FULL;
+    if (reversible) {
+        // 1..65535 over the span, the middle at rest
+        position = (uint32_t)(mix + DRIVE_MIXER_FULL + 1);
+    } else {
+        position = mix > 0 ? (uint32_t) mix << 1 : 0;
+    }
+    return min + ((position * span + 0x8000) >> 16);
+}
@@ -0,0 +1,49 @@
+/*
+ * drive_mixer.h
+ *
+ * Differential drive mixing of the sticks in integer fixed point. A stick
+ * first passes a radial deadzone: inside the circle it is at rest, outside
+ * its deflection is rescaled so the edge of the deadzone is zero and full
+ * travel stays full, in any direction. Arcade mixes one stick into both
+ * motors, throttle on Y and steering on X; tank takes the Y of each stick
+ * as one track. Mixes that would drive a motor beyond full travel scale
+ * both motors down together, so the turn keeps its ratio.
+ *
+ * The mix of a control tick takes multiplies and shifts only: the square
+ * root and the divides a rescale needs are reciprocals refined by
+ * Newton-Raphson steps. Only setting a deadzone divides.
+ */
+
+#ifndef DRIVE_MIXER_H
+#define DRIVE_MIXER_H
+
+#include <stdint.h>
+
+#define DRIVE_MIXER_FULL                32767   // motor output at full travel, -DRIVE_MIXER_FULL full reverse
+#define DRIVE_MIXER_DEADZONE_DEFAULT    3277    // 10 % of the travel
+#define DRIVE_MIXER_DEADZONE_MAX        16384   // half the travel
+
+typedef struct {
+    uint16_t deadzone;  // radius at rest, in DRIVE_MIXER_FULL units
+    uint32_t gain;      // DRIVE_MIXER_FULL / (DRIVE_MIXER_FULL - deadzone), 8.24
+} drive_mixer_stick_t;
+
+/* sets a stick's deadzone, clamped to DRIVE_MIXER_DEADZONE_MAX */
+void drive_mixer_stick_init(drive_mixer_stick_t *stick, uint16_t deadzone);
+
+/*
+ * mixes one stick into both motors of an arcade drive
+ * @param x, y the stick's 16 bit axes, up and left report 0
+ */
+void drive_mixer_arcade(const drive_mixer_stick_t *stick, uint16_t x, uint16_t y, int32_t *left, int32_t *right);
+
+/* @return the track of a tank drive a stick sets: its Y past the radial deadzone */
+int32_t drive_mixer_tank(const drive_mixer_stick_t *stick, uint16_t x, uint16_t y);
+
+/*
+ * maps a motor output onto an output's range: a reversible output rests
+ * in the middle, reverse toward min; any other only runs forward from min
+ */
+uint32_t drive_mixer_output(int32_t mix, uint32_t min, uint32_t max, int reversible);
+
+#endif
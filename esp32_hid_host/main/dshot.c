@@ -0,0 +1,92 @@
+/*
+ * dshot.c
+ *
+ * The RMT runs from the 80 MHz APB clock undivided, 12.5 ns per tick:
+ * DShot600 is 133 ticks per bit (1.66 us), 100 high for a one (1.25 us)
+ * and 50 for a zero (0.625 us); DShot300 and DShot150 are two and four
+ * times that. A frame fits one 64 item memory block.
+ *
+ * The driver is not installed: dshot_write() fills the memory block with
+ * rmt_fill_tx_items() and dshot_start() starts the channels, so sending
+ * takes no interrupt and no task. Filling all channels first and starting
+ * them back to back puts the frames of all motors on the wires within a
+ * few APB cycles of each other, the same pattern as motor_pwm_commit().
+ */
+
+#include "dshot.h"
+
+#define DSHOT_RMT_CLOCK_DIV  1
+#define DSHOT_CHANNELS       RMT_CHANNEL_MAX
+
+static const dshot_timing_t dshot_timings[DSHOT_PROTOCOL_COUNT] = {
+    // bit period, then 3/4 and 3/8 of it high
+    [DSHOT_150] = { 533, 400, 200 },
+    [DSHOT_300] = { 266, 200, 100 },
+    [DSHOT_600] = { 133, 100, 50 },
+};
+
+static uint8_t dshot_protocols[DSHOT_CHANNELS];
+
+const dshot_timing_t *dshot_get_timing(dshot_protocol_t protocol) {
+    return &dshot_timings[protocol];
+}
+
+uint16_t dshot_frame(uint16_t value, int telemetry) {
+    uint16_t data = (uint16_t)(((value & DSHOT_VALUE_MAX) << 1) | (telemetry ? 1 : 0));
+    uint16_t crc = (data ^ (data >> 4) ^ (data >> 8)) & 0xf;
+
+    return (uint16_t)((data << 4) | crc);
+}
+
+void dshot_encode(dshot_protocol_t protocol, uint16_t frame, rmt_item32_t *items) {
+    const dshot_timing_t *timing = &dshot_timings[protocol];
+    int i;
+
+    for (i = 0; i < DSHOT_BITS; i++) {
+        uint16_t high = (frame & (0x8000 >> i)) ? timing->one_high_ticks : timing->zero_high_ticks;
+        items[i].val = 0;
+        items[i].level0    = 1;
+        items[i].duration0 = high;
+        items[i].level1    = 0;
+        items[i].duration1 = timing->bit_ticks - high;
+    }
+    // a zero duration stops the transmitter, the line stays at its idle low
+    items[DSHOT_BITS].val = 0;
+}
+
+esp_err_t dshot_init_channel(rmt_channel_t channel, gpio_num_t gpio, dshot_protocol_t protocol) {
+    rmt_config_t config = {0};
+
+    config.rmt_mode = RMT_MODE_TX;
+    config.channel = channel;
+    config.clk_div = DSHOT_RMT_CLOCK_DIV;
+    config.gpio_num = gpio;
+    config.mem_block_num = 1;
+    config.tx_config.loop_en = false;
+    config.tx_config.carrier_en = false;
+    config.tx_config.idle_level = RMT_IDLE_LEVEL_LOW;
+    config.tx_config.idle_output_en = true;
+    dshot_protocols[channel] = (uint8_t) protocol;
+    return rmt_config(&config);
+}
+
+esp_err_t dshot_write(rmt_channel_t channel, uint16_t frame) {
+    rmt_item32_t items[DSHOT_ITEMS];
+
+    dshot_encode((dshot_protocol_t) dshot_protocols[channel], frame, items);
+    return rmt_fill_tx_items(channel, items, DSHOT_ITEMS, 0);
+}
+
+esp_err_t dshot_start(uint32_t channel_mask) {
+    esp_err_t result = ESP_OK;
+    esp_err_t err;
+    int channel;
+
+    while (channel_mask) {
+        channel = __builtin_ctz(channel_mask);
+        channel_mask &= channel_mask - 1;
+        err = rmt_tx_start((rmt_channel_t) channel, true);
+        if (err != ESP_OK && result == ESP_OK) result = err;
+    }
+    return result;
+}
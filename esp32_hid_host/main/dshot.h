@@ -0,0 +1,61 @@
+/*
+ * dshot.h
+ *
+ * DShot digital ESC output on the RMT peripheral. A frame is 16 bits, MSB
+ * first: an 11 bit value (0 disarmed, 1..47 commands, 48..2047 throttle),
+ * the telemetry request bit and a 4 bit CRC. Every bit is one RMT item, a
+ * high pulse of 3/8 (0) or 3/4 (1) of the bit period followed by low.
+ * Unlike PWM a frame needs no endpoint calibration and goes out as soon
+ * as it is started, but the ESC needs one every few milliseconds.
+ *
+ * The frame encoding is pure and runs on the host as well.
+ */
+
+#ifndef DSHOT_H
+#define DSHOT_H
+
+#include <stdint.h>
+
+#include "driver/gpio.h"
+#include "driver/rmt.h"
+#include "esp_err.h"
+
+#define DSHOT_BITS           16
+#define DSHOT_VALUE_BITS     11
+#define DSHOT_ITEMS          (DSHOT_BITS + 1)   // one per bit and the end marker
+#define DSHOT_VALUE_MAX      2047
+#define DSHOT_THROTTLE_MIN   48                 // values below are commands
+#define DSHOT_RMT_CLOCK_HZ   80000000           // APB clock, RMT divider 1
+
+typedef enum {
+    DSHOT_150 = 0,
+    DSHOT_300,
+    DSHOT_600,
+    DSHOT_PROTOCOL_COUNT
+} dshot_protocol_t;
+
+typedef struct {
+    uint16_t bit_ticks;         // RMT ticks per bit
+    uint16_t one_high_ticks;
+    uint16_t zero_high_ticks;
+} dshot_timing_t;
+
+/* @return the RMT timing of a protocol */
+const dshot_timing_t *dshot_get_timing(dshot_protocol_t protocol);
+
+/* @return the frame of an 11 bit value with the telemetry request bit and CRC */
+uint16_t dshot_frame(uint16_t value, int telemetry);
+
+/* encodes a frame into DSHOT_ITEMS RMT items, end marker included */
+void dshot_encode(dshot_protocol_t protocol, uint16_t frame, rmt_item32_t *items);
+
+/* configures an RMT channel to send frames of a protocol on a GPIO */
+esp_err_t dshot_init_channel(rmt_channel_t channel, gpio_num_t gpio, dshot_protocol_t protocol);
+
+/* encodes a frame into the channel's RMT memory, nothing is sent before dshot_start */
+esp_err_t dshot_write(rmt_channel_t channel, uint16_t frame);
+
+/* starts the written frames of the channels in the mask back to back */
+esp_err_t dshot_start(uint32_t channel_mask);
+
+#endif
@@ -39,81 +39,131 @@
 
 /* EXAMPLE_START(hid_host_demo): HID Host Demo
  *
- * @text This example implements an HID Host for the ESP32. For now, it connects to a fixed Xbox One Controller, queries the HID SDP
- * record and opens the HID Control + Interrupt channels
+ * @text This example implements an HID Host for the ESP32. It connects to Xbox One Controllers, configured or found by
+ * inquiry, queries the HID SDP record and opens the HID Control + Interrupt channels
  */
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <math.h>
 
 #include "btstack_config.h"
 #include "btstack.h"
-#include "driver/ledc.h"
+#include "btstack_link_key_db_tlv.h"
+#include "btstack_tlv.h"
 #include "esp_err.h"
-
-#define MAX_ATTRIBUTE_VALUE_SIZE 300
-#define HUNDRED 100
-// ### Xbox One Controller
-// Address
-#define MAC_ADDRESS "5C-BA-37-FE-E0-03"
-// Controls
-#define JOYSTICK_FULL 65535
-#define TRIGGER_FULL 1023
-#define DPAD_UP 1
-#define DPAD_RIGHT 3
-#define DPAD_DOWN 5
-#define DPAD_LEFT 7
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "controller_discovery.h"
+#include "hid_cache.h"
+#include "hid_decoder.h"
+#include "input_route.h"
+#include "log_ring.h"
+#include "motor_pwm.h"
+#include "motion_stage.h"
+#include "control_loop.h"
+#include "cpu_stats.h"
+#include "hid_console.h"
+#include "latency_stats.h"
+#include "haptics.h"
+#include "hid_control.h"
+#include "link_policy.h"
+#include "report_capture.h"
+#include "state_mailbox.h"
+#include "telemetry.h"
+#include "response_curve.h"
+#include "sdp_hid_parser.h"
+
+// ### Xbox One Controllers
+// controllers to connect, comma separated, at most MAX_CONTROLLERS; with no address
+// configured or remembered every controller is found by inquiry at boot, otherwise
+// the empty ones wait for the 'discover' command; an address remembered from a
+// discovery replaces the configured one
+#ifndef CONTROLLER_ADDRESSES
+#define CONTROLLER_ADDRESSES ""
+#endif
+#define MAX_CONTROLLERS 2 // simultaneous HID sessions, the controller allows 7 ACL links
+#define CID_TABLE_SIZE 64 // local L2CAP cids, direct-mapped by their low bits
+#define SDP_QUERY_RETRY_MS 100
+// reconnect
+#define RECONNECT_DELAY_MIN_MS 250 // paging backoff, doubles per failed attempt
+#define RECONNECT_DELAY_MAX_MS 4000
+#define RECONNECT_TARGET_MS 2000 // link loss to first report
+#define THROUGHPUT_PERIOD_MS 10000
+// Controls, the routing table (input_route.h) maps them onto the outputs
 #define BUTTON_A 1
-#define BUTTON_B 2
-#define BUTTON_X 4
 #define BUTTON_Y 8
-#define BUTTON_LEFT 16
-#define BUTTON_RIGHT 32
 #define BUTTON_BACK 64
 #define BUTTON_START 128
-#define LEFT_STICK_PUSH 1
-#define RIGHT_STICK_PUSH 2
-// Bluetooth packets
-#define JOYSTICK_PACKET_SIZE 4 // 2 bytes for x and y
-#define TRIGGER_PACKET_SIZE 2 // just one direction
-// PWM
-#define PWM_FREQ 62 // Hz
-#define MOTOR_PWM_CHANNEL_1 LEDC_CHANNEL_1
-#define MOTOR_PWM_CHANNEL_2 LEDC_CHANNEL_2
-#define MOTOR_PWM_CHANNEL_3 LEDC_CHANNEL_3
-#define LED_PWM_CHANNEL_4 LEDC_CHANNEL_4
-#define MOTOR_PWM_TIMER LEDC_TIMER_1
-#define MOTOR_PWM_BIT_NUM LEDC_TIMER_10_BIT
-// GPIO
-#define PWM1_PIN GPIO_NUM_19
-#define PWM2_PIN GPIO_NUM_21
-#define PWM3_PIN GPIO_NUM_18
-#define LED_PIN GPIO_NUM_17
+#define CONTROLLER_ALL_FIELDS ((1u << HID_FIELD_COUNT) - 1)
+// Control loop
+#define CONTROL_LOOP_PERIOD_US 2000 // 500 Hz, the motion stage moves the outputs several times per report
+// ESC calibration
+#define CALIBRATION_BUTTONS (BUTTON_BACK | BUTTON_START)
+#define CALIBRATION_TRIGGER_FULL 1023 // full trigger travel drives the whole range of the output's mode while calibrating
+#define CALIBRATION_SAVE_POLL_MS 100 // the Bluetooth side writes finished endpoints to NVS within this
+// Haptics
+#define HAPTICS_LIMIT_MAGNITUDE 30 // % trigger rumble while its output sits at the end of its range
+
+#if MAX_CONTROLLERS > STATE_MAILBOX_SLOTS || MAX_CONTROLLERS > INPUT_ROUTE_MAX_SLOTS || MAX_CONTROLLERS > CONTROLLER_DISCOVERY_SLOTS
+#error "every controller needs its own state mailbox slot, routes and discovery slot"
+#endif
+
+// one HID host session
+typedef struct {
+    bd_addr_t           remote_addr;
+
+    // SDP
+    uint32_t            hid_descriptor_len;
+    uint32_t            hid_descriptor_hash;
+    hid_decoder_t       hid_decoder;
+    uint16_t            hid_control_psm;
+    uint16_t            hid_interrupt_psm;
+    uint8_t             sdp_pending;        // waits for its SDP query
+    uint8_t             cached;             // connected with the cached SDP results
+    uint8_t             incoming;           // the controller opened the channels
+    uint8_t             discovered;         // handed over by the discovery, not connected yet
+
+    // L2CAP
+    uint16_t            l2cap_hid_control_cid;
+    uint16_t            l2cap_hid_interrupt_cid;
+
+    // reports carry a subset of the fields, so the state accumulates them
+    hid_gamepad_state_t state;
+    hid_gamepad_state_t published_state;
+    uint32_t            reports;
+    uint32_t            reports_logged;
+    uint8_t             first_report_logged;
+    uint32_t            last_report_us;     // arrival of the previous report
+
+    // reconnect
+    btstack_timer_source_t reconnect_timer;
+    uint16_t            reconnect_delay_ms;
+    int64_t             link_lost_us;       // 0 until the first link loss
+} hid_controller_t;
 
 // SDP
-static uint8_t            hid_descriptor[MAX_ATTRIBUTE_VALUE_SIZE];
-static uint16_t           hid_descriptor_len;
-
-static uint16_t           hid_control_psm;
-static uint16_t           hid_interrupt_psm;
-
-static uint8_t            attribute_value[MAX_ATTRIBUTE_VALUE_SIZE];
-static const unsigned int attribute_value_buffer_size = MAX_ATTRIBUTE_VALUE_SIZE;
-
-// L2CAP
-static uint16_t           l2cap_hid_control_cid;
-static uint16_t           l2cap_hid_interrupt_cid;
-
-// Xbox One Controller
-static const char * remote_addr_string = MAC_ADDRESS;
-
-static ledc_channel_config_t pwm1;
-static ledc_channel_config_t pwm2;
-static ledc_channel_config_t pwm3;
-static ledc_channel_config_t pwm4;
-
-static bd_addr_t remote_addr;
+static sdp_hid_parser_t   sdp_parser;
+static hid_controller_t  *sdp_query_controller;    // record being fetched, one query at a time
+static hid_decoder_t      sdp_decoder;             // compiled by the query, taken over once it completed
+static btstack_timer_source_t sdp_query_timer;
+
+// Xbox One Controllers
+static const char * const controller_addr_strings[] = { CONTROLLER_ADDRESSES };
+static hid_controller_t   hid_controllers[MAX_CONTROLLERS];
+static unsigned int       num_controllers;
+static uint8_t            controller_by_cid[CID_TABLE_SIZE]; // index + 1 into hid_controllers
+static btstack_timer_source_t throughput_timer;
+static uint8_t            controller_link_lost[MAX_CONTROLLERS]; // failsafe state published, the control task clears it
+// shadows of the last dispatched states, aligned for the word-wise diff, control task only
+static hid_gamepad_state_t dispatched_states[MAX_CONTROLLERS];
+
+// ESC calibration
+static int                   calibration_active;
+static unsigned int          calibration_slot;  // controller that entered it
+static uint8_t               calibration_save_pending; // set by the control task, the Bluetooth side clears it
+static btstack_timer_source_t calibration_save_timer;
 
 static btstack_packet_callback_registration_t hci_event_callback_registration;
 
@@ -124,27 +174,32 @@ static btstack_packet_callback_registration_t hci_event_callback_registration;
  */
 static void packet_handler (uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
 static void handle_sdp_client_query_result(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
-static void check_controller_joystick_left_move(uint16_t left_joy_x, uint16_t left_joy_y);
-static void check_controller_joystick_right_move(uint16_t right_joy_x, uint16_t right_joy_y);
-static void check_controller_trigger_left(uint16_t left_trigger_pos);
-static void check_controller_trigger_right(uint16_t right_trigger_pos);
-static float calc_speed_motor(uint16_t value);
-static void check_controller_dpad(uint8_t packet15);
-static void check_controller_button(uint8_t packet16);
-static void check_controller_joystick_push(uint8_t packet17);
-static int fill_joystick_data(uint8_t joystick_packets[], uint8_t *packet);
-static int fill_trigger_data(uint8_t trigger_packets[], uint8_t *packet);
-static void handle_controller_interrupts(uint8_t *packet, uint16_t size);
-static void motor_pwm_init(void);
-static void pwm1_duty_set(float perc);
-static void pwm2_duty_set(float perc);
-static void pwm3_duty_set(float perc);
-static void pwm4_duty_set(float perc);
+static void update_controller_haptics(unsigned int slot);
+static void drive_outputs(void);
+static void check_controller_calibration(unsigned int slot, uint8_t buttons);
+static void handle_controller_interrupts(hid_controller_t *controller, uint8_t *packet, uint16_t size,
+                                         uint32_t rx_us, uint32_t rx_cycles);
+static void handle_controller_state(unsigned int slot, const hid_gamepad_state_t *state, uint32_t updates);
 
 static void hid_host_setup(void){
+    const btstack_tlv_t *tlv_impl;
+    void *tlv_context;
+
     // Initialize L2CAP 
     l2cap_init();
 
+    // keep link keys across power cycles
+    btstack_tlv_get_instance(&tlv_impl, &tlv_context);
+    if (tlv_impl) {
+        hci_set_link_key_db(btstack_link_key_db_tlv_get_instance(tlv_impl, tlv_context));
+    }
+
+    // bonded controllers page us when they wake up
+    l2cap_register_service(packet_handler, PSM_HID_CONTROL, 48, LEVEL_2);
+    l2cap_register_service(packet_handler, PSM_HID_INTERRUPT, 48, LEVEL_2);
+    gap_discoverable_control(0);
+    gap_connectable_control(1);
+
     // register for HCI events
     hci_event_callback_registration.callback = &packet_handler;
     hci_add_event_handler(&hci_event_callback_registration);
@@ -153,114 +208,384 @@ static void hid_host_setup(void){
     setbuf(stdout, NULL);
 }
 
+/* finds the session a local L2CAP cid belongs to */
+static hid_controller_t * controller_for_cid(uint16_t cid) {
+    uint8_t           slot = controller_by_cid[cid & (CID_TABLE_SIZE - 1)];
+    hid_controller_t *controller;
+    unsigned int      i;
+
+    if (slot) {
+        controller = &hid_controllers[slot - 1];
+        if (controller->l2cap_hid_interrupt_cid == cid || controller->l2cap_hid_control_cid == cid) return controller;
+    }
+    // another live cid with the same low bits took the entry
+    for (i = 0; i < num_controllers; i++) {
+        controller = &hid_controllers[i];
+        if (controller->l2cap_hid_interrupt_cid == cid || controller->l2cap_hid_control_cid == cid) return controller;
+    }
+    return NULL;
+}
+
+static void controller_add_cid(hid_controller_t *controller, uint16_t cid) {
+    controller_by_cid[cid & (CID_TABLE_SIZE - 1)] = (uint8_t)(controller - hid_controllers + 1);
+}
+
+static void controller_query_next(void);
+
+static void controller_query_retry(btstack_timer_source_t *ts) {
+    UNUSED(ts);
+    controller_query_next();
+}
+
+/* starts the next pending SDP query, the SDP client serves one at a time */
+static void controller_query_next(void) {
+    hid_controller_t *controller = NULL;
+    uint8_t status;
+    unsigned int i;
+
+    if (sdp_query_controller) return;
+    for (i = 0; i < num_controllers && !controller; i++) {
+        if (hid_controllers[i].sdp_pending) controller = &hid_controllers[i];
+    }
+    if (!controller) return;
+    printf("Start SDP HID query for remote HID Device %s.\n", bd_addr_to_str(controller->remote_addr));
+    status = sdp_client_query_uuid16(&handle_sdp_client_query_result, controller->remote_addr,
+                                     BLUETOOTH_SERVICE_CLASS_HUMAN_INTERFACE_DEVICE_SERVICE);
+    if (status) {
+        // the previous query is still shutting down its L2CAP channel
+        btstack_run_loop_set_timer_handler(&sdp_query_timer, &controller_query_retry);
+        btstack_run_loop_set_timer(&sdp_query_timer, SDP_QUERY_RETRY_MS);
+        btstack_run_loop_add_timer(&sdp_query_timer);
+        return;
+    }
+    controller->sdp_pending = 0;
+    sdp_query_controller = controller;
+    // a cached decoder stays in use while SDP confirms it, the query only hashes the descriptor; otherwise
+    // it compiles aside, the open interrupt channel keeps decoding with the previous decoder
+    sdp_hid_parser_init(&sdp_parser, controller->cached ? NULL : &sdp_decoder);
+}
+
+/* opens the HID Control channel, the Interrupt channel follows once it is up */
+static void controller_connect(hid_controller_t *controller) {
+    uint8_t status;
+
+    printf("Setup HID\n");
+    status = l2cap_create_channel(packet_handler, controller->remote_addr, controller->hid_control_psm, 48, &controller->l2cap_hid_control_cid);
+    if (status){
+        printf("Connecting to HID Control failed: 0x%02x\n", status);
+        return;
+    }
+    controller_add_cid(controller, controller->l2cap_hid_control_cid);
+}
+
+/* connects with the cached SDP results if the controller is known, queries SDP otherwise */
+static void controller_start(hid_controller_t *controller) {
+    hid_cache_record_t record;
+
+    if (!hid_cache_load(controller->remote_addr, &record, &controller->hid_decoder)) {
+        controller->sdp_pending = 1;
+        return;
+    }
+    controller->hid_control_psm = record.hid_control_psm;
+    controller->hid_interrupt_psm = record.hid_interrupt_psm;
+    controller->hid_descriptor_len = record.hid_descriptor_len;
+    controller->hid_descriptor_hash = record.hid_descriptor_hash;
+    controller->cached = 1;
+    printf("HID Device %s cached, skipping SDP\n", bd_addr_to_str(controller->remote_addr));
+    controller_connect(controller);
+}
+
+static void controller_store_cache(hid_controller_t *controller) {
+    hid_cache_record_t record;
+
+    memcpy(record.remote_addr, controller->remote_addr, sizeof(bd_addr_t));
+    record.hid_control_psm = controller->hid_control_psm;
+    record.hid_interrupt_psm = controller->hid_interrupt_psm;
+    record.hid_descriptor_len = controller->hid_descriptor_len;
+    record.hid_descriptor_hash = controller->hid_descriptor_hash;
+    hid_cache_store(&record, &controller->hid_decoder);
+}
+
+/* drops cached SDP results that did not connect and falls back to a query */
+static void controller_invalidate_cache(hid_controller_t *controller) {
+    printf("Cached SDP results of %s failed, querying SDP\n", bd_addr_to_str(controller->remote_addr));
+    hid_cache_delete(controller->remote_addr);
+    controller->cached = 0;
+    controller->l2cap_hid_control_cid = 0;
+    controller->l2cap_hid_interrupt_cid = 0;
+    controller->hid_control_psm = 0;
+    controller->hid_interrupt_psm = 0;
+    controller->sdp_pending = 1;
+    controller_query_next();
+}
+
+/* finds the session of a configured controller by its address */
+static hid_controller_t * controller_for_addr(const bd_addr_t addr) {
+    unsigned int i;
+    for (i = 0; i < num_controllers; i++) {
+        if (memcmp(hid_controllers[i].remote_addr, addr, sizeof(bd_addr_t)) == 0) return &hid_controllers[i];
+    }
+    return NULL;
+}
+
+static void controller_reconnect(btstack_timer_source_t *ts) {
+    hid_controller_t *controller = (hid_controller_t *)((uint8_t *) ts - offsetof(hid_controller_t, reconnect_timer));
+
+    // the controller may have paged us in the meantime
+    if (controller->l2cap_hid_control_cid || controller->l2cap_hid_interrupt_cid) return;
+    if (controller->hid_interrupt_psm && controller->hid_decoder.num_reports) {
+        controller_connect(controller);
+    } else {
+        controller->sdp_pending = 1;
+        controller_query_next();
+    }
+}
+
+/* pages the controller again after the current backoff delay */
+static void controller_schedule_reconnect(hid_controller_t *controller) {
+    if (!controller->reconnect_delay_ms) {
+        controller->reconnect_delay_ms = RECONNECT_DELAY_MIN_MS;
+    }
+    btstack_run_loop_remove_timer(&controller->reconnect_timer);
+    btstack_run_loop_set_timer_handler(&controller->reconnect_timer, &controller_reconnect);
+    btstack_run_loop_set_timer(&controller->reconnect_timer, controller->reconnect_delay_ms);
+    btstack_run_loop_add_timer(&controller->reconnect_timer);
+    if (controller->reconnect_delay_ms < RECONNECT_DELAY_MAX_MS) {
+        controller->reconnect_delay_ms *= 2;
+    }
+}
+
+/* @return 1 if the controller has an address: configured, remembered or discovered */
+static int controller_assigned(const hid_controller_t *controller) {
+    static const bd_addr_t unassigned;
+    return memcmp(controller->remote_addr, unassigned, sizeof(bd_addr_t)) != 0;
+}
+
+/* takes over a controller the discovery found, @return 0 while the slot is busy with its previous address */
+static int controller_discovered(unsigned int slot, const bd_addr_t addr) {
+    hid_controller_t *controller = &hid_controllers[slot];
+
+    if (controller->l2cap_hid_control_cid || controller->l2cap_hid_interrupt_cid || sdp_query_controller == controller) return 0;
+    btstack_run_loop_remove_timer(&controller->reconnect_timer);
+    printf("Discovered HID Device %s for controller %u\n", bd_addr_to_str(addr), slot + 1);
+    memcpy(controller->remote_addr, addr, sizeof(bd_addr_t));
+    controller->cached = 0;
+    controller->sdp_pending = 0;
+    controller->hid_control_psm = 0;
+    controller->hid_interrupt_psm = 0;
+    controller->reconnect_delay_ms = 0;
+    controller->link_lost_us = 0;
+    controller->discovered = 1;
+    controller_start(controller);
+    controller_query_next();
+    return 1;
+}
+
+/* gives up on a discovered controller that did not connect, the slot goes back to its remembered address */
+static void controller_drop_discovered(hid_controller_t *controller) {
+    unsigned int slot = controller - hid_controllers;
+
+    controller->discovered = 0;
+    controller->cached = 0;
+    controller->sdp_pending = 0;
+    controller->hid_control_psm = 0;
+    controller->hid_interrupt_psm = 0;
+    if (!controller_discovery_remembered(slot, controller->remote_addr)) {
+        memset(controller->remote_addr, 0, sizeof(bd_addr_t));
+    }
+    if (controller_assigned(controller)) {
+        controller_schedule_reconnect(controller);
+    }
+    controller_discovery_failed(slot);
+}
+
+/* drives the outputs of a controller without link to their rest values */
+static void controller_failsafe(hid_controller_t *controller) {
+    memset(&controller->state, 0, sizeof(controller->state));
+    controller->state.value[HID_FIELD_LEFT_X] = HID_DECODER_JOYSTICK_CENTER;
+    controller->state.value[HID_FIELD_LEFT_Y] = HID_DECODER_JOYSTICK_CENTER;
+    controller->state.value[HID_FIELD_RIGHT_X] = HID_DECODER_JOYSTICK_CENTER;
+    controller->state.value[HID_FIELD_RIGHT_Y] = HID_DECODER_JOYSTICK_CENTER;
+    controller->published_state = controller->state;
+    // toggled outputs go to rest too, the control task sees the flag with the state
+    __atomic_store_n(&controller_link_lost[controller - hid_controllers], 1, __ATOMIC_RELAXED);
+    state_mailbox_publish(controller - hid_controllers, &controller->state, (uint32_t) esp_timer_get_time());
+}
+
+/* handles the close of one HID channel, the session ends with the first one */
+static void controller_channel_closed(hid_controller_t *controller, uint16_t l2cap_cid) {
+    if (l2cap_cid == controller->l2cap_hid_interrupt_cid) {
+        controller->l2cap_hid_interrupt_cid = 0;
+        controller_failsafe(controller);
+        link_policy_detach(controller - hid_controllers);
+        controller_discovery_detach(controller - hid_controllers);
+        haptics_detach(controller - hid_controllers);
+        hid_control_detach(controller - hid_controllers);
+        if (controller->l2cap_hid_control_cid) {
+            l2cap_disconnect(controller->l2cap_hid_control_cid, 0);
+        }
+    }
+    if (l2cap_cid == controller->l2cap_hid_control_cid) {
+        controller->l2cap_hid_control_cid = 0;
+        hid_control_detach(controller - hid_controllers);
+        if (controller->l2cap_hid_interrupt_cid) {
+            l2cap_disconnect(controller->l2cap_hid_interrupt_cid, 0);
+        }
+    }
+    if (controller->l2cap_hid_control_cid || controller->l2cap_hid_interrupt_cid) return;
+
+    printf("HID Connection %u closed\n", (unsigned int)(controller - hid_controllers) + 1);
+    controller->incoming = 0;
+    controller->first_report_logged = 0;
+    if (controller->discovered) {
+        // the candidate does not take our page
+        controller_drop_discovered(controller);
+        return;
+    }
+    controller->link_lost_us = esp_timer_get_time();
+    controller_schedule_reconnect(controller);
+}
+
+/* accepts the HID channels of a configured controller that pages us */
+static void controller_incoming_connection(uint8_t *packet) {
+    hid_controller_t *controller;
+    bd_addr_t event_addr;
+    uint16_t  l2cap_cid = l2cap_event_incoming_connection_get_local_cid(packet);
+
+    l2cap_event_incoming_connection_get_address(packet, event_addr);
+    controller = controller_for_addr(event_addr);
+    if (!controller) {
+        l2cap_decline_connection(l2cap_cid);
+        return;
+    }
+    switch (l2cap_event_incoming_connection_get_psm(packet)) {
+        case PSM_HID_CONTROL:
+            if (controller->l2cap_hid_control_cid) {
+                // our own page is under way
+                l2cap_decline_connection(l2cap_cid);
+                return;
+            }
+            controller->incoming = 1;
+            controller->l2cap_hid_control_cid = l2cap_cid;
+            break;
+        case PSM_HID_INTERRUPT:
+            if (controller->l2cap_hid_interrupt_cid || !controller->incoming) {
+                l2cap_decline_connection(l2cap_cid);
+                return;
+            }
+            controller->l2cap_hid_interrupt_cid = l2cap_cid;
+            break;
+        default:
+            l2cap_decline_connection(l2cap_cid);
+            return;
+    }
+    btstack_run_loop_remove_timer(&controller->reconnect_timer);
+    controller_add_cid(controller, l2cap_cid);
+    l2cap_accept_connection(l2cap_cid);
+}
+
+/* logs the interrupt reports per second of every controller */
+static void controller_log_throughput(btstack_timer_source_t *ts) {
+    unsigned int i;
+
+    for (i = 0; i < num_controllers; i++) {
+        hid_controller_t *controller = &hid_controllers[i];
+        if (!controller->l2cap_hid_interrupt_cid) continue;
+        log_ring_write(LOG_CONTROLLER_REPORTS, i + 1,
+                       (controller->reports - controller->reports_logged) / (THROUGHPUT_PERIOD_MS / 1000));
+        controller->reports_logged = controller->reports;
+    }
+    btstack_run_loop_set_timer(ts, THROUGHPUT_PERIOD_MS);
+    btstack_run_loop_add_timer(ts);
+}
+
+/* takes over the results of a finished SDP query, the parser still holds them */
+static void controller_sdp_complete(hid_controller_t *controller, uint8_t status, int num_fields) {
+    if (status) {
+        printf("SDP query failed: 0x%02x\n", status);
+        if (!controller->l2cap_hid_control_cid && !controller->discovered) {
+            controller_schedule_reconnect(controller);
+        }
+        return;
+    }
+    if (sdp_parser.malformed_attributes) {
+        printf("SDP record: %u malformed attributes skipped\n", (unsigned int) sdp_parser.malformed_attributes);
+    }
+    if (sdp_parser.hid_control_psm) {
+        controller->hid_control_psm = sdp_parser.hid_control_psm;
+        printf("HID Control PSM: 0x%04x\n", (int) controller->hid_control_psm);
+    }
+    if (sdp_parser.hid_interrupt_psm) {
+        controller->hid_interrupt_psm = sdp_parser.hid_interrupt_psm;
+        printf("HID Interrupt PSM: 0x%04x\n", (int) controller->hid_interrupt_psm);
+    }
+    if (!controller->hid_control_psm) {
+        printf("HID Control PSM missing\n");
+        return;
+    }
+    if (!controller->hid_interrupt_psm) {
+        printf("HID Interrupt PSM missing\n");
+        return;
+    }
+    if (!sdp_parser.hid_descriptor_found) {
+        printf("HID Descriptor missing\n");
+        return;
+    }
+    printf("HID Descriptor: %u bytes, hash 0x%08x\n", (unsigned int) sdp_parser.hid_descriptor_len,
+           (unsigned int) sdp_parser.hid_descriptor_hash);
+    if (controller->cached) {
+        // check of the cached results after connecting without SDP
+        if (sdp_parser.hid_descriptor_hash == controller->hid_descriptor_hash) return;
+        // the descriptor was only hashed, query again and compile it this time
+        printf("HID Descriptor changed\n");
+        hid_cache_delete(controller->remote_addr);
+        controller->cached = 0;
+        controller->sdp_pending = 1;
+        return;
+    }
+    if (!num_fields) {
+        printf("HID Descriptor has no usable input fields\n");
+        hid_cache_delete(controller->remote_addr);
+        return;
+    }
+    // only a complete decoder replaces the one in use
+    controller->hid_decoder = sdp_decoder;
+    printf("HID Decoder: %u reports, %u fields\n", controller->hid_decoder.num_reports, controller->hid_decoder.num_fields);
+    controller->hid_descriptor_len = sdp_parser.hid_descriptor_len;
+    controller->hid_descriptor_hash = sdp_parser.hid_descriptor_hash;
+    controller_store_cache(controller);
+    if (!controller->l2cap_hid_control_cid) {
+        controller_connect(controller);
+    }
+}
+
 /* @section SDP parser callback 
  * 
- * @text The SDP parsers retrieves the BNEP PAN UUID as explained in  
- * Section [on SDP BNEP Query example](#sec:sdpbnepqueryExample}.
+ * @text The attribute bytes go straight into the streaming HID record parser.
  */
 static void handle_sdp_client_query_result(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
     UNUSED(packet_type);
     UNUSED(channel);
     UNUSED(size);
 
-    des_iterator_t attribute_list_it;
-    des_iterator_t additional_des_it;
-    des_iterator_t prot_it;
-    uint8_t       *des_element;
-    uint8_t       *element;
-    uint32_t       uuid;
-    uint8_t        status;
+    hid_controller_t *controller = sdp_query_controller;
 
+    if (!controller) return;
     switch (hci_event_packet_get_type(packet)){
         case SDP_EVENT_QUERY_ATTRIBUTE_VALUE:
-            if (sdp_event_query_attribute_byte_get_attribute_length(packet) <= attribute_value_buffer_size) {
-                attribute_value[sdp_event_query_attribute_byte_get_data_offset(packet)] = sdp_event_query_attribute_byte_get_data(packet);
-                if ((uint16_t)(sdp_event_query_attribute_byte_get_data_offset(packet)+1) == sdp_event_query_attribute_byte_get_attribute_length(packet)) {
-                    switch(sdp_event_query_attribute_byte_get_attribute_id(packet)) {
-                        case BLUETOOTH_ATTRIBUTE_PROTOCOL_DESCRIPTOR_LIST:
-                            for (des_iterator_init(&attribute_list_it, attribute_value); des_iterator_has_more(&attribute_list_it); des_iterator_next(&attribute_list_it)) {                                    
-                                if (des_iterator_get_type(&attribute_list_it) != DE_DES) continue;
-                                des_element = des_iterator_get_element(&attribute_list_it);
-                                des_iterator_init(&prot_it, des_element);
-                                element = des_iterator_get_element(&prot_it);
-                                if (!element) continue;
-                                if (de_get_element_type(element) != DE_UUID) continue;
-                                uuid = de_get_uuid32(element);
-                                des_iterator_next(&prot_it);
-                                switch (uuid){
-                                    case BLUETOOTH_PROTOCOL_L2CAP:
-                                        if (!des_iterator_has_more(&prot_it)) continue;
-                                        de_element_get_uint16(des_iterator_get_element(&prot_it), &hid_control_psm);
-                                        printf("HID Control PSM: 0x%04x\n", (int) hid_control_psm);
-                                        break;
-                                    default:
-                                        break;
-                                }
-                            }
-                            break;
-                        case BLUETOOTH_ATTRIBUTE_ADDITIONAL_PROTOCOL_DESCRIPTOR_LISTS:
-                            for (des_iterator_init(&attribute_list_it, attribute_value); des_iterator_has_more(&attribute_list_it); des_iterator_next(&attribute_list_it)) {                                    
-                                if (des_iterator_get_type(&attribute_list_it) != DE_DES) continue;
-                                des_element = des_iterator_get_element(&attribute_list_it);
-                                for (des_iterator_init(&additional_des_it, des_element); des_iterator_has_more(&additional_des_it); des_iterator_next(&additional_des_it)) {                                    
-                                    if (des_iterator_get_type(&additional_des_it) != DE_DES) continue;
-                                    des_element = des_iterator_get_element(&additional_des_it);
-                                    des_iterator_init(&prot_it, des_element);
-                                    element = des_iterator_get_element(&prot_it);
-                                    if (!element) continue;
-                                    if (de_get_element_type(element) != DE_UUID) continue;
-                                    uuid = de_get_uuid32(element);
-                                    des_iterator_next(&prot_it);
-                                    switch (uuid){
-                                        case BLUETOOTH_PROTOCOL_L2CAP:
-                                            if (!des_iterator_has_more(&prot_it)) continue;
-                                            de_element_get_uint16(des_iterator_get_element(&prot_it), &hid_interrupt_psm);
-                                            printf("HID Interrupt PSM: 0x%04x\n", (int) hid_interrupt_psm);
-                                            break;
-                                        default:
-                                            break;
-                                    }
-                                }
-                            }
-                            break;
-                        case BLUETOOTH_ATTRIBUTE_HID_DESCRIPTOR_LIST:
-                            for (des_iterator_init(&attribute_list_it, attribute_value); des_iterator_has_more(&attribute_list_it); des_iterator_next(&attribute_list_it)) {
-                                if (des_iterator_get_type(&attribute_list_it) != DE_DES) continue;
-                                des_element = des_iterator_get_element(&attribute_list_it);
-                                for (des_iterator_init(&additional_des_it, des_element); des_iterator_has_more(&additional_des_it); des_iterator_next(&additional_des_it)) {                                    
-                                    if (des_iterator_get_type(&additional_des_it) != DE_STRING) continue;
-                                    element = des_iterator_get_element(&additional_des_it);
-                                    const uint8_t * descriptor = de_get_string(element);
-                                    hid_descriptor_len = de_get_data_size(element);
-                                    memcpy(hid_descriptor, descriptor, hid_descriptor_len);
-                                    printf("HID Descriptor:\n");
-                                    printf_hexdump(hid_descriptor, hid_descriptor_len);
-                                }
-                            }                        
-                            break;
-                        default:
-                            break;
-                    }
-                }
-            } else {
-                fprintf(stderr, "SDP attribute value buffer size exceeded: available %d, required %d\n", attribute_value_buffer_size, sdp_event_query_attribute_byte_get_attribute_length(packet));
-            }
+            sdp_hid_parser_byte(&sdp_parser, sdp_event_query_attribute_byte_get_attribute_id(packet),
+                                sdp_event_query_attribute_byte_get_data_offset(packet),
+                                sdp_event_query_attribute_byte_get_data(packet));
             break;
             
         case SDP_EVENT_QUERY_COMPLETE:
-            if (!hid_control_psm) {
-                printf("HID Control PSM missing\n");
-                break;
-            }
-            if (!hid_interrupt_psm) {
-                printf("HID Interrupt PSM missing\n");
-                break;
-            }
-            printf("Setup HID\n");
-            status = l2cap_create_channel(packet_handler, remote_addr, hid_control_psm, 48, &l2cap_hid_control_cid);
-            if (status){
-                printf("Connecting to HID Control failed: 0x%02x\n", status);
+            sdp_query_controller = NULL;
+            controller_sdp_complete(controller, sdp_event_query_complete_get_status(packet), sdp_hid_parser_finish(&sdp_parser));
+            if (controller->discovered && !controller->l2cap_hid_control_cid && !controller->sdp_pending) {
+                // no answer or no usable HID record, the discovery tries the next candidate
+                controller_drop_discovered(controller);
             }
+            controller_query_next();
             break;
     }
 }
@@ -277,6 +602,9 @@ static void packet_handler (uint8_t packet_type, uint16_t channel, uint8_t *pack
     bd_addr_t event_addr;
     uint8_t   status;
     uint16_t  l2cap_cid;
+    hid_controller_t *controller;
+    unsigned int i, assigned;
+    uint32_t  rx_us, rx_cycles;
 
     /* LISTING_RESUME */
     switch (packet_type) {
@@ -288,8 +616,18 @@ static void packet_handler (uint8_t packet_type, uint16_t channel, uint8_t *pack
                  */
                 case BTSTACK_EVENT_STATE:
                     if (btstack_event_state_get_state(packet) == HCI_STATE_WORKING){
-                        printf("Start SDP HID query for remote HID Device.\n");
-                        sdp_client_query_uuid16(&handle_sdp_client_query_result, remote_addr, BLUETOOTH_SERVICE_CLASS_HUMAN_INTERFACE_DEVICE_SERVICE);
+                        assigned = 0;
+                        for (i = 0; i < num_controllers; i++) {
+                            if (controller_assigned(&hid_controllers[i])) {
+                                controller_start(&hid_controllers[i]);
+                                assigned++;
+                            }
+                        }
+                        // inquiries hold off the known controllers, the empty slots next to them wait for 'discover'
+                        for (i = 0; !assigned && i < num_controllers; i++) {
+                            controller_discovery_start(i);
+                        }
+                        controller_query_next();
                     }
                     break;
 
@@ -305,39 +643,84 @@ static void packet_handler (uint8_t packet_type, uint16_t channel, uint8_t *pack
                     // inform about user confirmation request
                     printf("SSP User Confirmation Request with numeric value '%"PRIu32"'\n", little_endian_read_32(packet, 8));
                     printf("SSP User Confirmation Auto accept\n");
+                    hci_event_user_confirmation_request_get_bd_addr(packet, event_addr);
+                    gap_ssp_confirmation_response(event_addr);
                     break;
 
                 /* LISTING_RESUME */
 
                 case L2CAP_EVENT_CHANNEL_OPENED: 
                     status = packet[2];
+                    l2cap_cid  = little_endian_read_16(packet, 13);
+                    controller = l2cap_cid ? controller_for_cid(l2cap_cid) : NULL;
                     if (status){
                         printf("L2CAP Connection failed: 0x%02x\n", status);
+                        if (!controller) break;
+                        if (status == L2CAP_CONNECTION_RESPONSE_RESULT_REFUSED_PSM && controller->cached) {
+                            // the controller is there, but not at the cached PSMs
+                            controller->l2cap_hid_control_cid = 0;
+                            controller->l2cap_hid_interrupt_cid = 0;
+                            controller_invalidate_cache(controller);
+                            break;
+                        }
+                        controller_channel_closed(controller, l2cap_cid);
                         break;
                     }
-                    l2cap_cid  = little_endian_read_16(packet, 13);
-                    if (!l2cap_cid) break;
-                    if (l2cap_cid == l2cap_hid_control_cid){
-                        status = l2cap_create_channel(packet_handler, remote_addr, hid_interrupt_psm, 48, &l2cap_hid_interrupt_cid);
+                    if (!controller) break;
+                    if (l2cap_cid == controller->l2cap_hid_control_cid && !controller->incoming){
+                        status = l2cap_create_channel(packet_handler, controller->remote_addr, controller->hid_interrupt_psm, 48, &controller->l2cap_hid_interrupt_cid);
                         if (status){
                             printf("Connecting to HID Control failed: 0x%02x\n", status);
                             break;
                         }
+                        controller_add_cid(controller, controller->l2cap_hid_interrupt_cid);
                     }                        
-                    if (l2cap_cid == l2cap_hid_interrupt_cid){
-                        printf("HID Connection established\n");
+                    if (l2cap_cid == controller->l2cap_hid_interrupt_cid){
+                        printf("HID Connection %u established\n", (unsigned int)(controller - hid_controllers) + 1);
+                        controller->reconnect_delay_ms = 0;
+                        controller->discovered = 0;
+                        controller_discovery_attach(controller - hid_controllers, controller->remote_addr);
+                        link_policy_attach(controller - hid_controllers, l2cap_event_channel_opened_get_handle(packet),
+                                           controller->remote_addr);
+                        haptics_attach(controller - hid_controllers, l2cap_cid);
+                        hid_control_attach(controller - hid_controllers, controller->l2cap_hid_control_cid);
+                        if (controller->cached) {
+                            // confirm the cached descriptor in the background
+                            controller->sdp_pending = 1;
+                            controller_query_next();
+                        }
                     }
                     break;
+
+                case L2CAP_EVENT_INCOMING_CONNECTION:
+                    controller_incoming_connection(packet);
+                    break;
+
+                case L2CAP_EVENT_CHANNEL_CLOSED:
+                    l2cap_cid = l2cap_event_channel_closed_get_local_cid(packet);
+                    controller = controller_for_cid(l2cap_cid);
+                    if (!controller) break;
+                    controller_channel_closed(controller, l2cap_cid);
+                    break;
+
+                case L2CAP_EVENT_CAN_SEND_NOW:
+                    haptics_can_send_now(l2cap_event_can_send_now_get_local_cid(packet));
+                    hid_control_can_send_now(l2cap_event_can_send_now_get_local_cid(packet));
+                    break;
                 default:
                     break;
             }
             break;
         case L2CAP_DATA_PACKET:
-            if (channel == l2cap_hid_interrupt_cid){
-                handle_controller_interrupts(packet, size);
-            } else if (channel == l2cap_hid_control_cid){
-                printf("HID Control: ");
-                printf_hexdump(packet, size);
+            // the report latency counts from here
+            rx_cycles = latency_stats_cycles();
+            rx_us = (uint32_t) esp_timer_get_time();
+            controller = controller_for_cid(channel);
+            if (!controller) break;
+            if (channel == controller->l2cap_hid_interrupt_cid){
+                handle_controller_interrupts(controller, packet, size, rx_us, rx_cycles);
+            } else if (channel == controller->l2cap_hid_control_cid){
+                hid_control_packet(channel, packet, size);
             } else {
                 break;
             }
@@ -346,258 +729,249 @@ static void packet_handler (uint8_t packet_type, uint16_t channel, uint8_t *pack
     }
 }
 
-/* handles left Joystick rotation */
-/* 100 in y ist unten 0 ist oben
- 0 in x ist links 100 ist rechts*/
-static void check_controller_joystick_left_move(uint16_t left_joy_x, uint16_t left_joy_y) {
-    printf("LJoy_x: %d%\n",((left_joy_x * HUNDRED) / JOYSTICK_FULL));
-    printf("LJoy_y: %d%\n",((left_joy_y * HUNDRED) / JOYSTICK_FULL));
-    // ...
-}
-
-/* handles right Joystick rotation */
-static void check_controller_joystick_right_move(uint16_t right_joy_x, uint16_t right_joy_y) {
-    printf("RJoy_x: %d%\n",((right_joy_x * HUNDRED) / JOYSTICK_FULL));
-    printf("RJoy_y: %d%\n",((right_joy_y * HUNDRED) / JOYSTICK_FULL));
-    // ...
-}
-
-/* handles left Trigger (LT) position */
-static void check_controller_trigger_left(uint16_t left_trigger_pos) {
-    printf("LT: %d%\n",left_trigger_pos);
-    pwm1_duty_set(calc_speed_motor(left_trigger_pos));
-    // ...
-}
-
-/* handles right Trigger (RT) position */
-static void check_controller_trigger_right(uint16_t right_trigger_pos) {
-    printf("RT: %d%\n",right_trigger_pos);
-    pwm4_duty_set(calc_speed_motor(right_trigger_pos));
-    // ...
-}
+/*
+ * writes the endpoints of a finished calibration to NVS, from the Bluetooth
+ * side: the flash write stalls the cache for milliseconds, the control
+ * task would overrun its periods
+ */
+static void calibration_save(btstack_timer_source_t *ts) {
+    esp_err_t err;
 
-/* calculates the Dutycicle of the speedmotor  */
-static float calc_speed_motor(uint16_t value) {
-    return (0.124121 * value + 60.1); // make defines?
+    if (__atomic_exchange_n(&calibration_save_pending, 0, __ATOMIC_ACQUIRE)) {
+        err = response_curve_save();
+        if (err == ESP_OK) {
+            log_ring_write(LOG_CALIBRATION_SAVED, 0, 0);
+        } else {
+            log_ring_write(LOG_CALIBRATION_FAILED, err, 0);
+        }
+    }
+    btstack_run_loop_set_timer(ts, CALIBRATION_SAVE_POLL_MS);
+    btstack_run_loop_add_timer(ts);
 }
 
-/* handles directional-pad (Dpad) button presses */
-static void check_controller_dpad(uint8_t packet15) {
-    if(packet15 == DPAD_UP) {
-        printf("dpad Up pressed\n");
-    }
-    if(packet15 == DPAD_RIGHT) {
-        printf("dpad Right pressed\n");
+/*
+ * handles the ESC calibration mode
+ * Back+Start enters it, A and Y take the current pulse width of the last moved
+ * trigger as its minimum and maximum, Back+Start again has them saved to NVS
+ * the trigger is the last axis that swept an output through a curve route,
+ * only the controller that entered the mode takes endpoints and leaves it
+ */
+static void check_controller_calibration(unsigned int slot, uint8_t buttons) {
+    static uint8_t last_buttons[MAX_CONTROLLERS];
+    uint8_t pressed = buttons & ~last_buttons[slot];
+    response_curve_axis_t calibration_axis;
+    motor_pwm_output_t calibration_output;
+    int32_t out_min, out_max;
+
+    last_buttons[slot] = buttons;
+    if(calibration_active && slot != calibration_slot) return;
+    if((buttons & CALIBRATION_BUTTONS) == CALIBRATION_BUTTONS && (pressed & CALIBRATION_BUTTONS)) {
+        if(!calibration_active) {
+            calibration_active = 1;
+            calibration_slot = slot;
+            input_route_set_calibration(1);
+            log_ring_write(LOG_CALIBRATION_START, 0, 0);
+            return;
+        }
+        calibration_active = 0;
+        input_route_set_calibration(0);
+        __atomic_store_n(&calibration_save_pending, 1, __ATOMIC_RELEASE);
+        if(input_route_get_calibration(&calibration_axis, &calibration_output)) {
+            motion_stage_jump(calibration_output, input_route_axis_value(INPUT_TRANSFORM_CURVE, calibration_axis,
+                                                                         calibration_output, 0));
+        }
+        return;
     }
-    if(packet15 == DPAD_DOWN) {
-        printf("dpad Down pressed\n");
+    if(!calibration_active || !(pressed & (BUTTON_A | BUTTON_Y))
+            || !input_route_get_calibration(&calibration_axis, &calibration_output)) return;
+
+    // the curve table is only rebuilt for a new endpoint
+    response_curve_get_endpoints(calibration_axis, &out_min, &out_max);
+    if(pressed & BUTTON_A) {
+        out_min = motor_pwm_get_value(calibration_output);
+        log_ring_write(LOG_CALIBRATION_MIN, calibration_output + 1, out_min);
     }
-    if(packet15 == DPAD_LEFT) {
-        printf("dpad Left pressed\n");
+    if(pressed & BUTTON_Y) {
+        out_max = motor_pwm_get_value(calibration_output);
+        log_ring_write(LOG_CALIBRATION_MAX, calibration_output + 1, out_max);
     }
+    response_curve_set_endpoints(calibration_axis, out_min, out_max);
+    input_route_rescale();
 }
 
-/* handles action and setting button presses */
-static void check_controller_button(uint8_t packet16) {
-    if(packet16 & BUTTON_A) {
-        printf("button A pressed\n");
-    }
-    if(packet16 & BUTTON_B) {
-        printf("button B pressed\n");
-    }
-    if(packet16 & BUTTON_X) {
-        printf("button X pressed\n");
-    }
-    if(packet16 & BUTTON_Y) {
-        printf("button Y pressed\n");
-    }
-    if(packet16 & BUTTON_LEFT) {
-        printf("button left pressed\n");
-    }
-    if(packet16 & BUTTON_RIGHT) {
-        printf("button right pressed\n");
-    }
-    if(packet16 & BUTTON_BACK) {
-        printf("button back pressed\n");
+/* logs how long the controller took to its first report after power on or a link loss */
+static void controller_log_first_report(hid_controller_t *controller) {
+    int32_t index = (int32_t)(controller - hid_controllers) + 1;
+    int32_t elapsed_ms;
+
+    controller->first_report_logged = 1;
+    if(!controller->link_lost_us) {
+        log_ring_write(controller->cached ? LOG_FIRST_REPORT_CACHED : LOG_FIRST_REPORT,
+                       index, (int32_t)(esp_timer_get_time() / 1000));
+        return;
     }
-    if(packet16 & BUTTON_START) {
-        printf("button start pressed\n");
+    elapsed_ms = (int32_t)((esp_timer_get_time() - controller->link_lost_us) / 1000);
+    log_ring_write(LOG_RECONNECTED, index, elapsed_ms);
+    if(elapsed_ms > RECONNECT_TARGET_MS) {
+        log_ring_write(LOG_RECONNECT_SLOW, index, RECONNECT_TARGET_MS);
     }
 }
 
-/* handles Joystick button push */
-static void check_controller_joystick_push(uint8_t packet17) {
-    if(packet17 & LEFT_STICK_PUSH) {
-        printf("Left Joystick pushed\n");
+/* handles the controller interrupts */
+static void handle_controller_interrupts(hid_controller_t *controller, uint8_t *packet, uint16_t size,
+                                         uint32_t rx_us, uint32_t rx_cycles) {
+    unsigned int slot = controller - hid_controllers;
+
+    report_capture_record(slot, packet, size, rx_us);
+    if(!controller->first_report_logged) {
+        controller_log_first_report(controller);
+    } else {
+        latency_stats_record(LATENCY_INTERVAL_1 + slot, rx_us - controller->last_report_us);
+        link_policy_report(slot, rx_us - controller->last_report_us);
+    }
+    controller->last_report_us = rx_us;
+    controller->reports++;
+    if(!hid_decoder_decode(&controller->hid_decoder, packet, size, &controller->state)) {
+        // unknown report ID or report shorter than its descriptor says
+        return;
     }
-    if(packet17 & RIGHT_STICK_PUSH) {
-        printf("Right Joystick pushed\n");
+    latency_stats_record(LATENCY_DECODE, latency_stats_cycles() - rx_cycles);
+    if(!hid_decoder_diff(&controller->published_state, &controller->state)) {
+        // the controller keeps streaming unchanged reports
+        return;
     }
+    controller->published_state = controller->state;
+    // the control loop picks it up at its next period
+    state_mailbox_publish(slot, &controller->state, rx_us);
 }
 
-/*
- * fills joystick data array with the respcetive bt packets
- * @return 1 if data in array changed
- */
-static int fill_joystick_data(uint8_t joystick_packets[], uint8_t *packet) {
-    uint32_t i, changed;
-    for(i = 0, changed = 0; i < JOYSTICK_PACKET_SIZE; i++) {
-        if(joystick_packets[i] != *packet) {
-            joystick_packets[i] = *packet++;
-            changed = 1;
-        } else {
-            packet++;
-        }
+/* handles the newest state of a controller, once per control loop period */
+static void handle_controller_state(unsigned int slot, const hid_gamepad_state_t *state, uint32_t updates) {
+    static uint8_t dispatched[MAX_CONTROLLERS];
+    static uint32_t generations[MAX_CONTROLLERS];
+    uint32_t generation = input_route_acquire();
+    uint32_t changed;
+    int all;
+
+    if(!updates && (!dispatched[slot] || generation == generations[slot])) return;
+    // the first state and a new routing table drive every output, the outputs start at their power on value, not at rest
+    all = !dispatched[slot] || generation != generations[slot];
+    if(__atomic_exchange_n(&controller_link_lost[slot], 0, __ATOMIC_RELAXED)) {
+        input_route_rest(slot);
+        all = 1;
     }
-    return changed;
-}
+    changed = all ? CONTROLLER_ALL_FIELDS : hid_decoder_diff(&dispatched_states[slot], state);
+    if(!changed) return;
 
-/*
- * fills trigger data array with the respcetive bt packets
- * @return 1 if data in array changed
- */
-static int fill_trigger_data(uint8_t trigger_packets[], uint8_t *packet) {
-    uint32_t i, changed;
-    for(i = 0, changed = 0; i < TRIGGER_PACKET_SIZE; i++) {
-        if(trigger_packets[i] != *packet) {
-            trigger_packets[i] = *packet++;
-            changed = 1;
-        } else {
-            packet++;
-        }
+    if(changed & HID_FIELD_BIT(HID_FIELD_BUTTONS)) {
+        check_controller_calibration(slot, state->value[HID_FIELD_BUTTONS]);
     }
-    return changed;
+    // only the routes of changed fields run
+    input_route_dispatch(slot, all ? NULL : &dispatched_states[slot], state, changed);
+    dispatched[slot] = 1;
+    generations[slot] = generation;
+    dispatched_states[slot] = *state;
 }
 
-/* handles the controller interrupts */
-static void handle_controller_interrupts(uint8_t *packet, uint16_t size) {
-    static uint8_t joystick_left_packets[JOYSTICK_PACKET_SIZE], joystick_right_packets[JOYSTICK_PACKET_SIZE];
-    static uint8_t trigger_left_packets[TRIGGER_PACKET_SIZE], trigger_right_packets[TRIGGER_PACKET_SIZE];
-    // skip unimportant packets
-    packet += 2;
-    // joystick packets
-    {
-        // Left
-        if(fill_joystick_data(joystick_left_packets, packet)) {
-            uint16_t left_joy_x = joystick_left_packets[1] << 8 | joystick_left_packets[0];
-            uint16_t left_joy_y = joystick_left_packets[3] << 8 | joystick_left_packets[2];
-            check_controller_joystick_left_move(left_joy_x, left_joy_y);
-        }
-        packet += JOYSTICK_PACKET_SIZE;
-        // Right
-        if(fill_joystick_data(joystick_right_packets, packet)) {
-            uint16_t right_joy_x = joystick_right_packets[1] << 8 | joystick_right_packets[0];
-            uint16_t right_joy_y = joystick_right_packets[3] << 8 | joystick_right_packets[2];
-            check_controller_joystick_right_move(right_joy_x, right_joy_y);
-        }
-        packet += JOYSTICK_PACKET_SIZE;
-    }
-    // trigger packets
-    {
-        // Left
-        if(fill_trigger_data(trigger_left_packets, packet)) {
-            uint16_t left_trigger_pos = trigger_left_packets[1] << 8 | trigger_left_packets[0];
-            check_controller_trigger_left(left_trigger_pos);
-        }
-        packet += TRIGGER_PACKET_SIZE;
-        // Right
-        if(fill_trigger_data(trigger_right_packets, packet)) {
-            uint16_t right_trigger_pos = trigger_right_packets[1] << 8 | trigger_right_packets[0];
-            check_controller_trigger_right(right_trigger_pos);
+/* fills a telemetry snapshot with the dispatched inputs and the committed outputs */
+static void fill_telemetry(telemetry_snapshot_t *snapshot) {
+    unsigned int slot;
+    int i;
+
+    for (slot = 0; slot < snapshot->num_controllers; slot++) {
+        const hid_gamepad_state_t *state = &dispatched_states[slot];
+        telemetry_controller_t *controller = &snapshot->controllers[slot];
+        for (i = 0; i < TELEMETRY_AXES; i++) {
+            controller->axes[i] = state->value[HID_FIELD_LEFT_X + i];
         }
-        packet += TRIGGER_PACKET_SIZE;
+        controller->buttons = state->value[HID_FIELD_BUTTONS];
+        controller->dpad    = (uint8_t)(state->value[HID_FIELD_DPAD] | (state->value[HID_FIELD_GUIDE] ? TELEMETRY_GUIDE : 0));
+        controller->battery = (uint8_t) state->value[HID_FIELD_BATTERY];
+    }
+    for (i = 0; i < snapshot->num_outputs; i++) {
+        snapshot->outputs[i] = (uint16_t) motor_pwm_get_value((motor_pwm_output_t) i);
     }
-    // push buttons
-    check_controller_dpad(*packet++);
-    check_controller_button(*packet++);
-    check_controller_joystick_push(*packet);
-}
-
-/* Initializes all three PWM Signals  */
-static void motor_pwm_init(void)
-{
-    {
-        pwm1.gpio_num = PWM1_PIN;
-        pwm1.speed_mode = LEDC_HIGH_SPEED_MODE;
-        pwm1.channel = MOTOR_PWM_CHANNEL_1;
-        pwm1.intr_type = LEDC_INTR_DISABLE;
-        pwm1.timer_sel = MOTOR_PWM_TIMER;
-        pwm1.duty = 200; // 20%
-        printf("pwm1 initialized");
-        
-        pwm2.gpio_num = PWM2_PIN;
-        pwm2.speed_mode = LEDC_HIGH_SPEED_MODE;
-        pwm2.channel = MOTOR_PWM_CHANNEL_2;
-        pwm2.intr_type = LEDC_INTR_DISABLE;
-        pwm2.timer_sel = MOTOR_PWM_TIMER;
-        pwm2.duty = 500; // 50%
-        printf("pwm2 initialized");
-        
-        pwm3.gpio_num = PWM3_PIN;
-        pwm3.speed_mode = LEDC_HIGH_SPEED_MODE;
-        pwm3.channel = MOTOR_PWM_CHANNEL_3;
-        pwm3.intr_type = LEDC_INTR_DISABLE;
-        pwm3.timer_sel = MOTOR_PWM_TIMER;
-        pwm3.duty = 800; // 80%
-        printf("pwm3 initialized");
-        
-        pwm4.gpio_num = LED_PIN;
-        pwm4.speed_mode = LEDC_HIGH_SPEED_MODE;
-        pwm4.channel = LED_PWM_CHANNEL_4;
-        pwm4.intr_type = LEDC_INTR_DISABLE;
-        pwm4.timer_sel = MOTOR_PWM_TIMER;
-        pwm4.duty = 300; // 30%
-        printf("pwm4 initialized");
-    }
-    ledc_timer_config_t ledc_timer = {0};
-    ledc_timer.speed_mode = LEDC_HIGH_SPEED_MODE;
-    ledc_timer.bit_num = MOTOR_PWM_BIT_NUM;
-    ledc_timer.timer_num = MOTOR_PWM_TIMER;
-    ledc_timer.freq_hz = PWM_FREQ; // freq -> 62 Hz
-    
-    ESP_ERROR_CHECK( ledc_channel_config(&pwm1) );
-    ESP_ERROR_CHECK( ledc_channel_config(&pwm2) );
-    ESP_ERROR_CHECK( ledc_channel_config(&pwm3) );
-    ESP_ERROR_CHECK( ledc_channel_config(&pwm4) );
-    ESP_ERROR_CHECK( ledc_timer_config(&ledc_timer) );
 }
 
-/* Sets the dutycicle of PWM1 */
-static void pwm1_duty_set(float perc) {
-    pwm1.duty = perc;
-    ESP_ERROR_CHECK( ledc_channel_config(&pwm1) );
-}
+/* moves the outputs toward the setpoints of all controllers, once per control loop period */
+static void drive_outputs(void) {
+    telemetry_snapshot_t *snapshot;
+    unsigned int slot;
 
-/* Sets the dutycicle of PWM2 */
-static void pwm2_duty_set(float perc) {
-    pwm2.duty = perc;
-    ESP_ERROR_CHECK( ledc_channel_config(&pwm2) );
+    motion_stage_step();
+    // latch all outputs the motion stage moved at the same period boundary
+    motor_pwm_commit();
+    for (slot = 0; slot < num_controllers; slot++) {
+        update_controller_haptics(slot);
+    }
+    snapshot = telemetry_due();
+    if (snapshot) {
+        fill_telemetry(snapshot);
+        telemetry_submit(snapshot);
+    }
 }
 
-/* Sets the dutycicle of PWM3 */
-static void pwm3_duty_set(float perc) {
-    pwm3.duty = perc;
-    ESP_ERROR_CHECK( ledc_channel_config(&pwm3) );
-}
+/* rumbles each trigger that drives an output to the end of its range */
+static void update_controller_haptics(unsigned int slot) {
+    haptics_effect_t effect;
 
-/* Sets the dutycicle of PWM4 */
-static void pwm4_duty_set(float perc) {
-    pwm4.duty = perc;
-    ESP_ERROR_CHECK( ledc_channel_config(&pwm4) );
+    memset(&effect, 0, sizeof(effect));
+    if(!calibration_active) {
+        if(input_route_at_limit(slot, INPUT_SOURCE_TRIGGER_LEFT)) {
+            effect.left_trigger = HAPTICS_LIMIT_MAGNITUDE;
+        }
+        if(input_route_at_limit(slot, INPUT_SOURCE_TRIGGER_RIGHT)) {
+            effect.right_trigger = HAPTICS_LIMIT_MAGNITUDE;
+        }
+    }
+    // only a changed effect is sent, the Bluetooth side coalesces the rest
+    haptics_set(slot, &effect);
 }
 
 int btstack_main(int argc, const char * argv[]);
 int btstack_main(int argc, const char * argv[]){
+    unsigned int i;
 
     (void)argc;
     (void)argv;
     
     // init
+    log_ring_init();
+    log_ring_start_task();
+    // the modules open their NVS namespaces from here on, without NVS they keep their defaults
+    if (nvs_flash_init() != ESP_OK) {
+        printf("NVS not available, settings are not kept\n");
+    }
     motor_pwm_init();
+    response_curve_init();
     hid_host_setup();
-
-    // parse human readable Bluetooth address
-    sscanf_bd_addr(remote_addr_string, remote_addr);
+    link_policy_init();
+    haptics_init();
+    hid_control_init();
+    report_capture_init();
+
+    // parse human readable Bluetooth addresses, the controllers past them stay empty
+    num_controllers = MAX_CONTROLLERS;
+    for (i = 0; i < num_controllers && i < sizeof(controller_addr_strings) / sizeof(controller_addr_strings[0]); i++) {
+        sscanf_bd_addr(controller_addr_strings[i], hid_controllers[i].remote_addr);
+    }
+    // the controllers found by a discovery replace the configured ones
+    controller_discovery_init(num_controllers, controller_discovered);
+    for (i = 0; i < num_controllers; i++) {
+        controller_discovery_remembered(i, hid_controllers[i].remote_addr);
+    }
+    motion_stage_init(CONTROL_LOOP_PERIOD_US);
+    input_route_init(num_controllers);
+    telemetry_init(CONTROL_LOOP_PERIOD_US, num_controllers, MOTOR_PWM_COUNT);
+    control_loop_start(CONTROL_LOOP_PERIOD_US, num_controllers, handle_controller_state, drive_outputs);
+    cpu_stats_start();
+    hid_console_start();
+    btstack_run_loop_set_timer_handler(&throughput_timer, &controller_log_throughput);
+    btstack_run_loop_set_timer(&throughput_timer, THROUGHPUT_PERIOD_MS);
+    btstack_run_loop_add_timer(&throughput_timer);
+    btstack_run_loop_set_timer_handler(&calibration_save_timer, &calibration_save);
+    btstack_run_loop_set_timer(&calibration_save_timer, CALIBRATION_SAVE_POLL_MS);
+    btstack_run_loop_add_timer(&calibration_save_timer);
 
     // Turn on the device 
     hci_power_control(HCI_POWER_ON);
@@ -0,0 +1,148 @@
+/*
+ * haptics.c
+ *
+ * The effect of a controller is one 32 bit word, so the control task can
+ * replace it with a single store and the Bluetooth side always reads a
+ * whole effect. Nothing is queued: the send timer asks L2CAP for a
+ * CAN_SEND_NOW event when the word differs from what was sent last, and
+ * the report is built from the word only when that event arrives, so only
+ * the newest effect is ever in flight.
+ *
+ * Input reports do not wait for any of this. They arrive in slots of
+ * their own and are handled as soon as they come in; the output report is
+ * a single 14 byte DM1 packet in our transmit slot, sent only when the
+ * controller has a free ACL buffer, at most 20 times a second, and the
+ * link's short flush timeout drops it rather than letting it retransmit.
+ */
+
+#include <string.h>
+
+#include "btstack.h"
+
+#include "haptics.h"
+
+#define HAPTICS_PERIOD_MS       50      // at most 20 reports/s per controller
+#define HAPTICS_REFRESH_MS      2000    // resend a running effect before it expires
+#define HAPTICS_DURATION_10MS   250     // the controller plays an effect for 2.5 s
+#define HAPTICS_REPORT_ID       0x03
+#define HIDP_DATA_OUTPUT        0xA2    // HIDP DATA transaction, output report
+
+// actuator enable bits of the force feedback report
+#define HAPTICS_ENABLE_WEAK     0x01
+#define HAPTICS_ENABLE_STRONG   0x02
+#define HAPTICS_ENABLE_RIGHT    0x04
+#define HAPTICS_ENABLE_LEFT     0x08
+
+typedef union {
+    haptics_effect_t effect;
+    uint32_t         word;
+} haptics_word_t;
+
+typedef struct {
+    uint16_t        cid;            // interrupt channel, 0 if not attached
+    uint8_t         waiting;        // CAN_SEND_NOW requested
+    uint32_t        requested;      // newest effect, written by haptics_set
+    uint32_t        sent;           // effect of the last report
+    uint32_t        sent_ms;
+    haptics_stats_t stats;
+} haptics_channel_t;
+
+static haptics_channel_t      haptics_channels[HAPTICS_SLOTS];
+static btstack_timer_source_t haptics_timer;
+
+static void haptics_timer_handler(btstack_timer_source_t *ts) {
+    haptics_poll();
+    btstack_run_loop_set_timer(ts, HAPTICS_PERIOD_MS);
+    btstack_run_loop_add_timer(ts);
+}
+
+void haptics_init(void) {
+    btstack_run_loop_set_timer_handler(&haptics_timer, &haptics_timer_handler);
+    btstack_run_loop_set_timer(&haptics_timer, HAPTICS_PERIOD_MS);
+    btstack_run_loop_add_timer(&haptics_timer);
+}
+
+void haptics_attach(unsigned int slot, uint16_t interrupt_cid) {
+    if (slot >= HAPTICS_SLOTS) return;
+    haptics_channels[slot].cid     = interrupt_cid;
+    haptics_channels[slot].waiting = 0;
+    // the controller forgot what it played, a running effect goes out again
+    haptics_channels[slot].sent    = 0;
+}
+
+void haptics_detach(unsigned int slot) {
+    if (slot >= HAPTICS_SLOTS) return;
+    haptics_channels[slot].cid = 0;
+}
+
+void haptics_set(unsigned int slot, const haptics_effect_t *effect) {
+    haptics_channel_t *channel;
+    haptics_word_t     value;
+
+    if (slot >= HAPTICS_SLOTS) return;
+    channel = &haptics_channels[slot];
+    value.effect = *effect;
+    if (value.word == __atomic_load_n(&channel->requested, __ATOMIC_RELAXED)) return;
+    __atomic_store_n(&channel->requested, value.word, __ATOMIC_RELAXED);
+    channel->stats.requests++;
+}
+
+void haptics_poll(void) {
+    uint32_t     now = btstack_run_loop_get_time_ms();
+    unsigned int slot;
+
+    for (slot = 0; slot < HAPTICS_SLOTS; slot++) {
+        haptics_channel_t *channel = &haptics_channels[slot];
+        uint32_t requested;
+
+        if (!channel->cid || channel->waiting) continue;
+        requested = __atomic_load_n(&channel->requested, __ATOMIC_RELAXED);
+        if (requested == channel->sent && (!requested || now - channel->sent_ms < HAPTICS_REFRESH_MS)) continue;
+        channel->waiting = 1;
+        l2cap_request_can_send_now_event(channel->cid);
+    }
+}
+
+void haptics_can_send_now(uint16_t local_cid) {
+    haptics_channel_t *channel = NULL;
+    haptics_word_t     value;
+    uint8_t            report[10];
+    unsigned int       slot;
+
+    for (slot = 0; slot < HAPTICS_SLOTS; slot++) {
+        if (haptics_channels[slot].cid == local_cid && haptics_channels[slot].waiting) {
+            channel = &haptics_channels[slot];
+            break;
+        }
+    }
+    if (!channel) return;
+    channel->waiting = 0;
+
+    // whatever is newest now, effects set since the request are coalesced
+    value.word = __atomic_load_n(&channel->requested, __ATOMIC_RELAXED);
+    report[0]  = HIDP_DATA_OUTPUT;
+    report[1]  = HAPTICS_REPORT_ID;
+    report[2]  = (value.effect.weak ? HAPTICS_ENABLE_WEAK : 0) | (value.effect.strong ? HAPTICS_ENABLE_STRONG : 0)
+               | (value.effect.right_trigger ? HAPTICS_ENABLE_RIGHT : 0) | (value.effect.left_trigger ? HAPTICS_ENABLE_LEFT : 0);
+    report[3]  = value.effect.left_trigger;
+    report[4]  = value.effect.right_trigger;
+    report[5]  = value.effect.strong;
+    report[6]  = value.effect.weak;
+    report[7]  = HAPTICS_DURATION_10MS;
+    report[8]  = 0;     // start delay
+    report[9]  = 0;     // loop count
+    if (l2cap_send(local_cid, report, sizeof(report))) return;
+
+    if (value.word == channel->sent) {
+        channel->stats.refreshes++;
+    }
+    channel->sent    = value.word;
+    channel->sent_ms = btstack_run_loop_get_time_ms();
+    channel->stats.reports++;
+}
+
+int haptics_get_stats(unsigned int slot, haptics_stats_t *stats) {
+    if (slot >= HAPTICS_SLOTS) return 0;
+    *stats = haptics_channels[slot].stats;
+    return haptics_channels[slot].cid != 0;
+}
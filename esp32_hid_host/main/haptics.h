@@ -0,0 +1,53 @@
+/*
+ * haptics.h
+ *
+ * Rumble output reports for the controllers. Any task sets the effect it
+ * wants; the Bluetooth side sends the newest one when L2CAP can take it,
+ * at most one report per period per controller. Effects set in between
+ * are coalesced, a running effect is refreshed before the controller
+ * lets it expire.
+ */
+
+#ifndef HAPTICS_H
+#define HAPTICS_H
+
+#include <stdint.h>
+
+#define HAPTICS_SLOTS 4 // one per controller
+
+/* magnitudes 0..100 % of the four motors of an Xbox One controller */
+typedef struct {
+    uint8_t left_trigger;
+    uint8_t right_trigger;
+    uint8_t strong;         // left grip, low frequency
+    uint8_t weak;           // right grip, high frequency
+} haptics_effect_t;
+
+typedef struct {
+    uint32_t requests;      // haptics_set calls that changed the effect
+    uint32_t reports;       // output reports sent
+    uint32_t refreshes;     // of those, resends of an unchanged running effect
+} haptics_stats_t;
+
+/* starts the send timer */
+void haptics_init(void);
+
+/* sends output reports on the interrupt channel of a controller from now on */
+void haptics_attach(unsigned int slot, uint16_t interrupt_cid);
+
+/* stops sending to a controller, its effect is kept for the next attach */
+void haptics_detach(unsigned int slot);
+
+/* sets the effect of a controller, from any task, never blocks */
+void haptics_set(unsigned int slot, const haptics_effect_t *effect);
+
+/* runs one send period: asks L2CAP to signal when a changed effect can be sent */
+void haptics_poll(void);
+
+/* sends the newest effect on a channel that got L2CAP_EVENT_CAN_SEND_NOW */
+void haptics_can_send_now(uint16_t local_cid);
+
+/* @return 1 if the controller is attached */
+int haptics_get_stats(unsigned int slot, haptics_stats_t *stats);
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * hid_cache.c
+ *
+ * Two tags per controller: the record and the compiled decoder. Both
+ * carry the descriptor hash, so a decoder is only used with the
+ * descriptor it was compiled from. The descriptor itself is not kept,
+ * SDP streams it into the compiler and the hash. The tags are derived from the lower
+ * half of the address; the full address inside the record resolves any
+ * collision as a miss.
+ */
+
+#include <string.h>
+
+#include "btstack_tlv.h"
+
+#include "hid_cache.h"
+
+#define HID_CACHE_VERSION       2   // bump when the layout of the stored structs changes
+#define HID_CACHE_TAG_RECORD    'H'
+#define HID_CACHE_TAG_DECODER   'D'
+
+typedef struct {
+    uint32_t      hid_descriptor_hash;
+    hid_decoder_t decoder;
+} hid_cache_decoder_t;
+
+// too large for the BTstack task's stack
+static hid_cache_record_t  hid_cache_record;
+static hid_cache_decoder_t hid_cache_decoder;
+
+static uint32_t hid_cache_tag(uint8_t kind, const bd_addr_t remote_addr) {
+    return ((uint32_t) kind << 24) | big_endian_read_24(remote_addr, 3);
+}
+
+uint32_t hid_cache_hash(const uint8_t *descriptor, uint16_t len) {
+    uint32_t hash = HID_CACHE_HASH_INIT;
+    uint16_t i;
+    for (i = 0; i < len; i++) {
+        hash = hid_cache_hash_byte(hash, descriptor[i]);
+    }
+    return hash;
+}
+
+int hid_cache_load(const bd_addr_t remote_addr, hid_cache_record_t *record, hid_decoder_t *decoder) {
+    const btstack_tlv_t *tlv_impl;
+    void *tlv_context;
+    int   size;
+
+    btstack_tlv_get_instance(&tlv_impl, &tlv_context);
+    if (!tlv_impl) return 0;
+
+    size = tlv_impl->get_tag(tlv_context, hid_cache_tag(HID_CACHE_TAG_RECORD, remote_addr),
+                             (uint8_t *) record, sizeof(*record));
+    if (size != sizeof(*record) || record->version != HID_CACHE_VERSION) return 0;
+    if (memcmp(record->remote_addr, remote_addr, sizeof(bd_addr_t)) != 0) return 0;
+
+    size = tlv_impl->get_tag(tlv_context, hid_cache_tag(HID_CACHE_TAG_DECODER, remote_addr),
+                             (uint8_t *) &hid_cache_decoder, sizeof(hid_cache_decoder));
+    if (size != sizeof(hid_cache_decoder)) return 0;
+    if (hid_cache_decoder.hid_descriptor_hash != record->hid_descriptor_hash) return 0;
+
+    *decoder = hid_cache_decoder.decoder;
+    return 1;
+}
+
+void hid_cache_store(const hid_cache_record_t *record, const hid_decoder_t *decoder) {
+    const btstack_tlv_t *tlv_impl;
+    void *tlv_context;
+
+    btstack_tlv_get_instance(&tlv_impl, &tlv_context);
+    if (!tlv_impl) return;
+
+    hid_cache_record = *record;
+    hid_cache_record.version = HID_CACHE_VERSION;
+    hid_cache_decoder.hid_descriptor_hash = record->hid_descriptor_hash;
+    hid_cache_decoder.decoder = *decoder;
+    tlv_impl->store_tag(tlv_context, hid_cache_tag(HID_CACHE_TAG_DECODER, record->remote_addr),
+                        (const uint8_t *) &hid_cache_decoder, sizeof(hid_cache_decoder));
+    tlv_impl->store_tag(tlv_context, hid_cache_tag(HID_CACHE_TAG_RECORD, record->remote_addr),
+                        (const uint8_t *) &hid_cache_record, sizeof(hid_cache_record));
+}
+
+void hid_cache_delete(const bd_addr_t remote_addr) {
+    const btstack_tlv_t *tlv_impl;
+    void *tlv_context;
+
+    btstack_tlv_get_instance(&tlv_impl, &tlv_context);
+    if (!tlv_impl) return;
+    tlv_impl->delete_tag(tlv_context, hid_cache_tag(HID_CACHE_TAG_RECORD, remote_addr));
+    tlv_impl->delete_tag(tlv_context, hid_cache_tag(HID_CACHE_TAG_DECODER, remote_addr));
+}
@@ -0,0 +1,50 @@
+/*
+ * hid_cache.h
+ *
+ * Per-controller cache of the SDP results (HID PSMs, report descriptor
+ * hash) and the decoder compiled from the descriptor, stored through BTstack's TLV and
+ * keyed by the controller's address. A known controller can then open its
+ * L2CAP channels right after power on, without a service discovery.
+ */
+
+#ifndef HID_CACHE_H
+#define HID_CACHE_H
+
+#include <stdint.h>
+
+#include "btstack.h"
+#include "hid_decoder.h"
+
+#define HID_CACHE_HASH_INIT  2166136261u // FNV-1a offset basis
+#define HID_CACHE_HASH_PRIME 16777619u
+
+typedef struct {
+    uint8_t   version;
+    bd_addr_t remote_addr;
+    uint16_t  hid_control_psm;
+    uint16_t  hid_interrupt_psm;
+    uint32_t  hid_descriptor_len;
+    uint32_t  hid_descriptor_hash;
+} hid_cache_record_t;
+
+/* @return hash identifying a report descriptor */
+uint32_t hid_cache_hash(const uint8_t *descriptor, uint16_t len);
+
+/* continues a hash started with HID_CACHE_HASH_INIT with the next descriptor byte */
+static inline uint32_t hid_cache_hash_byte(uint32_t hash, uint8_t byte) {
+    return (hash ^ byte) * HID_CACHE_HASH_PRIME;
+}
+
+/*
+ * looks up a controller
+ * @return 1 if a record and a decoder matching its descriptor hash were found
+ */
+int hid_cache_load(const bd_addr_t remote_addr, hid_cache_record_t *record, hid_decoder_t *decoder);
+
+/* stores or replaces the record and decoder of record->remote_addr */
+void hid_cache_store(const hid_cache_record_t *record, const hid_decoder_t *decoder);
+
+/* forgets a controller, e.g. after its cached PSMs failed to connect */
+void hid_cache_delete(const bd_addr_t remote_addr);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * hid_console.c
+ *
+ * The UART driver replaces the ROM output routines so that stdin blocks
+ * in the console task instead of polling; the firmware's own printf output
+ * keeps going through the same VFS. The console stays on core 0 with the
+ * other low priority tasks, off the control core.
+ */
+
+#include <stdio.h>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "esp_console.h"
+#include "esp_vfs_dev.h"
+#include "linenoise/linenoise.h"
+
+#include "controller_discovery.h"
+#include "hid_console.h"
+#include "hid_control.h"
+#include "input_route.h"
+#include "latency_stats.h"
+#include "link_policy.h"
+#include "motion_stage.h"
+#include "motor_pwm.h"
+#include "report_capture.h"
+#include "response_curve.h"
+#include "telemetry.h"
+
+#define CONSOLE_TASK_STACK_SIZE 4096
+#define CONSOLE_TASK_PRIORITY   1
+#define CONSOLE_TASK_CORE       0
+#define CONSOLE_RX_BUFFER_SIZE  256
+#define CONSOLE_MAX_ARGS        8
+#define CONSOLE_MAX_LINE        128
+#define CONSOLE_PROMPT          "hid> "
+
+static const esp_console_cmd_t console_commands[] = {
+    {
+        .command = "latency",
+        .help    = "Print the report latency histograms, 'latency reset' clears them",
+        .hint    = "[reset]",
+        .func    = latency_stats_command,
+    },
+    {
+        .command = "link",
+        .help    = "Print the link policy state, link quality and report cadence of the controllers",
+        .hint    = NULL,
+        .func    = link_policy_command,
+    },
+    {
+        .command = "capture",
+        .help    = "Print the report capture state, 'on' and 'off' switch it across reboots, 'erase' clears the partition; "
+                   "every sector erase stops the control loop for tens of ms, leave it off while driving",
+        .hint    = "[on|off|erase]",
+        .func    = report_capture_command,
+    },
+    {
+        .command = "motion",
+        .help    = "Print the motion stage of the outputs, set the slew and acceleration limits of one or 'reset' the statistics",
+        .hint    = "[<pwm> <slew/s> <accel/s2>|reset]",
+        .func    = motion_stage_command,
+    },
+    {
+        .command = "pwm",
+        .help    = "Print the outputs with their mode, timer resolution and current value, or set the group or phase of one",
+        .hint    = "[<pwm> group <group>|<pwm> phase <value>]",
+        .func    = motor_pwm_command,
+    },
+    {
+        .command = "route",
+        .help    = "Print the routes from the controls to the outputs, add or delete one, restore the defaults, set the stick deadzones of the drive mixes or save them to NVS",
+        .hint    = "[add <controller|*> <source> <transform> <pwm>|add <controller|*> <source> log|del <n>|clear|default|deadzone <left|right> <percent>|save]",
+        .func    = input_route_command,
+    },
+    {
+        .command = "curve",
+        .help    = "Print the response curves of the axes, set the deadzone, expo or inversion of one or save them to NVS",
+        .hint    = "[<axis> deadzone <percent>|<axis> expo <percent>|<axis> invert <0|1>|save]",
+        .func    = response_curve_command,
+    },
+    {
+        .command = "telemetry",
+        .help    = "Print the binary telemetry stream state, set its snapshot rate or switch it off, across reboots",
+        .hint    = "[<Hz>|off]",
+        .func    = telemetry_command,
+    },
+    {
+        .command = "hidctl",
+        .help    = "Print the protocol and idle rate negotiated with the controllers, set the idle rate across reboots, or get and set a report",
+        .hint    = "[idle <ms>|off|<controller> get <type> <id>|<controller> set <type> <id> <hex>]",
+        .func    = hid_control_command,
+    },
+    {
+        .command = "discover",
+        .help    = "Print the controller discovery, find a new controller for a slot by inquiry and remember it, stop the discovery or forget a remembered address",
+        .hint    = "[<controller>|stop|forget <controller>]",
+        .func    = controller_discovery_command,
+    },
+};
+
+static void hid_console_task(void *arg) {
+    char *line;
+    int   ret;
+    (void) arg;
+
+    for (;;) {
+        line = linenoise(CONSOLE_PROMPT);
+        if (!line) continue;
+        if (line[0]) {
+            linenoiseHistoryAdd(line);
+            if (esp_console_run(line, &ret) == ESP_ERR_NOT_FOUND) {
+                printf("Unknown command, try 'help'\n");
+            }
+        }
+        linenoiseFree(line);
+    }
+}
+
+void hid_console_start(void) {
+    esp_console_config_t config = {
+        .max_cmdline_args   = CONSOLE_MAX_ARGS,
+        .max_cmdline_length = CONSOLE_MAX_LINE,
+    };
+    unsigned int i;
+
+    fflush(stdout);
+    setvbuf(stdin, NULL, _IONBF, 0);
+    esp_vfs_dev_uart_set_rx_line_endings(ESP_LINE_ENDINGS_CR);
+    esp_vfs_dev_uart_set_tx_line_endings(ESP_LINE_ENDINGS_CRLF);
+    if (uart_driver_install(CONFIG_CONSOLE_UART_NUM, CONSOLE_RX_BUFFER_SIZE, 0, 0, NULL, 0) != ESP_OK) {
+        printf("Console UART driver not installed\n");
+        return;
+    }
+    esp_vfs_dev_uart_use_driver(CONFIG_CONSOLE_UART_NUM);
+
+    ESP_ERROR_CHECK( esp_console_init(&config) );
+    esp_console_register_help_command();
+    for (i = 0; i < sizeof(console_commands) / sizeof(console_commands[0]); i++) {
+        ESP_ERROR_CHECK( esp_console_cmd_register(&console_commands[i]) );
+    }
+    // the log output interleaves with the prompt, a dumb terminal redraws less
+    linenoiseSetDumbMode(1);
+    linenoiseHistorySetMaxLen(16);
+
+    xTaskCreatePinnedToCore(hid_console_task, "console", CONSOLE_TASK_STACK_SIZE, NULL,
+                            CONSOLE_TASK_PRIORITY, NULL, CONSOLE_TASK_CORE);
+}
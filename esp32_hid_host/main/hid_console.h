@@ -0,0 +1,15 @@
+/*
+ * hid_console.h
+ *
+ * Serial console on the monitor UART: a low priority task reads command
+ * lines with linenoise and runs them through esp_console. The commands
+ * belong to the modules whose state they show or change.
+ */
+
+#ifndef HID_CONSOLE_H
+#define HID_CONSOLE_H
+
+/* installs the UART driver, registers the commands and starts the console task */
+void hid_console_start(void);
+
+#endif
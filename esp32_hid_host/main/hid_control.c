@@ -0,0 +1,490 @@
+/*
+ * hid_control.c
+ *
+ * HIDP has no transaction IDs: an answer belongs to the one request that
+ * is outstanding. The transactions of a controller are kept as pending
+ * bits and sent lowest bit first, each when the channel signals
+ * CAN_SEND_NOW and the one before it is answered. NOT_READY sends the
+ * same request again after a pause. After a timeout the channel stays
+ * quiet for another timeout, so a late answer is dropped rather than
+ * taken for the answer to the next request.
+ *
+ * The idle rate is what saves radio and CPU time: at 500 ms an idle
+ * controller repeats its report twice a second instead of every 8 ms, at
+ * 0 it sends nothing until an input changes. The repeats bring the state
+ * back after a lost report, so the default keeps a few. HID 1.1
+ * deprecated SET_IDLE; a controller that answers ERR_UNSUPPORTED_REQUEST
+ * keeps streaming at its own rate. While a controller idles, the report
+ * cadence in the link statistics counts the idle gaps as late reports.
+ *
+ * Console requests reach the Bluetooth side through one slot per
+ * controller and its state word: the console fills a free slot, the
+ * timer takes it and the answer frees it again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btstack.h"
+#include "nvs.h"
+
+#include "hid_control.h"
+
+#define HID_CONTROL_PERIOD_MS       20
+#define HID_CONTROL_TIMEOUT_MS      500
+#define HID_CONTROL_RETRY_MS        100     // pause after NOT_READY
+#define HID_CONTROL_ATTEMPTS        3
+#define HID_CONTROL_IDLE_DEFAULT_MS 500     // an idle controller repeats its report twice a second
+#define HID_CONTROL_IDLE_UNIT_MS    4
+#define NVS_NAMESPACE               "hidctl"
+#define NVS_KEY_IDLE                "idle"
+
+// HIDP transaction header: type in the high nibble, parameter in the low one
+#define HIDP_TYPE_MASK              0xf0
+#define HIDP_PARAM_MASK             0x0f
+#define HIDP_HANDSHAKE              0x00
+#define HIDP_HID_CONTROL            0x10
+#define HIDP_GET_REPORT             0x40
+#define HIDP_SET_REPORT             0x50
+#define HIDP_SET_PROTOCOL           0x70
+#define HIDP_SET_IDLE               0x90
+#define HIDP_DATA                   0xa0
+#define HIDP_GET_REPORT_SIZE        0x08    // a buffer size follows the report ID
+#define HIDP_PROTOCOL_REPORT        0x01
+#define HIDP_VIRTUAL_CABLE_UNPLUG   0x05
+
+// transactions of a controller, sent in this order
+#define HID_CONTROL_SET_PROTOCOL    (1 << 0)
+#define HID_CONTROL_SET_IDLE        (1 << 1)
+#define HID_CONTROL_USER            (1 << 2)
+
+// console request slot
+#define REQUEST_FREE                0
+#define REQUEST_QUEUED              1       // filled by the console
+#define REQUEST_TAKEN               2       // the Bluetooth side owns it until the answer
+
+typedef struct {
+    uint16_t              cid;              // control channel, 0 if not attached
+    uint8_t               pending;          // HID_CONTROL_* transactions to send
+    uint8_t               outstanding;      // the one sent, waits for its answer
+    uint8_t               waiting;          // CAN_SEND_NOW requested
+    uint8_t               attempts;         // sends of the outstanding transaction
+    uint32_t              sent_ms;
+    uint32_t              quiet_until_ms;   // nothing is sent before
+    uint16_t              idle_ms;          // setting the channel follows
+    uint16_t              idle_sent_ms;     // rate of the SET_IDLE sent last
+    hid_control_request_t request;          // HID_CONTROL_USER
+    hid_control_stats_t   stats;
+} hid_control_channel_t;
+
+static hid_control_channel_t  hid_control_channels[HID_CONTROL_SLOTS];
+static btstack_timer_source_t hid_control_timer;
+
+// console side
+static hid_control_request_t  hid_control_requests[HID_CONTROL_SLOTS];
+static uint8_t                hid_control_request_state[HID_CONTROL_SLOTS];
+static uint16_t               hid_control_idle_ms = HID_CONTROL_IDLE_DEFAULT_MS;
+
+static const char * const hid_control_report_types[] = { "", "input", "output", "feature" };
+
+static uint16_t hid_control_load_idle(void) {
+    uint16_t   idle_ms;
+    size_t     size = sizeof(idle_ms);
+    nvs_handle handle;
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) return HID_CONTROL_IDLE_DEFAULT_MS;
+    if (nvs_get_blob(handle, NVS_KEY_IDLE, &idle_ms, &size) != ESP_OK || size != sizeof(idle_ms)
+            || (idle_ms > HID_CONTROL_IDLE_MAX_MS && idle_ms != HID_CONTROL_IDLE_OFF)) {
+        idle_ms = HID_CONTROL_IDLE_DEFAULT_MS;
+    }
+    nvs_close(handle);
+    return idle_ms;
+}
+
+static esp_err_t hid_control_save_idle(uint16_t idle_ms) {
+    nvs_handle handle;
+    esp_err_t  err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+
+    if (err != ESP_OK) return err;
+    err = nvs_set_blob(handle, NVS_KEY_IDLE, &idle_ms, sizeof(idle_ms));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+static const char *hid_control_result_name(uint8_t result) {
+    switch (result) {
+        case HID_CONTROL_SUCCESSFUL:            return "ok";
+        case HID_CONTROL_NOT_READY:             return "not ready";
+        case HID_CONTROL_ERR_INVALID_REPORT_ID: return "invalid report ID";
+        case HID_CONTROL_ERR_UNSUPPORTED:       return "unsupported";
+        case HID_CONTROL_ERR_INVALID_PARAMETER: return "invalid parameter";
+        case HID_CONTROL_ERR_FATAL:             return "fatal error";
+        case HID_CONTROL_TIMEOUT:               return "timeout";
+        case HID_CONTROL_CLOSED:                return "closed";
+        case HID_CONTROL_PENDING:               return "pending";
+        default:                                return "unknown error";
+    }
+}
+
+static hid_control_channel_t *hid_control_channel_for_cid(uint16_t cid) {
+    unsigned int slot;
+    for (slot = 0; slot < HID_CONTROL_SLOTS; slot++) {
+        if (hid_control_channels[slot].cid && hid_control_channels[slot].cid == cid) return &hid_control_channels[slot];
+    }
+    return NULL;
+}
+
+/* asks for CAN_SEND_NOW if a transaction can go out */
+static void hid_control_kick(hid_control_channel_t *channel) {
+    if (!channel->cid || !channel->pending || channel->outstanding || channel->waiting) return;
+    if ((int32_t)(btstack_run_loop_get_time_ms() - channel->quiet_until_ms) < 0) return;
+    if (l2cap_request_can_send_now_event(channel->cid)) return;
+    channel->waiting = 1;
+}
+
+/* prints the answer to a console request and frees its slot */
+static void hid_control_answer(unsigned int slot, const hid_control_request_t *request, uint8_t result,
+                               const uint8_t *data, uint16_t len) {
+    uint16_t i;
+
+    printf("HID Control %u: %s %s %u: ", slot + 1, request->set ? "SET_REPORT" : "GET_REPORT",
+           hid_control_report_types[request->type], request->report_id);
+    if (result != HID_CONTROL_SUCCESSFUL || request->set) {
+        printf("%s\n", hid_control_result_name(result));
+    } else {
+        for (i = 0; i < len; i++) {
+            printf(i ? " %02x" : "%02x", data[i]);
+        }
+        printf("\n");
+    }
+    __atomic_store_n(&hid_control_request_state[slot], REQUEST_FREE, __ATOMIC_RELEASE);
+}
+
+/* ends the outstanding transaction and sends the next one */
+static void hid_control_complete(hid_control_channel_t *channel, uint8_t result, const uint8_t *data, uint16_t len) {
+    unsigned int slot = channel - hid_control_channels;
+    uint8_t transaction = channel->outstanding;
+
+    channel->outstanding = 0;
+    channel->attempts    = 0;
+    if (result != HID_CONTROL_SUCCESSFUL && result != HID_CONTROL_TIMEOUT) {
+        channel->stats.errors++;
+    }
+    switch (transaction) {
+        case HID_CONTROL_SET_PROTOCOL:
+            channel->stats.protocol = result;
+            if (result != HID_CONTROL_SUCCESSFUL) {
+                printf("HID Control %u: SET_PROTOCOL(report) %s\n", slot + 1, hid_control_result_name(result));
+            }
+            break;
+        case HID_CONTROL_SET_IDLE:
+            channel->stats.idle = result;
+            if (result == HID_CONTROL_SUCCESSFUL) {
+                channel->stats.idle_ms = channel->idle_sent_ms;
+            } else {
+                printf("HID Control %u: SET_IDLE %s\n", slot + 1, hid_control_result_name(result));
+            }
+            break;
+        case HID_CONTROL_USER:
+            hid_control_answer(slot, &channel->request, result, data, len);
+            break;
+        default:
+            break;
+    }
+    hid_control_kick(channel);
+}
+
+static void hid_control_timer_handler(btstack_timer_source_t *ts) {
+    hid_control_poll();
+    btstack_run_loop_set_timer(ts, HID_CONTROL_PERIOD_MS);
+    btstack_run_loop_add_timer(ts);
+}
+
+void hid_control_init(void) {
+    hid_control_idle_ms = hid_control_load_idle();
+    btstack_run_loop_set_timer_handler(&hid_control_timer, &hid_control_timer_handler);
+    btstack_run_loop_set_timer(&hid_control_timer, HID_CONTROL_PERIOD_MS);
+    btstack_run_loop_add_timer(&hid_control_timer);
+}
+
+void hid_control_attach(unsigned int slot, uint16_t control_cid) {
+    hid_control_channel_t *channel;
+
+    if (slot >= HID_CONTROL_SLOTS) return;
+    channel = &hid_control_channels[slot];
+    memset(channel, 0, sizeof(*channel));
+    channel->cid             = control_cid;
+    channel->idle_ms         = __atomic_load_n(&hid_control_idle_ms, __ATOMIC_RELAXED);
+    channel->pending         = HID_CONTROL_SET_PROTOCOL | (channel->idle_ms != HID_CONTROL_IDLE_OFF ? HID_CONTROL_SET_IDLE : 0);
+    channel->quiet_until_ms  = btstack_run_loop_get_time_ms();
+    channel->stats.protocol  = HID_CONTROL_PENDING;
+    channel->stats.idle      = HID_CONTROL_PENDING;
+    channel->stats.idle_ms   = HID_CONTROL_IDLE_OFF;
+    hid_control_kick(channel);
+}
+
+void hid_control_detach(unsigned int slot) {
+    hid_control_channel_t *channel;
+
+    if (slot >= HID_CONTROL_SLOTS) return;
+    channel = &hid_control_channels[slot];
+    if (!channel->cid) return;
+    if (channel->outstanding == HID_CONTROL_USER || (channel->pending & HID_CONTROL_USER)) {
+        hid_control_answer(slot, &channel->request, HID_CONTROL_CLOSED, NULL, 0);
+    }
+    channel->cid         = 0;
+    channel->pending     = 0;
+    channel->outstanding = 0;
+    channel->waiting     = 0;
+}
+
+void hid_control_poll(void) {
+    uint32_t     now = btstack_run_loop_get_time_ms();
+    uint16_t     idle_ms = __atomic_load_n(&hid_control_idle_ms, __ATOMIC_RELAXED);
+    unsigned int slot;
+
+    for (slot = 0; slot < HID_CONTROL_SLOTS; slot++) {
+        hid_control_channel_t *channel = &hid_control_channels[slot];
+
+        if (__atomic_load_n(&hid_control_request_state[slot], __ATOMIC_ACQUIRE) == REQUEST_QUEUED) {
+            if (!channel->cid) {
+                hid_control_answer(slot, &hid_control_requests[slot], HID_CONTROL_CLOSED, NULL, 0);
+            } else {
+                channel->request  = hid_control_requests[slot];
+                channel->pending |= HID_CONTROL_USER;
+                __atomic_store_n(&hid_control_request_state[slot], REQUEST_TAKEN, __ATOMIC_RELAXED);
+            }
+        }
+        if (!channel->cid) continue;
+        // a controller without SET_IDLE keeps its rate, whatever the setting
+        if (idle_ms != channel->idle_ms && channel->stats.idle != HID_CONTROL_ERR_UNSUPPORTED) {
+            channel->idle_ms = idle_ms;
+            if (idle_ms != HID_CONTROL_IDLE_OFF) {
+                channel->pending   |= HID_CONTROL_SET_IDLE;
+                channel->stats.idle = HID_CONTROL_PENDING;
+            } else {
+                channel->pending &= ~HID_CONTROL_SET_IDLE;
+            }
+        }
+        if (channel->outstanding && now - channel->sent_ms >= HID_CONTROL_TIMEOUT_MS) {
+            channel->stats.timeouts++;
+            channel->quiet_until_ms = now + HID_CONTROL_TIMEOUT_MS;
+            hid_control_complete(channel, HID_CONTROL_TIMEOUT, NULL, 0);
+        }
+        hid_control_kick(channel);
+    }
+}
+
+void hid_control_can_send_now(uint16_t local_cid) {
+    hid_control_channel_t *channel = hid_control_channel_for_cid(local_cid);
+    const hid_control_request_t *request;
+    uint8_t  message[2 + HID_CONTROL_REPORT_MAX];
+    uint16_t len = 0;
+    uint8_t  transaction;
+
+    if (!channel || !channel->waiting) return;
+    channel->waiting = 0;
+    if (!channel->pending || channel->outstanding) return;
+
+    transaction = channel->pending & -channel->pending;
+    request     = &channel->request;
+    switch (transaction) {
+        case HID_CONTROL_SET_PROTOCOL:
+            message[len++] = HIDP_SET_PROTOCOL | HIDP_PROTOCOL_REPORT;
+            break;
+        case HID_CONTROL_SET_IDLE:
+            channel->idle_sent_ms = channel->idle_ms;
+            message[len++] = HIDP_SET_IDLE;
+            message[len++] = (uint8_t)(channel->idle_ms / HID_CONTROL_IDLE_UNIT_MS);
+            break;
+        default:
+            if (request->set) {
+                message[len++] = HIDP_SET_REPORT | request->type;
+            } else {
+                message[len++] = HIDP_GET_REPORT | HIDP_GET_REPORT_SIZE | request->type;
+            }
+            if (request->report_id) {
+                message[len++] = request->report_id;
+            }
+            if (request->set) {
+                memcpy(&message[len], request->data, request->len);
+                len += request->len;
+            } else {
+                // the answer is cut to what the console prints, rather than split over several packets
+                little_endian_store_16(message, len, HID_CONTROL_REPORT_MAX);
+                len += 2;
+            }
+            break;
+    }
+    if (l2cap_send(local_cid, message, len)) return;
+
+    channel->pending    &= ~transaction;
+    channel->outstanding = transaction;
+    channel->sent_ms     = btstack_run_loop_get_time_ms();
+    channel->attempts++;
+    channel->stats.transactions++;
+}
+
+void hid_control_packet(uint16_t local_cid, const uint8_t *packet, uint16_t size) {
+    hid_control_channel_t *channel = hid_control_channel_for_cid(local_cid);
+    uint8_t result;
+
+    if (!channel || !size) return;
+    switch (packet[0] & HIDP_TYPE_MASK) {
+        case HIDP_HANDSHAKE:
+            if (!channel->outstanding) {
+                channel->stats.unexpected++;
+                return;
+            }
+            result = packet[0] & HIDP_PARAM_MASK;
+            if (result == HID_CONTROL_NOT_READY && channel->attempts < HID_CONTROL_ATTEMPTS) {
+                channel->pending       |= channel->outstanding;
+                channel->outstanding    = 0;
+                channel->quiet_until_ms = btstack_run_loop_get_time_ms() + HID_CONTROL_RETRY_MS;
+                channel->stats.retries++;
+                return;
+            }
+            hid_control_complete(channel, result, NULL, 0);
+            break;
+        case HIDP_DATA:
+            if (channel->outstanding != HID_CONTROL_USER || channel->request.set) {
+                channel->stats.unexpected++;
+                return;
+            }
+            hid_control_complete(channel, HID_CONTROL_SUCCESSFUL, packet + 1, size - 1);
+            break;
+        case HIDP_HID_CONTROL:
+            // the controller closes its channels next
+            if ((packet[0] & HIDP_PARAM_MASK) == HIDP_VIRTUAL_CABLE_UNPLUG) {
+                printf("HID Control %u: virtual cable unplug\n", (unsigned int)(channel - hid_control_channels) + 1);
+            }
+            break;
+        default:
+            channel->stats.unexpected++;
+            break;
+    }
+}
+
+int hid_control_request(unsigned int slot, const hid_control_request_t *request) {
+    if (slot >= HID_CONTROL_SLOTS || request->len > HID_CONTROL_REPORT_MAX
+            || __atomic_load_n(&hid_control_request_state[slot], __ATOMIC_ACQUIRE) != REQUEST_FREE) {
+        return 0;
+    }
+    hid_control_requests[slot] = *request;
+    __atomic_store_n(&hid_control_request_state[slot], REQUEST_QUEUED, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int hid_control_get_stats(unsigned int slot, hid_control_stats_t *stats) {
+    if (slot >= HID_CONTROL_SLOTS) return 0;
+    *stats = hid_control_channels[slot].stats;
+    return hid_control_channels[slot].cid != 0;
+}
+
+/* "hidctl <controller> get|set <type> <id> [<hex>]", the data as one string of hex digits */
+static int hid_control_report_command(int argc, char **argv) {
+    hid_control_request_t request;
+    unsigned long slot, value;
+    const char *hex;
+    char digits[3];
+    char *end;
+    int i;
+
+    memset(&request, 0, sizeof(request));
+    slot = strtoul(argv[1], &end, 10);
+    if (*end || !slot || slot > HID_CONTROL_SLOTS) return -1;
+    request.set = strcmp(argv[2], "set") == 0;
+    if (!request.set && strcmp(argv[2], "get") != 0) return -1;
+    if (argc != (request.set ? 6 : 5)) return -1;
+    for (i = HID_CONTROL_REPORT_INPUT; i <= HID_CONTROL_REPORT_FEATURE; i++) {
+        if (strcmp(argv[3], hid_control_report_types[i]) == 0) request.type = (uint8_t) i;
+    }
+    // input reports come in on the interrupt channel, they cannot be set
+    if (!request.type || (request.set && request.type == HID_CONTROL_REPORT_INPUT)) return -1;
+    value = strtoul(argv[4], &end, 0);
+    if (*end || value > 0xff) return -1;
+    request.report_id = (uint8_t) value;
+    for (hex = request.set ? argv[5] : ""; *hex; hex += 2) {
+        if (!hex[1] || request.len == HID_CONTROL_REPORT_MAX) return -1;
+        digits[0] = hex[0];
+        digits[1] = hex[1];
+        digits[2] = 0;
+        value = strtoul(digits, &end, 16);
+        if (*end) return -1;
+        request.data[request.len++] = (uint8_t) value;
+    }
+    if (!hid_control_channels[slot - 1].cid) {
+        printf("controller %lu is not connected\n", slot);
+        return 1;
+    }
+    if (!hid_control_request(slot - 1, &request)) {
+        printf("controller %lu: the previous request is not answered yet\n", slot);
+        return 1;
+    }
+    return 0;
+}
+
+int hid_control_command(int argc, char **argv) {
+    hid_control_stats_t stats;
+    unsigned long idle_ms;
+    unsigned int slot;
+    char *end;
+    esp_err_t err;
+    int printed = 0;
+    int ret;
+
+    if (argc == 1) {
+        idle_ms = __atomic_load_n(&hid_control_idle_ms, __ATOMIC_RELAXED);
+        if (idle_ms == HID_CONTROL_IDLE_OFF) {
+            printf("idle rate: controller default\n");
+        } else {
+            printf("idle rate: %lu ms%s\n", idle_ms, idle_ms ? "" : ", reports on change only");
+        }
+        for (slot = 0; slot < HID_CONTROL_SLOTS; slot++) {
+            if (!hid_control_get_stats(slot, &stats)) continue;
+            printed = 1;
+            printf("controller %u: report protocol %s, idle %s", slot + 1, hid_control_result_name(stats.protocol),
+                   hid_control_result_name(stats.idle));
+            if (stats.idle_ms != HID_CONTROL_IDLE_OFF) {
+                printf(" at %u ms", stats.idle_ms);
+            }
+            printf("\n  %u transactions, %u retries, %u errors, %u timeouts, %u unexpected\n",
+                   stats.transactions, stats.retries, stats.errors, stats.timeouts, stats.unexpected);
+        }
+        if (!printed) {
+            printf("no control channels\n");
+        }
+        return 0;
+    }
+    if (argc == 3 && strcmp(argv[1], "idle") == 0) {
+        if (strcmp(argv[2], "off") == 0) {
+            idle_ms = HID_CONTROL_IDLE_OFF;
+        } else {
+            idle_ms = strtoul(argv[2], &end, 10);
+            if (*end || idle_ms > HID_CONTROL_IDLE_MAX_MS) {
+                printf("usage: %s idle <ms 0..%d>|off\n", argv[0], HID_CONTROL_IDLE_MAX_MS);
+                return 1;
+            }
+            // whole units of 4 ms, rounded up so only 0 stops the repeats
+            idle_ms = (idle_ms + HID_CONTROL_IDLE_UNIT_MS - 1) / HID_CONTROL_IDLE_UNIT_MS * HID_CONTROL_IDLE_UNIT_MS;
+        }
+        __atomic_store_n(&hid_control_idle_ms, (uint16_t) idle_ms, __ATOMIC_RELAXED);
+        err = hid_control_save_idle((uint16_t) idle_ms);
+        if (err != ESP_OK) {
+            printf("idle rate set, not saved: error 0x%x\n", err);
+            return 1;
+        }
+        return 0;
+    }
+    if (argc >= 5) {
+        ret = hid_control_report_command(argc, argv);
+        if (ret >= 0) return ret;
+    }
+    printf("usage: %s [idle <ms>|off|<controller> get <input|output|feature> <id>|"
+           "<controller> set <output|feature> <id> <hex>]\n", argv[0]);
+    return 1;
+}
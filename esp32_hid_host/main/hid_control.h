@@ -0,0 +1,90 @@
+/*
+ * hid_control.h
+ *
+ * HID control channel client. Once the HID channels of a controller are
+ * open it asks for the report protocol, which the decoder was compiled
+ * for, and sets the idle rate: how often the controller repeats a report
+ * that did not change. GET_REPORT and SET_REPORT requests go out from the
+ * console. One transaction is outstanding per controller, each one ends
+ * with its HANDSHAKE or DATA answer or a timeout.
+ */
+
+#ifndef HID_CONTROL_H
+#define HID_CONTROL_H
+
+#include <stdint.h>
+
+#define HID_CONTROL_SLOTS       4       // one per controller
+#define HID_CONTROL_REPORT_MAX  32      // bytes of a GET_REPORT or SET_REPORT payload
+#define HID_CONTROL_IDLE_OFF    0xffff  // idle setting: leave the controller's default rate
+#define HID_CONTROL_IDLE_MAX_MS 1020    // 255 units of 4 ms, 0 repeats nothing
+
+// HANDSHAKE result codes, and the outcomes no HANDSHAKE reports
+#define HID_CONTROL_SUCCESSFUL          0x0
+#define HID_CONTROL_NOT_READY           0x1
+#define HID_CONTROL_ERR_INVALID_REPORT_ID 0x2
+#define HID_CONTROL_ERR_UNSUPPORTED     0x3
+#define HID_CONTROL_ERR_INVALID_PARAMETER 0x4
+#define HID_CONTROL_ERR_UNKNOWN         0xe
+#define HID_CONTROL_ERR_FATAL           0xf
+#define HID_CONTROL_TIMEOUT             0x10    // no answer within HID_CONTROL_TIMEOUT_MS
+#define HID_CONTROL_CLOSED              0x11    // the channel closed before the answer
+#define HID_CONTROL_PENDING             0xff    // not answered yet
+
+typedef enum {
+    HID_CONTROL_REPORT_INPUT = 1,
+    HID_CONTROL_REPORT_OUTPUT,
+    HID_CONTROL_REPORT_FEATURE
+} hid_control_report_type_t;
+
+typedef struct {
+    uint8_t  set;                       // SET_REPORT, GET_REPORT otherwise
+    uint8_t  type;                      // hid_control_report_type_t
+    uint8_t  report_id;                 // 0 for a controller without report IDs
+    uint8_t  len;                       // SET_REPORT data
+    uint8_t  data[HID_CONTROL_REPORT_MAX];
+} hid_control_request_t;
+
+typedef struct {
+    uint8_t  protocol;                  // result of SET_PROTOCOL(report)
+    uint8_t  idle;                      // result of SET_IDLE
+    uint16_t idle_ms;                   // rate the controller took, HID_CONTROL_IDLE_OFF until then
+    uint32_t transactions;              // requests sent, retries included
+    uint32_t retries;                   // resent after HANDSHAKE NOT_READY
+    uint32_t errors;                    // HANDSHAKE errors
+    uint32_t timeouts;
+    uint32_t unexpected;                // messages while nothing was outstanding, late answers
+} hid_control_stats_t;
+
+/* loads the idle setting from NVS and starts the timer that sends the transactions and times them out */
+void hid_control_init(void);
+
+/* negotiates the protocol and idle rate on the control channel of a controller whose HID channels are open */
+void hid_control_attach(unsigned int slot, uint16_t control_cid);
+
+/* forgets the control channel of a controller, an outstanding request ends with HID_CONTROL_CLOSED */
+void hid_control_detach(unsigned int slot);
+
+/* runs one timer period: takes console requests and idle changes, times out answers, asks for CAN_SEND_NOW */
+void hid_control_poll(void);
+
+/* sends the next transaction on a channel that got L2CAP_EVENT_CAN_SEND_NOW */
+void hid_control_can_send_now(uint16_t local_cid);
+
+/* handles a message the controller sent on its control channel */
+void hid_control_packet(uint16_t local_cid, const uint8_t *packet, uint16_t size);
+
+/*
+ * queues a GET_REPORT or SET_REPORT for a controller, from any task; the
+ * Bluetooth side prints the answer
+ * @return 0 if the previous request of the controller is not answered yet
+ */
+int hid_control_request(unsigned int slot, const hid_control_request_t *request);
+
+/* @return 1 if the controller's control channel is attached */
+int hid_control_get_stats(unsigned int slot, hid_control_stats_t *stats);
+
+/* console command: "hidctl" prints the negotiation, "hidctl idle <ms>|off" sets the idle rate, get and set reports */
+int hid_control_command(int argc, char **argv);
+
+#endif
@@ -0,0 +1,482 @@
+/*
+ * hid_decoder.c
+ *
+ * The report descriptor is walked once at connect time. Every input field
+ * we have a use for becomes one entry in a flat extraction table: where to
+ * read it, how to sign extend it and how to scale it onto the canonical
+ * range of its hid_field_t. Decoding a report is then a single walk over
+ * the entries of its report ID doing the same arithmetic for each field.
+ */
+
+#include <string.h>
+
+#include "hid_decoder.h"
+
+// HIDP header of an input report on the interrupt channel (DATA | INPUT)
+#define HIDP_INPUT_REPORT 0xA1
+
+// item types and tags
+#define ITEM_TYPE_MAIN          0
+#define ITEM_TYPE_GLOBAL        1
+#define ITEM_TYPE_LOCAL         2
+#define ITEM_LONG               0xFE
+
+#define MAIN_INPUT              0x8
+#define MAIN_OUTPUT             0x9
+#define MAIN_COLLECTION         0xA
+#define MAIN_FEATURE            0xB
+#define MAIN_END_COLLECTION     0xC
+
+#define GLOBAL_USAGE_PAGE       0x0
+#define GLOBAL_LOGICAL_MIN      0x1
+#define GLOBAL_LOGICAL_MAX      0x2
+#define GLOBAL_REPORT_SIZE      0x7
+#define GLOBAL_REPORT_ID        0x8
+#define GLOBAL_REPORT_COUNT     0x9
+#define GLOBAL_PUSH             0xA
+#define GLOBAL_POP              0xB
+
+#define LOCAL_USAGE             0x0
+#define LOCAL_USAGE_MIN         0x1
+#define LOCAL_USAGE_MAX         0x2
+
+// input item flags
+#define INPUT_CONSTANT          0x01
+#define INPUT_VARIABLE          0x02
+
+// usages
+#define PAGE_GENERIC_DESKTOP    0x01
+#define PAGE_SIMULATION         0x02
+#define PAGE_GENERIC_DEVICE     0x06
+#define PAGE_BUTTON             0x09
+#define PAGE_CONSUMER           0x0C
+#define USAGE(page, id)         (((uint32_t)(page) << 16) | (id))
+
+#define MAX_USAGES              16
+#define MAX_GLOBAL_STACK        4
+#define MAX_FIELD_BITS          24
+#define BUTTON_BITS             16
+
+typedef struct {
+    uint16_t usage_page;
+    int32_t  logical_min;
+    int32_t  logical_max;
+    uint32_t logical_max_unsigned;
+    uint8_t  report_size;
+    uint8_t  report_id;
+    uint16_t report_count;
+} hid_global_state_t;
+
+typedef struct {
+    uint32_t usages[MAX_USAGES];
+    uint8_t  num_usages;
+    uint32_t usage_min;
+    uint32_t usage_max;
+    uint8_t  has_range;
+} hid_local_state_t;
+
+typedef struct {
+    hid_decoder_t      *decoder;
+    hid_global_state_t global;
+    hid_local_state_t  local;
+    hid_global_state_t global_stack[MAX_GLOBAL_STACK];
+    uint8_t            global_stack_depth;
+    uint16_t           report_bits[HID_DECODER_MAX_REPORTS];
+    uint16_t           field_bits[HID_DECODER_MAX_FIELDS];
+    uint8_t            field_report[HID_DECODER_MAX_FIELDS];
+} hid_compiler_t;
+
+// item being reassembled by the streaming compiler
+typedef struct {
+    uint8_t  prefix;
+    uint8_t  need;          // data bytes of the short item still to come
+    uint8_t  len;           // data bytes received
+    uint8_t  data[4];
+    uint8_t  long_size;     // next byte is the data size of a long item
+    uint16_t skip;          // bytes of a long item still to skip
+} hid_item_stream_t;
+
+// one compilation at a time, SDP queries run one after another
+static hid_compiler_t    stream_compiler;
+static hid_item_stream_t stream_item;
+
+static uint32_t item_data_unsigned(const uint8_t *data, uint8_t size) {
+    switch (size) {
+        case 1:
+            return data[0];
+        case 2:
+            return data[0] | (data[1] << 8);
+        case 4:
+            return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+        default:
+            return 0;
+    }
+}
+
+static int32_t item_data_signed(const uint8_t *data, uint8_t size) {
+    switch (size) {
+        case 1:
+            return (int8_t) data[0];
+        case 2:
+            return (int16_t)(data[0] | (data[1] << 8));
+        case 4:
+            return (int32_t) item_data_unsigned(data, size);
+        default:
+            return 0;
+    }
+}
+
+/*
+ * maps a usage onto its gamepad field
+ * @return hid_field_t or -1, canonical_max is 0 for fields that are not scaled
+ */
+static int usage_to_field(uint32_t usage, uint32_t *canonical_max) {
+    *canonical_max = 0;
+    switch (usage) {
+        case USAGE(PAGE_GENERIC_DESKTOP, 0x30):     // X
+            *canonical_max = HID_DECODER_JOYSTICK_FULL;
+            return HID_FIELD_LEFT_X;
+        case USAGE(PAGE_GENERIC_DESKTOP, 0x31):     // Y
+            *canonical_max = HID_DECODER_JOYSTICK_FULL;
+            return HID_FIELD_LEFT_Y;
+        case USAGE(PAGE_GENERIC_DESKTOP, 0x32):     // Z
+        case USAGE(PAGE_GENERIC_DESKTOP, 0x33):     // Rx
+            *canonical_max = HID_DECODER_JOYSTICK_FULL;
+            return HID_FIELD_RIGHT_X;
+        case USAGE(PAGE_GENERIC_DESKTOP, 0x35):     // Rz
+        case USAGE(PAGE_GENERIC_DESKTOP, 0x34):     // Ry
+            *canonical_max = HID_DECODER_JOYSTICK_FULL;
+            return HID_FIELD_RIGHT_Y;
+        case USAGE(PAGE_SIMULATION, 0xC5):          // Brake
+            *canonical_max = HID_DECODER_TRIGGER_FULL;
+            return HID_FIELD_TRIGGER_LEFT;
+        case USAGE(PAGE_SIMULATION, 0xC4):          // Accelerator
+            *canonical_max = HID_DECODER_TRIGGER_FULL;
+            return HID_FIELD_TRIGGER_RIGHT;
+        case USAGE(PAGE_GENERIC_DESKTOP, 0x39):     // Hat switch
+            return HID_FIELD_DPAD;
+        case USAGE(PAGE_CONSUMER, 0x223):           // AC Home
+            return HID_FIELD_GUIDE;
+        case USAGE(PAGE_GENERIC_DEVICE, 0x20):      // Battery Strength
+            return HID_FIELD_BATTERY;
+        default:
+            return -1;
+    }
+}
+
+/* @return index into decoder->reports for the report ID, -1 if the table is full */
+static int compiler_report_index(hid_compiler_t *compiler, uint8_t report_id) {
+    hid_decoder_t *decoder = compiler->decoder;
+    if (decoder->report_slot[report_id]) return decoder->report_slot[report_id] - 1;
+    if (decoder->num_reports == HID_DECODER_MAX_REPORTS) return -1;
+    decoder->reports[decoder->num_reports].report_id = report_id;
+    decoder->report_slot[report_id] = ++decoder->num_reports;
+    return decoder->num_reports - 1;
+}
+
+static void compiler_add_field(hid_compiler_t *compiler, int report, uint16_t bit_pos, uint8_t bits,
+                               int field, uint32_t canonical_max, uint8_t dest_shift) {
+    hid_decoder_t       *decoder = compiler->decoder;
+    hid_global_state_t  *global  = &compiler->global;
+    hid_decoder_field_t *entry;
+    uint32_t range;
+
+    if (decoder->num_fields == HID_DECODER_MAX_FIELDS) return;
+    if (bits == 0 || bits > MAX_FIELD_BITS) return;
+
+    entry = &decoder->fields[decoder->num_fields];
+    memset(entry, 0, sizeof(*entry));
+    entry->field      = (uint8_t) field;
+    entry->mask       = (1u << bits) - 1;
+    entry->sign_bit   = global->logical_min < 0 ? 1u << (bits - 1) : 0;
+    entry->scale      = 1 << 8;
+    entry->dest_shift = dest_shift;
+    entry->dest_mask  = field == HID_FIELD_BUTTONS ? (uint16_t)(entry->mask << dest_shift) : 0xFFFF;
+    if (field == HID_FIELD_DPAD) {
+        // hat switches report up as 1, whatever their logical minimum
+        entry->offset = (uint32_t)(global->logical_min - 1);
+    }
+    if (canonical_max) {
+        range = global->logical_min < 0 ? (uint32_t)(global->logical_max - global->logical_min)
+                                        : global->logical_max_unsigned - (uint32_t) global->logical_min;
+        if (range) {
+            entry->offset = (uint32_t) global->logical_min;
+            entry->scale  = (canonical_max << 8) / range;
+        }
+    }
+
+    compiler->field_bits[decoder->num_fields]   = bit_pos;
+    compiler->field_report[decoder->num_fields] = (uint8_t) report;
+    decoder->reports[report].field_mask |= HID_FIELD_BIT(field);
+    decoder->num_fields++;
+}
+
+static uint32_t compiler_usage_for_index(hid_local_state_t *local, uint16_t index) {
+    if (local->num_usages) {
+        return local->usages[index < local->num_usages ? index : local->num_usages - 1];
+    }
+    if (local->has_range) {
+        uint32_t usage = local->usage_min + index;
+        return usage <= local->usage_max ? usage : local->usage_max;
+    }
+    return 0;
+}
+
+static void compiler_input_item(hid_compiler_t *compiler, uint32_t flags) {
+    hid_global_state_t *global = &compiler->global;
+    hid_local_state_t  *local  = &compiler->local;
+    uint16_t bit_pos;
+    uint16_t i;
+    int report;
+
+    report = compiler_report_index(compiler, global->report_id);
+    if (report < 0) return;
+    bit_pos = compiler->report_bits[report];
+    compiler->report_bits[report] += global->report_size * global->report_count;
+
+    if ((flags & INPUT_CONSTANT) || !(flags & INPUT_VARIABLE) || !global->report_size) return;
+
+    // runs of one bit buttons become a single field
+    if ((compiler_usage_for_index(local, 0) >> 16) == PAGE_BUTTON && global->report_size == 1) {
+        uint32_t first = compiler_usage_for_index(local, 0) & 0xFFFF;
+        uint16_t count = global->report_count;
+        if (first == 0 || first > BUTTON_BITS) return;
+        if (first - 1 + count > BUTTON_BITS) count = (uint16_t)(BUTTON_BITS - (first - 1));
+        compiler_add_field(compiler, report, bit_pos, (uint8_t) count, HID_FIELD_BUTTONS, 0, (uint8_t)(first - 1));
+        return;
+    }
+
+    for (i = 0; i < global->report_count; i++) {
+        uint32_t canonical_max;
+        int field = usage_to_field(compiler_usage_for_index(local, i), &canonical_max);
+        if (field < 0) continue;
+        compiler_add_field(compiler, report, (uint16_t)(bit_pos + i * global->report_size),
+                           global->report_size, field, canonical_max, 0);
+    }
+}
+
+/* orders the fields by report and converts bit positions into reads that stay inside the report */
+static void compiler_finalize(hid_compiler_t *compiler) {
+    hid_decoder_t *decoder = compiler->decoder;
+    hid_decoder_field_t sorted[HID_DECODER_MAX_FIELDS];
+    uint8_t num_sorted = 0;
+    uint8_t report;
+    uint8_t i;
+
+    for (report = 0; report < decoder->num_reports; report++) {
+        hid_decoder_report_t *entry = &decoder->reports[report];
+        entry->len         = (uint16_t)((compiler->report_bits[report] + 7) / 8);
+        entry->first_field = num_sorted;
+        for (i = 0; i < decoder->num_fields; i++) {
+            hid_decoder_field_t *field;
+            uint16_t byte_offset;
+            uint8_t  shift;
+            if (compiler->field_report[i] != report) continue;
+            field       = &sorted[num_sorted++];
+            *field      = decoder->fields[i];
+            byte_offset = compiler->field_bits[i] / 8;
+            shift       = compiler->field_bits[i] % 8;
+            // every field is read with one 32 bit load, move loads near the end of the report back
+            if (entry->len >= 4 && byte_offset + 4 > entry->len) {
+                shift       += (uint8_t)(8 * (byte_offset + 4 - entry->len));
+                byte_offset  = (uint16_t)(entry->len - 4);
+            }
+            field->byte_offset = (uint8_t) byte_offset;
+            field->shift       = shift;
+        }
+        entry->num_fields = (uint8_t)(num_sorted - entry->first_field);
+    }
+    memcpy(decoder->fields, sorted, num_sorted * sizeof(hid_decoder_field_t));
+}
+
+/* applies one short item to the compiler state */
+static void compiler_item(hid_compiler_t *compiler, uint8_t prefix, const uint8_t *data) {
+    uint8_t  size = prefix & 0x03;
+    uint8_t  type = (prefix >> 2) & 0x03;
+    uint8_t  tag  = prefix >> 4;
+    uint32_t value;
+
+    if (size == 3) size = 4;
+    value = item_data_unsigned(data, size);
+
+    switch (type) {
+        case ITEM_TYPE_MAIN:
+            if (tag == MAIN_INPUT) {
+                compiler_input_item(compiler, value);
+            }
+            memset(&compiler->local, 0, sizeof(compiler->local));
+            break;
+        case ITEM_TYPE_GLOBAL:
+            switch (tag) {
+                case GLOBAL_USAGE_PAGE:
+                    compiler->global.usage_page = (uint16_t) value;
+                    break;
+                case GLOBAL_LOGICAL_MIN:
+                    compiler->global.logical_min = item_data_signed(data, size);
+                    break;
+                case GLOBAL_LOGICAL_MAX:
+                    compiler->global.logical_max          = item_data_signed(data, size);
+                    compiler->global.logical_max_unsigned = value;
+                    break;
+                case GLOBAL_REPORT_SIZE:
+                    compiler->global.report_size = (uint8_t) value;
+                    break;
+                case GLOBAL_REPORT_ID:
+                    compiler->global.report_id       = (uint8_t) value;
+                    compiler->decoder->uses_report_ids = 1;
+                    break;
+                case GLOBAL_REPORT_COUNT:
+                    compiler->global.report_count = (uint16_t) value;
+                    break;
+                case GLOBAL_PUSH:
+                    if (compiler->global_stack_depth < MAX_GLOBAL_STACK) {
+                        compiler->global_stack[compiler->global_stack_depth++] = compiler->global;
+                    }
+                    break;
+                case GLOBAL_POP:
+                    if (compiler->global_stack_depth) {
+                        compiler->global = compiler->global_stack[--compiler->global_stack_depth];
+                    }
+                    break;
+                default:
+                    break;
+            }
+            break;
+        case ITEM_TYPE_LOCAL:
+            // 1 and 2 byte usages live on the current usage page
+            if (size < 4) value = USAGE(compiler->global.usage_page, value);
+            switch (tag) {
+                case LOCAL_USAGE:
+                    if (compiler->local.num_usages < MAX_USAGES) {
+                        compiler->local.usages[compiler->local.num_usages++] = value;
+                    }
+                    break;
+                case LOCAL_USAGE_MIN:
+                    compiler->local.usage_min = value;
+                    compiler->local.has_range = 1;
+                    break;
+                case LOCAL_USAGE_MAX:
+                    compiler->local.usage_max = value;
+                    break;
+                default:
+                    break;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void hid_decoder_compile_begin(hid_decoder_t *decoder) {
+    memset(decoder, 0, sizeof(*decoder));
+    memset(&stream_compiler, 0, sizeof(stream_compiler));
+    memset(&stream_item, 0, sizeof(stream_item));
+    stream_compiler.decoder = decoder;
+}
+
+void hid_decoder_compile_byte(uint8_t byte) {
+    hid_item_stream_t *item = &stream_item;
+
+    if (item->need) {
+        // data of a short item
+        item->data[item->len++] = byte;
+        if (--item->need) return;
+        compiler_item(&stream_compiler, item->prefix, item->data);
+        return;
+    }
+    if (item->skip) {
+        // long item: data size byte, tag byte and data are skipped
+        item->skip--;
+        if (item->long_size) {
+            item->long_size = 0;
+            item->skip      = (uint16_t)(1 + byte);
+        }
+        return;
+    }
+    if (byte == ITEM_LONG) {
+        item->skip      = 1;
+        item->long_size = 1;
+        return;
+    }
+    item->prefix = byte;
+    item->len    = 0;
+    item->need   = (uint8_t)((byte & 0x03) == 3 ? 4 : byte & 0x03);
+    if (!item->need) {
+        compiler_item(&stream_compiler, byte, item->data);
+    }
+}
+
+void hid_decoder_compile_feed(const uint8_t *data, uint32_t len) {
+    uint32_t i;
+    for (i = 0; i < len; i++) {
+        hid_decoder_compile_byte(data[i]);
+    }
+}
+
+int hid_decoder_compile_end(void) {
+    // a truncated last item is dropped, as the one-shot walk did
+    compiler_finalize(&stream_compiler);
+    return stream_compiler.decoder->num_fields;
+}
+
+int hid_decoder_compile(hid_decoder_t *decoder, const uint8_t *descriptor, uint16_t descriptor_len) {
+    hid_decoder_compile_begin(decoder);
+    hid_decoder_compile_feed(descriptor, descriptor_len);
+    return hid_decoder_compile_end();
+}
+
+static inline uint32_t read_32(const uint8_t *buffer, uint8_t pos) {
+    return buffer[pos] | (buffer[pos + 1] << 8) | (buffer[pos + 2] << 16) | ((uint32_t) buffer[pos + 3] << 24);
+}
+
+uint32_t hid_decoder_decode(const hid_decoder_t *decoder, const uint8_t *packet, uint16_t size, hid_gamepad_state_t *state) {
+    const hid_decoder_report_t *report;
+    const hid_decoder_field_t  *field;
+    const hid_decoder_field_t  *end;
+    const uint8_t *payload;
+    uint8_t  padded[8];
+    uint8_t  report_id = 0;
+    uint8_t  slot;
+
+    if (size < 1 || packet[0] != HIDP_INPUT_REPORT) return 0;
+    payload = packet + 1;
+    size--;
+    if (decoder->uses_report_ids) {
+        if (!size) return 0;
+        report_id = *payload++;
+        size--;
+    }
+    slot = decoder->report_slot[report_id];
+    if (!slot) return 0;
+    report = &decoder->reports[slot - 1];
+    if (size < report->len) return 0;
+    if (report->len < 4) {
+        // short reports like guide button and battery are read from a padded copy
+        memset(padded, 0, sizeof(padded));
+        memcpy(padded, payload, report->len);
+        payload = padded;
+    }
+
+    field = &decoder->fields[report->first_field];
+    end   = field + report->num_fields;
+    for (; field < end; field++) {
+        uint32_t value = (read_32(payload, field->byte_offset) >> field->shift) & field->mask;
+        value = (value ^ field->sign_bit) - field->sign_bit;
+        value = ((value - field->offset) * field->scale) >> 8;
+        state->value[field->field] = (uint16_t)((state->value[field->field] & ~field->dest_mask)
+                                                | ((value << field->dest_shift) & field->dest_mask));
+    }
+    return report->field_mask;
+}
+
+uint32_t hid_decoder_diff(const hid_gamepad_state_t *old_state, const hid_gamepad_state_t *new_state) {
+    uint32_t changed = 0;
+    int i;
+    for (i = 0; i < HID_STATE_WORDS; i++) {
+        uint32_t diff = old_state->word[i] ^ new_state->word[i];
+        // little endian: value[2 * i] is the low half of word[i]
+        changed |= (uint32_t)((diff & 0xFFFF) != 0) << (2 * i);
+        changed |= (uint32_t)((diff >> 16) != 0) << (2 * i + 1);
+    }
+    return changed;
+}
@@ -0,0 +1,112 @@
+/*
+ * hid_decoder.h
+ *
+ * Compiles a HID report descriptor into a flat per-report-ID extraction
+ * table, in one piece or as it streams in, and decodes interrupt-channel
+ * reports with it.
+ */
+
+#ifndef HID_DECODER_H
+#define HID_DECODER_H
+
+#include <stdint.h>
+
+#define HID_DECODER_MAX_REPORTS 8
+#define HID_DECODER_MAX_FIELDS  32
+
+// canonical ranges of the decoded fields
+#define HID_DECODER_JOYSTICK_FULL   65535
+#define HID_DECODER_JOYSTICK_CENTER 32768
+#define HID_DECODER_TRIGGER_FULL    1023
+
+/* logical gamepad fields, independent of the device's report layout */
+typedef enum {
+    HID_FIELD_LEFT_X = 0,
+    HID_FIELD_LEFT_Y,
+    HID_FIELD_RIGHT_X,
+    HID_FIELD_RIGHT_Y,
+    HID_FIELD_TRIGGER_LEFT,
+    HID_FIELD_TRIGGER_RIGHT,
+    HID_FIELD_DPAD,
+    HID_FIELD_BUTTONS,
+    HID_FIELD_GUIDE,
+    HID_FIELD_BATTERY,
+    HID_FIELD_COUNT
+} hid_field_t;
+
+#define HID_FIELD_BIT(field) (1u << (field))
+
+#define HID_STATE_WORDS ((HID_FIELD_COUNT + 1) / 2)
+
+/*
+ * decoded gamepad state
+ * sticks are scaled to 0..HID_DECODER_JOYSTICK_FULL, triggers to
+ * 0..HID_DECODER_TRIGGER_FULL, dpad is the raw hat switch value and
+ * buttons hold button n in bit n-1
+ * packed two fields per word so whole states compare word-wise
+ */
+typedef union {
+    uint16_t value[HID_STATE_WORDS * 2];
+    uint32_t word[HID_STATE_WORDS];
+} hid_gamepad_state_t;
+
+/* one entry of the extraction table */
+typedef struct {
+    uint8_t  byte_offset;   // first byte of the 32 bit read, relative to the report payload
+    uint8_t  shift;         // position of the field inside that read
+    uint8_t  field;         // destination hid_field_t
+    uint8_t  dest_shift;    // position inside the destination (buttons)
+    uint32_t mask;
+    uint32_t sign_bit;      // 0 for unsigned fields
+    uint32_t offset;        // subtracted before scaling
+    uint32_t scale;         // Q8 factor onto the canonical range
+    uint16_t dest_mask;
+} hid_decoder_field_t;
+
+typedef struct {
+    uint8_t  report_id;
+    uint8_t  first_field;
+    uint8_t  num_fields;
+    uint16_t len;           // payload bytes, without HIDP header and report ID
+    uint32_t field_mask;    // HID_FIELD_BIT()s carried by this report
+} hid_decoder_report_t;
+
+typedef struct {
+    uint8_t              uses_report_ids;
+    uint8_t              num_reports;
+    uint8_t              num_fields;
+    uint8_t              report_slot[256];  // report ID -> index + 1 into reports, 0 if unknown
+    hid_decoder_report_t reports[HID_DECODER_MAX_REPORTS];
+    hid_decoder_field_t  fields[HID_DECODER_MAX_FIELDS];
+} hid_decoder_t;
+
+/*
+ * compiles the input reports of a HID report descriptor
+ * @return number of extracted fields, 0 if the descriptor has none we can use
+ */
+int hid_decoder_compile(hid_decoder_t *decoder, const uint8_t *descriptor, uint16_t descriptor_len);
+
+/*
+ * streaming form of hid_decoder_compile for descriptors that arrive in
+ * pieces: begin, feed the bytes in order, end returns the field count
+ * one compilation at a time, the compiler state is static
+ */
+void hid_decoder_compile_begin(hid_decoder_t *decoder);
+void hid_decoder_compile_feed(const uint8_t *data, uint32_t len);
+void hid_decoder_compile_byte(uint8_t byte);
+int hid_decoder_compile_end(void);
+
+/*
+ * decodes one interrupt-channel packet (HIDP header, report ID, payload)
+ * into state, fields not carried by the report are left untouched
+ * @return HID_FIELD_BIT()s written, 0 if the packet was not a known, complete input report
+ */
+uint32_t hid_decoder_decode(const hid_decoder_t *decoder, const uint8_t *packet, uint16_t size, hid_gamepad_state_t *state);
+
+/*
+ * compares two states word by word
+ * @return HID_FIELD_BIT()s of the fields that differ, 0 if the states are equal
+ */
+uint32_t hid_decoder_diff(const hid_gamepad_state_t *old_state, const hid_gamepad_state_t *new_state);
+
+#endif
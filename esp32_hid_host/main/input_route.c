@@ -0,0 +1,819 @@
+/*
+ * input_route.c
+ *
+ * The compiled table holds the routes of every controller grouped by the
+ * field they read, so dispatching a changed field is a walk over a short
+ * contiguous run of entries. A route for every controller is compiled once
+ * per controller. Two tables alternate: the console compiles into the one
+ * the control task does not use and publishes it, the control task takes
+ * it at the start of its next period. The console refuses to compile
+ * again before that, so neither side ever waits on the other.
+ *
+ * A mix is listed under both axes of its stick; the entry under the Y axis
+ * stays idle when the X axis changed as well, so a mix runs once per
+ * dispatch. The stick deadzones are compiled into the table with the
+ * routes and switch with them.
+ *
+ * An axis route maps its curve onto the output with a Q16 factor computed
+ * when the table is compiled and again when the endpoints of an axis
+ * change, so a dispatch takes one multiply and no divide.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvs.h"
+
+#include "input_route.h"
+#include "log_ring.h"
+#include "motion_stage.h"
+
+#define NVS_NAMESPACE       "routes"
+#define NVS_KEY_ROUTES      "table"
+#define NVS_KEY_DEADZONES   "deadzones"
+
+#define INPUT_ROUTE_SCALE_BITS 16      // fraction bits of an axis route's output factor
+
+typedef struct {
+    const char *name;
+    uint8_t     field;          // hid_field_t
+    uint16_t    mask;           // bits of the field the source reads
+    uint16_t    match;          // digital sources are pressed while (value & mask) == match
+    uint16_t    log;            // log_message_t of the log target
+} input_source_info_t;
+
+static const input_source_info_t input_sources[INPUT_SOURCE_COUNT] = {
+    [INPUT_SOURCE_LEFT_X]           = { "lx",    HID_FIELD_LEFT_X,        0xFFFF, 0,      LOG_JOYSTICK_LEFT_X },
+    [INPUT_SOURCE_LEFT_Y]           = { "ly",    HID_FIELD_LEFT_Y,        0xFFFF, 0,      LOG_JOYSTICK_LEFT_Y },
+    [INPUT_SOURCE_RIGHT_X]          = { "rx",    HID_FIELD_RIGHT_X,       0xFFFF, 0,      LOG_JOYSTICK_RIGHT_X },
+    [INPUT_SOURCE_RIGHT_Y]          = { "ry",    HID_FIELD_RIGHT_Y,       0xFFFF, 0,      LOG_JOYSTICK_RIGHT_Y },
+    [INPUT_SOURCE_TRIGGER_LEFT]     = { "lt",    HID_FIELD_TRIGGER_LEFT,  0xFFFF, 0,      LOG_TRIGGER_LEFT },
+    [INPUT_SOURCE_TRIGGER_RIGHT]    = { "rt",    HID_FIELD_TRIGGER_RIGHT, 0xFFFF, 0,      LOG_TRIGGER_RIGHT },
+    // hat switch values, diagonals press none of the directions
+    [INPUT_SOURCE_DPAD_UP]          = { "up",    HID_FIELD_DPAD,          0x000F, 1,      LOG_DPAD_UP },
+    [INPUT_SOURCE_DPAD_RIGHT]       = { "right", HID_FIELD_DPAD,          0x000F, 3,      LOG_DPAD_RIGHT },
+    [INPUT_SOURCE_DPAD_DOWN]        = { "down",  HID_FIELD_DPAD,          0x000F, 5,      LOG_DPAD_DOWN },
+    [INPUT_SOURCE_DPAD_LEFT]        = { "left",  HID_FIELD_DPAD,          0x000F, 7,      LOG_DPAD_LEFT },
+    // button n in bit n-1, the stick buttons follow the eight buttons
+    [INPUT_SOURCE_BUTTON_A]         = { "a",     HID_FIELD_BUTTONS,       0x0001, 0x0001, LOG_BUTTON_A },
+    [INPUT_SOURCE_BUTTON_B]         = { "b",     HID_FIELD_BUTTONS,       0x0002, 0x0002, LOG_BUTTON_B },
+    [INPUT_SOURCE_BUTTON_X]         = { "x",     HID_FIELD_BUTTONS,       0x0004, 0x0004, LOG_BUTTON_X },
+    [INPUT_SOURCE_BUTTON_Y]         = { "y",     HID_FIELD_BUTTONS,       0x0008, 0x0008, LOG_BUTTON_Y },
+    [INPUT_SOURCE_BUTTON_LEFT]      = { "lb",    HID_FIELD_BUTTONS,       0x0010, 0x0010, LOG_BUTTON_LEFT },
+    [INPUT_SOURCE_BUTTON_RIGHT]     = { "rb",    HID_FIELD_BUTTONS,       0x0020, 0x0020, LOG_BUTTON_RIGHT },
+    [INPUT_SOURCE_BUTTON_BACK]      = { "back",  HID_FIELD_BUTTONS,       0x0040, 0x0040, LOG_BUTTON_BACK },
+    [INPUT_SOURCE_BUTTON_START]     = { "start", HID_FIELD_BUTTONS,       0x0080, 0x0080, LOG_BUTTON_START },
+    [INPUT_SOURCE_STICK_LEFT_PUSH]  = { "ls",    HID_FIELD_BUTTONS,       0x0100, 0x0100, LOG_STICK_LEFT_PUSH },
+    [INPUT_SOURCE_STICK_RIGHT_PUSH] = { "rs",    HID_FIELD_BUTTONS,       0x0200, 0x0200, LOG_STICK_RIGHT_PUSH },
+    [INPUT_SOURCE_GUIDE]            = { "guide", HID_FIELD_GUIDE,         0x0001, 0x0001, LOG_BUTTON_GUIDE },
+};
+
+static const char * const input_transform_names[INPUT_TRANSFORM_COUNT] = {
+    [INPUT_TRANSFORM_CURVE]  = "curve",
+    [INPUT_TRANSFORM_SCALE]  = "scale",
+    [INPUT_TRANSFORM_HOLD]   = "hold",
+    [INPUT_TRANSFORM_TOGGLE] = "toggle",
+    [INPUT_TRANSFORM_ARCADE_LEFT]  = "arcl",
+    [INPUT_TRANSFORM_ARCADE_RIGHT] = "arcr",
+    [INPUT_TRANSFORM_TANK]   = "tank",
+};
+
+static const char * const input_stick_names[INPUT_ROUTE_STICKS] = { "left", "right" };
+
+// the triggers of the first controller drive PWM1 and the LED, those of the second PWM2 and PWM3
+static const input_route_config_t input_default_routes[] = {
+    { 1, INPUT_SOURCE_TRIGGER_LEFT,     INPUT_TRANSFORM_CURVE, MOTOR_PWM_1 },
+    { 1, INPUT_SOURCE_TRIGGER_RIGHT,    INPUT_TRANSFORM_CURVE, MOTOR_PWM_LED },
+    { 2, INPUT_SOURCE_TRIGGER_LEFT,     INPUT_TRANSFORM_CURVE, MOTOR_PWM_2 },
+    { 2, INPUT_SOURCE_TRIGGER_RIGHT,    INPUT_TRANSFORM_CURVE, MOTOR_PWM_3 },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_LEFT_X,           0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_LEFT_Y,           0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_RIGHT_X,          0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_RIGHT_Y,          0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_TRIGGER_LEFT,     0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_TRIGGER_RIGHT,    0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_DPAD_UP,          0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_DPAD_RIGHT,       0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_DPAD_DOWN,        0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_DPAD_LEFT,        0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_BUTTON_A,         0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_BUTTON_B,         0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_BUTTON_X,         0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_BUTTON_Y,         0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_BUTTON_LEFT,      0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_BUTTON_RIGHT,     0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_BUTTON_BACK,      0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_BUTTON_START,     0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_STICK_LEFT_PUSH,  0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_STICK_RIGHT_PUSH, 0, INPUT_TARGET_LOG },
+    { INPUT_ROUTE_ALL_SLOTS, INPUT_SOURCE_GUIDE,            0, INPUT_TARGET_LOG },
+};
+
+typedef struct {
+    int32_t  base;              // axis routes: curve value at the start of the output range
+    uint32_t offset;            // axis routes: output value at base
+    int32_t  factor;            // axis routes: output units per curve unit, Q16
+    uint32_t full;              // axis routes: output value of full travel
+    uint16_t mask;
+    uint16_t match;
+    uint8_t  source;
+    uint8_t  transform;
+    uint8_t  target;
+    uint8_t  toggled;           // INPUT_TRANSFORM_TOGGLE: at the output's maximum
+    uint8_t  second;            // mix: the entry under the stick's Y axis
+} input_route_entry_t;
+
+typedef struct {
+    uint32_t            generation;
+    uint32_t            scales;                             // input_scales the factors were computed at
+    uint32_t            fields[INPUT_ROUTE_MAX_SLOTS];      // HID_FIELD_BIT()s with routes
+    uint32_t            outputs;                            // bits of the outputs driven
+    // entries of a controller's field run from first[slot][field] to first[slot][field + 1]
+    uint8_t             first[INPUT_ROUTE_MAX_SLOTS][HID_FIELD_COUNT + 1];
+    uint16_t            num_entries;
+    drive_mixer_stick_t sticks[INPUT_ROUTE_STICKS];
+    input_route_entry_t entries[INPUT_ROUTE_MAX_ENTRIES];
+} input_route_table_t;
+
+// console side: the routes as configured
+static input_route_config_t input_routes[INPUT_ROUTE_MAX];
+static unsigned int         input_num_routes;
+static uint16_t             input_deadzones[INPUT_ROUTE_STICKS] = {
+    DRIVE_MIXER_DEADZONE_DEFAULT, DRIVE_MIXER_DEADZONE_DEFAULT
+};
+static unsigned int         input_num_slots;
+static uint32_t             input_generation;
+
+static input_route_table_t  input_tables[2];
+static input_route_table_t *input_active;      // written by the control task only
+static input_route_table_t *input_pending;     // compiled, not taken yet
+static uint32_t             input_scales;      // counts the endpoint changes, written by the control task
+static uint32_t             input_shapes;      // response_curve_acquire() the factors were computed at
+
+// control task side
+static input_route_stats_t   input_stats;
+static int                   input_calibrating;
+static int                   input_calibration_set;
+static response_curve_axis_t input_calibration_axis;
+static motor_pwm_output_t    input_calibration_output;
+static uint32_t              input_calibration_min[MOTOR_PWM_COUNT];
+static uint32_t              input_calibration_factors[MOTOR_PWM_COUNT]; // output units per input unit, Q16
+
+static int input_route_is_mix(uint8_t transform) {
+    return transform >= INPUT_TRANSFORM_ARCADE_LEFT;
+}
+
+/* @return stick of a stick axis source */
+static unsigned int input_route_stick(uint8_t source) {
+    return (unsigned int)(source - INPUT_SOURCE_LEFT_X) >> 1;
+}
+
+/* @return field of a stick's X (0) or Y (1) axis */
+static unsigned int input_route_stick_field(unsigned int stick, unsigned int axis) {
+    return input_sources[INPUT_SOURCE_LEFT_X + 2 * stick + axis].field;
+}
+
+/* @return HID_FIELD_BIT()s a route reads */
+static uint32_t input_route_reads(const input_route_config_t *route) {
+    unsigned int stick;
+
+    if (route->target != INPUT_TARGET_LOG && input_route_is_mix(route->transform)) {
+        stick = input_route_stick(route->source);
+        return HID_FIELD_BIT(input_route_stick_field(stick, 0)) | HID_FIELD_BIT(input_route_stick_field(stick, 1));
+    }
+    return HID_FIELD_BIT(input_sources[route->source].field);
+}
+
+static int input_route_valid(const input_route_config_t *route) {
+    if (route->slot > INPUT_ROUTE_MAX_SLOTS || route->source >= INPUT_SOURCE_COUNT || route->target > INPUT_TARGET_LOG) {
+        return 0;
+    }
+    if (route->target == INPUT_TARGET_LOG) return 1;
+    if (route->transform >= INPUT_TRANSFORM_COUNT) return 0;
+    // mixes take the sticks
+    if (input_route_is_mix(route->transform)) return route->source <= INPUT_SOURCE_RIGHT_Y;
+    // a stick curve is no pulse width or throttle, it rests at its center
+    if (route->transform == INPUT_TRANSFORM_CURVE && route->source <= INPUT_SOURCE_RIGHT_Y
+            && motor_pwm_get_mode((motor_pwm_output_t) route->target) != MOTOR_PWM_MODE_DUTY) {
+        return 0;
+    }
+    // axes take the curve transforms, the digital sources the others
+    return (route->source < INPUT_SOURCE_AXES) == (route->transform <= INPUT_TRANSFORM_SCALE);
+}
+
+/* computes the factor that maps the curve of an axis route onto its output */
+static void input_route_scale(input_route_entry_t *entry) {
+    motor_pwm_output_t output = (motor_pwm_output_t) entry->target;
+    int32_t out_min, out_max;
+    motor_pwm_info_t info;
+
+    motor_pwm_get_info(output, &info);
+    if (entry->transform == INPUT_TRANSFORM_CURVE && motor_pwm_mode_is_pulse(info.mode)) {
+        // the curve is the pulse width
+        entry->base   = 0;
+        entry->offset = 0;
+        entry->factor = 1 << INPUT_ROUTE_SCALE_BITS;
+        return;
+    }
+    // how far the curve is between its endpoints: from 0 for a curve, from the minimum for a scale
+    response_curve_get_endpoints((response_curve_axis_t) entry->source, &out_min, &out_max);
+    if (entry->transform == INPUT_TRANSFORM_CURVE) {
+        info.min = 0;
+    }
+    entry->base   = out_min;
+    entry->offset = info.min;
+    // rounded, with the rounded product full travel lands on the maximum
+    entry->factor = out_max == out_min ? 0
+                    : (int32_t)((((int64_t)(info.max - info.min) << INPUT_ROUTE_SCALE_BITS) + llabs(out_max - out_min) / 2)
+                                / (out_max - out_min));
+}
+
+/* @return value of an axis route for a 16 bit input */
+static uint32_t input_route_scaled(const input_route_entry_t *entry, uint16_t input) {
+    int32_t value = response_curve_map((response_curve_axis_t) entry->source, input);
+    int64_t scaled = entry->offset + (((int64_t)(value - entry->base) * entry->factor
+                                       + (1 << (INPUT_ROUTE_SCALE_BITS - 1))) >> INPUT_ROUTE_SCALE_BITS);
+
+    return scaled > 0 ? (uint32_t) scaled : 0;
+}
+
+/* computes the factors and the full travel values of a table's axis routes with the current endpoints */
+static void input_route_scale_table(input_route_table_t *table, uint32_t scales) {
+    input_route_entry_t *entry;
+    unsigned int i;
+
+    for (i = 0; i < table->num_entries; i++) {
+        entry = &table->entries[i];
+        if (entry->source >= INPUT_SOURCE_AXES || entry->target == INPUT_TARGET_LOG
+                || input_route_is_mix(entry->transform)) continue;
+        input_route_scale(entry);
+        entry->full = input_route_scaled(entry, HID_DECODER_JOYSTICK_FULL);
+    }
+    table->scales = scales;
+}
+
+static esp_err_t input_route_compile(input_route_table_t *table, const input_route_config_t *routes,
+                                     unsigned int num_routes) {
+    input_route_entry_t *entry;
+    unsigned int slot, field, i;
+    uint32_t outputs;
+
+    memset(table, 0, sizeof(*table));
+    for (i = 0; i < INPUT_ROUTE_STICKS; i++) {
+        drive_mixer_stick_init(&table->sticks[i], input_deadzones[i]);
+    }
+    for (slot = 0; slot < input_num_slots; slot++) {
+        outputs = 0;
+        for (field = 0; field < HID_FIELD_COUNT; field++) {
+            table->first[slot][field] = (uint8_t) table->num_entries;
+            for (i = 0; i < num_routes; i++) {
+                const input_route_config_t *route = &routes[i];
+                const input_source_info_t  *source = &input_sources[route->source];
+
+                if (!(input_route_reads(route) & HID_FIELD_BIT(field))) continue;
+                if (route->slot != INPUT_ROUTE_ALL_SLOTS && route->slot != slot + 1) continue;
+                // a mix listed under its other axis drives the same output
+                if (route->target != INPUT_TARGET_LOG && source->field == field) {
+                    // two routes of one controller would fight over the output
+                    if (outputs & (1u << route->target)) return ESP_ERR_INVALID_ARG;
+                    outputs |= 1u << route->target;
+                }
+                if (table->num_entries == INPUT_ROUTE_MAX_ENTRIES) return ESP_ERR_NO_MEM;
+                entry = &table->entries[table->num_entries++];
+                entry->mask      = source->mask;
+                entry->match     = source->match;
+                entry->source    = route->source;
+                entry->transform = route->transform;
+                entry->target    = route->target;
+                entry->second    = route->target != INPUT_TARGET_LOG && input_route_is_mix(route->transform)
+                                   && field == input_route_stick_field(input_route_stick(route->source), 1);
+                table->fields[slot] |= HID_FIELD_BIT(field);
+            }
+        }
+        table->first[slot][HID_FIELD_COUNT] = (uint8_t) table->num_entries;
+        table->outputs |= outputs;
+    }
+    // endpoints changed from here on are caught up when the table is taken
+    input_route_scale_table(table, __atomic_load_n(&input_scales, __ATOMIC_ACQUIRE));
+    return ESP_OK;
+}
+
+esp_err_t input_route_load(const input_route_config_t *routes, unsigned int num_routes) {
+    input_route_table_t *table;
+    esp_err_t err;
+    unsigned int i;
+
+    if (num_routes > INPUT_ROUTE_MAX) return ESP_ERR_NO_MEM;
+    for (i = 0; i < num_routes; i++) {
+        if (!input_route_valid(&routes[i])) return ESP_ERR_INVALID_ARG;
+    }
+    if (__atomic_load_n(&input_pending, __ATOMIC_ACQUIRE)) return ESP_ERR_INVALID_STATE;
+
+    table = __atomic_load_n(&input_active, __ATOMIC_RELAXED) == &input_tables[0] ? &input_tables[1] : &input_tables[0];
+    err = input_route_compile(table, routes, num_routes);
+    if (err != ESP_OK) return err;
+    table->generation = ++input_generation;
+    if (routes != input_routes) {
+        memcpy(input_routes, routes, num_routes * sizeof(routes[0]));
+    }
+    input_num_routes = num_routes;
+    __atomic_store_n(&input_pending, table, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+void input_route_init(unsigned int num_slots) {
+    input_route_config_t routes[INPUT_ROUTE_MAX];
+    uint16_t   deadzones[INPUT_ROUTE_STICKS];
+    size_t     size = sizeof(routes);
+    size_t     deadzones_size = sizeof(deadzones);
+    nvs_handle handle;
+    esp_err_t  err;
+
+    input_num_slots = num_slots < INPUT_ROUTE_MAX_SLOTS ? num_slots : INPUT_ROUTE_MAX_SLOTS;
+    err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err == ESP_OK) {
+        if (nvs_get_blob(handle, NVS_KEY_DEADZONES, deadzones, &deadzones_size) == ESP_OK
+                && deadzones_size == sizeof(deadzones)
+                && deadzones[0] <= DRIVE_MIXER_DEADZONE_MAX && deadzones[1] <= DRIVE_MIXER_DEADZONE_MAX) {
+            memcpy(input_deadzones, deadzones, sizeof(deadzones));
+        }
+        err = nvs_get_blob(handle, NVS_KEY_ROUTES, routes, &size);
+        nvs_close(handle);
+    }
+    if (err == ESP_OK && size % sizeof(routes[0]) == 0
+            && input_route_load(routes, size / sizeof(routes[0])) == ESP_OK) {
+        printf("%u routes loaded from NVS\n", (unsigned int)(size / sizeof(routes[0])));
+        return;
+    }
+    input_route_load(input_default_routes, sizeof(input_default_routes) / sizeof(input_default_routes[0]));
+}
+
+esp_err_t input_route_set_deadzone(unsigned int stick, uint16_t deadzone) {
+    uint16_t  former;
+    esp_err_t err;
+
+    if (stick >= INPUT_ROUTE_STICKS || deadzone > DRIVE_MIXER_DEADZONE_MAX) return ESP_ERR_INVALID_ARG;
+    former = input_deadzones[stick];
+    input_deadzones[stick] = deadzone;
+    err = input_route_load(input_routes, input_num_routes);
+    if (err != ESP_OK) {
+        input_deadzones[stick] = former;
+    }
+    return err;
+}
+
+esp_err_t input_route_save(void) {
+    nvs_handle handle;
+    esp_err_t  err;
+
+    err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) return err;
+    err = nvs_set_blob(handle, NVS_KEY_ROUTES, input_routes, input_num_routes * sizeof(input_routes[0]));
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, NVS_KEY_DEADZONES, input_deadzones, sizeof(input_deadzones));
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+uint32_t input_route_acquire(void) {
+    input_route_table_t *pending = __atomic_load_n(&input_pending, __ATOMIC_ACQUIRE);
+    input_route_table_t *active = input_active;
+    uint32_t shapes = response_curve_acquire();
+    motor_pwm_info_t info;
+    uint32_t dropped;
+    int output;
+
+    if (shapes != input_shapes) {
+        // an inverted curve moves the value of full travel
+        input_shapes = shapes;
+        input_route_rescale();
+    }
+    if (pending) {
+        if (pending->scales != input_scales) {
+            input_route_scale_table(pending, input_scales);
+        }
+        dropped = active ? active->outputs & ~pending->outputs : 0;
+        __atomic_store_n(&input_active, pending, __ATOMIC_RELAXED);
+        // the console may compile into the former table from here on
+        __atomic_store_n(&input_pending, NULL, __ATOMIC_RELEASE);
+        while (dropped) {
+            output = __builtin_ctz(dropped);
+            dropped &= dropped - 1;
+            motor_pwm_get_info((motor_pwm_output_t) output, &info);
+            motion_stage_jump((motor_pwm_output_t) output, info.min);
+        }
+        log_ring_write(LOG_ROUTES_APPLIED, pending->generation, pending->num_entries);
+        active = pending;
+    }
+    // a new shape drives every output again too
+    return active ? active->generation + shapes : 0;
+}
+
+void input_route_rescale(void) {
+    uint32_t scales = __atomic_add_fetch(&input_scales, 1, __ATOMIC_RELEASE);
+
+    if (input_active) {
+        input_route_scale_table(input_active, scales);
+    }
+}
+
+uint32_t input_route_axis_value(input_transform_t transform, response_curve_axis_t axis, motor_pwm_output_t output,
+                                uint16_t input) {
+    input_route_entry_t entry;
+
+    entry.source    = (uint8_t) axis;
+    entry.transform = (uint8_t) transform;
+    entry.target    = (uint8_t) output;
+    input_route_scale(&entry);
+    return input_route_scaled(&entry, input);
+}
+
+/* @return 16 bit input of an axis source */
+static uint16_t input_route_axis_input(uint8_t source, uint16_t value) {
+    return source >= INPUT_SOURCE_TRIGGER_LEFT ? response_curve_input_10bit(value) : value;
+}
+
+/* @return motor output of a mix entry for a state */
+static int32_t input_route_mix(const input_route_table_t *table, const input_route_entry_t *entry,
+                               const hid_gamepad_state_t *state) {
+    unsigned int stick = input_route_stick(entry->source);
+    uint16_t x = state->value[input_route_stick_field(stick, 0)];
+    uint16_t y = state->value[input_route_stick_field(stick, 1)];
+    int32_t left, right;
+
+    if (entry->transform == INPUT_TRANSFORM_TANK) {
+        return drive_mixer_tank(&table->sticks[stick], x, y);
+    }
+    drive_mixer_arcade(&table->sticks[stick], x, y, &left, &right);
+    return entry->transform == INPUT_TRANSFORM_ARCADE_LEFT ? left : right;
+}
+
+/* @return value of a motor output on an output, pulse outputs are taken as reversible ESCs */
+static uint32_t input_route_mix_value(motor_pwm_output_t output, int32_t mix) {
+    motor_pwm_info_t info;
+
+    motor_pwm_get_info(output, &info);
+    return drive_mixer_output(mix, info.min, info.max, motor_pwm_mode_is_pulse(info.mode));
+}
+
+static void input_route_drive_mix(const input_route_table_t *table, const input_route_entry_t *entry,
+                                  const hid_gamepad_state_t *state) {
+    motor_pwm_output_t output = (motor_pwm_output_t) entry->target;
+    int32_t mix = input_route_mix(table, entry, state);
+
+    input_stats.mixes++;
+    if (mix == 0) {
+        // a stick in its deadzone and the failsafe stop the motor at once
+        motion_stage_jump(output, input_route_mix_value(output, mix));
+        return;
+    }
+    motion_stage_set_target(output, input_route_mix_value(output, mix));
+}
+
+static void input_route_drive_axis(const input_route_entry_t *entry, uint16_t value) {
+    motor_pwm_output_t output = (motor_pwm_output_t) entry->target;
+    uint16_t rest = entry->source >= INPUT_SOURCE_TRIGGER_LEFT ? 0 : HID_DECODER_JOYSTICK_CENTER;
+    uint16_t input = input_route_axis_input(entry->source, value);
+
+    if (input_calibrating && entry->transform == INPUT_TRANSFORM_CURVE
+            && motor_pwm_mode_is_pulse(motor_pwm_get_mode(output))) {
+        input_calibration_set = 1;
+        input_calibration_axis = (response_curve_axis_t) entry->source;
+        input_calibration_output = output;
+        motion_stage_jump(output, input_calibration_min[output]
+                                  + (uint32_t)(((uint64_t) input * input_calibration_factors[output]) >> INPUT_ROUTE_SCALE_BITS));
+        return;
+    }
+    if (value == rest) {
+        // a released trigger, a centered stick and the failsafe stop the output at once, never slewed
+        motion_stage_jump(output, input_route_scaled(entry, input));
+        return;
+    }
+    motion_stage_set_target(output, input_route_scaled(entry, input));
+}
+
+/* logs a stick through its curve, in tenths of a percent of the curve's output range */
+static void input_route_log_stick(const input_source_info_t *source, response_curve_axis_t axis, uint16_t value) {
+    int32_t out_min, out_max, permille = 0;
+
+    response_curve_get_endpoints(axis, &out_min, &out_max);
+    if (out_max != out_min) {
+        permille = (int32_t)((int64_t)(response_curve_map(axis, value) - out_min) * 1000 / (out_max - out_min));
+    }
+    log_ring_write((log_message_t) source->log, permille / 10, permille % 10);
+}
+
+static void input_route_run(const input_route_table_t *table, input_route_entry_t *entry,
+                            const hid_gamepad_state_t *last, const hid_gamepad_state_t *state, uint32_t changed) {
+    const input_source_info_t *source = &input_sources[entry->source];
+    uint16_t value = state->value[source->field];
+    motor_pwm_info_t info;
+    int pressed, on;
+
+    if (entry->source < INPUT_SOURCE_AXES) {
+        if (entry->second && (changed & HID_FIELD_BIT(input_route_stick_field(input_route_stick(entry->source), 0)))) {
+            // the mix ran from its X axis
+            input_stats.skipped++;
+            return;
+        }
+        input_stats.routes++;
+        if (entry->target != INPUT_TARGET_LOG && input_route_is_mix(entry->transform)) {
+            input_route_drive_mix(table, entry, state);
+        } else if (entry->target != INPUT_TARGET_LOG) {
+            input_route_drive_axis(entry, value);
+        } else if (entry->source >= INPUT_SOURCE_TRIGGER_LEFT) {
+            log_ring_write((log_message_t) source->log, value, 0);
+        } else {
+            input_route_log_stick(source, (response_curve_axis_t) entry->source, value);
+        }
+        return;
+    }
+
+    pressed = (value & entry->mask) == entry->match;
+    if (last && ((last->value[source->field] & entry->mask) == entry->match) == pressed) {
+        // another bit or value of the field changed
+        input_stats.skipped++;
+        return;
+    }
+    input_stats.routes++;
+    if (entry->target == INPUT_TARGET_LOG) {
+        if (pressed) log_ring_write((log_message_t) source->log, 0, 0);
+        return;
+    }
+    if (entry->transform == INPUT_TRANSFORM_TOGGLE) {
+        if (pressed && last) entry->toggled ^= 1;
+        on = entry->toggled;
+    } else {
+        on = pressed;
+    }
+    motor_pwm_get_info((motor_pwm_output_t) entry->target, &info);
+    if (on) {
+        motion_stage_set_target((motor_pwm_output_t) entry->target, info.max);
+    } else {
+        motion_stage_jump((motor_pwm_output_t) entry->target, info.min);
+    }
+}
+
+void input_route_dispatch(unsigned int slot, const hid_gamepad_state_t *last, const hid_gamepad_state_t *state,
+                          uint32_t changed) {
+    input_route_table_t *table = input_active;
+    unsigned int field, i;
+
+    uint32_t pending;
+
+    if (!table || slot >= input_num_slots) return;
+    changed &= table->fields[slot];
+    pending = changed;
+    while (pending) {
+        field = __builtin_ctz(pending);
+        pending &= pending - 1;
+        input_stats.dispatches++;
+        for (i = table->first[slot][field]; i < table->first[slot][field + 1]; i++) {
+            input_route_run(table, &table->entries[i], last, state, changed);
+        }
+    }
+}
+
+uint32_t input_route_fields(unsigned int slot) {
+    return input_active && slot < input_num_slots ? input_active->fields[slot] : 0;
+}
+
+void input_route_rest(unsigned int slot) {
+    input_route_table_t *table = input_active;
+    unsigned int i;
+
+    if (!table || slot >= input_num_slots) return;
+    for (i = table->first[slot][0]; i < table->first[slot][HID_FIELD_COUNT]; i++) {
+        table->entries[i].toggled = 0;
+    }
+}
+
+int input_route_value(unsigned int slot, motor_pwm_output_t output, const hid_gamepad_state_t *state, uint32_t *value) {
+    const input_route_table_t *table = input_active;
+    const input_route_entry_t *entry;
+    motor_pwm_info_t info;
+    uint16_t field_value;
+    unsigned int i;
+
+    if (!table || slot >= input_num_slots) return 0;
+    for (i = table->first[slot][0]; i < table->first[slot][HID_FIELD_COUNT]; i++) {
+        entry = &table->entries[i];
+        if (entry->target != output) continue;
+        field_value = state->value[input_sources[entry->source].field];
+        if (input_route_is_mix(entry->transform) && entry->source < INPUT_SOURCE_AXES) {
+            *value = input_route_mix_value(output, input_route_mix(table, entry, state));
+            return 1;
+        }
+        if (entry->source < INPUT_SOURCE_AXES) {
+            *value = input_route_scaled(entry, input_route_axis_input(entry->source, field_value));
+            return 1;
+        }
+        motor_pwm_get_info(output, &info);
+        if (entry->transform == INPUT_TRANSFORM_TOGGLE) {
+            *value = entry->toggled ? info.max : info.min;
+        } else {
+            *value = (field_value & entry->mask) == entry->match ? info.max : info.min;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+int input_route_at_limit(unsigned int slot, input_source_t source) {
+    const input_route_table_t *table = input_active;
+    const input_route_entry_t *entry;
+    unsigned int field = input_sources[source].field;
+    unsigned int i;
+
+    if (!table || slot >= input_num_slots || source >= INPUT_SOURCE_AXES) return 0;
+    for (i = table->first[slot][field]; i < table->first[slot][field + 1]; i++) {
+        entry = &table->entries[i];
+        if (entry->source != source || entry->target == INPUT_TARGET_LOG || input_route_is_mix(entry->transform)) continue;
+        // the value of full travel is the limit, wherever the endpoints are
+        if (motor_pwm_get_value((motor_pwm_output_t) entry->target) == entry->full) return 1;
+    }
+    return 0;
+}
+
+void input_route_set_calibration(int active) {
+    motor_pwm_info_t info;
+    int i;
+
+    if (active) {
+        // rounded up, full travel reaches the maximum and no input goes past it
+        for (i = 0; i < MOTOR_PWM_COUNT; i++) {
+            motor_pwm_get_info((motor_pwm_output_t) i, &info);
+            input_calibration_min[i] = info.min;
+            input_calibration_factors[i] = (uint32_t)((((uint64_t)(info.max - info.min) << INPUT_ROUTE_SCALE_BITS)
+                                                       + HID_DECODER_JOYSTICK_FULL - 1) / HID_DECODER_JOYSTICK_FULL);
+        }
+    }
+    input_calibrating = active;
+}
+
+int input_route_get_calibration(response_curve_axis_t *axis, motor_pwm_output_t *output) {
+    if (!input_calibration_set) return 0;
+    *axis = input_calibration_axis;
+    *output = input_calibration_output;
+    return 1;
+}
+
+void input_route_get_stats(input_route_stats_t *stats) {
+    *stats = input_stats;
+}
+
+/* @return index of name in a table of names, -1 if it is none of them */
+static int input_route_lookup(const char *name, const char * const *names, int count) {
+    int i;
+    for (i = 0; i < count; i++) {
+        if (names[i] && !strcmp(name, names[i])) return i;
+    }
+    return -1;
+}
+
+/* parses "<controller|*> <source> <transform> <pwm>" or "<controller|*> <source> log" */
+static int input_route_parse(int argc, char **argv, input_route_config_t *route) {
+    const char *source_names[INPUT_SOURCE_COUNT];
+    unsigned long slot;
+    int i, value;
+
+    if (argc < 3) return 0;
+    if (!strcmp(argv[0], "*")) {
+        route->slot = INPUT_ROUTE_ALL_SLOTS;
+    } else {
+        slot = strtoul(argv[0], NULL, 10);
+        if (slot < 1 || slot > INPUT_ROUTE_MAX_SLOTS) return 0;
+        route->slot = (uint8_t) slot;
+    }
+    for (i = 0; i < INPUT_SOURCE_COUNT; i++) {
+        source_names[i] = input_sources[i].name;
+    }
+    value = input_route_lookup(argv[1], source_names, INPUT_SOURCE_COUNT);
+    if (value < 0) return 0;
+    route->source = (uint8_t) value;
+    if (argc == 3 && !strcmp(argv[2], "log")) {
+        route->transform = 0;
+        route->target = INPUT_TARGET_LOG;
+        return 1;
+    }
+    if (argc != 4) return 0;
+    value = input_route_lookup(argv[2], input_transform_names, INPUT_TRANSFORM_COUNT);
+    if (value < 0) return 0;
+    route->transform = (uint8_t) value;
+    if (strncmp(argv[3], "pwm", 3)) return 0;
+    slot = strtoul(argv[3] + 3, NULL, 10);
+    if (slot < 1 || slot > MOTOR_PWM_COUNT) return 0;
+    route->target = (uint8_t)(slot - 1);
+    return 1;
+}
+
+static void input_route_print(unsigned int index, const input_route_config_t *route) {
+    char slot[4];
+
+    if (route->slot == INPUT_ROUTE_ALL_SLOTS) {
+        strcpy(slot, "*");
+    } else {
+        snprintf(slot, sizeof(slot), "%u", route->slot);
+    }
+    if (route->target == INPUT_TARGET_LOG) {
+        printf("%2u: controller %s %-5s log\n", index + 1, slot, input_sources[route->source].name);
+    } else {
+        printf("%2u: controller %s %-5s %-6s pwm%u\n", index + 1, slot, input_sources[route->source].name,
+               input_transform_names[route->transform], route->target + 1);
+    }
+}
+
+/* reports why the routes were not compiled */
+static int input_route_refused(esp_err_t err) {
+    if (err == ESP_OK) return 0;
+    if (err == ESP_ERR_INVALID_ARG) {
+        printf("axes take curve or scale, sticks also arcl, arcr or tank but curve only onto duty outputs, buttons and the dpad hold or toggle, an output one route per controller\n");
+    } else if (err == ESP_ERR_NO_MEM) {
+        printf("too many routes, at most %d and %d once compiled for every controller\n", INPUT_ROUTE_MAX, INPUT_ROUTE_MAX_ENTRIES);
+    } else {
+        printf("the previous routing table is not applied yet, try again\n");
+    }
+    return 1;
+}
+
+/* loads an edited copy of the routes and reports why it was refused */
+static int input_route_apply(const input_route_config_t *routes, unsigned int num_routes) {
+    return input_route_refused(input_route_load(routes, num_routes));
+}
+
+int input_route_command(int argc, char **argv) {
+    input_route_config_t routes[INPUT_ROUTE_MAX];
+    const input_route_table_t *table;
+    unsigned long index, percent;
+    esp_err_t err;
+    unsigned int i;
+    int stick;
+
+    if (argc == 1) {
+        table = __atomic_load_n(&input_active, __ATOMIC_ACQUIRE);
+        for (i = 0; i < input_num_routes; i++) {
+            input_route_print(i, &input_routes[i]);
+        }
+        printf("table %u in use, %u compiled routes for %u controllers; %u fields dispatched, %u routes run, %u skipped\n",
+               table ? table->generation : 0, table ? table->num_entries : 0, input_num_slots,
+               input_stats.dispatches, input_stats.routes, input_stats.skipped);
+        printf("mix deadzones: left stick %u %%, right stick %u %%; %u mixes run\n",
+               (input_deadzones[0] * 100u + DRIVE_MIXER_FULL / 2) / DRIVE_MIXER_FULL,
+               (input_deadzones[1] * 100u + DRIVE_MIXER_FULL / 2) / DRIVE_MIXER_FULL, input_stats.mixes);
+        return 0;
+    }
+    if (argc >= 5 && !strcmp(argv[1], "add")) {
+        if (input_num_routes == INPUT_ROUTE_MAX) {
+            printf("at most %d routes\n", INPUT_ROUTE_MAX);
+            return 1;
+        }
+        memcpy(routes, input_routes, input_num_routes * sizeof(routes[0]));
+        if (input_route_parse(argc - 2, argv + 2, &routes[input_num_routes])) {
+            return input_route_apply(routes, input_num_routes + 1);
+        }
+    }
+    if (argc == 3 && !strcmp(argv[1], "del")) {
+        index = strtoul(argv[2], NULL, 10);
+        if (index >= 1 && index <= input_num_routes) {
+            memcpy(routes, input_routes, input_num_routes * sizeof(routes[0]));
+            memmove(&routes[index - 1], &routes[index], (input_num_routes - index) * sizeof(routes[0]));
+            return input_route_apply(routes, input_num_routes - 1);
+        }
+    }
+    if (argc == 2 && !strcmp(argv[1], "clear")) {
+        return input_route_apply(input_routes, 0);
+    }
+    if (argc == 2 && !strcmp(argv[1], "default")) {
+        return input_route_apply(input_default_routes, sizeof(input_default_routes) / sizeof(input_default_routes[0]));
+    }
+    if (argc == 4 && !strcmp(argv[1], "deadzone")) {
+        stick = input_route_lookup(argv[2], input_stick_names, INPUT_ROUTE_STICKS);
+        percent = strtoul(argv[3], NULL, 10);
+        if (stick >= 0 && percent * DRIVE_MIXER_FULL <= DRIVE_MIXER_DEADZONE_MAX * 100ul) {
+            return input_route_refused(input_route_set_deadzone((unsigned int) stick,
+                                                                (uint16_t)((percent * DRIVE_MIXER_FULL + 50) / 100)));
+        }
+    }
+    if (argc == 2 && !strcmp(argv[1], "save")) {
+        err = input_route_save();
+        if (err != ESP_OK) {
+            printf("routes not saved: error 0x%x\n", err);
+            return 1;
+        }
+        printf("%u routes and the stick deadzones saved\n", input_num_routes);
+        return 0;
+    }
+    printf("usage: %s [add <controller|*> <source> <curve|scale|arcl|arcr|tank|hold|toggle> <pwm 1..%d>|add <controller|*> <source> log|del <n>|clear|default|deadzone <left|right> <percent>|save]\n",
+           argv[0], MOTOR_PWM_COUNT);
+    printf("sources:");
+    for (i = 0; i < INPUT_SOURCE_COUNT; i++) {
+        printf(" %s", input_sources[i].name);
+    }
+    printf("\n");
+    return 1;
+}
@@ -0,0 +1,173 @@
+/*
+ * input_route.h
+ *
+ * Routing table from the decoded gamepad fields to the outputs. A route
+ * takes one source of a controller (an axis, a button, a dpad direction),
+ * passes it through a transform and drives an output or the log. The
+ * routes are loaded from NVS or edited on the console and compiled into a
+ * flat dispatch array, grouped by controller and field, so a report only
+ * runs the routes of the fields it changed.
+ *
+ * The mixes drive a differential drive from the sticks (drive_mixer.h):
+ * an arcade mix of one stick puts its left motor on one output and its
+ * right motor on another, a tank mix puts one stick's track on an output.
+ * The source names the stick by either of its axes, a mix runs when
+ * either of them changes; it reads the raw stick through the stick's
+ * radial deadzone, the response curves do not apply.
+ */
+
+#ifndef INPUT_ROUTE_H
+#define INPUT_ROUTE_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "drive_mixer.h"
+#include "hid_decoder.h"
+#include "motor_pwm.h"
+#include "response_curve.h"
+
+#define INPUT_ROUTE_MAX         48  // configured routes
+#define INPUT_ROUTE_MAX_ENTRIES 96  // compiled routes, a route for every controller counts once per controller
+#define INPUT_ROUTE_MAX_SLOTS   4   // controllers
+#define INPUT_ROUTE_ALL_SLOTS   0   // route slot for every controller, the others count from 1
+#define INPUT_ROUTE_STICKS      2   // left and right, each with its own deadzone
+
+typedef enum {
+    // axes, in the order of hid_field_t and response_curve_axis_t
+    INPUT_SOURCE_LEFT_X = 0,
+    INPUT_SOURCE_LEFT_Y,
+    INPUT_SOURCE_RIGHT_X,
+    INPUT_SOURCE_RIGHT_Y,
+    INPUT_SOURCE_TRIGGER_LEFT,
+    INPUT_SOURCE_TRIGGER_RIGHT,
+    // digital, pressed or not
+    INPUT_SOURCE_DPAD_UP,
+    INPUT_SOURCE_DPAD_RIGHT,
+    INPUT_SOURCE_DPAD_DOWN,
+    INPUT_SOURCE_DPAD_LEFT,
+    INPUT_SOURCE_BUTTON_A,
+    INPUT_SOURCE_BUTTON_B,
+    INPUT_SOURCE_BUTTON_X,
+    INPUT_SOURCE_BUTTON_Y,
+    INPUT_SOURCE_BUTTON_LEFT,
+    INPUT_SOURCE_BUTTON_RIGHT,
+    INPUT_SOURCE_BUTTON_BACK,
+    INPUT_SOURCE_BUTTON_START,
+    INPUT_SOURCE_STICK_LEFT_PUSH,
+    INPUT_SOURCE_STICK_RIGHT_PUSH,
+    INPUT_SOURCE_GUIDE,
+    INPUT_SOURCE_COUNT
+} input_source_t;
+
+#define INPUT_SOURCE_AXES (INPUT_SOURCE_TRIGGER_RIGHT + 1)
+
+typedef enum {
+    INPUT_TRANSFORM_CURVE = 0,  // axis: its response curve, pulse widths as calibrated
+    INPUT_TRANSFORM_SCALE,      // axis: its response curve spread over the output's whole range
+    INPUT_TRANSFORM_HOLD,       // digital: the output's maximum while pressed, its minimum otherwise
+    INPUT_TRANSFORM_TOGGLE,     // digital: every press flips between minimum and maximum
+    INPUT_TRANSFORM_ARCADE_LEFT,    // stick: left motor of its arcade mix
+    INPUT_TRANSFORM_ARCADE_RIGHT,   // stick: right motor of its arcade mix
+    INPUT_TRANSFORM_TANK,           // stick: its track of a tank mix
+    INPUT_TRANSFORM_COUNT
+} input_transform_t;
+
+#define INPUT_TARGET_LOG MOTOR_PWM_COUNT // target that prints the source, takes no transform
+
+typedef struct {
+    uint8_t slot;               // controller 1.., INPUT_ROUTE_ALL_SLOTS for every controller
+    uint8_t source;             // input_source_t
+    uint8_t transform;          // input_transform_t
+    uint8_t target;             // motor_pwm_output_t or INPUT_TARGET_LOG
+} input_route_config_t;
+
+typedef struct {
+    uint32_t dispatches;        // fields that changed and had routes
+    uint32_t routes;            // routes run
+    uint32_t skipped;           // routes of a changed field whose source did not change
+    uint32_t mixes;             // of the routes run, stick mixes
+} input_route_stats_t;
+
+/* loads the routes from NVS, the defaults if there are none, and compiles them for num_slots controllers */
+void input_route_init(unsigned int num_slots);
+
+/*
+ * validates and compiles the routes, the control task switches to them at
+ * its next period
+ * @return ESP_ERR_INVALID_ARG for a route the sources, transforms or
+ * targets do not allow, a stick curve onto a pulse or DShot output or a
+ * second route of a controller to the same output, ESP_ERR_NO_MEM if they compile to too many
+ * entries, ESP_ERR_INVALID_STATE while the previous table is not taken yet
+ */
+esp_err_t input_route_load(const input_route_config_t *routes, unsigned int num_routes);
+
+/*
+ * sets the radial deadzone of a stick's mixes, in DRIVE_MIXER_FULL units,
+ * and recompiles the routes with it
+ * @return as input_route_load, ESP_ERR_INVALID_ARG beyond DRIVE_MIXER_DEADZONE_MAX
+ */
+esp_err_t input_route_set_deadzone(unsigned int stick, uint16_t deadzone);
+
+/* persists the loaded routes and the stick deadzones in NVS */
+esp_err_t input_route_save(void);
+
+/*
+ * switches to a newly compiled table and to the staged curve shapes
+ * (response_curve_acquire), once per period from the control task;
+ * outputs the new table no longer drives go to rest
+ * @return generation of the table and shapes in use, changes with every switch
+ */
+uint32_t input_route_acquire(void);
+
+/*
+ * runs the routes of a controller's changed fields, from the control task
+ * @param last previous state, NULL to run every route of the fields
+ */
+void input_route_dispatch(unsigned int slot, const hid_gamepad_state_t *last, const hid_gamepad_state_t *state,
+                          uint32_t changed);
+
+/* @return HID_FIELD_BIT()s of the fields with routes */
+uint32_t input_route_fields(unsigned int slot);
+
+/*
+ * clears the toggles of a controller after its link dropped, so the
+ * failsafe state puts all of its outputs to rest
+ */
+void input_route_rest(unsigned int slot);
+
+/*
+ * computes the value the route of a controller to an output puts on it
+ * for a state, with the current toggle state
+ * @return 0 if no route of the controller drives the output
+ */
+int input_route_value(unsigned int slot, motor_pwm_output_t output, const hid_gamepad_state_t *state, uint32_t *value);
+
+/* @return whether an axis of a controller drives an output to the value of its full travel */
+int input_route_at_limit(unsigned int slot, input_source_t source);
+
+/*
+ * while calibrating, curve routes to pulse outputs sweep the whole range
+ * of the output's mode instead, so the ESC endpoints can be searched
+ */
+void input_route_set_calibration(int active);
+
+/* @return 1 and the axis and output of the last calibration sweep, 0 if there was none */
+int input_route_get_calibration(response_curve_axis_t *axis, motor_pwm_output_t *output);
+
+/*
+ * recomputes the output factors of the axis routes after the endpoints of
+ * an axis changed, from the control task
+ */
+void input_route_rescale(void);
+
+/* @return value of an axis transform with a 16 bit input on an output, outside calibration */
+uint32_t input_route_axis_value(input_transform_t transform, response_curve_axis_t axis, motor_pwm_output_t output,
+                                uint16_t input);
+
+void input_route_get_stats(input_route_stats_t *stats);
+
+/* console command: "route" lists, "route add|del|clear|default|deadzone|save" edits and persists the routes */
+int input_route_command(int argc, char **argv);
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * latency_stats.c
+ *
+ * The buckets are logarithmic with linear steps in between, like a
+ * floating point number with a two bit mantissa: the bucket of a sample is
+ * found with one count-leading-zeros and a shift, and the resolution stays
+ * within a quarter of the value from a few cycles up to 100 ms.
+ *
+ * The decode stage runs on the Bluetooth core and is measured with its
+ * cycle counter. The later stages cross over to the control core, whose
+ * cycle counter is not synchronized, so they use the esp_timer timestamp
+ * the state mailbox carries anyway. The LEDC applies an updated duty at
+ * the start of its next PWM cycle, up to one PWM period after the update
+ * counted here.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "latency_stats.h"
+
+#define LATENCY_CYCLES_PER_US CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ
+
+latency_histogram_data_t latency_histograms[LATENCY_HISTOGRAM_COUNT];
+
+static const char * const latency_descriptions[] = {
+#define LATENCY_HISTOGRAM_DESCRIPTION(id, description, unit) description,
+    LATENCY_HISTOGRAMS(LATENCY_HISTOGRAM_DESCRIPTION)
+#undef LATENCY_HISTOGRAM_DESCRIPTION
+};
+
+static const char * const latency_units[] = {
+#define LATENCY_HISTOGRAM_UNIT(id, description, unit) unit,
+    LATENCY_HISTOGRAMS(LATENCY_HISTOGRAM_UNIT)
+#undef LATENCY_HISTOGRAM_UNIT
+};
+
+uint32_t latency_stats_bucket_floor(unsigned int bucket) {
+    unsigned int msb;
+
+    if (bucket < (1u << LATENCY_STATS_SUB_BITS)) return bucket;
+    msb = (bucket >> LATENCY_STATS_SUB_BITS) + LATENCY_STATS_SUB_BITS - 1;
+    return ((1u << LATENCY_STATS_SUB_BITS) | (bucket & ((1u << LATENCY_STATS_SUB_BITS) - 1)))
+           << (msb - LATENCY_STATS_SUB_BITS);
+}
+
+/* @return upper bound of the bucket holding the given share of the samples */
+static uint32_t latency_stats_percentile(const latency_histogram_data_t *histogram, uint32_t percent) {
+    uint64_t     rank = ((uint64_t) histogram->count * percent + 99) / 100;
+    uint64_t     seen = 0;
+    unsigned int bucket;
+
+    for (bucket = 0; bucket < LATENCY_STATS_BUCKETS - 1; bucket++) {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank) return latency_stats_bucket_floor(bucket + 1);
+    }
+    return histogram->max + 1;
+}
+
+void latency_stats_reset(void) {
+    memset(latency_histograms, 0, sizeof(latency_histograms));
+}
+
+void latency_stats_print(void) {
+    unsigned int id, bucket;
+    int printed = 0;
+
+    for (id = 0; id < LATENCY_HISTOGRAM_COUNT; id++) {
+        // the recording tasks keep counting, print from a snapshot
+        latency_histogram_data_t histogram = latency_histograms[id];
+
+        if (!histogram.count) continue;
+        printed = 1;
+        printf("%s: %u samples, mean %u %s, p50 < %u, p99 < %u, max %u\n", latency_descriptions[id],
+               histogram.count, (uint32_t)(histogram.total / histogram.count), latency_units[id],
+               latency_stats_percentile(&histogram, 50), latency_stats_percentile(&histogram, 99), histogram.max);
+        for (bucket = 0; bucket < LATENCY_STATS_BUCKETS; bucket++) {
+            if (!histogram.buckets[bucket]) continue;
+            if (bucket == LATENCY_STATS_BUCKETS - 1) {
+                printf("  %9u and more: %u\n", latency_stats_bucket_floor(bucket), histogram.buckets[bucket]);
+            } else {
+                printf("  %9u .. %9u: %u\n", latency_stats_bucket_floor(bucket),
+                       latency_stats_bucket_floor(bucket + 1) - 1, histogram.buckets[bucket]);
+            }
+        }
+    }
+    if (!printed) {
+        printf("no latency samples\n");
+        return;
+    }
+    printf("%d cycles/us\n", LATENCY_CYCLES_PER_US);
+}
+
+int latency_stats_command(int argc, char **argv) {
+    if (argc == 1) {
+        latency_stats_print();
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        latency_stats_reset();
+        printf("latency histograms reset\n");
+        return 0;
+    }
+    printf("usage: %s [reset]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,95 @@
+/*
+ * latency_stats.h
+ *
+ * End-to-end latency histograms. A report is timestamped when its
+ * L2CAP_DATA_PACKET arrives, once it is decoded, and after the control
+ * loop has updated the LEDC duties; the stage durations and the report
+ * inter-arrival times are counted in fixed buckets. Recording a sample is
+ * a handful of instructions and never blocks. The console command
+ * "latency" prints the histograms, "latency reset" clears them.
+ */
+
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <stdint.h>
+
+#include "xtensa/hal.h"
+
+#ifndef LATENCY_STATS_ENABLED
+#define LATENCY_STATS_ENABLED   1   // 0 compiles the recording out
+#endif
+
+#define LATENCY_STATS_SUB_BITS  2   // linear sub-buckets per power of two: 2^2, values within 25%
+#define LATENCY_STATS_BUCKETS   64  // the last bucket also counts everything above 2^17
+
+/* histogram catalog: id, description and unit */
+#define LATENCY_HISTOGRAMS(X) \
+    X(LATENCY_DECODE,       "receive to decoded",           "cycles") \
+    X(LATENCY_QUEUE,        "receive to control period",    "us") \
+    X(LATENCY_ACTUATE,      "receive to duty update",       "us") \
+    X(LATENCY_INTERVAL_1,   "controller 1 report interval", "us") \
+    X(LATENCY_INTERVAL_2,   "controller 2 report interval", "us") \
+    X(LATENCY_INTERVAL_3,   "controller 3 report interval", "us") \
+    X(LATENCY_INTERVAL_4,   "controller 4 report interval", "us")
+
+typedef enum {
+#define LATENCY_HISTOGRAM_ID(id, description, unit) id,
+    LATENCY_HISTOGRAMS(LATENCY_HISTOGRAM_ID)
+#undef LATENCY_HISTOGRAM_ID
+    LATENCY_HISTOGRAM_COUNT
+} latency_histogram_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max;
+    uint64_t total;
+    uint32_t buckets[LATENCY_STATS_BUCKETS];
+} latency_histogram_data_t;
+
+extern latency_histogram_data_t latency_histograms[LATENCY_HISTOGRAM_COUNT];
+
+/* @return CPU cycle counter of the calling core, only differences on the same core are meaningful */
+static inline uint32_t latency_stats_cycles(void) {
+    return xthal_get_ccount();
+}
+
+/* @return bucket of a value: exact below 4, then 4 buckets per power of two */
+static inline unsigned int latency_stats_bucket(uint32_t value) {
+    unsigned int msb, bucket;
+
+    if (value < (1u << LATENCY_STATS_SUB_BITS)) return value;
+    msb = 31 - __builtin_clz(value);
+    bucket = ((msb - LATENCY_STATS_SUB_BITS + 1) << LATENCY_STATS_SUB_BITS)
+           | ((value >> (msb - LATENCY_STATS_SUB_BITS)) & ((1u << LATENCY_STATS_SUB_BITS) - 1));
+    return bucket < LATENCY_STATS_BUCKETS ? bucket : LATENCY_STATS_BUCKETS - 1;
+}
+
+/* counts a sample, called from the Bluetooth and the control task without locking */
+static inline void latency_stats_record(latency_histogram_t id, uint32_t value) {
+#if LATENCY_STATS_ENABLED
+    latency_histogram_data_t *histogram = &latency_histograms[id];
+
+    histogram->buckets[latency_stats_bucket(value)]++;
+    histogram->count++;
+    histogram->total += value;
+    if (value > histogram->max) histogram->max = value;
+#else
+    (void) id;
+    (void) value;
+#endif
+}
+
+/* @return smallest value counted in a bucket */
+uint32_t latency_stats_bucket_floor(unsigned int bucket);
+
+/* clears every histogram, samples recorded meanwhile may be lost */
+void latency_stats_reset(void);
+
+/* prints the histograms that have samples */
+void latency_stats_print(void);
+
+/* console command: "latency" prints, "latency reset" clears */
+int latency_stats_command(int argc, char **argv);
+
+#endif
@@ -0,0 +1,394 @@
+/*
+ * link_policy.c
+ *
+ * The HCI commands of every link are kept as a set of pending bits and
+ * sent one at a time, lowest bit first, whenever BTstack can send a
+ * command; every HCI event runs the queue again, so the Command Complete
+ * of one command sends the next. BTstack's own commands go first.
+ *
+ * The poll interval of the central bounds the report latency: a report
+ * waits in the controller until it is polled, 25 ms by default. The QoS
+ * request asks for a guaranteed latency instead, which the link manager
+ * turns into a shorter poll interval. The flush timeout applies to what
+ * we send (output reports), the controller flushes its own reports.
+ * Retransmissions of the reports are not visible to the host, they show
+ * up as late reports in the cadence.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "btstack.h"
+
+#include "link_policy.h"
+#include "log_ring.h"
+
+#define LINK_TIMER_PERIOD_MS        1000
+#define LINK_LOG_PERIOD_TICKS       10      // link statistics logged every 10 s
+#define LINK_FLUSH_TIMEOUT_SLOTS    16      // 10 ms in 0.625 ms baseband slots
+#define LINK_QOS_SERVICE_GUARANTEED 0x02
+#define LINK_QOS_TOKEN_RATE         4000    // bytes/s, reports of up to 32 bytes at 125 Hz
+#define LINK_QOS_LATENCY_US         3750    // poll at least every 6 slots
+#define LINK_QOS_NO_PREFERENCE      0xFFFFFFFF
+#define LINK_CADENCE_SHIFT          4       // running means over about 16 reports
+#define LINK_MODE_ACTIVE            0
+#define LINK_ROLE_CENTRAL           0       // HCI role values, 1 is peripheral
+
+// commands of a link, sent in this order
+#define LINK_WRITE_POLICY           (1 << 0)
+#define LINK_EXIT_SNIFF             (1 << 1)
+#define LINK_ROLE_DISCOVERY         (1 << 2)
+#define LINK_SWITCH_ROLE            (1 << 3)
+#define LINK_QOS_SETUP              (1 << 4)
+#define LINK_FLUSH_TIMEOUT          (1 << 5)
+#define LINK_READ_RSSI              (1 << 6)
+#define LINK_READ_FAILED_CONTACTS   (1 << 7)
+#define LINK_POLICY_COMMANDS        (LINK_WRITE_POLICY | LINK_ROLE_DISCOVERY | LINK_QOS_SETUP | LINK_FLUSH_TIMEOUT)
+#define LINK_TRACKED_COMMANDS       (LINK_POLICY_COMMANDS | LINK_SWITCH_ROLE)
+
+typedef struct {
+    link_policy_stats_t stats;
+    bd_addr_t           addr;
+    uint16_t            pending;        // LINK_* commands still to send
+    uint16_t            outstanding;    // LINK_TRACKED_COMMANDS sent but not completed
+    uint32_t            interval_q;     // mean interval << LINK_CADENCE_SHIFT
+    uint32_t            jitter_q;       // mean deviation << LINK_CADENCE_SHIFT
+} link_t;
+
+// not in BTstack's command table
+static const hci_cmd_t link_role_discovery = {
+    OPCODE(OGF_LINK_POLICY, 0x09), "H"
+};
+static const hci_cmd_t link_qos_setup = {
+    OPCODE(OGF_LINK_POLICY, 0x07), "H114444"
+};
+static const hci_cmd_t link_read_failed_contact_counter = {
+    OPCODE(OGF_STATUS_PARAMETERS, 0x01), "H"
+};
+
+static link_t                                 links[LINK_POLICY_SLOTS];
+static btstack_packet_callback_registration_t link_event_registration;
+static btstack_timer_source_t                 link_timer;
+static unsigned int                           link_ticks;
+static uint16_t                               link_sent_opcode;   // last command sent, for its Command Status
+static link_t                                *link_sent;
+
+static link_t * link_for_handle(hci_con_handle_t handle) {
+    unsigned int slot;
+
+    for (slot = 0; slot < LINK_POLICY_SLOTS; slot++) {
+        if (links[slot].stats.handle == handle) return &links[slot];
+    }
+    return NULL;
+}
+
+static link_t * link_for_addr(const bd_addr_t addr) {
+    unsigned int slot;
+
+    for (slot = 0; slot < LINK_POLICY_SLOTS; slot++) {
+        if (links[slot].stats.handle != HCI_CON_HANDLE_INVALID && memcmp(links[slot].addr, addr, sizeof(bd_addr_t)) == 0) {
+            return &links[slot];
+        }
+    }
+    return NULL;
+}
+
+/* sends the next pending command of a link */
+static void link_send(link_t *link) {
+    hci_con_handle_t handle = link->stats.handle;
+    uint16_t command = link->pending & -link->pending;
+
+    link->pending &= ~command;
+    link->outstanding |= command & LINK_TRACKED_COMMANDS;
+    link_sent = link;
+    switch (command) {
+        case LINK_WRITE_POLICY:
+            // the role may change, the link manager must refuse sniff, hold and park
+            link_sent_opcode = hci_write_link_policy_settings.opcode;
+            hci_send_cmd(&hci_write_link_policy_settings, handle, LM_LINK_POLICY_ENABLE_ROLE_SWITCH);
+            break;
+        case LINK_EXIT_SNIFF:
+            link_sent_opcode = hci_exit_sniff_mode.opcode;
+            hci_send_cmd(&hci_exit_sniff_mode, handle);
+            break;
+        case LINK_ROLE_DISCOVERY:
+            link_sent_opcode = link_role_discovery.opcode;
+            hci_send_cmd(&link_role_discovery, handle);
+            break;
+        case LINK_SWITCH_ROLE:
+            link_sent_opcode = hci_switch_role_command.opcode;
+            hci_send_cmd(&hci_switch_role_command, link->addr, LINK_ROLE_CENTRAL);
+            break;
+        case LINK_QOS_SETUP:
+            link_sent_opcode = link_qos_setup.opcode;
+            hci_send_cmd(&link_qos_setup, handle, 0, LINK_QOS_SERVICE_GUARANTEED, LINK_QOS_TOKEN_RATE,
+                         0, LINK_QOS_LATENCY_US, LINK_QOS_NO_PREFERENCE);
+            break;
+        case LINK_FLUSH_TIMEOUT:
+            link_sent_opcode = hci_write_automatic_flush_timeout.opcode;
+            hci_send_cmd(&hci_write_automatic_flush_timeout, handle, LINK_FLUSH_TIMEOUT_SLOTS);
+            break;
+        case LINK_READ_RSSI:
+            link_sent_opcode = hci_read_rssi.opcode;
+            hci_send_cmd(&hci_read_rssi, handle);
+            break;
+        case LINK_READ_FAILED_CONTACTS:
+            link_sent_opcode = link_read_failed_contact_counter.opcode;
+            hci_send_cmd(&link_read_failed_contact_counter, handle);
+            break;
+        default:
+            break;
+    }
+}
+
+/* sends one pending command, the event completing it sends the next */
+static void link_run(void) {
+    unsigned int slot;
+
+    if (!hci_can_send_command_packet_now()) return;
+    for (slot = 0; slot < LINK_POLICY_SLOTS; slot++) {
+        if (links[slot].stats.handle != HCI_CON_HANDLE_INVALID && links[slot].pending) {
+            link_send(&links[slot]);
+            return;
+        }
+    }
+}
+
+/* marks a policy command done, logs once all of them went through */
+static void link_command_done(link_t *link, uint16_t command, uint8_t status, uint16_t opcode) {
+    int32_t index = (int32_t)(link - links) + 1;
+
+    if (status) {
+        link->stats.command_failures++;
+        log_ring_write(LOG_LINK_COMMAND_FAILED, opcode, status);
+    }
+    if (!(link->outstanding & command)) return;
+    link->outstanding &= ~command;
+    if (link->outstanding || link->pending & LINK_TRACKED_COMMANDS) return;
+    link->stats.applied = 1;
+    log_ring_write(LOG_LINK_POLICY, index, link->stats.poll_latency_us);
+}
+
+static void link_command_complete(const uint8_t *packet, uint16_t size) {
+    uint16_t opcode = little_endian_read_16(packet, 3);
+    uint8_t  status;
+    link_t  *link;
+
+    if (size < 8) return;
+    status = packet[5];
+    link = link_for_handle(little_endian_read_16(packet, 6) & 0x0FFF);
+    if (!link) return;
+
+    if (opcode == hci_write_link_policy_settings.opcode) {
+        link_command_done(link, LINK_WRITE_POLICY, status, opcode);
+    } else if (opcode == link_role_discovery.opcode) {
+        if (!status && size > 8) {
+            link->stats.central = packet[8] == LINK_ROLE_CENTRAL;
+            if (!link->stats.central) {
+                // the controller paged us, ask for the role that sets the poll interval
+                link->pending |= LINK_SWITCH_ROLE;
+            }
+        }
+        link_command_done(link, LINK_ROLE_DISCOVERY, status, opcode);
+    } else if (opcode == hci_write_automatic_flush_timeout.opcode) {
+        link_command_done(link, LINK_FLUSH_TIMEOUT, status, opcode);
+    } else if (opcode == hci_read_rssi.opcode) {
+        if (!status && size > 8) link->stats.rssi = (int8_t) packet[8];
+    } else if (opcode == link_read_failed_contact_counter.opcode) {
+        if (!status && size > 9) link->stats.failed_contacts = little_endian_read_16(packet, 8);
+    }
+}
+
+static void link_command_status(const uint8_t *packet, uint16_t size) {
+    uint16_t opcode;
+
+    if (size < 6 || !packet[2]) return;
+    opcode = little_endian_read_16(packet, 4);
+    if (opcode != link_sent_opcode || !link_sent) return;
+    // the command was refused, no completion event follows
+    if (opcode == link_qos_setup.opcode) {
+        link_command_done(link_sent, LINK_QOS_SETUP, packet[2], opcode);
+    } else if (opcode == hci_switch_role_command.opcode) {
+        link_command_done(link_sent, LINK_SWITCH_ROLE, packet[2], opcode);
+    } else {
+        link_sent->stats.command_failures++;
+        log_ring_write(LOG_LINK_COMMAND_FAILED, opcode, packet[2]);
+    }
+}
+
+static void link_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    bd_addr_t addr;
+    link_t   *link;
+    UNUSED(channel);
+
+    if (packet_type != HCI_EVENT_PACKET) return;
+    switch (hci_event_packet_get_type(packet)) {
+        case HCI_EVENT_COMMAND_COMPLETE:
+            link_command_complete(packet, size);
+            break;
+        case HCI_EVENT_COMMAND_STATUS:
+            link_command_status(packet, size);
+            break;
+        case HCI_EVENT_QOS_SETUP_COMPLETE:
+            if (size < 19) break;
+            link = link_for_handle(little_endian_read_16(packet, 3) & 0x0FFF);
+            if (!link) break;
+            if (!packet[2]) link->stats.poll_latency_us = little_endian_read_32(packet, 15);
+            link_command_done(link, LINK_QOS_SETUP, packet[2], link_qos_setup.opcode);
+            break;
+        case HCI_EVENT_ROLE_CHANGE:
+            if (size < 10) break;
+            reverse_bd_addr(&packet[3], addr);
+            link = link_for_addr(addr);
+            if (!link) break;
+            if (!packet[2]) link->stats.central = packet[9] == LINK_ROLE_CENTRAL;
+            link_command_done(link, LINK_SWITCH_ROLE, packet[2], hci_switch_role_command.opcode);
+            break;
+        case HCI_EVENT_MODE_CHANGE:
+            if (size < 8 || packet[2]) break;
+            link = link_for_handle(little_endian_read_16(packet, 3) & 0x0FFF);
+            if (!link) break;
+            link->stats.mode = packet[5];
+            if (link->stats.mode != LINK_MODE_ACTIVE) {
+                // accepted before the policy was written, or the peer insists
+                link->stats.sniff_exits++;
+                link->pending |= LINK_EXIT_SNIFF;
+                log_ring_write(LOG_LINK_SNIFF, (int32_t)(link - links) + 1, little_endian_read_16(packet, 6));
+            }
+            break;
+        case HCI_EVENT_FLUSH_OCCURRED:
+            if (size < 4) break;
+            link = link_for_handle(little_endian_read_16(packet, 2) & 0x0FFF);
+            if (link) link->stats.flushes++;
+            break;
+        case HCI_EVENT_DISCONNECTION_COMPLETE:
+            if (size < 5 || packet[2]) break;
+            link = link_for_handle(little_endian_read_16(packet, 3) & 0x0FFF);
+            if (link) link_policy_detach(link - links);
+            break;
+        default:
+            break;
+    }
+    link_run();
+}
+
+/* logs the statistics of every link through the log ring */
+static void link_log_stats(void) {
+    unsigned int slot;
+
+    for (slot = 0; slot < LINK_POLICY_SLOTS; slot++) {
+        const link_policy_stats_t *stats = &links[slot].stats;
+
+        if (stats->handle == HCI_CON_HANDLE_INVALID) continue;
+        log_ring_write(LOG_LINK_CADENCE, slot + 1, stats->interval_us);
+        log_ring_write(LOG_LINK_JITTER, slot + 1, stats->jitter_us);
+        log_ring_write(LOG_LINK_RSSI, slot + 1, stats->rssi);
+        log_ring_write(LOG_LINK_LATE, slot + 1, stats->late_reports);
+    }
+}
+
+/* polls the link quality of every link */
+static void link_timer_handler(btstack_timer_source_t *ts) {
+    unsigned int slot;
+
+    for (slot = 0; slot < LINK_POLICY_SLOTS; slot++) {
+        if (links[slot].stats.handle == HCI_CON_HANDLE_INVALID) continue;
+        links[slot].pending |= LINK_READ_RSSI | LINK_READ_FAILED_CONTACTS;
+    }
+    if (++link_ticks == LINK_LOG_PERIOD_TICKS) {
+        link_ticks = 0;
+        link_log_stats();
+    }
+    link_run();
+    btstack_run_loop_set_timer(ts, LINK_TIMER_PERIOD_MS);
+    btstack_run_loop_add_timer(ts);
+}
+
+void link_policy_init(void) {
+    unsigned int slot;
+
+    for (slot = 0; slot < LINK_POLICY_SLOTS; slot++) {
+        memset(&links[slot], 0, sizeof(links[slot]));
+        links[slot].stats.handle = HCI_CON_HANDLE_INVALID;
+    }
+    link_event_registration.callback = &link_event_handler;
+    hci_add_event_handler(&link_event_registration);
+    btstack_run_loop_set_timer_handler(&link_timer, &link_timer_handler);
+    btstack_run_loop_set_timer(&link_timer, LINK_TIMER_PERIOD_MS);
+    btstack_run_loop_add_timer(&link_timer);
+}
+
+void link_policy_attach(unsigned int slot, hci_con_handle_t handle, const bd_addr_t addr) {
+    link_t *link;
+
+    if (slot >= LINK_POLICY_SLOTS) return;
+    link = &links[slot];
+    memset(link, 0, sizeof(*link));
+    link->stats.handle = handle;
+    memcpy(link->addr, addr, sizeof(bd_addr_t));
+    link->pending = LINK_POLICY_COMMANDS;
+    link_run();
+}
+
+void link_policy_detach(unsigned int slot) {
+    if (slot >= LINK_POLICY_SLOTS) return;
+    if (link_sent == &links[slot]) link_sent = NULL;
+    links[slot].stats.handle = HCI_CON_HANDLE_INVALID;
+    links[slot].pending = 0;
+    links[slot].outstanding = 0;
+}
+
+void link_policy_report(unsigned int slot, uint32_t interval_us) {
+    link_t  *link;
+    uint32_t mean, deviation;
+
+    if (slot >= LINK_POLICY_SLOTS) return;
+    link = &links[slot];
+    link->stats.reports++;
+    if (!link->interval_q) {
+        link->interval_q = interval_us << LINK_CADENCE_SHIFT;
+        return;
+    }
+    mean = link->interval_q >> LINK_CADENCE_SHIFT;
+    if (2 * interval_us > 3 * mean) {
+        link->stats.late_reports++;
+    }
+    deviation = interval_us > mean ? interval_us - mean : mean - interval_us;
+    // mean deviation like the RTP interarrival jitter, in the same fixed point
+    link->interval_q += interval_us - mean;
+    link->jitter_q   += deviation - (link->jitter_q >> LINK_CADENCE_SHIFT);
+    link->stats.interval_us = link->interval_q >> LINK_CADENCE_SHIFT;
+    link->stats.jitter_us   = link->jitter_q >> LINK_CADENCE_SHIFT;
+}
+
+int link_policy_get_stats(unsigned int slot, link_policy_stats_t *stats) {
+    if (slot >= LINK_POLICY_SLOTS) return 0;
+    *stats = links[slot].stats;
+    return stats->handle != HCI_CON_HANDLE_INVALID;
+}
+
+int link_policy_command(int argc, char **argv) {
+    link_policy_stats_t stats;
+    unsigned int slot;
+    int printed = 0;
+
+    if (argc != 1) {
+        printf("usage: %s\n", argv[0]);
+        return 1;
+    }
+    for (slot = 0; slot < LINK_POLICY_SLOTS; slot++) {
+        if (!link_policy_get_stats(slot, &stats)) continue;
+        printed = 1;
+        printf("controller %u: handle 0x%04x, %s, %s, policy %s, poll latency %u us\n", slot + 1, stats.handle,
+               stats.central ? "central" : "peripheral", stats.mode == LINK_MODE_ACTIVE ? "active" : "sniff",
+               stats.applied ? "applied" : "pending", stats.poll_latency_us);
+        printf("  RSSI %d dB, %u failed contacts, %u flushes, %u sniff exits, %u failed commands\n",
+               stats.rssi, stats.failed_contacts, stats.flushes, stats.sniff_exits, stats.command_failures);
+        printf("  %u reports, interval %u us, jitter %u us, %u late\n",
+               stats.reports, stats.interval_us, stats.jitter_us, stats.late_reports);
+    }
+    if (!printed) {
+        printf("no controller links\n");
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+/*
+ * link_policy.h
+ *
+ * Latency-first policy for the ACL links of the controllers, and link
+ * quality telemetry. Once a controller's HID channels are up its link
+ * gets: no sniff, hold or park mode, the central role, a QoS request that
+ * shortens the poll interval, and a short automatic flush timeout. RSSI
+ * and the failed contact counter are read every second; the report
+ * cadence is measured from the arrival times of the reports.
+ */
+
+#ifndef LINK_POLICY_H
+#define LINK_POLICY_H
+
+#include <stdint.h>
+
+#include "btstack.h"
+
+#define LINK_POLICY_SLOTS 4 // one per controller
+
+typedef struct {
+    hci_con_handle_t handle;            // HCI_CON_HANDLE_INVALID if not attached
+    uint8_t  central;                   // we are the central (master) of the link
+    uint8_t  mode;                      // 0 active, 2 sniff
+    uint8_t  applied;                   // every policy command completed, failures are counted
+    int8_t   rssi;                      // dB off the golden receive power range
+    uint32_t poll_latency_us;           // granted by the QoS setup, 0 until then
+    uint32_t failed_contacts;           // consecutive flushed packets, 0 after an acknowledged one
+    uint32_t flushes;                   // flush occurred events
+    uint32_t sniff_exits;               // times the peer got the link into sniff mode
+    uint32_t command_failures;
+
+    // report cadence
+    uint32_t reports;
+    uint32_t interval_us;               // running mean of the report interval
+    uint32_t jitter_us;                 // running mean deviation from it
+    uint32_t late_reports;              // intervals over one and a half times the mean
+} link_policy_stats_t;
+
+/* registers for HCI events and starts the link quality timer */
+void link_policy_init(void);
+
+/* applies the policy to the link of a controller whose HID channels are open */
+void link_policy_attach(unsigned int slot, hci_con_handle_t handle, const bd_addr_t addr);
+
+/* forgets the link of a controller */
+void link_policy_detach(unsigned int slot);
+
+/* counts a report that arrived interval_us after the previous one */
+void link_policy_report(unsigned int slot, uint32_t interval_us);
+
+/*
+ * copies the statistics of a controller's link
+ * @return 1 if the controller has a link attached
+ */
+int link_policy_get_stats(unsigned int slot, link_policy_stats_t *stats);
+
+/* console command: "link" prints the links */
+int link_policy_command(int argc, char **argv);
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * log_ring.c
+ *
+ * Bounded multi-producer, single-consumer ring: every slot carries a
+ * sequence number telling producers and the consumer whose turn it is, so
+ * neither side takes a lock and a full ring costs the writer one compare.
+ */
+
+#include <stdio.h>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include "log_ring.h"
+
+#define LOG_TASK_STACK_SIZE 2048
+#define LOG_TASK_PRIORITY   1
+#define LOG_TASK_PERIOD_MS  20
+#define LOG_TASK_CORE       0   // console output stays with Bluetooth, off the control core
+
+typedef struct {
+    uint32_t     sequence;
+    log_record_t record;
+} log_slot_t;
+
+static const char * const log_formats[LOG_MESSAGE_COUNT] = {
+#define LOG_RING_MESSAGE_FORMAT(id, format) format,
+    LOG_RING_MESSAGES(LOG_RING_MESSAGE_FORMAT)
+#undef LOG_RING_MESSAGE_FORMAT
+};
+
+static log_slot_t log_slots[LOG_RING_SIZE];
+static uint32_t   log_head;     // next slot to reserve, shared by producers
+static uint32_t   log_tail;     // next slot to read, consumer only
+static uint32_t   log_dropped;
+
+void log_ring_init(void) {
+    uint32_t i;
+    for (i = 0; i < LOG_RING_SIZE; i++) {
+        log_slots[i].sequence = i;
+    }
+    log_head    = 0;
+    log_tail    = 0;
+    log_dropped = 0;
+}
+
+void log_ring_write(log_message_t id, int32_t arg0, int32_t arg1) {
+    uint32_t    pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+    log_slot_t *slot;
+
+    for (;;) {
+        int32_t diff;
+        slot = &log_slots[pos & (LOG_RING_SIZE - 1)];
+        diff = (int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&log_head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        } else if (diff < 0) {
+            // consumer has not freed this slot yet: ring is full
+            __atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->record.timestamp = (uint32_t) esp_timer_get_time();
+    slot->record.id        = (uint16_t) id;
+    slot->record.args[0]   = arg0;
+    slot->record.args[1]   = arg1;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+}
+
+int log_ring_read(log_record_t *record) {
+    log_slot_t *slot = &log_slots[log_tail & (LOG_RING_SIZE - 1)];
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != log_tail + 1) return 0;
+    *record = slot->record;
+    __atomic_store_n(&slot->sequence, log_tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+    log_tail++;
+    return 1;
+}
+
+void log_ring_print(const log_record_t *record) {
+    if (record->id >= LOG_MESSAGE_COUNT) return;
+    printf("[%u.%03u] ", record->timestamp / 1000000, (record->timestamp / 1000) % 1000);
+    printf(log_formats[record->id], record->args[0], record->args[1]);
+}
+
+uint32_t log_ring_dropped(void) {
+    return __atomic_load_n(&log_dropped, __ATOMIC_RELAXED);
+}
+
+/* prints the records whenever nothing more important runs */
+static void log_ring_task(void *arg) {
+    log_record_t record;
+    uint32_t     reported_dropped = 0;
+    (void) arg;
+
+    for (;;) {
+        uint32_t dropped;
+        while (log_ring_read(&record)) {
+            log_ring_print(&record);
+        }
+        dropped = log_ring_dropped();
+        if (dropped != reported_dropped) {
+            printf("log: %u records dropped\n", dropped - reported_dropped);
+            reported_dropped = dropped;
+        }
+        vTaskDelay(pdMS_TO_TICKS(LOG_TASK_PERIOD_MS));
+    }
+}
+
+void log_ring_start_task(void) {
+    xTaskCreatePinnedToCore(log_ring_task, "log_ring", LOG_TASK_STACK_SIZE, NULL, LOG_TASK_PRIORITY, NULL, LOG_TASK_CORE);
+}
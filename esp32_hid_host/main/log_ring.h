@@ -0,0 +1,102 @@
+/*
+ * log_ring.h
+ *
+ * Deferred binary logging. The hot path stores a compact record (message
+ * id, two arguments, timestamp) in a lock-free ring buffer; a low priority
+ * task formats and prints the records later.
+ */
+
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <stdint.h>
+
+#define LOG_RING_SIZE 128 // records, power of two
+
+/* message catalog: id and printf format taking up to two int arguments */
+#define LOG_RING_MESSAGES(X) \
+    X(LOG_JOYSTICK_LEFT_X,      "LJoy_x: %d.%d%%\n") \
+    X(LOG_JOYSTICK_LEFT_Y,      "LJoy_y: %d.%d%%\n") \
+    X(LOG_JOYSTICK_RIGHT_X,     "RJoy_x: %d.%d%%\n") \
+    X(LOG_JOYSTICK_RIGHT_Y,     "RJoy_y: %d.%d%%\n") \
+    X(LOG_TRIGGER_LEFT,         "LT: %d%%\n") \
+    X(LOG_TRIGGER_RIGHT,        "RT: %d%%\n") \
+    X(LOG_DPAD_UP,              "dpad Up pressed\n") \
+    X(LOG_DPAD_RIGHT,           "dpad Right pressed\n") \
+    X(LOG_DPAD_DOWN,            "dpad Down pressed\n") \
+    X(LOG_DPAD_LEFT,            "dpad Left pressed\n") \
+    X(LOG_BUTTON_A,             "button A pressed\n") \
+    X(LOG_BUTTON_B,             "button B pressed\n") \
+    X(LOG_BUTTON_X,             "button X pressed\n") \
+    X(LOG_BUTTON_Y,             "button Y pressed\n") \
+    X(LOG_BUTTON_LEFT,          "button left pressed\n") \
+    X(LOG_BUTTON_RIGHT,         "button right pressed\n") \
+    X(LOG_BUTTON_BACK,          "button back pressed\n") \
+    X(LOG_BUTTON_START,         "button start pressed\n") \
+    X(LOG_BUTTON_GUIDE,         "button guide pressed\n") \
+    X(LOG_STICK_LEFT_PUSH,      "Left Joystick pushed\n") \
+    X(LOG_STICK_RIGHT_PUSH,     "Right Joystick pushed\n") \
+    X(LOG_CALIBRATION_START,    "ESC calibration: move a trigger, A stores min, Y stores max, Back+Start saves\n") \
+    X(LOG_CALIBRATION_MIN,      "ESC calibration: pwm%d min %d us\n") \
+    X(LOG_CALIBRATION_MAX,      "ESC calibration: pwm%d max %d us\n") \
+    X(LOG_CALIBRATION_SAVED,    "ESC calibration saved\n") \
+    X(LOG_CALIBRATION_FAILED,   "ESC calibration not saved: error 0x%x\n") \
+    X(LOG_CONTROL_TIMING,       "control: max jitter %d us, max step %d us\n") \
+    X(LOG_CONTROL_OVERRUNS,     "control: %d overruns, %d reports coalesced\n") \
+    X(LOG_CONTROL_FLASH_STALLS, "control: %d flash erases stopped the loop, the longest %d us\n") \
+    X(LOG_CONTROL_LATENCY,      "control: report to PWM %d us average, %d us max\n") \
+    X(LOG_CPU_IDLE,             "cpu%d: %d%% idle\n") \
+    X(LOG_CONTROLLER_REPORTS,   "controller %d: %d reports/s\n") \
+    X(LOG_FIRST_REPORT,         "controller %d: first report %d ms after power on\n") \
+    X(LOG_FIRST_REPORT_CACHED,  "controller %d: first report %d ms after power on, SDP skipped\n") \
+    X(LOG_RECONNECTED,          "controller %d: first report %d ms after the link dropped\n") \
+    X(LOG_RECONNECT_SLOW,       "controller %d: reconnect slower than the %d ms target\n") \
+    X(LOG_LINK_POLICY,          "controller %d: link policy applied, poll latency %d us\n") \
+    X(LOG_LINK_COMMAND_FAILED,  "link command 0x%04x failed: status 0x%02x\n") \
+    X(LOG_LINK_SNIFF,           "controller %d: link entered sniff mode, %d slots, leaving it\n") \
+    X(LOG_LINK_CADENCE,         "controller %d: report interval %d us\n") \
+    X(LOG_LINK_JITTER,          "controller %d: report jitter %d us\n") \
+    X(LOG_LINK_RSSI,            "controller %d: RSSI %d dB\n") \
+    X(LOG_LINK_LATE,            "controller %d: %d late reports\n") \
+    X(LOG_ROUTES_APPLIED,       "routing table %d applied, %d compiled routes\n") \
+    X(LOG_DISCOVERY_RESPONSE,   "discovery: first gamepad responded after %d ms, RSSI %d dBm\n") \
+    X(LOG_DISCOVERY_CONNECTED,  "controller %d: discovered and connected %d ms after the inquiry started\n") \
+    X(LOG_DISCOVERY_FAILED,     "controller %d: no gamepad connected after %d inquiries\n") \
+    X(LOG_DISCOVERY_COMMAND_FAILED, "discovery command 0x%04x failed: status 0x%02x\n")
+
+typedef enum {
+#define LOG_RING_MESSAGE_ID(id, format) id,
+    LOG_RING_MESSAGES(LOG_RING_MESSAGE_ID)
+#undef LOG_RING_MESSAGE_ID
+    LOG_MESSAGE_COUNT
+} log_message_t;
+
+typedef struct {
+    uint32_t timestamp; // us since boot
+    uint16_t id;
+    uint16_t reserved;
+    int32_t  args[2];
+} log_record_t;
+
+/* resets the ring, call before the first log_ring_write */
+void log_ring_init(void);
+
+/* starts the low priority task that prints the records */
+void log_ring_start_task(void);
+
+/* stores a record, never blocks, counts a drop if the ring is full */
+void log_ring_write(log_message_t id, int32_t arg0, int32_t arg1);
+
+/*
+ * takes the oldest record out of the ring, single consumer only
+ * @return 1 if a record was read
+ */
+int log_ring_read(log_record_t *record);
+
+/* prints a record with its catalog format */
+void log_ring_print(const log_record_t *record);
+
+/* @return number of records dropped since boot */
+uint32_t log_ring_dropped(void);
+
+#endif
@@ -0,0 +1,231 @@
+/*
+ * motion_stage.c
+ *
+ * Positions and velocities are kept in 1/256 of the output's unit per
+ * tick, so slow slews still move every tick instead of in steps of whole
+ * microseconds or per mille. The limits are converted to those units
+ * once, when they are set.
+ *
+ * Each tick an output wants to cover the whole distance to its setpoint;
+ * that speed is cut to the slew limit and to the highest speed from which
+ * the acceleration limit can still brake before the setpoint, then the
+ * change of speed is cut to the acceleration limit. Arriving at the
+ * setpoint stops the output.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "motion_stage.h"
+
+#define MOTION_FRACTION_BITS    8
+#define MOTION_ONE              (1 << MOTION_FRACTION_BITS)
+#define MOTION_US_PER_S         1000000ull
+
+typedef struct {
+    int32_t  position;          // 1/256 units
+    int32_t  velocity;          // 1/256 units per tick
+    int32_t  target;            // 1/256 units
+    uint32_t value;             // last staged
+    int32_t  slew;              // 1/256 units per tick, 0 for no limit
+    int32_t  accel;             // 1/256 units per tick per tick, 0 for no limit
+    uint8_t  settling;          // on the way to a setpoint
+    uint8_t  jumped;            // the next tick's step is a jump
+    uint32_t settle_start;      // tick the setpoint was set in
+    motion_stage_limits_t limits;
+    motion_stage_stats_t  stats;
+} motion_output_t;
+
+// limits of the outputs, the LED follows its trigger directly
+static const motion_stage_limits_t motion_default_limits[MOTOR_PWM_COUNT] = {
+    [MOTOR_PWM_1]   = { 3000, 30000 },  // the 1000 us ESC range in about a third of a second
+    [MOTOR_PWM_2]   = { 3000, 30000 },
+    [MOTOR_PWM_3]   = { 3000, 30000 },
+    [MOTOR_PWM_LED] = { 0, 0 },
+};
+
+static motion_output_t motion_outputs[MOTOR_PWM_COUNT];
+static uint32_t        motion_tick_us;
+static uint32_t        motion_ticks;
+
+static uint32_t motion_isqrt(uint64_t value) {
+    uint64_t root = 0;
+    uint64_t bit = 1ull << 62;
+
+    while (bit > value) bit >>= 2;
+    while (bit) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t) root;
+}
+
+/* @return a limit per second (or per second squared) in 1/256 units per tick, at least 1 */
+static int32_t motion_per_tick(uint64_t limit, unsigned int ticks_per_unit) {
+    unsigned int i;
+
+    if (!limit) return 0;
+    limit <<= MOTION_FRACTION_BITS;
+    for (i = 0; i < ticks_per_unit; i++) {
+        limit = limit * motion_tick_us / MOTION_US_PER_S;
+    }
+    if (!limit) return 1;
+    return limit > INT32_MAX ? INT32_MAX : (int32_t) limit;
+}
+
+void motion_stage_init(uint32_t tick_us) {
+    int i;
+
+    motion_tick_us = tick_us;
+    memset(motion_outputs, 0, sizeof(motion_outputs));
+    for (i = 0; i < MOTOR_PWM_COUNT; i++) {
+        motion_outputs[i].value    = motor_pwm_get_value((motor_pwm_output_t) i);
+        motion_outputs[i].position = (int32_t) motion_outputs[i].value << MOTION_FRACTION_BITS;
+        motion_outputs[i].target   = motion_outputs[i].position;
+        motion_stage_set_limits((motor_pwm_output_t) i, &motion_default_limits[i]);
+    }
+}
+
+void motion_stage_set_limits(motor_pwm_output_t output, const motion_stage_limits_t *limits) {
+    motion_output_t *motion = &motion_outputs[output];
+
+    motion->limits = *limits;
+    motion->slew   = motion_per_tick(limits->slew, 1);
+    motion->accel  = motion_per_tick(limits->accel, 2);
+}
+
+void motion_stage_get_limits(motor_pwm_output_t output, motion_stage_limits_t *limits) {
+    *limits = motion_outputs[output].limits;
+}
+
+void motion_stage_set_target(motor_pwm_output_t output, uint32_t value) {
+    motion_output_t *motion = &motion_outputs[output];
+    int32_t target = (int32_t) value << MOTION_FRACTION_BITS;
+
+    if (target == motion->target) return;
+    motion->target       = target;
+    motion->settling     = 1;
+    motion->settle_start = motion_ticks;
+    motion->stats.setpoints++;
+}
+
+void motion_stage_jump(motor_pwm_output_t output, uint32_t value) {
+    motion_output_t *motion = &motion_outputs[output];
+
+    motion_stage_set_target(output, value);
+    if (motion->position == motion->target) return;
+    motion->position = motion->target;
+    motion->velocity = 0;
+    motion->jumped   = 1;
+    motion->stats.jumps++;
+}
+
+/* @return the speed toward a setpoint distance away, within the output's limits */
+static int32_t motion_speed(const motion_output_t *motion, int32_t distance) {
+    int32_t speed = distance;
+
+    if (motion->slew && speed > motion->slew) {
+        speed = motion->slew;
+    }
+    if (motion->accel) {
+        // braking by accel every tick from speed v covers about v * (v + accel) / (2 * accel)
+        uint64_t accel = (uint64_t) motion->accel;
+        int32_t  brake = (int32_t)((motion_isqrt(accel * accel + 8 * accel * (uint64_t) distance) - accel) / 2);
+        if (brake < 1) brake = 1;
+        if (speed > brake) speed = brake;
+    }
+    return speed;
+}
+
+void motion_stage_step(void) {
+    int i;
+
+    for (i = 0; i < MOTOR_PWM_COUNT; i++) {
+        motion_output_t *motion = &motion_outputs[i];
+        int32_t  error = motion->target - motion->position;
+        int32_t  velocity;
+        uint32_t value, step;
+        uint8_t  jumped = motion->jumped;
+
+        motion->jumped = 0;
+
+        if (error || motion->velocity) {
+            velocity = error < 0 ? -motion_speed(motion, -error) : motion_speed(motion, error);
+            if (motion->accel) {
+                if (velocity > motion->velocity + motion->accel) velocity = motion->velocity + motion->accel;
+                if (velocity < motion->velocity - motion->accel) velocity = motion->velocity - motion->accel;
+            }
+            motion->position += velocity;
+            motion->velocity  = motion->position == motion->target ? 0 : velocity;
+        }
+
+        if (motion->settling && motion->position == motion->target) {
+            uint32_t ticks = motion_ticks - motion->settle_start;
+            motion->settling = 0;
+            motion->stats.settled++;
+            motion->stats.settle_ticks += ticks;
+            if (!ticks) motion->stats.immediate++;
+            if (ticks > motion->stats.settle_ticks_max) motion->stats.settle_ticks_max = ticks;
+        }
+
+        value = (uint32_t)((motion->position + MOTION_ONE / 2) >> MOTION_FRACTION_BITS);
+        if (value == motion->value) continue;
+        step = value > motion->value ? value - motion->value : motion->value - value;
+        if (!jumped && step > motion->stats.step_max) motion->stats.step_max = step;
+        motion->value = value;
+        motor_pwm_stage((motor_pwm_output_t) i, value);
+    }
+    motion_ticks++;
+}
+
+void motion_stage_get_stats(motor_pwm_output_t output, motion_stage_stats_t *stats) {
+    *stats = motion_outputs[output].stats;
+}
+
+void motion_stage_reset_stats(void) {
+    int i;
+    for (i = 0; i < MOTOR_PWM_COUNT; i++) {
+        memset(&motion_outputs[i].stats, 0, sizeof(motion_outputs[i].stats));
+    }
+}
+
+int motion_stage_command(int argc, char **argv) {
+    motion_stage_limits_t limits;
+    motion_stage_stats_t  stats;
+    unsigned long output;
+    int i;
+
+    if (argc == 1) {
+        printf("%u us ticks\n", motion_tick_us);
+        for (i = 0; i < MOTOR_PWM_COUNT; i++) {
+            motion_stage_get_limits((motor_pwm_output_t) i, &limits);
+            motion_stage_get_stats((motor_pwm_output_t) i, &stats);
+            printf("pwm%d: at %u, slew %u/s, accel %u/s2, %u setpoints (%u immediate, %u jumps), settled after %u ticks average, %u max, steps up to %u\n",
+                   i + 1, motion_outputs[i].value, limits.slew, limits.accel, stats.setpoints, stats.immediate, stats.jumps,
+                   stats.settled ? stats.settle_ticks / stats.settled : 0, stats.settle_ticks_max, stats.step_max);
+        }
+        return 0;
+    }
+    if (argc == 2 && !strcmp(argv[1], "reset")) {
+        motion_stage_reset_stats();
+        return 0;
+    }
+    if (argc == 4) {
+        output = strtoul(argv[1], NULL, 10);
+        if (output >= 1 && output <= MOTOR_PWM_COUNT) {
+            limits.slew  = (uint32_t) strtoul(argv[2], NULL, 10);
+            limits.accel = (uint32_t) strtoul(argv[3], NULL, 10);
+            motion_stage_set_limits((motor_pwm_output_t)(output - 1), &limits);
+            printf("pwm%lu: slew %u/s, accel %u/s2\n", output, limits.slew, limits.accel);
+            return 0;
+        }
+    }
+    printf("usage: %s [<pwm 1..%d> <slew/s> <accel/s2>|reset], 0 for no limit\n", argv[0], MOTOR_PWM_COUNT);
+    return 1;
+}
@@ -0,0 +1,58 @@
+/*
+ * motion_stage.h
+ *
+ * Per-output motion stage between the controller handlers and the PWM.
+ * The handlers set a setpoint whenever a report changes one; every control
+ * tick the stage moves each output toward its newest setpoint within the
+ * output's slew and acceleration limits and stages the value. A setpoint
+ * the limits allow is reached in the tick it was set, so the stage adds
+ * no latency of its own; going to rest is never slowed down.
+ */
+
+#ifndef MOTION_STAGE_H
+#define MOTION_STAGE_H
+
+#include <stdint.h>
+
+#include "motor_pwm.h"
+
+typedef struct {
+    uint32_t slew;              // output units (motor_pwm.h) per second, 0 for no limit
+    uint32_t accel;             // output units per second squared, 0 for no limit
+} motion_stage_limits_t;
+
+typedef struct {
+    uint32_t setpoints;         // setpoint changes
+    uint32_t immediate;         // of those, reached in the tick they were set
+    uint32_t settled;           // reached at all, the rest were replaced on the way
+    uint32_t settle_ticks;      // sum of the ticks after the setpoint's own, for the average
+    uint32_t settle_ticks_max;
+    uint32_t jumps;             // setpoints put in place without limits
+    uint32_t step_max;          // largest change in one tick, jumps aside
+} motion_stage_stats_t;
+
+/* starts every output at its current value, tick_us is the control period */
+void motion_stage_init(uint32_t tick_us);
+
+/* sets the limits of an output, takes effect at the next tick */
+void motion_stage_set_limits(motor_pwm_output_t output, const motion_stage_limits_t *limits);
+
+void motion_stage_get_limits(motor_pwm_output_t output, motion_stage_limits_t *limits);
+
+/* sets the value an output moves toward, from the control task */
+void motion_stage_set_target(motor_pwm_output_t output, uint32_t value);
+
+/* puts an output at a value at the next tick, without limits: rest, failsafe and calibration */
+void motion_stage_jump(motor_pwm_output_t output, uint32_t value);
+
+/* runs one tick: moves the outputs and stages the changed duties for motor_pwm_commit */
+void motion_stage_step(void);
+
+void motion_stage_get_stats(motor_pwm_output_t output, motion_stage_stats_t *stats);
+
+void motion_stage_reset_stats(void);
+
+/* console command: "motion" prints the outputs, "motion <pwm> <slew> <accel>" sets limits, "motion reset" */
+int motion_stage_command(int argc, char **argv);
+
+#endif
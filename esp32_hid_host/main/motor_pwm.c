@@ -0,0 +1,431 @@
+/*
+ * motor_pwm.c
+ *
+ * ledc_channel_config() routes the GPIO matrix and reprograms the whole
+ * channel, so it only runs in motor_pwm_init(). Per report the outputs
+ * only see ledc_set_duty() for the duty register and ledc_update_duty()
+ * to latch it, and only for outputs whose value actually changed.
+ *
+ * A mode's timer divides the 80 MHz APB clock, its divider must stay at 1
+ * or above: frequency << bits may not exceed the clock. Each mode takes
+ * the most bits that fit, e.g. 20 at 50 Hz and 17 at 400 Hz, where the
+ * former 62 Hz / 10 bit timer left an ESC about 60 counts of throttle.
+ * Values are converted to duty counts with a Q16 factor per output, so a
+ * commit never divides.
+ *
+ * ledc_set_duty() also clears the channel's hpoint, so the duty is written
+ * with ledc_set_duty_with_hpoint() to keep the output's phase. The hpoint
+ * plus the longest pulse of the mode has to stay within the period, the
+ * pulse would otherwise run into the next one: at 400 Hz a 2000 us pulse
+ * leaves 500 us to stagger the ESCs in.
+ *
+ * ledc_update_duty() latches a channel at the next overflow of its timer.
+ * Latched one after the other, the outputs of a commit can straddle an
+ * overflow, and one motor runs a whole period on its old value. A group
+ * is latched in a critical section once its timer is more than
+ * MOTOR_PWM_LATCH_GUARD_US away from the overflow, which the latches of
+ * all outputs fit into; the wait is at most that long.
+ *
+ * A DShot throttle t goes out as the value t + 47, the first throttle
+ * value after the commands, and 0 as 0. The frames of all DShot outputs
+ * are written while the LEDC duties are, and started right after the
+ * LEDC latches, so both kinds of output change within the same commit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "driver/ledc.h"
+#include "freertos/FreeRTOS.h"
+#include "soc/ledc_struct.h"
+
+#include "dshot.h"
+#include "motor_pwm.h"
+
+#define MOTOR_PWM_SPEED_MODE LEDC_HIGH_SPEED_MODE
+#define MOTOR_PWM_BITS_MAX (LEDC_TIMER_BIT_MAX - 1)
+#define MOTOR_PWM_SCALE_BITS 16
+#define MOTOR_PWM_US_PER_S 1000000
+#define MOTOR_PWM_LATCH_GUARD_US 8 // latching a group takes well below this
+// GPIO
+#define PWM1_PIN GPIO_NUM_19
+#define PWM2_PIN GPIO_NUM_21
+#define PWM3_PIN GPIO_NUM_18
+#define LED_PIN GPIO_NUM_17
+
+typedef struct {
+    const char *name;
+    const char *unit;
+    uint32_t    freq_hz;
+    uint32_t    min;
+    uint32_t    max;
+    uint32_t    full_scale;     // value of a 100% duty
+} motor_pwm_mode_config_t;
+
+typedef struct {
+    gpio_num_t       gpio_num;
+    uint8_t          channel;       // LEDC, RMT for DShot
+    motor_pwm_mode_t mode;
+    uint32_t         initial_value;
+    uint8_t          group;         // MOTOR_PWM_NO_GROUP or 1..MOTOR_PWM_GROUP_MAX, outputs of one mode
+    uint32_t         phase;         // in the mode's unit
+} motor_pwm_channel_t;
+
+static const motor_pwm_mode_config_t motor_pwm_modes[MOTOR_PWM_MODE_COUNT] = {
+    [MOTOR_PWM_MODE_SERVO]      = { "servo",      "us",       50,   500,  2500, MOTOR_PWM_US_PER_S / 50 },
+    [MOTOR_PWM_MODE_ESC_400HZ]  = { "esc400",     "us",       400,  1000, 2000, MOTOR_PWM_US_PER_S / 400 },
+    [MOTOR_PWM_MODE_ONESHOT125] = { "oneshot125", "us",       2000, 125,  250,  MOTOR_PWM_US_PER_S / 2000 },
+    [MOTOR_PWM_MODE_DUTY]       = { "duty",       "permille", 1000, 0,    MOTOR_PWM_DUTY_FULL, MOTOR_PWM_DUTY_FULL },
+    [MOTOR_PWM_MODE_DSHOT150]   = { "dshot150",   "throttle", 0,    0,    MOTOR_PWM_DSHOT_FULL, 0 },
+    [MOTOR_PWM_MODE_DSHOT300]   = { "dshot300",   "throttle", 0,    0,    MOTOR_PWM_DSHOT_FULL, 0 },
+    [MOTOR_PWM_MODE_DSHOT600]   = { "dshot600",   "throttle", 0,    0,    MOTOR_PWM_DSHOT_FULL, 0 },
+};
+
+// ESCs that only take 50 Hz need MOTOR_PWM_MODE_SERVO, DShot ESCs take an RMT channel instead of LEDC
+static const motor_pwm_channel_t motor_pwm_channels[MOTOR_PWM_COUNT] = {
+    { PWM1_PIN, LEDC_CHANNEL_1, MOTOR_PWM_MODE_ESC_400HZ, 1000, 1, 0 },   // ESC stopped
+    { PWM2_PIN, LEDC_CHANNEL_2, MOTOR_PWM_MODE_ESC_400HZ, 1000, 1, 150 }, // staggered in the 500 us left
+    { PWM3_PIN, LEDC_CHANNEL_3, MOTOR_PWM_MODE_ESC_400HZ, 1000, 1, 300 },
+    { LED_PIN,  LEDC_CHANNEL_4, MOTOR_PWM_MODE_DUTY,      300,  MOTOR_PWM_NO_GROUP, 0 }, // 30%
+};
+
+static uint32_t motor_pwm_bits[MOTOR_PWM_MODE_COUNT];
+static uint32_t motor_pwm_guard[MOTOR_PWM_MODE_COUNT];  // counts of MOTOR_PWM_LATCH_GUARD_US
+static uint32_t motor_pwm_scale[MOTOR_PWM_COUNT];      // duty counts per unit, Q16
+static uint32_t motor_pwm_value[MOTOR_PWM_COUNT];
+static uint32_t motor_pwm_staged[MOTOR_PWM_COUNT];
+static uint32_t motor_pwm_staged_mask;
+static uint8_t  motor_pwm_group[MOTOR_PWM_COUNT];
+static uint32_t motor_pwm_phase[MOTOR_PWM_COUNT];
+static uint32_t motor_pwm_hpoint[MOTOR_PWM_COUNT];     // counts of the phase
+static uint32_t motor_pwm_rewrite_mask;                 // outputs whose phase changed, set from the console
+static portMUX_TYPE motor_pwm_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t motor_pwm_dshot_mask;                   // outputs
+static uint32_t motor_pwm_dshot_channels;               // their RMT channels
+static uint32_t motor_pwm_telemetry_mask;
+static uint32_t motor_pwm_errors;
+
+/* @return the widest duty resolution the LEDC clock allows at a frequency */
+static uint32_t motor_pwm_max_bits(uint32_t freq_hz) {
+    uint32_t bits = MOTOR_PWM_BITS_MAX;
+
+    while (bits > 1 && ((uint64_t) freq_hz << bits) > LEDC_APB_CLK_HZ) bits--;
+    return bits;
+}
+
+/* @return a value clamped to the range of the output's mode */
+static uint32_t motor_pwm_clamp(motor_pwm_output_t output, uint32_t value) {
+    const motor_pwm_mode_config_t *mode = &motor_pwm_modes[motor_pwm_channels[output].mode];
+
+    if (value < mode->min) return mode->min;
+    if (value > mode->max) return mode->max;
+    return value;
+}
+
+/* @return duty counts of a value in range */
+static uint32_t motor_pwm_counts(motor_pwm_output_t output, uint32_t value) {
+    return (uint32_t)(((uint64_t) value * motor_pwm_scale[output] + (1u << (MOTOR_PWM_SCALE_BITS - 1)))
+                      >> MOTOR_PWM_SCALE_BITS);
+}
+
+/* @return the latest phase of an output at which its mode's longest pulse still ends within the period */
+static uint32_t motor_pwm_phase_max(motor_pwm_output_t output) {
+    const motor_pwm_mode_config_t *mode = &motor_pwm_modes[motor_pwm_channels[output].mode];
+
+    return mode->full_scale - mode->max;
+}
+
+void motor_pwm_init(void) {
+    uint32_t used = 0;
+    int i;
+
+    for (i = 0; i < MOTOR_PWM_COUNT; i++) {
+        used |= 1u << motor_pwm_channels[i].mode;
+    }
+    // one timer per PWM mode in use, timer n runs mode n
+    for (i = 0; i < MOTOR_PWM_MODE_COUNT; i++) {
+        ledc_timer_config_t ledc_timer = {0};
+
+        if (!(used & (1u << i)) || motor_pwm_mode_is_dshot((motor_pwm_mode_t) i)) continue;
+        motor_pwm_bits[i] = motor_pwm_max_bits(motor_pwm_modes[i].freq_hz);
+        ledc_timer.speed_mode = MOTOR_PWM_SPEED_MODE;
+        ledc_timer.bit_num = (ledc_timer_bit_t) motor_pwm_bits[i];
+        ledc_timer.timer_num = (ledc_timer_t) i;
+        ledc_timer.freq_hz = motor_pwm_modes[i].freq_hz;
+        ESP_ERROR_CHECK( ledc_timer_config(&ledc_timer) );
+        motor_pwm_guard[i] = (uint32_t)((((uint64_t) motor_pwm_modes[i].freq_hz << motor_pwm_bits[i])
+                                         * MOTOR_PWM_LATCH_GUARD_US + MOTOR_PWM_US_PER_S - 1) / MOTOR_PWM_US_PER_S);
+    }
+
+    for (i = 0; i < MOTOR_PWM_COUNT; i++) {
+        const motor_pwm_channel_t *channel = &motor_pwm_channels[i];
+        ledc_channel_config_t channel_config = {0};
+
+        motor_pwm_value[i] = motor_pwm_clamp((motor_pwm_output_t) i, channel->initial_value);
+        if (motor_pwm_mode_is_dshot(channel->mode)) {
+            ESP_ERROR_CHECK( dshot_init_channel((rmt_channel_t) channel->channel, channel->gpio_num,
+                                               (dshot_protocol_t)(channel->mode - MOTOR_PWM_MODE_DSHOT150)) );
+            motor_pwm_bits[channel->mode] = DSHOT_VALUE_BITS;
+            motor_pwm_dshot_mask |= 1u << i;
+            motor_pwm_dshot_channels |= 1u << channel->channel;
+            printf("pwm%d initialized: %s on RMT channel %u\n", i + 1, motor_pwm_modes[channel->mode].name,
+                   channel->channel);
+            continue;
+        }
+        motor_pwm_scale[i] = (uint32_t)(((uint64_t) 1 << (motor_pwm_bits[channel->mode] + MOTOR_PWM_SCALE_BITS))
+                                        / motor_pwm_modes[channel->mode].full_scale);
+        motor_pwm_group[i] = channel->group;
+        motor_pwm_phase[i] = channel->phase < motor_pwm_phase_max((motor_pwm_output_t) i)
+                             ? channel->phase : motor_pwm_phase_max((motor_pwm_output_t) i);
+        motor_pwm_hpoint[i] = motor_pwm_counts((motor_pwm_output_t) i, motor_pwm_phase[i]);
+        channel_config.gpio_num = channel->gpio_num;
+        channel_config.speed_mode = MOTOR_PWM_SPEED_MODE;
+        channel_config.channel = (ledc_channel_t) channel->channel;
+        channel_config.intr_type = LEDC_INTR_DISABLE;
+        channel_config.timer_sel = (ledc_timer_t) channel->mode;
+        channel_config.duty = motor_pwm_counts((motor_pwm_output_t) i,
+                                               motor_pwm_clamp((motor_pwm_output_t) i, channel->initial_value));
+        channel_config.hpoint = (int) motor_pwm_hpoint[i];
+        ESP_ERROR_CHECK( ledc_channel_config(&channel_config) );
+        printf("pwm%d initialized: %s, %u Hz, %u bit, phase %u %s\n", i + 1, motor_pwm_modes[channel->mode].name,
+               motor_pwm_modes[channel->mode].freq_hz, motor_pwm_bits[channel->mode], motor_pwm_phase[i],
+               motor_pwm_modes[channel->mode].unit);
+    }
+    motor_pwm_staged_mask = 0;
+}
+
+/* @return the DShot frame of an output's value, taking a pending telemetry request */
+static uint16_t motor_pwm_dshot_frame(int output) {
+    uint32_t value = motor_pwm_value[output];
+    int telemetry = (motor_pwm_telemetry_mask >> output) & 1;
+
+    motor_pwm_telemetry_mask &= ~(1u << output);
+    return dshot_frame(value ? (uint16_t)(value + DSHOT_THROTTLE_MIN - 1) : 0, telemetry);
+}
+
+void motor_pwm_stage(motor_pwm_output_t output, uint32_t value) {
+    motor_pwm_staged[output] = motor_pwm_clamp(output, value);
+    motor_pwm_staged_mask |= 1u << output;
+}
+
+/*
+ * latches the written duties of outputs that share a timer; more than one
+ * are latched together after waiting out the end of the timer's period if
+ * it is closer than the guard
+ * @return ESP_OK or the first driver error, errors are also counted
+ */
+static esp_err_t motor_pwm_latch(uint32_t outputs) {
+    esp_err_t result = ESP_OK;
+    esp_err_t err;
+    uint32_t  timer = (uint32_t) motor_pwm_channels[__builtin_ctz(outputs)].mode;
+    uint32_t  limit = (1u << motor_pwm_bits[timer]) - motor_pwm_guard[timer];
+    int       together = (outputs & (outputs - 1)) != 0;
+    int       i;
+
+    if (together) {
+        portENTER_CRITICAL(&motor_pwm_mux);
+        while (LEDC.timer_group[MOTOR_PWM_SPEED_MODE].timer[timer].value.timer_cnt >= limit);
+    }
+    while (outputs) {
+        i = __builtin_ctz(outputs);
+        outputs &= outputs - 1;
+        err = ledc_update_duty(MOTOR_PWM_SPEED_MODE, (ledc_channel_t) motor_pwm_channels[i].channel);
+        if (err != ESP_OK) {
+            motor_pwm_errors++;
+            if (result == ESP_OK) result = err;
+        }
+    }
+    if (together) {
+        portEXIT_CRITICAL(&motor_pwm_mux);
+    }
+    return result;
+}
+
+esp_err_t motor_pwm_commit(void) {
+    esp_err_t result = ESP_OK;
+    esp_err_t err;
+    uint32_t  changed = 0;
+    uint32_t  rewrite;
+    uint32_t  pending;
+    int i;
+
+    // outputs with a new phase are written again with their value
+    rewrite = __atomic_exchange_n(&motor_pwm_rewrite_mask, 0, __ATOMIC_ACQUIRE);
+    pending = rewrite & ~motor_pwm_staged_mask;
+    while (pending) {
+        i = __builtin_ctz(pending);
+        pending &= pending - 1;
+        motor_pwm_staged[i] = motor_pwm_value[i];
+    }
+
+    // write all duty registers first ...
+    pending = motor_pwm_staged_mask | rewrite;
+    motor_pwm_staged_mask = 0;
+    while (pending) {
+        i = __builtin_ctz(pending);
+        pending &= pending - 1;
+        if (motor_pwm_staged[i] == motor_pwm_value[i] && !(rewrite & (1u << i))) continue;
+        if (motor_pwm_dshot_mask & (1u << i)) {
+            motor_pwm_value[i] = motor_pwm_staged[i];
+            continue;
+        }
+        err = ledc_set_duty_with_hpoint(MOTOR_PWM_SPEED_MODE, (ledc_channel_t) motor_pwm_channels[i].channel,
+                                        motor_pwm_counts((motor_pwm_output_t) i, motor_pwm_staged[i]),
+                                        __atomic_load_n(&motor_pwm_hpoint[i], __ATOMIC_RELAXED));
+        if (err != ESP_OK) {
+            motor_pwm_errors++;
+            if (result == ESP_OK) result = err;
+            continue;
+        }
+        motor_pwm_value[i] = motor_pwm_staged[i];
+        changed |= 1u << i;
+    }
+    // ... and every DShot frame ...
+    pending = motor_pwm_dshot_mask;
+    while (pending) {
+        i = __builtin_ctz(pending);
+        pending &= pending - 1;
+        err = dshot_write((rmt_channel_t) motor_pwm_channels[i].channel, motor_pwm_dshot_frame(i));
+        if (err != ESP_OK) {
+            motor_pwm_errors++;
+            if (result == ESP_OK) result = err;
+        }
+    }
+    // ... then latch them back to back, each group within one period of its timer
+    while (changed) {
+        uint32_t latch = changed & -changed;
+        uint8_t  group = motor_pwm_group[__builtin_ctz(latch)];
+
+        if (group != MOTOR_PWM_NO_GROUP) {
+            for (i = __builtin_ctz(latch) + 1; i < MOTOR_PWM_COUNT; i++) {
+                if (motor_pwm_group[i] == group) latch |= changed & (1u << i);
+            }
+        }
+        changed &= ~latch;
+        err = motor_pwm_latch(latch);
+        if (err != ESP_OK && result == ESP_OK) result = err;
+    }
+    if (motor_pwm_dshot_channels) {
+        err = dshot_start(motor_pwm_dshot_channels);
+        if (err != ESP_OK) {
+            motor_pwm_errors++;
+            if (result == ESP_OK) result = err;
+        }
+    }
+    return result;
+}
+
+esp_err_t motor_pwm_set_value(motor_pwm_output_t output, uint32_t value) {
+    motor_pwm_stage(output, value);
+    return motor_pwm_commit();
+}
+
+uint32_t motor_pwm_get_value(motor_pwm_output_t output) {
+    return motor_pwm_value[output];
+}
+
+void motor_pwm_request_telemetry(motor_pwm_output_t output) {
+    if (motor_pwm_dshot_mask & (1u << output)) {
+        motor_pwm_telemetry_mask |= 1u << output;
+    }
+}
+
+motor_pwm_mode_t motor_pwm_get_mode(motor_pwm_output_t output) {
+    return motor_pwm_channels[output].mode;
+}
+
+void motor_pwm_get_info(motor_pwm_output_t output, motor_pwm_info_t *info) {
+    const motor_pwm_channel_t     *channel = &motor_pwm_channels[output];
+    const motor_pwm_mode_config_t *mode = &motor_pwm_modes[channel->mode];
+
+    info->mode    = channel->mode;
+    info->name    = mode->name;
+    info->unit    = mode->unit;
+    info->freq_hz = mode->freq_hz;
+    info->bits    = motor_pwm_bits[channel->mode];
+    info->min     = mode->min;
+    info->max     = mode->max;
+    info->channel = channel->channel;
+    info->timer   = (uint32_t) channel->mode;
+    info->group   = motor_pwm_group[output];
+    info->phase   = motor_pwm_phase[output];
+    info->phase_max = motor_pwm_mode_is_dshot(channel->mode) ? 0 : motor_pwm_phase_max(output);
+}
+
+esp_err_t motor_pwm_set_group(motor_pwm_output_t output, uint32_t group) {
+    int i;
+
+    if (motor_pwm_mode_is_dshot(motor_pwm_channels[output].mode) || group > MOTOR_PWM_GROUP_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (i = 0; i < MOTOR_PWM_COUNT; i++) {
+        if (group != MOTOR_PWM_NO_GROUP && motor_pwm_group[i] == group
+                && motor_pwm_channels[i].mode != motor_pwm_channels[output].mode) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    __atomic_store_n(&motor_pwm_group[output], (uint8_t) group, __ATOMIC_RELAXED);
+    return ESP_OK;
+}
+
+esp_err_t motor_pwm_set_phase(motor_pwm_output_t output, uint32_t phase) {
+    if (motor_pwm_mode_is_dshot(motor_pwm_channels[output].mode) || phase > motor_pwm_phase_max(output)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    motor_pwm_phase[output] = phase;
+    __atomic_store_n(&motor_pwm_hpoint[output], motor_pwm_counts(output, phase), __ATOMIC_RELAXED);
+    __atomic_or_fetch(&motor_pwm_rewrite_mask, 1u << output, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+uint32_t motor_pwm_error_count(void) {
+    return motor_pwm_errors;
+}
+
+int motor_pwm_command(int argc, char **argv) {
+    motor_pwm_info_t info;
+    unsigned long output;
+    uint32_t value;
+    int i;
+
+    if (argc == 4) {
+        output = strtoul(argv[1], NULL, 10);
+        value = (uint32_t) strtoul(argv[3], NULL, 10);
+        if (output >= 1 && output <= MOTOR_PWM_COUNT && !strcmp(argv[2], "group")) {
+            if (motor_pwm_set_group((motor_pwm_output_t)(output - 1), value) != ESP_OK) {
+                printf("pwm%lu: no PWM output or group %u holds outputs of another mode\n", output, value);
+                return 1;
+            }
+            return 0;
+        }
+        if (output >= 1 && output <= MOTOR_PWM_COUNT && !strcmp(argv[2], "phase")) {
+            motor_pwm_get_info((motor_pwm_output_t)(output - 1), &info);
+            if (motor_pwm_set_phase((motor_pwm_output_t)(output - 1), value) != ESP_OK) {
+                printf("pwm%lu: no PWM output or phase beyond %u %s\n", output, info.phase_max, info.unit);
+                return 1;
+            }
+            return 0;
+        }
+    }
+    if (argc != 1) {
+        printf("usage: %s [<pwm 1..%d> group <0..%d>|<pwm 1..%d> phase <value>], group 0 latches alone\n", argv[0],
+               MOTOR_PWM_COUNT, MOTOR_PWM_GROUP_MAX, MOTOR_PWM_COUNT);
+        return 1;
+    }
+
+    for (i = 0; i < MOTOR_PWM_COUNT; i++) {
+        motor_pwm_get_info((motor_pwm_output_t) i, &info);
+        if (motor_pwm_mode_is_dshot(info.mode)) {
+            printf("pwm%d: %s on RMT channel %u, %u..%u %s, at %u\n", i + 1, info.name, info.channel,
+                   info.min, info.max, info.unit, motor_pwm_value[i]);
+            continue;
+        }
+        printf("pwm%d: %s, %u Hz, %u bit, %u..%u %s, at %u %s (%u counts), group %u, phase %u %s (up to %u)\n", i + 1,
+               info.name, info.freq_hz, info.bits, info.min, info.max, info.unit, motor_pwm_value[i], info.unit,
+               motor_pwm_counts((motor_pwm_output_t) i, motor_pwm_value[i]), info.group, info.phase, info.unit,
+               info.phase_max);
+    }
+    printf("%u driver errors\n", motor_pwm_errors);
+    return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * motor_pwm.h
+ *
+ * PWM outputs for the motors and the LED. Every output runs in a mode
+ * that fixes its frequency and the unit it is addressed in: a pulse width
+ * in microseconds for servos and ESCs, a duty in per mille, or a DShot
+ * throttle. The outputs of a PWM mode share an LEDC timer at the widest
+ * duty resolution the LEDC clock allows for the mode's frequency; DShot
+ * outputs each take an RMT channel (dshot.h). The timers and channels are
+ * configured once; afterwards only the duty is written. Values are staged
+ * and committed together, the LEDC latches them at the next PWM period,
+ * DShot frames go out right away.
+ *
+ * PWM outputs of a mode can form a group: a commit latches the changed
+ * outputs of a group so they all take their new value in the same period.
+ * Each PWM output starts its pulse at its own phase into the period, so
+ * outputs on one timer do not switch on at the same edge.
+ */
+
+#ifndef MOTOR_PWM_H
+#define MOTOR_PWM_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef enum {
+    MOTOR_PWM_1 = 0,
+    MOTOR_PWM_2,
+    MOTOR_PWM_3,
+    MOTOR_PWM_LED,
+    MOTOR_PWM_COUNT
+} motor_pwm_output_t;
+
+#define MOTOR_PWM_DUTY_FULL 1000 // MOTOR_PWM_MODE_DUTY unit: per mille
+#define MOTOR_PWM_DSHOT_FULL 2000 // DShot throttle, 0 stops the motor
+#define MOTOR_PWM_NO_GROUP 0      // output latched on its own, groups count from 1
+#define MOTOR_PWM_GROUP_MAX MOTOR_PWM_COUNT
+
+typedef enum {
+    MOTOR_PWM_MODE_SERVO = 0,       // 50 Hz, 500..2500 us
+    MOTOR_PWM_MODE_ESC_400HZ,       // 400 Hz, 1000..2000 us
+    MOTOR_PWM_MODE_ONESHOT125,      // 2 kHz, 125..250 us
+    MOTOR_PWM_MODE_DUTY,            // 1 kHz, 0..1000 per mille
+    MOTOR_PWM_MODE_DSHOT150,        // a frame per commit, throttle 0..2000
+    MOTOR_PWM_MODE_DSHOT300,
+    MOTOR_PWM_MODE_DSHOT600,
+    MOTOR_PWM_MODE_COUNT
+} motor_pwm_mode_t;
+
+/* @return whether outputs of a mode are addressed by pulse width in us */
+static inline int motor_pwm_mode_is_pulse(motor_pwm_mode_t mode) {
+    return mode <= MOTOR_PWM_MODE_ONESHOT125;
+}
+
+static inline int motor_pwm_mode_is_dshot(motor_pwm_mode_t mode) {
+    return mode >= MOTOR_PWM_MODE_DSHOT150;
+}
+
+typedef struct {
+    motor_pwm_mode_t mode;
+    const char      *name;
+    const char      *unit;
+    uint32_t         freq_hz;       // 0 for DShot, a frame per commit
+    uint32_t         bits;          // duty resolution of the mode's timer, the throttle's for DShot
+    uint32_t         min;           // value range, in the mode's unit
+    uint32_t         max;
+    uint32_t         channel;       // LEDC, RMT for DShot
+    uint32_t         timer;         // LEDC
+    uint32_t         group;         // MOTOR_PWM_NO_GROUP or 1..MOTOR_PWM_GROUP_MAX
+    uint32_t         phase;         // start of the pulse into the period, in the mode's unit
+    uint32_t         phase_max;     // latest phase at which the longest pulse still ends within the period
+} motor_pwm_info_t;
+
+/* configures the LEDC timers of the modes in use, the RMT channels and all outputs with their initial value */
+void motor_pwm_init(void);
+
+/*
+ * stages a new value for an output in the unit of its mode, clamped to
+ * the mode's range, nothing is written before motor_pwm_commit
+ */
+void motor_pwm_stage(motor_pwm_output_t output, uint32_t value);
+
+/*
+ * writes all staged values that differ from the current ones and starts
+ * their update, so they take effect together at the next period, the
+ * outputs of a group in the same one even if the timer's period ends
+ * while they are latched; sends
+ * a frame to every DShot output, changed or not, which the ESCs need to
+ * stay armed
+ * @return ESP_OK or the first driver error, errors are also counted
+ */
+esp_err_t motor_pwm_commit(void);
+
+/* stages and commits a single output */
+esp_err_t motor_pwm_set_value(motor_pwm_output_t output, uint32_t value);
+
+/* @return value last committed to an output, in the unit of its mode */
+uint32_t motor_pwm_get_value(motor_pwm_output_t output);
+
+motor_pwm_mode_t motor_pwm_get_mode(motor_pwm_output_t output);
+
+/* sets the telemetry request bit in the next DShot frame of an output */
+void motor_pwm_request_telemetry(motor_pwm_output_t output);
+
+/* copies the mode, timing and value range of an output */
+void motor_pwm_get_info(motor_pwm_output_t output, motor_pwm_info_t *info);
+
+/* @return number of failed driver calls since boot */
+uint32_t motor_pwm_error_count(void);
+
+/*
+ * puts a PWM output into a group, all of whose outputs have to share its mode
+ * @return ESP_ERR_INVALID_ARG for a DShot output, a group out of range or one of another mode
+ */
+esp_err_t motor_pwm_set_group(motor_pwm_output_t output, uint32_t group);
+
+/*
+ * moves the start of a PWM output's pulse into the period, from the next commit on
+ * @return ESP_ERR_INVALID_ARG for a DShot output or a phase beyond phase_max
+ */
+esp_err_t motor_pwm_set_phase(motor_pwm_output_t output, uint32_t phase);
+
+/* console command: "pwm" prints the outputs with their modes, "pwm <n> group|phase" sets them */
+int motor_pwm_command(int argc, char **argv);
+
+#endif
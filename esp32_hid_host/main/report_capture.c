@@ -0,0 +1,318 @@
+/*
+ * report_capture.c
+ *
+ * The Bluetooth task hands a report over through a single-producer,
+ * single-consumer queue: one copy and two index updates, no lock, no
+ * flash access. Everything else runs in the capture task.
+ *
+ * A flash write or erase stalls the cache of both cores, so the task keeps
+ * them few and short: the encoded sector is built in RAM and written a
+ * 256 byte page at a time, a partly filled page only after a second, so a
+ * reset loses at most one second. Each new sector costs one 4 KB erase;
+ * with the reports a byte or two each that is every few minutes of input.
+ * The control task is not in IRAM, an erase stops it for tens of
+ * milliseconds, so every erase is counted in the control loop statistics.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include "capture_format.h"
+#include "control_loop.h"
+#include "report_capture.h"
+
+#define CAPTURE_QUEUE_SIZE          32      // reports, power of two
+#define CAPTURE_PAGE_SIZE           256     // flash program page
+#define CAPTURE_FLUSH_US            1000000 // a partly filled page waits at most this long
+#define CAPTURE_PARTITION_LABEL     "capture"
+#define CAPTURE_PARTITION_SUBTYPE   0x40    // first custom data subtype, see partitions.csv
+#define CAPTURE_TASK_STACK_SIZE     2048
+#define CAPTURE_TASK_PRIORITY       1
+#define CAPTURE_TASK_PERIOD_MS      20
+#define CAPTURE_TASK_CORE           0       // next to Bluetooth, off the control core
+#define NVS_NAMESPACE               "capture"
+#define NVS_KEY_ENABLED             "enabled"
+
+typedef struct {
+    uint32_t rx_us;
+    uint8_t  slot;
+    uint8_t  len;
+    uint8_t  report[CAPTURE_REPORT_MAX];
+} capture_entry_t;
+
+// queue, written by the Bluetooth task, read by the capture task
+static capture_entry_t capture_queue[CAPTURE_QUEUE_SIZE];
+static uint32_t        capture_head;
+static uint32_t        capture_tail;
+static int             capture_enabled;
+static int             capture_erase_requested;
+
+// capture task
+static const esp_partition_t *capture_partition;
+static uint32_t          capture_sectors;
+static uint32_t          capture_sector;        // being written
+static uint32_t          capture_sequence;      // of the next sector
+static uint16_t          capture_session;
+static capture_encoder_t capture_encoder;
+static uint8_t           capture_buffer[CAPTURE_SECTOR_SIZE];
+static int               capture_open;          // capture_buffer holds the sector being written
+static uint16_t          capture_written;       // bytes of it in flash
+static uint32_t          capture_pending_us;    // when the oldest unwritten byte was encoded
+static int               capture_clock_started;
+static uint64_t          capture_clock_us;      // rx_us without its wrap after 71 minutes
+static uint32_t          capture_last_rx_us;
+static report_capture_stats_t capture_stats;
+
+static int capture_load_enabled(void) {
+    uint8_t    enabled = 0;
+    size_t     size = sizeof(enabled);
+    nvs_handle handle;
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) return 0;
+    if (nvs_get_blob(handle, NVS_KEY_ENABLED, &enabled, &size) != ESP_OK || size != sizeof(enabled)) enabled = 0;
+    nvs_close(handle);
+    return enabled;
+}
+
+static esp_err_t capture_save_enabled(uint8_t enabled) {
+    nvs_handle handle;
+    esp_err_t  err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+
+    if (err != ESP_OK) return err;
+    err = nvs_set_blob(handle, NVS_KEY_ENABLED, &enabled, sizeof(enabled));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+/* writes the encoded bytes of the sector up to end */
+static void capture_flash_write(uint16_t end) {
+    if (esp_partition_write(capture_partition, capture_sector * CAPTURE_SECTOR_SIZE + capture_written,
+                            &capture_buffer[capture_written], end - capture_written) != ESP_OK) {
+        capture_stats.flash_errors++;
+    }
+    capture_written = end;
+}
+
+/* erases a range of the partition, the control loop stops meanwhile */
+static void capture_flash_erase(uint32_t offset, uint32_t size) {
+    int64_t start = esp_timer_get_time();
+
+    if (esp_partition_erase_range(capture_partition, offset, size) != ESP_OK) {
+        capture_stats.flash_errors++;
+    }
+    control_loop_flash_stall((uint32_t)(esp_timer_get_time() - start));
+}
+
+/* erases the next sector of the ring and starts encoding into it */
+static void capture_sector_start(uint32_t time_ms) {
+    capture_sector = (capture_sector + 1) % capture_sectors;
+    capture_flash_erase(capture_sector * CAPTURE_SECTOR_SIZE, CAPTURE_SECTOR_SIZE);
+    capture_encoder_start(&capture_encoder, capture_buffer, capture_sequence++, capture_session, time_ms);
+    capture_written = 0;
+    capture_open    = 1;
+}
+
+static void capture_encode(const capture_entry_t *entry) {
+    uint16_t used;
+    uint32_t time_ms;
+
+    if (!capture_clock_started) {
+        capture_clock_us      = entry->rx_us;
+        capture_clock_started = 1;
+    } else {
+        capture_clock_us += (uint32_t)(entry->rx_us - capture_last_rx_us);
+    }
+    capture_last_rx_us = entry->rx_us;
+    time_ms = (uint32_t)(capture_clock_us / CAPTURE_TICK_US);
+
+    if (!capture_open) {
+        capture_sector_start(time_ms);
+    }
+    used = capture_encoder.used;
+    if (!capture_encoder_add(&capture_encoder, entry->slot, entry->report, entry->len, time_ms)) {
+        // the sector is full: finish it and start the next with a full report
+        capture_flash_write(capture_encoder.used);
+        capture_sector_start(time_ms);
+        used = capture_encoder.used;
+        capture_encoder_add(&capture_encoder, entry->slot, entry->report, entry->len, time_ms);
+    }
+    capture_stats.reports++;
+    capture_stats.bytes += capture_encoder.used - used;
+}
+
+static void capture_erase(void) {
+    capture_erase_requested = 0;
+    capture_flash_erase(0, capture_sectors * CAPTURE_SECTOR_SIZE);
+    capture_sector   = capture_sectors - 1;
+    capture_sequence = 0;
+    capture_open     = 0;
+    printf("capture: partition erased\n");
+}
+
+/* encodes and writes the reports whenever nothing more important runs */
+static void report_capture_task(void *arg) {
+    (void) arg;
+    for (;;) {
+        report_capture_drain();
+        vTaskDelay(pdMS_TO_TICKS(CAPTURE_TASK_PERIOD_MS));
+    }
+}
+
+void report_capture_init(void) {
+    capture_sector_header_t header;
+    uint32_t sector;
+    int      found = 0;
+
+    capture_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t) CAPTURE_PARTITION_SUBTYPE,
+                                                 CAPTURE_PARTITION_LABEL);
+    if (!capture_partition) {
+        printf("No capture partition, report capture unavailable\n");
+        return;
+    }
+    capture_sectors = capture_partition->size / CAPTURE_SECTOR_SIZE;
+
+    // continue after the newest sector, in a new session
+    capture_sector = capture_sectors - 1;
+    for (sector = 0; sector < capture_sectors; sector++) {
+        if (esp_partition_read(capture_partition, sector * CAPTURE_SECTOR_SIZE, &header, sizeof(header)) != ESP_OK) continue;
+        if (header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION) continue;
+        if (found && (int32_t)(header.sequence - capture_sequence) < 0) continue;
+        found            = 1;
+        capture_sector   = sector;
+        capture_sequence = header.sequence;
+        capture_session  = header.session;
+    }
+    if (found) {
+        capture_sequence++;
+        capture_session++;
+    }
+
+    capture_enabled = capture_load_enabled();
+    if (capture_enabled) {
+        printf("Report capture on, session %u\n", capture_session);
+    }
+    xTaskCreatePinnedToCore(report_capture_task, "capture", CAPTURE_TASK_STACK_SIZE, NULL,
+                            CAPTURE_TASK_PRIORITY, NULL, CAPTURE_TASK_CORE);
+}
+
+void report_capture_record(unsigned int slot, const uint8_t *report, uint16_t len, uint32_t rx_us) {
+    uint32_t         head;
+    capture_entry_t *entry;
+
+    if (!__atomic_load_n(&capture_enabled, __ATOMIC_RELAXED)) return;
+    if (len > CAPTURE_REPORT_MAX || slot >= CAPTURE_SLOTS) {
+        __atomic_fetch_add(&capture_stats.oversize, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    head = capture_head;
+    if (head - __atomic_load_n(&capture_tail, __ATOMIC_ACQUIRE) == CAPTURE_QUEUE_SIZE) {
+        __atomic_fetch_add(&capture_stats.dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    entry = &capture_queue[head & (CAPTURE_QUEUE_SIZE - 1)];
+    entry->rx_us = rx_us;
+    entry->slot  = (uint8_t) slot;
+    entry->len   = (uint8_t) len;
+    memcpy(entry->report, report, len);
+    __atomic_store_n(&capture_head, head + 1, __ATOMIC_RELEASE);
+}
+
+void report_capture_drain(void) {
+    uint32_t now_us = (uint32_t) esp_timer_get_time();
+    uint32_t tail   = capture_tail;
+    uint16_t pages;
+
+    if (!capture_partition) return;
+    if (capture_erase_requested) {
+        capture_erase();
+    }
+    while (tail != __atomic_load_n(&capture_head, __ATOMIC_ACQUIRE)) {
+        capture_encode(&capture_queue[tail & (CAPTURE_QUEUE_SIZE - 1)]);
+        tail++;
+        __atomic_store_n(&capture_tail, tail, __ATOMIC_RELEASE);
+    }
+    if (!capture_open) return;
+
+    pages = capture_encoder.used & ~(CAPTURE_PAGE_SIZE - 1);
+    if (pages > capture_written) {
+        capture_pending_us = now_us;
+        capture_flash_write(pages);
+    }
+    if (capture_encoder.used == capture_written) {
+        capture_pending_us = now_us;
+    } else if (now_us - capture_pending_us >= CAPTURE_FLUSH_US || !__atomic_load_n(&capture_enabled, __ATOMIC_RELAXED)) {
+        capture_flash_write(capture_encoder.used);
+    }
+}
+
+void report_capture_get_stats(report_capture_stats_t *stats) {
+    *stats = capture_stats;
+    stats->enabled  = (uint8_t) __atomic_load_n(&capture_enabled, __ATOMIC_RELAXED);
+    stats->sectors  = capture_sectors;
+    stats->sequence = capture_sequence;
+    stats->session  = capture_session;
+}
+
+int report_capture_command(int argc, char **argv) {
+    report_capture_stats_t stats;
+    esp_err_t err;
+
+    if (argc == 1) {
+        report_capture_get_stats(&stats);
+        if (!stats.sectors) {
+            printf("no capture partition\n");
+            return 0;
+        }
+        printf("capture %s: %u of %u sectors written, session %u\n", stats.enabled ? "on" : "off",
+               stats.sequence, stats.sectors, stats.session);
+        printf("%u reports in %u bytes (%u.%u bytes/report), %u dropped, %u too long, %u flash errors\n",
+               stats.reports, stats.bytes, stats.reports ? stats.bytes / stats.reports : 0,
+               stats.reports ? (stats.bytes * 10 / stats.reports) % 10 : 0,
+               stats.dropped, stats.oversize, stats.flash_errors);
+        return 0;
+    }
+    if (argc == 2 && (strcmp(argv[1], "on") == 0 || strcmp(argv[1], "off") == 0)) {
+        if (!capture_partition) {
+            printf("no capture partition\n");
+            return 1;
+        }
+        __atomic_store_n(&capture_enabled, argv[1][1] == 'n', __ATOMIC_RELAXED);
+        err = capture_save_enabled((uint8_t) capture_enabled);
+        if (err != ESP_OK) {
+            printf("capture %s, not saved: error 0x%x\n", argv[1], err);
+            return 1;
+        }
+        printf("capture %s\n", argv[1]);
+        if (capture_enabled) {
+            printf("every %u KB of reports erases a sector, the outputs hold for its duration\n",
+                   CAPTURE_SECTOR_SIZE / 1024);
+        }
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "erase") == 0) {
+        if (!capture_partition) {
+            printf("no capture partition\n");
+            return 1;
+        }
+        if (capture_enabled) {
+            printf("switch capture off first\n");
+            return 1;
+        }
+        // the capture task owns the flash, it erases at its next period
+        __atomic_store_n(&capture_erase_requested, 1, __ATOMIC_RELAXED);
+        printf("capture: erasing %u sectors\n", capture_sectors);
+        return 0;
+    }
+    printf("usage: %s [on|off|erase]\n", argv[0]);
+    return 1;
+}
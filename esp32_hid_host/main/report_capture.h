@@ -0,0 +1,47 @@
+/*
+ * report_capture.h
+ *
+ * Capture of the interrupt-channel reports into the "capture" flash
+ * partition, for replaying field incidents later. The Bluetooth side only
+ * copies a report into a RAM queue; a low priority task encodes the
+ * reports (capture_format.h) and writes them to flash a page at a time.
+ * Capture is switched on and off from the console and stays that way
+ * across reboots.
+ */
+
+#ifndef REPORT_CAPTURE_H
+#define REPORT_CAPTURE_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint8_t  enabled;
+    uint32_t sectors;           // of the partition, 0 if there is none
+    uint32_t sequence;          // sectors written since the last erase, the ring keeps the newest
+    uint16_t session;
+    uint32_t reports;           // captured since boot
+    uint32_t bytes;             // they took encoded
+    uint32_t dropped;           // queue full
+    uint32_t oversize;          // reports longer than CAPTURE_REPORT_MAX
+    uint32_t flash_errors;
+} report_capture_stats_t;
+
+/* finds the partition, continues its ring and starts the task if capture is on */
+void report_capture_init(void);
+
+/* queues a report that arrived at rx_us, never blocks, does nothing while capture is off */
+void report_capture_record(unsigned int slot, const uint8_t *report, uint16_t len, uint32_t rx_us);
+
+/*
+ * encodes the queued reports and writes the full flash pages, plus a
+ * partly filled one once it waited long enough, the task's work
+ */
+void report_capture_drain(void);
+
+/* copies the capture statistics */
+void report_capture_get_stats(report_capture_stats_t *stats);
+
+/* console command: "capture [on|off|erase]" */
+int report_capture_command(int argc, char **argv);
+
+#endif
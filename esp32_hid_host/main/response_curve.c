@@ -0,0 +1,253 @@
+/*
+ * response_curve.c
+ *
+ * Tables are sampled with floats at boot, after calibration or a shape
+ * change only; the report path uses integer math exclusively.
+ *
+ * The console stages a new deadzone, expo or inversion per axis, the
+ * control task rebuilds the table with it at its next period, so the table
+ * never changes under a report.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvs.h"
+
+#include "response_curve.h"
+
+#define NVS_NAMESPACE "curves"
+#define NVS_KEY_CONFIGS "configs"
+#define NVS_KEY_ENDPOINTS "endpoints_us" // endpoints only, before the configs; "endpoints" held 62 Hz / 10 bit duties
+#define INPUT_FULL 65535
+
+static response_curve_config_t response_curve_configs[RESPONSE_CURVE_COUNT] = {
+    // sticks: 16 bit travel, half of it at rest, the routes rescale it to the output
+    [RESPONSE_CURVE_LEFT_X]         = { 1, 0, 0, 0, INPUT_FULL, 0, 0, RESPONSE_CURVE_STICK_FULL },
+    [RESPONSE_CURVE_LEFT_Y]         = { 1, 0, 0, 0, INPUT_FULL, 0, 0, RESPONSE_CURVE_STICK_FULL },
+    [RESPONSE_CURVE_RIGHT_X]        = { 1, 0, 0, 0, INPUT_FULL, 0, 0, RESPONSE_CURVE_STICK_FULL },
+    [RESPONSE_CURVE_RIGHT_Y]        = { 1, 0, 0, 0, INPUT_FULL, 0, 0, RESPONSE_CURVE_STICK_FULL },
+    // triggers: ESC pulse width in us
+    [RESPONSE_CURVE_TRIGGER_LEFT]   = { 0, 0, 0, 0, INPUT_FULL, 0, 1000, 2000 },
+    [RESPONSE_CURVE_TRIGGER_RIGHT]  = { 0, 0, 0, 0, INPUT_FULL, 0, 1000, 2000 },
+};
+
+static response_curve_t response_curves[RESPONSE_CURVE_COUNT];
+
+static const char * const response_curve_names[RESPONSE_CURVE_COUNT] = { "lx", "ly", "rx", "ry", "lt", "rt" };
+
+// console side: shapes not taken yet, an axis bit stays set until the control task rebuilt its table
+static response_curve_config_t response_curve_staged[RESPONSE_CURVE_COUNT];
+static uint32_t                response_curve_pending;
+static uint32_t                response_curve_shapes;  // counts the shapes applied, written by the control task
+
+/* evaluates the curve at input, -1..1 (bipolar) or 0..1 */
+static double response_curve_shape(const response_curve_config_t *config, double input) {
+    double span = (double) config->in_max - config->in_min;
+    double deadzone = config->deadzone / (double) INPUT_FULL;
+    double expo = config->expo / 100.0;
+    double x, magnitude;
+
+    if (span <= 0) return 0;
+    if (config->bipolar) {
+        x = (input - (config->in_min + span / 2)) / (span / 2);
+    } else {
+        x = (input - config->in_min) / span;
+    }
+    if (x > 1) x = 1;
+    if (x < (config->bipolar ? -1 : 0)) x = config->bipolar ? -1 : 0;
+
+    magnitude = fabs(x);
+    magnitude = magnitude <= deadzone ? 0 : (magnitude - deadzone) / (1 - deadzone);
+    magnitude = (1 - expo) * magnitude + expo * magnitude * magnitude * magnitude;
+    x = x < 0 ? -magnitude : magnitude;
+
+    if (config->invert) {
+        x = config->bipolar ? -x : 1 - x;
+    }
+    return x;
+}
+
+static void response_curve_build(response_curve_axis_t axis) {
+    const response_curve_config_t *config = &response_curve_configs[axis];
+    double out_span = (double) config->out_max - config->out_min;
+    int i;
+
+    for (i = 0; i < RESPONSE_CURVE_POINTS; i++) {
+        double input = (double)(i << RESPONSE_CURVE_SEGMENT_BITS);
+        double x;
+        if (input > INPUT_FULL) input = INPUT_FULL;
+        x = response_curve_shape(config, input);
+        if (config->bipolar) {
+            x = (x + 1) / 2;
+        }
+        response_curves[axis].lut[i] = (int32_t) lround(config->out_min + x * out_span);
+    }
+}
+
+static void response_curve_load(void) {
+    response_curve_config_t configs[RESPONSE_CURVE_COUNT];
+    int32_t    endpoints[RESPONSE_CURVE_COUNT][2];
+    size_t     size = sizeof(configs);
+    nvs_handle handle;
+    esp_err_t  err;
+    int i;
+
+    err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) return;
+    err = nvs_get_blob(handle, NVS_KEY_CONFIGS, configs, &size);
+    if (err == ESP_OK && size == sizeof(configs)) {
+        nvs_close(handle);
+        memcpy(response_curve_configs, configs, sizeof(configs));
+        printf("Response curves loaded from NVS\n");
+        return;
+    }
+    // calibrated before the shapes were kept
+    size = sizeof(endpoints);
+    err = nvs_get_blob(handle, NVS_KEY_ENDPOINTS, endpoints, &size);
+    nvs_close(handle);
+    if (err != ESP_OK || size != sizeof(endpoints)) return;
+
+    for (i = 0; i < RESPONSE_CURVE_COUNT; i++) {
+        // the sticks were percent of travel then
+        if (response_curve_configs[i].bipolar && endpoints[i][0] == 0 && endpoints[i][1] == 100) continue;
+        response_curve_configs[i].out_min = endpoints[i][0];
+        response_curve_configs[i].out_max = endpoints[i][1];
+    }
+    printf("Response curve endpoints loaded from NVS\n");
+}
+
+void response_curve_init(void) {
+    int i;
+    response_curve_load();
+    for (i = 0; i < RESPONSE_CURVE_COUNT; i++) {
+        response_curve_build((response_curve_axis_t) i);
+    }
+}
+
+int32_t response_curve_map(response_curve_axis_t axis, uint16_t input) {
+    const int32_t *lut = &response_curves[axis].lut[input >> RESPONSE_CURVE_SEGMENT_BITS];
+    int32_t fraction = input & ((1 << RESPONSE_CURVE_SEGMENT_BITS) - 1);
+
+    // the last point sits at full input, not a whole segment on, full travel is the output endpoint
+    if (input == INPUT_FULL) return lut[1];
+    return lut[0] + (((lut[1] - lut[0]) * fraction) >> RESPONSE_CURVE_SEGMENT_BITS);
+}
+
+void response_curve_get_endpoints(response_curve_axis_t axis, int32_t *out_min, int32_t *out_max) {
+    *out_min = response_curve_configs[axis].out_min;
+    *out_max = response_curve_configs[axis].out_max;
+}
+
+void response_curve_set_endpoints(response_curve_axis_t axis, int32_t out_min, int32_t out_max) {
+    response_curve_configs[axis].out_min = out_min;
+    response_curve_configs[axis].out_max = out_max;
+    response_curve_build(axis);
+}
+
+esp_err_t response_curve_set_shape(response_curve_axis_t axis, uint16_t deadzone, uint8_t expo, uint8_t invert) {
+    if (deadzone > RESPONSE_CURVE_DEADZONE_MAX || expo > 100) return ESP_ERR_INVALID_ARG;
+    if (__atomic_load_n(&response_curve_pending, __ATOMIC_ACQUIRE) & (1u << axis)) return ESP_ERR_INVALID_STATE;
+    response_curve_staged[axis].deadzone = deadzone;
+    response_curve_staged[axis].expo     = expo;
+    response_curve_staged[axis].invert   = invert ? 1 : 0;
+    __atomic_or_fetch(&response_curve_pending, 1u << axis, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+uint32_t response_curve_acquire(void) {
+    uint32_t pending = __atomic_load_n(&response_curve_pending, __ATOMIC_ACQUIRE);
+    response_curve_axis_t axis;
+
+    while (pending) {
+        axis = (response_curve_axis_t) __builtin_ctz(pending);
+        pending &= pending - 1;
+        response_curve_configs[axis].deadzone = response_curve_staged[axis].deadzone;
+        response_curve_configs[axis].expo     = response_curve_staged[axis].expo;
+        response_curve_configs[axis].invert   = response_curve_staged[axis].invert;
+        response_curve_build(axis);
+        // the console may stage the axis again from here on
+        __atomic_and_fetch(&response_curve_pending, ~(1u << axis), __ATOMIC_RELEASE);
+        __atomic_add_fetch(&response_curve_shapes, 1, __ATOMIC_RELAXED);
+    }
+    return response_curve_shapes;
+}
+
+esp_err_t response_curve_save(void) {
+    response_curve_config_t configs[RESPONSE_CURVE_COUNT];
+    nvs_handle handle;
+    esp_err_t  err;
+
+    memcpy(configs, response_curve_configs, sizeof(configs));
+    err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) return err;
+    err = nvs_set_blob(handle, NVS_KEY_CONFIGS, configs, sizeof(configs));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+static void response_curve_print(response_curve_axis_t axis) {
+    const response_curve_config_t *config = &response_curve_configs[axis];
+
+    printf("%s: %d..%d, deadzone %u %%, expo %u %%%s\n", response_curve_names[axis], (int) config->out_min, (int) config->out_max,
+           (config->deadzone * 100u + INPUT_FULL / 2) / INPUT_FULL, config->expo, config->invert ? ", inverted" : "");
+}
+
+int response_curve_command(int argc, char **argv) {
+    response_curve_config_t config;
+    unsigned long value;
+    char *end;
+    esp_err_t err;
+    int axis;
+
+    if (argc == 1) {
+        for (axis = 0; axis < RESPONSE_CURVE_COUNT; axis++) {
+            response_curve_print((response_curve_axis_t) axis);
+        }
+        return 0;
+    }
+    if (argc == 2 && !strcmp(argv[1], "save")) {
+        err = response_curve_save();
+        if (err != ESP_OK) {
+            printf("curves not saved: error 0x%x\n", err);
+            return 1;
+        }
+        printf("curves saved\n");
+        return 0;
+    }
+    for (axis = 0; axis < RESPONSE_CURVE_COUNT; axis++) {
+        if (!strcmp(argv[1], response_curve_names[axis])) break;
+    }
+    if (argc == 4 && axis < RESPONSE_CURVE_COUNT) {
+        config = response_curve_configs[axis];
+        value = strtoul(argv[3], &end, 10);
+        if (*end || end == argv[3]) {
+            value = ~0ul;
+        }
+        if (!strcmp(argv[2], "deadzone") && value <= 100 && value * INPUT_FULL <= RESPONSE_CURVE_DEADZONE_MAX * 100ul) {
+            config.deadzone = (uint16_t)((value * INPUT_FULL + 50) / 100);
+        } else if (!strcmp(argv[2], "expo") && value <= 100) {
+            config.expo = (uint8_t) value;
+        } else if (!strcmp(argv[2], "invert") && value <= 1) {
+            config.invert = (uint8_t) value;
+        } else {
+            axis = RESPONSE_CURVE_COUNT;
+        }
+    }
+    if (argc == 4 && axis < RESPONSE_CURVE_COUNT) {
+        err = response_curve_set_shape((response_curve_axis_t) axis, config.deadzone, config.expo, config.invert);
+        if (err != ESP_OK) {
+            printf("the previous change of %s is not applied yet, try again\n", argv[1]);
+            return 1;
+        }
+        return 0;
+    }
+    printf("usage: %s [<lx|ly|rx|ry|lt|rt> deadzone <percent 0..50>|<axis> expo <percent>|<axis> invert <0|1>|save]\n",
+           argv[0]);
+    return 1;
+}
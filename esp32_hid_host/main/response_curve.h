@@ -0,0 +1,86 @@
+/*
+ * response_curve.h
+ *
+ * Per-axis response curves (endpoints, deadzone, expo, inversion, output
+ * calibration). Each curve is sampled into a fixed-point lookup table at
+ * boot and whenever it changes, mapping an input is one lookup and a
+ * linear interpolation.
+ */
+
+#ifndef RESPONSE_CURVE_H
+#define RESPONSE_CURVE_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define RESPONSE_CURVE_SEGMENT_BITS 10  // inputs per table segment: 1024
+#define RESPONSE_CURVE_POINTS       ((1 << (16 - RESPONSE_CURVE_SEGMENT_BITS)) + 1)
+#define RESPONSE_CURVE_DEADZONE_MAX 32768   // half of the travel, 16 bit input scale
+#define RESPONSE_CURVE_STICK_FULL   65535   // default stick output at full travel, half of it at rest
+
+typedef enum {
+    RESPONSE_CURVE_LEFT_X = 0,
+    RESPONSE_CURVE_LEFT_Y,
+    RESPONSE_CURVE_RIGHT_X,
+    RESPONSE_CURVE_RIGHT_Y,
+    RESPONSE_CURVE_TRIGGER_LEFT,
+    RESPONSE_CURVE_TRIGGER_RIGHT,
+    RESPONSE_CURVE_COUNT
+} response_curve_axis_t;
+
+typedef struct {
+    uint8_t  bipolar;   // centered axis (stick) instead of 0..full (trigger)
+    uint8_t  invert;
+    uint8_t  expo;      // 0 linear .. 100 cubic
+    uint16_t in_min;    // input endpoints, 16 bit input scale
+    uint16_t in_max;
+    uint16_t deadzone;  // around the center (bipolar) or above in_min, 16 bit input scale
+    int32_t  out_min;   // output at in_min, e.g. ESC minimum pulse width in us
+    int32_t  out_max;   // output at in_max, e.g. ESC maximum pulse width in us
+} response_curve_config_t;
+
+typedef struct {
+    int32_t lut[RESPONSE_CURVE_POINTS];
+} response_curve_t;
+
+/* loads the curves from NVS and builds all lookup tables */
+void response_curve_init(void);
+
+/* maps a 16 bit input through the axis' curve */
+int32_t response_curve_map(response_curve_axis_t axis, uint16_t input);
+
+/* widens a 10 bit trigger value to the 16 bit input scale without a divide */
+static inline uint16_t response_curve_input_10bit(uint16_t value) {
+    return (uint16_t)((value << 6) | (value >> 4));
+}
+
+/* @return current output endpoints of an axis */
+void response_curve_get_endpoints(response_curve_axis_t axis, int32_t *out_min, int32_t *out_max);
+
+/* rebuilds the axis' table with new output endpoints */
+void response_curve_set_endpoints(response_curve_axis_t axis, int32_t out_min, int32_t out_max);
+
+/*
+ * stages a new deadzone, expo and inversion of an axis, the control task
+ * rebuilds its table at its next period
+ * @return ESP_ERR_INVALID_ARG beyond RESPONSE_CURVE_DEADZONE_MAX or an expo
+ * over 100, ESP_ERR_INVALID_STATE while the previous shape of the axis is
+ * not taken yet
+ */
+esp_err_t response_curve_set_shape(response_curve_axis_t axis, uint16_t deadzone, uint8_t expo, uint8_t invert);
+
+/*
+ * rebuilds the tables of the staged shapes, once per period from the
+ * control task
+ * @return count of the shapes applied, changes with every new shape
+ */
+uint32_t response_curve_acquire(void);
+
+/* persists the curves of all axes, endpoints and shapes, in NVS */
+esp_err_t response_curve_save(void);
+
+/* console command: "curve" lists, "curve <axis> deadzone|expo|invert <value>|save" shapes and persists the curves */
+int response_curve_command(int argc, char **argv);
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * sdp_hid_parser.c
+ *
+ * Byte-wise state machine over the data element encoding: header byte,
+ * optional length bytes, data bytes. Sequences are not buffered, only
+ * their end position is kept, so memory does not grow with the record.
+ * An element is recognized by the attribute it belongs to, its nesting
+ * depth and its index inside the enclosing sequence:
+ *
+ *  Protocol Descriptor List                DES { DES { UUID L2CAP, uint16 PSM } ... }
+ *  Additional Protocol Descriptor Lists    DES { DES { DES { UUID L2CAP, uint16 PSM } ... } }
+ *  HID Descriptor List                     DES { DES { uint8 type, string descriptor } }
+ */
+
+#include <string.h>
+
+#include "btstack.h"
+#include "hid_cache.h"
+
+#include "sdp_hid_parser.h"
+
+// depth of the values we extract, counted in open sequences
+#define PROTOCOL_DEPTH              2
+#define ADDITIONAL_PROTOCOL_DEPTH   3
+#define DESCRIPTOR_DEPTH            2
+
+enum {
+    PARSER_HEADER = 0,
+    PARSER_LENGTH,
+    PARSER_DATA,
+    PARSER_DESCRIPTOR,  // data of the report descriptor string
+};
+
+/* handles a complete value element */
+static void parser_value(sdp_hid_parser_t *parser) {
+    de_type_t type  = (de_type_t)(parser->header >> 3);
+    uint8_t   index = parser->index[parser->depth];
+    uint8_t   depth;
+
+    switch (parser->attribute_id) {
+        case BLUETOOTH_ATTRIBUTE_PROTOCOL_DESCRIPTOR_LIST:
+            depth = PROTOCOL_DEPTH;
+            break;
+        case BLUETOOTH_ATTRIBUTE_ADDITIONAL_PROTOCOL_DESCRIPTOR_LISTS:
+            depth = ADDITIONAL_PROTOCOL_DEPTH;
+            break;
+        default:
+            return;
+    }
+    if (parser->depth != depth) return;
+
+    if (index == 0) {
+        parser->protocol_uuid = type == DE_UUID ? parser->value : 0;
+        return;
+    }
+    // uint16 right behind the L2CAP UUID
+    if (index != 1 || parser->protocol_uuid != BLUETOOTH_PROTOCOL_L2CAP) return;
+    if (type != DE_UINT || (parser->header & 0x07) != DE_SIZE_16) return;
+    if (depth == PROTOCOL_DEPTH) {
+        parser->hid_control_psm = (uint16_t) parser->value;
+    } else {
+        parser->hid_interrupt_psm = (uint16_t) parser->value;
+    }
+}
+
+/* closes the element that ended at the current position and every sequence ending with it */
+static void parser_element_end(sdp_hid_parser_t *parser) {
+    parser->state = PARSER_HEADER;
+    parser->index[parser->depth]++;
+    while (parser->depth && parser->pos == parser->sequence_end[parser->depth - 1]) {
+        parser->depth--;
+        parser->index[parser->depth]++;
+    }
+}
+
+/* handles the start of an element once its length is known */
+static void parser_element_start(sdp_hid_parser_t *parser) {
+    de_type_t type = (de_type_t)(parser->header >> 3);
+    uint32_t  end  = parser->pos + parser->length;
+
+    if (parser->length > 0xFFFF || (parser->depth && end > parser->sequence_end[parser->depth - 1])) {
+        // longer than an attribute value or its sequence
+        parser->malformed = 1;
+        parser->skip      = 1;
+        return;
+    }
+    if (type == DE_DES || type == DE_DEA) {
+        if (parser->depth == SDP_HID_PARSER_MAX_DEPTH) {
+            parser->malformed = 1;
+            parser->skip      = 1;
+            return;
+        }
+        if (!parser->length) {
+            parser_element_end(parser);
+            return;
+        }
+        parser->sequence_end[parser->depth++] = end;
+        parser->index[parser->depth] = 0;
+        parser->state = PARSER_HEADER;
+        return;
+    }
+    parser->received = 0;
+    parser->value    = 0;
+    if (type == DE_STRING && parser->attribute_id == BLUETOOTH_ATTRIBUTE_HID_DESCRIPTOR_LIST
+            && parser->depth == DESCRIPTOR_DEPTH) {
+        // the last descriptor string of the list wins
+        parser->hid_descriptor_found = 0;
+        parser->hid_descriptor_len   = parser->length;
+        parser->hid_descriptor_hash  = HID_CACHE_HASH_INIT;
+        if (parser->decoder) {
+            hid_decoder_compile_begin(parser->decoder);
+        }
+        if (!parser->length) {
+            parser->hid_descriptor_found = 1;
+            parser_element_end(parser);
+            return;
+        }
+        parser->state = PARSER_DESCRIPTOR;
+        return;
+    }
+    if (!parser->length) {
+        parser_value(parser);
+        parser_element_end(parser);
+        return;
+    }
+    parser->state = PARSER_DATA;
+}
+
+void sdp_hid_parser_init(sdp_hid_parser_t *parser, hid_decoder_t *decoder) {
+    memset(parser, 0, sizeof(*parser));
+    parser->decoder = decoder;
+}
+
+void sdp_hid_parser_byte(sdp_hid_parser_t *parser, uint16_t attribute_id, uint16_t offset, uint8_t byte) {
+    uint8_t size;
+
+    if (offset == 0) {
+        if (parser->malformed || parser->depth || parser->state != PARSER_HEADER) {
+            parser->malformed_attributes++;
+        }
+        parser->attribute_id = attribute_id;
+        parser->pos          = 0;
+        parser->depth        = 0;
+        parser->index[0]     = 0;
+        parser->state        = PARSER_HEADER;
+        parser->malformed    = 0;
+        switch (attribute_id) {
+            case BLUETOOTH_ATTRIBUTE_PROTOCOL_DESCRIPTOR_LIST:
+            case BLUETOOTH_ATTRIBUTE_ADDITIONAL_PROTOCOL_DESCRIPTOR_LISTS:
+            case BLUETOOTH_ATTRIBUTE_HID_DESCRIPTOR_LIST:
+                parser->skip = 0;
+                break;
+            default:
+                // the rest of the record is not walked at all
+                parser->skip = 1;
+                return;
+        }
+    }
+    if (parser->skip) return;
+    parser->pos++;
+
+    switch (parser->state) {
+        case PARSER_DESCRIPTOR:
+            parser->hid_descriptor_hash = hid_cache_hash_byte(parser->hid_descriptor_hash, byte);
+            if (parser->decoder) {
+                hid_decoder_compile_byte(byte);
+            }
+            if (++parser->received < parser->length) return;
+            parser->hid_descriptor_found = 1;
+            parser_element_end(parser);
+            break;
+        case PARSER_HEADER:
+            parser->header = byte;
+            size = byte & 0x07;
+            if ((de_type_t)(byte >> 3) == DE_NIL) {
+                parser->length = 0;
+            } else if (size >= DE_SIZE_VAR_8) {
+                parser->length       = 0;
+                parser->length_bytes = (uint8_t)(1 << (size - DE_SIZE_VAR_8));
+                parser->state        = PARSER_LENGTH;
+                return;
+            } else {
+                parser->length = 1u << size;
+            }
+            parser_element_start(parser);
+            break;
+        case PARSER_LENGTH:
+            parser->length = (parser->length << 8) | byte;
+            if (--parser->length_bytes) return;
+            parser_element_start(parser);
+            break;
+        case PARSER_DATA:
+            if (parser->received < 4) {
+                parser->value = (parser->value << 8) | byte;
+            }
+            if (++parser->received < parser->length) return;
+            parser_value(parser);
+            parser_element_end(parser);
+            break;
+        default:
+            break;
+    }
+}
+
+int sdp_hid_parser_finish(sdp_hid_parser_t *parser) {
+    if (parser->malformed || parser->depth || parser->state != PARSER_HEADER) {
+        parser->malformed_attributes++;
+        parser->malformed = 0;
+        parser->skip      = 1;
+    }
+    if (!parser->hid_descriptor_found || !parser->decoder) return 0;
+    return hid_decoder_compile_end();
+}
@@ -0,0 +1,62 @@
+/*
+ * sdp_hid_parser.h
+ *
+ * Incremental parser for the HID service record. BTstack's SDP client
+ * delivers every attribute value one byte per event; the parser walks the
+ * data element sequences as the bytes arrive and keeps only the values the
+ * host needs: the control and interrupt PSMs and the report descriptor,
+ * which is streamed into the decoder compiler and the descriptor hash
+ * instead of being reassembled. There is no limit on the descriptor size.
+ */
+
+#ifndef SDP_HID_PARSER_H
+#define SDP_HID_PARSER_H
+
+#include <stdint.h>
+
+#include "hid_decoder.h"
+
+#define SDP_HID_PARSER_MAX_DEPTH 4 // nested sequences, the HID record uses 3
+
+typedef struct {
+    // element being parsed
+    uint8_t  state;
+    uint8_t  header;                    // type and size descriptor
+    uint8_t  length_bytes;              // length field bytes still to read
+    uint32_t length;                    // data bytes of the element
+    uint32_t received;                  // data bytes read so far
+    uint32_t value;                     // first four data bytes, big endian
+
+    // position inside the attribute
+    uint16_t attribute_id;
+    uint32_t pos;                       // bytes of the attribute value read so far
+    uint8_t  depth;                     // open sequences
+    uint32_t sequence_end[SDP_HID_PARSER_MAX_DEPTH];
+    uint8_t  index[SDP_HID_PARSER_MAX_DEPTH + 1]; // element index inside each open sequence
+    uint32_t protocol_uuid;             // UUID heading the current protocol descriptor
+    uint8_t  malformed;                 // rest of the attribute is ignored
+    uint8_t  skip;                      // attribute not needed or malformed
+
+    // results
+    hid_decoder_t *decoder;             // compile target, NULL only hashes the descriptor
+    uint16_t hid_control_psm;
+    uint16_t hid_interrupt_psm;
+    uint8_t  hid_descriptor_found;      // a complete descriptor was received
+    uint32_t hid_descriptor_len;
+    uint32_t hid_descriptor_hash;
+    uint32_t malformed_attributes;
+} sdp_hid_parser_t;
+
+/* prepares a parser for the next query, decoder may be NULL */
+void sdp_hid_parser_init(sdp_hid_parser_t *parser, hid_decoder_t *decoder);
+
+/* takes the byte at offset of an attribute value, offset 0 starts a new attribute */
+void sdp_hid_parser_byte(sdp_hid_parser_t *parser, uint16_t attribute_id, uint16_t offset, uint8_t byte);
+
+/*
+ * ends the query
+ * @return fields compiled into the decoder, 0 without descriptor or decoder
+ */
+int sdp_hid_parser_finish(sdp_hid_parser_t *parser);
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * state_mailbox.c
+ *
+ * Seqlock: the writer makes the sequence odd while it copies and even
+ * again when done, the reader retries if the sequence was odd or moved
+ * during its copy. The state is a few words, so a retry costs less than
+ * any lock the Bluetooth task might have to wait on.
+ */
+
+#include "state_mailbox.h"
+
+typedef struct {
+    hid_gamepad_state_t state;
+    uint32_t            timestamp;
+    uint32_t            sequence;   // twice the number of published states, odd while writing
+} state_mailbox_slot_t;
+
+static state_mailbox_slot_t mailbox_slots[STATE_MAILBOX_SLOTS];
+
+void state_mailbox_publish(unsigned int slot, const hid_gamepad_state_t *state, uint32_t timestamp) {
+    state_mailbox_slot_t *mailbox = &mailbox_slots[slot];
+    uint32_t sequence = __atomic_load_n(&mailbox->sequence, __ATOMIC_RELAXED);
+    int i;
+
+    __atomic_store_n(&mailbox->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (i = 0; i < HID_STATE_WORDS; i++) {
+        __atomic_store_n(&mailbox->state.word[i], state->word[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&mailbox->timestamp, timestamp, __ATOMIC_RELAXED);
+    __atomic_store_n(&mailbox->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+uint32_t state_mailbox_take(unsigned int slot, hid_gamepad_state_t *state, uint32_t *timestamp, uint32_t *sequence) {
+    state_mailbox_slot_t *mailbox = &mailbox_slots[slot];
+    uint32_t before, published;
+    int i;
+
+    for (;;) {
+        before = __atomic_load_n(&mailbox->sequence, __ATOMIC_ACQUIRE);
+        // a preempted writer may not run again before this reader yields,
+        // so a write in progress is picked up next time instead of waited for
+        if (before == *sequence || (before & 1)) return 0;
+        for (i = 0; i < HID_STATE_WORDS; i++) {
+            state->word[i] = __atomic_load_n(&mailbox->state.word[i], __ATOMIC_RELAXED);
+        }
+        *timestamp = __atomic_load_n(&mailbox->timestamp, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&mailbox->sequence, __ATOMIC_RELAXED) == before) break;
+    }
+
+    published = (before - *sequence) / 2;
+    *sequence = before;
+    return published;
+}
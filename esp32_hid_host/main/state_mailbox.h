@@ -0,0 +1,32 @@
+/*
+ * state_mailbox.h
+ *
+ * Latest-value mailbox for the decoded gamepad state. The Bluetooth side
+ * publishes without locking or waiting, the control loop takes whatever
+ * is newest; states published in between are coalesced. Writer and
+ * reader may run on different cores.
+ */
+
+#ifndef STATE_MAILBOX_H
+#define STATE_MAILBOX_H
+
+#include <stdint.h>
+
+#include "hid_decoder.h"
+
+#define STATE_MAILBOX_SLOTS 4   // one per controller
+
+/*
+ * publishes a state into a slot, single writer per slot, never blocks
+ * @param timestamp arrival of the report in us, for the latency
+ */
+void state_mailbox_publish(unsigned int slot, const hid_gamepad_state_t *state, uint32_t timestamp);
+
+/*
+ * copies the newest state of a slot if one was published after *sequence
+ * and advances *sequence together with its timestamp, single reader per slot
+ * @return number of states published since the last take, 0 if none
+ */
+uint32_t state_mailbox_take(unsigned int slot, hid_gamepad_state_t *state, uint32_t *timestamp, uint32_t *sequence);
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * telemetry.c
+ *
+ * The control task fills a snapshot in place in a single-producer,
+ * single-consumer queue and publishes it with one index update; it never
+ * waits for the UART. A rate accumulator spreads the snapshots evenly
+ * over the control periods without a divide, e.g. 100 Hz takes every
+ * fifth 2 ms period.
+ *
+ * The frames go out with uart_write_bytes() instead of stdout: the VFS
+ * would expand every 0x0a byte into CR LF, and one call keeps a frame
+ * whole against the printf output of the other tasks. The rate is capped
+ * so the frames take at most TELEMETRY_UART_SHARE_PERCENT of the baud
+ * rate, the console text keeps the rest.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include "link_policy.h"
+#include "telemetry.h"
+
+#define TELEMETRY_QUEUE_SIZE        8       // snapshots, power of two
+#define TELEMETRY_UART_BITS_PER_BYTE 10     // start, 8 data, stop
+#define TELEMETRY_UART_SHARE_PERCENT 90
+#define TELEMETRY_US_PER_S          1000000
+#define TELEMETRY_TASK_STACK_SIZE   2048
+#define TELEMETRY_TASK_PRIORITY     1
+#define TELEMETRY_TASK_PERIOD_MS    10
+#define TELEMETRY_TASK_CORE         0       // next to the console, off the control core
+#define NVS_NAMESPACE               "telemetry"
+#define NVS_KEY_RATE                "rate"
+
+// queue, filled by the control task, read by the telemetry task
+static telemetry_snapshot_t telemetry_queue[TELEMETRY_QUEUE_SIZE];
+static uint32_t telemetry_head;
+static uint32_t telemetry_tail;
+static uint32_t telemetry_rate_hz;
+
+// control task
+static uint32_t telemetry_periods_per_s;
+static uint32_t telemetry_phase;
+static uint16_t telemetry_sequence;
+
+static uint8_t  telemetry_num_controllers;
+static uint8_t  telemetry_num_outputs;
+static uint32_t telemetry_rate_max_hz;
+static telemetry_stats_t telemetry_stats;
+
+static uint32_t telemetry_load_rate(void) {
+    uint16_t   rate = 0;
+    size_t     size = sizeof(rate);
+    nvs_handle handle;
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) return 0;
+    if (nvs_get_blob(handle, NVS_KEY_RATE, &rate, &size) != ESP_OK || size != sizeof(rate)) rate = 0;
+    nvs_close(handle);
+    return rate;
+}
+
+static esp_err_t telemetry_save_rate(uint16_t rate) {
+    nvs_handle handle;
+    esp_err_t  err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+
+    if (err != ESP_OK) return err;
+    err = nvs_set_blob(handle, NVS_KEY_RATE, &rate, sizeof(rate));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+static uint16_t telemetry_saturate(uint32_t value) {
+    return value > UINT16_MAX ? UINT16_MAX : (uint16_t) value;
+}
+
+/* writes the queued snapshots whenever nothing more important runs */
+static void telemetry_task(void *arg) {
+    (void) arg;
+    for (;;) {
+        telemetry_drain();
+        vTaskDelay(pdMS_TO_TICKS(TELEMETRY_TASK_PERIOD_MS));
+    }
+}
+
+void telemetry_init(uint32_t period_us, unsigned int num_controllers, unsigned int num_outputs) {
+    size_t   frame_size;
+    uint32_t rate;
+
+    telemetry_num_controllers = (uint8_t)(num_controllers < TELEMETRY_CONTROLLERS ? num_controllers : TELEMETRY_CONTROLLERS);
+    telemetry_num_outputs     = (uint8_t)(num_outputs < TELEMETRY_OUTPUTS ? num_outputs : TELEMETRY_OUTPUTS);
+    telemetry_periods_per_s   = TELEMETRY_US_PER_S / period_us;
+    frame_size = telemetry_frame_size(telemetry_num_controllers, telemetry_num_outputs);
+    telemetry_rate_max_hz = (uint32_t)((uint64_t) CONFIG_CONSOLE_UART_BAUDRATE * TELEMETRY_UART_SHARE_PERCENT
+                                       / (100 * TELEMETRY_UART_BITS_PER_BYTE * frame_size));
+    if (telemetry_rate_max_hz > telemetry_periods_per_s) telemetry_rate_max_hz = telemetry_periods_per_s;
+
+    rate = telemetry_load_rate();
+    if (rate > telemetry_rate_max_hz) rate = telemetry_rate_max_hz;
+    telemetry_rate_hz = rate;
+    if (rate) {
+        printf("Telemetry on, %u Hz of %u bytes\n", rate, (unsigned int) frame_size);
+    }
+    xTaskCreatePinnedToCore(telemetry_task, "telemetry", TELEMETRY_TASK_STACK_SIZE, NULL,
+                            TELEMETRY_TASK_PRIORITY, NULL, TELEMETRY_TASK_CORE);
+}
+
+telemetry_snapshot_t *telemetry_due(void) {
+    uint32_t rate = __atomic_load_n(&telemetry_rate_hz, __ATOMIC_RELAXED);
+    uint32_t head = telemetry_head;
+    telemetry_snapshot_t *snapshot;
+
+    if (!rate) return NULL;
+    telemetry_phase += rate;
+    if (telemetry_phase < telemetry_periods_per_s) return NULL;
+    telemetry_phase -= telemetry_periods_per_s;
+    // after a lower rate was set the phase starts over
+    if (telemetry_phase >= telemetry_periods_per_s) telemetry_phase = 0;
+
+    if (head - __atomic_load_n(&telemetry_tail, __ATOMIC_ACQUIRE) == TELEMETRY_QUEUE_SIZE) {
+        __atomic_fetch_add(&telemetry_stats.dropped, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    snapshot = &telemetry_queue[head & (TELEMETRY_QUEUE_SIZE - 1)];
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->num_controllers = telemetry_num_controllers;
+    snapshot->num_outputs     = telemetry_num_outputs;
+    return snapshot;
+}
+
+void telemetry_submit(telemetry_snapshot_t *snapshot) {
+    snapshot->sequence = telemetry_sequence++;
+    snapshot->time_us  = (uint32_t) esp_timer_get_time();
+    __atomic_fetch_add(&telemetry_stats.snapshots, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&telemetry_head, telemetry_head + 1, __ATOMIC_RELEASE);
+}
+
+void telemetry_drain(void) {
+    uint8_t frame[TELEMETRY_FRAME_MAX];
+    uint32_t tail = telemetry_tail;
+    link_policy_stats_t link;
+    unsigned int slot;
+    size_t size;
+
+    while (tail != __atomic_load_n(&telemetry_head, __ATOMIC_ACQUIRE)) {
+        telemetry_snapshot_t *snapshot = &telemetry_queue[tail & (TELEMETRY_QUEUE_SIZE - 1)];
+        for (slot = 0; slot < snapshot->num_controllers; slot++) {
+            telemetry_controller_t *controller = &snapshot->controllers[slot];
+            if (!link_policy_get_stats(slot, &link)) continue;
+            controller->flags       |= TELEMETRY_LINKED | (link.mode ? TELEMETRY_SNIFF : 0);
+            controller->rssi         = link.rssi;
+            controller->interval_us  = telemetry_saturate(link.interval_us);
+            controller->jitter_us    = telemetry_saturate(link.jitter_us);
+            controller->late_reports = (uint16_t) link.late_reports;
+        }
+        size = telemetry_encode(snapshot, frame);
+        tail++;
+        __atomic_store_n(&telemetry_tail, tail, __ATOMIC_RELEASE);
+        if (uart_write_bytes(CONFIG_CONSOLE_UART_NUM, (const char *) frame, size) == (int) size) {
+            telemetry_stats.frames++;
+            telemetry_stats.bytes += size;
+        }
+    }
+}
+
+void telemetry_get_stats(telemetry_stats_t *stats) {
+    *stats = telemetry_stats;
+    stats->rate_hz     = __atomic_load_n(&telemetry_rate_hz, __ATOMIC_RELAXED);
+    stats->rate_max_hz = telemetry_rate_max_hz;
+}
+
+int telemetry_command(int argc, char **argv) {
+    telemetry_stats_t stats;
+    size_t frame_size = telemetry_frame_size(telemetry_num_controllers, telemetry_num_outputs);
+    unsigned long rate;
+    char *end;
+    esp_err_t err;
+
+    if (argc == 1) {
+        telemetry_get_stats(&stats);
+        printf("telemetry %s at %u Hz (up to %u Hz), %u bytes/frame, %u%% of %u baud\n",
+               stats.rate_hz ? "on" : "off", stats.rate_hz, stats.rate_max_hz, (unsigned int) frame_size,
+               (unsigned int)((uint64_t) stats.rate_hz * frame_size * TELEMETRY_UART_BITS_PER_BYTE * 100
+                              / CONFIG_CONSOLE_UART_BAUDRATE), CONFIG_CONSOLE_UART_BAUDRATE);
+        printf("%u snapshots, %u frames in %u bytes, %u dropped\n",
+               stats.snapshots, stats.frames, stats.bytes, stats.dropped);
+        return 0;
+    }
+    if (argc == 2) {
+        int off = strcmp(argv[1], "off") == 0;
+        rate = off ? 0 : strtoul(argv[1], &end, 10);
+        if (off || (rate && !*end)) {
+            if (rate > telemetry_rate_max_hz) {
+                printf("%lu Hz of %u byte frames exceed the UART, at most %u Hz\n", rate,
+                       (unsigned int) frame_size, telemetry_rate_max_hz);
+                return 1;
+            }
+            __atomic_store_n(&telemetry_rate_hz, (uint32_t) rate, __ATOMIC_RELAXED);
+            err = telemetry_save_rate((uint16_t) rate);
+            if (err != ESP_OK) {
+                printf("telemetry %s, not saved: error 0x%x\n", argv[1], err);
+                return 1;
+            }
+            printf("telemetry %s%s\n", argv[1], rate ? " Hz" : "");
+            return 0;
+        }
+    }
+    printf("usage: %s [<Hz 1..%u>|off]\n", argv[0], telemetry_rate_max_hz);
+    return 1;
+}
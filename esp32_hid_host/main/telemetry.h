@@ -0,0 +1,53 @@
+/*
+ * telemetry.h
+ *
+ * Fixed-rate binary snapshots of the whole state on the console UART:
+ * the decoded inputs of every controller, the output values, the link
+ * statistics and a sequence number (telemetry_format.h). The control
+ * task takes a snapshot at the configured rate and queues it; a low
+ * priority task adds the link statistics, frames it and writes it to the
+ * UART between the console text. The rate is set from the console and
+ * stays across reboots.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+#include "telemetry_format.h"
+
+typedef struct {
+    uint32_t rate_hz;           // 0 while off
+    uint32_t rate_max_hz;       // the UART budget, see telemetry_command
+    uint32_t snapshots;         // queued since boot
+    uint32_t frames;            // written to the UART
+    uint32_t bytes;             // they took
+    uint32_t dropped;           // queue full
+} telemetry_stats_t;
+
+/*
+ * loads the rate from NVS and starts the task
+ * @param period_us of the control loop that calls telemetry_due
+ * @param num_controllers and num_outputs every snapshot carries
+ */
+void telemetry_init(uint32_t period_us, unsigned int num_controllers, unsigned int num_outputs);
+
+/*
+ * from the control task once per period
+ * @return a snapshot to fill with the inputs and outputs if one is due this period, NULL otherwise
+ */
+telemetry_snapshot_t *telemetry_due(void);
+
+/* queues the snapshot telemetry_due returned, with its sequence number and time */
+void telemetry_submit(telemetry_snapshot_t *snapshot);
+
+/* adds the link statistics to the queued snapshots and writes them to the UART, the task's work */
+void telemetry_drain(void);
+
+void telemetry_get_stats(telemetry_stats_t *stats);
+
+/* console command: "telemetry" prints the stream state, "telemetry <Hz>|off" sets its rate */
+int telemetry_command(int argc, char **argv);
+
+#endif
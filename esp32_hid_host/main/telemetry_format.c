@@ -0,0 +1,170 @@
+/*
+ * telemetry_format.c
+ *
+ * COBS replaces every 0 byte with the distance to the next one, so a
+ * frame costs one byte over its payload up to 254 bytes and a reader
+ * finds the next frame at the next 0, whatever it lost before. The CRC
+ * runs bit by bit: some 70 bytes per snapshot do not need a table.
+ */
+
+#include <string.h>
+
+#include "telemetry_format.h"
+
+#define TELEMETRY_CRC_INIT  0xffff
+#define TELEMETRY_CRC_POLY  0x1021
+#define TELEMETRY_COBS_RUN  0xff    // code of a run of 254 bytes without a 0
+
+static uint16_t telemetry_crc(const uint8_t *data, size_t len) {
+    uint16_t crc = TELEMETRY_CRC_INIT;
+    size_t i;
+    int bit;
+
+    for (i = 0; i < len; i++) {
+        crc ^= (uint16_t)(data[i] << 8);
+        for (bit = 0; bit < 8; bit++) {
+            crc = (uint16_t)(crc & 0x8000 ? (crc << 1) ^ TELEMETRY_CRC_POLY : crc << 1);
+        }
+    }
+    return crc;
+}
+
+static size_t telemetry_store_16(uint8_t *out, size_t pos, uint16_t value) {
+    out[pos]     = (uint8_t) value;
+    out[pos + 1] = (uint8_t)(value >> 8);
+    return pos + 2;
+}
+
+static uint16_t telemetry_read_16(const uint8_t *in, size_t pos) {
+    return (uint16_t)(in[pos] | (in[pos + 1] << 8));
+}
+
+static size_t telemetry_payload_size(unsigned int num_controllers, unsigned int num_outputs) {
+    return TELEMETRY_HEADER_SIZE + num_controllers * TELEMETRY_CONTROLLER_SIZE + num_outputs * TELEMETRY_OUTPUT_SIZE
+           + TELEMETRY_CRC_SIZE;
+}
+
+size_t telemetry_frame_size(unsigned int num_controllers, unsigned int num_outputs) {
+    size_t payload = telemetry_payload_size(num_controllers, num_outputs);
+    return payload + payload / 254 + 2;
+}
+
+/* @return size of the COBS encoding of len bytes, without the delimiter */
+static size_t telemetry_cobs_encode(const uint8_t *in, size_t len, uint8_t *out) {
+    size_t code_pos = 0;
+    size_t pos = 1;
+    uint8_t code = 1;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (in[i]) {
+            out[pos++] = in[i];
+            code++;
+        }
+        if (!in[i] || code == TELEMETRY_COBS_RUN) {
+            out[code_pos] = code;
+            code_pos = pos++;
+            code = 1;
+        }
+    }
+    out[code_pos] = code;
+    return pos;
+}
+
+/* @return size of the decoded bytes, 0 if the frame holds a 0 or a code runs past its end */
+static size_t telemetry_cobs_decode(const uint8_t *in, size_t len, uint8_t *out, size_t out_size) {
+    size_t pos = 0, size = 0;
+
+    while (pos < len) {
+        uint8_t code = in[pos++];
+        uint8_t i;
+        if (!code || pos + code - 1 > len) return 0;
+        for (i = 1; i < code; i++) {
+            if (!in[pos] || size == out_size) return 0;
+            out[size++] = in[pos++];
+        }
+        // a code below a full run stands for a 0, except at the end of the frame
+        if (code != TELEMETRY_COBS_RUN && pos < len) {
+            if (size == out_size) return 0;
+            out[size++] = 0;
+        }
+    }
+    return size;
+}
+
+size_t telemetry_encode(const telemetry_snapshot_t *snapshot, uint8_t *frame) {
+    uint8_t payload[TELEMETRY_PAYLOAD_MAX];
+    size_t pos = 0;
+    size_t size;
+    unsigned int i, axis;
+
+    payload[pos++] = TELEMETRY_VERSION;
+    pos = telemetry_store_16(payload, pos, snapshot->sequence);
+    pos = telemetry_store_16(payload, pos, (uint16_t) snapshot->time_us);
+    pos = telemetry_store_16(payload, pos, (uint16_t)(snapshot->time_us >> 16));
+    payload[pos++] = (uint8_t)((snapshot->num_controllers << 4) | snapshot->num_outputs);
+    for (i = 0; i < snapshot->num_controllers; i++) {
+        const telemetry_controller_t *controller = &snapshot->controllers[i];
+        payload[pos++] = controller->flags;
+        payload[pos++] = (uint8_t) controller->rssi;
+        for (axis = 0; axis < TELEMETRY_AXES; axis++) {
+            pos = telemetry_store_16(payload, pos, controller->axes[axis]);
+        }
+        pos = telemetry_store_16(payload, pos, controller->buttons);
+        payload[pos++] = controller->dpad;
+        payload[pos++] = controller->battery;
+        pos = telemetry_store_16(payload, pos, controller->interval_us);
+        pos = telemetry_store_16(payload, pos, controller->jitter_us);
+        pos = telemetry_store_16(payload, pos, controller->late_reports);
+    }
+    for (i = 0; i < snapshot->num_outputs; i++) {
+        pos = telemetry_store_16(payload, pos, snapshot->outputs[i]);
+    }
+    pos = telemetry_store_16(payload, pos, telemetry_crc(payload, pos));
+
+    size = telemetry_cobs_encode(payload, pos, frame);
+    frame[size++] = 0;
+    return size;
+}
+
+int telemetry_decode(const uint8_t *frame, size_t len, telemetry_snapshot_t *snapshot) {
+    uint8_t payload[TELEMETRY_PAYLOAD_MAX];
+    size_t size = telemetry_cobs_decode(frame, len, payload, sizeof(payload));
+    size_t pos = 1;
+    unsigned int i, axis;
+
+    if (size < TELEMETRY_HEADER_SIZE + TELEMETRY_CRC_SIZE || payload[0] != TELEMETRY_VERSION) return 0;
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->num_controllers = payload[TELEMETRY_HEADER_SIZE - 1] >> 4;
+    snapshot->num_outputs     = payload[TELEMETRY_HEADER_SIZE - 1] & 0x0f;
+    if (snapshot->num_controllers > TELEMETRY_CONTROLLERS || snapshot->num_outputs > TELEMETRY_OUTPUTS
+            || size != telemetry_payload_size(snapshot->num_controllers, snapshot->num_outputs)
+            || telemetry_crc(payload, size - TELEMETRY_CRC_SIZE) != telemetry_read_16(payload, size - TELEMETRY_CRC_SIZE)) {
+        return 0;
+    }
+
+    snapshot->sequence = telemetry_read_16(payload, pos);
+    snapshot->time_us  = telemetry_read_16(payload, pos + 2) | ((uint32_t) telemetry_read_16(payload, pos + 4) << 16);
+    pos = TELEMETRY_HEADER_SIZE;
+    for (i = 0; i < snapshot->num_controllers; i++) {
+        telemetry_controller_t *controller = &snapshot->controllers[i];
+        controller->flags = payload[pos++];
+        controller->rssi  = (int8_t) payload[pos++];
+        for (axis = 0; axis < TELEMETRY_AXES; axis++) {
+            controller->axes[axis] = telemetry_read_16(payload, pos);
+            pos += 2;
+        }
+        controller->buttons      = telemetry_read_16(payload, pos);
+        controller->dpad         = payload[pos + 2];
+        controller->battery      = payload[pos + 3];
+        controller->interval_us  = telemetry_read_16(payload, pos + 4);
+        controller->jitter_us    = telemetry_read_16(payload, pos + 6);
+        controller->late_reports = telemetry_read_16(payload, pos + 8);
+        pos += 10;
+    }
+    for (i = 0; i < snapshot->num_outputs; i++) {
+        snapshot->outputs[i] = telemetry_read_16(payload, pos);
+        pos += 2;
+    }
+    return 1;
+}